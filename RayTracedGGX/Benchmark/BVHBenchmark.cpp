@@ -0,0 +1,303 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+// Build and refit benchmark of XUSG::BVH, reported as JSON
+// BVHBenchmark [--assets <dir>] [--repeat <n>] [--bins <n>] [--leaf <n>] [--max-threads <n>]
+//	[--frames <n>] [--out <file>]
+// dragon.obj, bunny.obj and TuringBowl.obj from --assets (Bin/Assets by default) are imported with
+// the post processes of RayTracer that change the triangles, and a BVH is built over each with every
+// build method and 1, 2, 4, ... up to --max-threads threads (64 by default). The build time is that
+// of BVH::Build(), and the SAH cost that of the tree, which is the same for any thread count, as is
+// the number of primitive indices, more than the triangles after spatial splits.
+// Each mesh is then twisted about its vertical axis over --frames frames (32 by default), and
+// per frame and build method, the tree of the first frame is refitted, and compared with a rebuild,
+// and with a tree that is refitted until NeedsRebuild(), then rebuilt.
+// Last, the binned SAH tree of each mesh is built with a cache file in the working directory, which
+// is removed afterwards: written by a cold build, then mapped by warm ones.
+
+#include "XUSGBVH.h"
+
+using namespace std;
+using namespace XUSG;
+
+struct Mesh
+{
+	string Name;
+	vector<ObjLoader::float3> Positions;
+	vector<uint32_t> Indices;
+};
+
+static double getMedian(vector<double> times)
+{
+	sort(times.begin(), times.end());
+	const auto n = times.size();
+
+	return n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) * 0.5;
+}
+
+static string toJSON(const string& str)
+{
+	string json = "\"";
+	for (const auto& c : str)
+	{
+		if (c == '"' || c == '\\') json += '\\';
+		json += c;
+	}
+
+	return json + "\"";
+}
+
+static const char* toJSON(bool value)
+{
+	return value ? "true" : "false";
+}
+
+int main(int argc, char* argv[])
+{
+	string assetDir = "Bin/Assets";
+	string outFileName;
+	auto numRepeats = 5u;
+	auto maxThreads = 64u;
+	auto numFrames = 32u;
+	BVH::BuildOptions options;
+	for (auto i = 1; i < argc; ++i)
+	{
+		const string arg = argv[i];
+		const auto hasValue = i + 1 < argc;
+		if (arg == "--assets" && hasValue) assetDir = argv[++i];
+		else if (arg == "--repeat" && hasValue) numRepeats = (max)(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1u);
+		else if (arg == "--bins" && hasValue) options.NumBins = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--leaf" && hasValue) options.MaxLeafSize = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--max-threads" && hasValue) maxThreads = (max)(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1u);
+		else if (arg == "--frames" && hasValue) numFrames = (max)(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1u);
+		else if (arg == "--out" && hasValue) outFileName = argv[++i];
+		else
+		{
+			fprintf(stderr, "Usage: %s [--assets <dir>] [--repeat <n>] [--bins <n>] [--leaf <n>] "
+				"[--max-threads <n>] [--frames <n>] [--out <file>]\n", argv[0]);
+
+			return 1;
+		}
+	}
+
+	string json = "{\n\t\"benchmark\": \"BVH\",\n";
+	json += "\t\"hardwareThreads\": " + to_string(thread::hardware_concurrency()) + ",\n";
+	json += "\t\"repeat\": " + to_string(numRepeats) + ",\n";
+	json += "\t\"bins\": " + to_string(options.NumBins) + ",\n";
+	json += "\t\"maxLeafSize\": " + to_string(options.MaxLeafSize) + ",\n";
+	json += "\t\"builds\": [";
+
+	const pair<const char*, BVH::BuildMethod> methods[] =
+	{
+		{ "binnedSAH", BVH::BINNED_SAH },
+		{ "lbvh30", BVH::LBVH_30 },
+		{ "lbvh63", BVH::LBVH_63 },
+		{ "spatialSplitSAH", BVH::SPATIAL_SPLIT_SAH }
+	};
+
+	vector<Mesh> meshes;
+	for (const auto& name : { "dragon", "bunny", "TuringBowl" })
+	{
+		const auto fileName = assetDir + "/" + name + ".obj";
+		ObjLoader objLoader;
+		ObjLoader::ImportOptions options;
+		options.PostProcesses = ObjLoader::WELD_VERTICES | ObjLoader::SANITIZE_MESH | ObjLoader::SPLIT_VERTEX_STREAMS;
+		if (!objLoader.Import(fileName.c_str(), options))
+		{
+			fprintf(stderr, "Skipping %s, which cannot be imported\n", fileName.c_str());
+			continue;
+		}
+
+		Mesh mesh = { name, {}, {} };
+		const auto numVert = objLoader.GetNumVertices();
+		mesh.Positions.resize(numVert);
+		for (auto i = 0u; i < numVert; ++i)
+			memcpy(&mesh.Positions[i], objLoader.GetPositions() + objLoader.GetPositionStride() * i, sizeof(ObjLoader::float3));
+		mesh.Indices.assign(objLoader.GetIndices(), objLoader.GetIndices() + objLoader.GetNumIndices());
+		meshes.emplace_back(move(mesh));
+	}
+
+	// Builds
+	char buffer[1024];
+	auto isFirst = true;
+	for (const auto& mesh : meshes)
+	{
+		const auto name = mesh.Name.c_str();
+		const auto numVert = static_cast<uint32_t>(mesh.Positions.size());
+		const auto numIndices = static_cast<uint32_t>(mesh.Indices.size());
+		const auto numTris = numIndices / 3;
+		for (const auto& method : methods)
+		{
+			for (auto numThreads = 1u; numThreads <= maxThreads; numThreads *= 2)
+			{
+				fprintf(stderr, "%s: %s, %u threads\n", name, method.first, numThreads);
+
+				BVH bvh;
+				options.Method = method.second;
+				options.NumThreads = numThreads;
+				vector<double> times;
+				auto success = true;
+				for (auto n = 0u; n < numRepeats && success; ++n)
+				{
+					success = bvh.Build(reinterpret_cast<const uint8_t*>(mesh.Positions.data()), sizeof(ObjLoader::float3),
+						numVert, mesh.Indices.data(), numIndices, options);
+					times.emplace_back(bvh.GetBuildStats().BuildTime);
+				}
+
+				const auto& stats = bvh.GetBuildStats();
+				const auto minTime = *min_element(times.cbegin(), times.cend());
+				snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"mesh\": %s, \"triangles\": %u, \"method\": \"%s\", \"threads\": %u, \"success\": %s, "
+					"\"minSeconds\": %.6f, \"medianSeconds\": %.6f, \"trianglesPerSec\": %.0f, \"sahCost\": %.4f, "
+					"\"nodes\": %u, \"leaves\": %u, \"maxDepth\": %u, \"primitives\": %u }",
+					isFirst ? "" : ",", toJSON(mesh.Name).c_str(), numTris, method.first, numThreads, toJSON(success), minTime,
+					getMedian(times), numTris / minTime, stats.SAHCost, bvh.GetNumNodes(), stats.NumLeaves, stats.MaxDepth,
+					bvh.GetNumPrimitives());
+				json += buffer;
+				isFirst = false;
+			}
+		}
+	}
+	json += "\n\t],\n\t\"animation\": [";
+
+	// Refits over a twist, with all hardware threads
+	isFirst = true;
+	options.NumThreads = 0;
+	for (const auto& mesh : meshes)
+	{
+		const auto numVert = static_cast<uint32_t>(mesh.Positions.size());
+		const auto numIndices = static_cast<uint32_t>(mesh.Indices.size());
+		const auto pIndices = mesh.Indices.data();
+
+		auto minY = mesh.Positions[0].y, maxY = minY;
+		for (const auto& p : mesh.Positions)
+		{
+			minY = (min)(p.y, minY);
+			maxY = (max)(p.y, maxY);
+		}
+
+		for (const auto& method : methods)
+		{
+			fprintf(stderr, "%s: %s, %u animated frames\n", mesh.Name.c_str(), method.first, numFrames);
+
+			options.Method = method.second;
+			vector<ObjLoader::float3> positions(mesh.Positions);
+			const auto pPositions = reinterpret_cast<const uint8_t*>(positions.data());
+			const uint32_t stride = sizeof(ObjLoader::float3);
+
+			BVH refitted, rebuilt, adaptive;
+			refitted.Build(pPositions, stride, numVert, pIndices, numIndices, options);
+			adaptive.Build(pPositions, stride, numVert, pIndices, numIndices, options);
+			for (auto f = 1u; f <= numFrames; ++f)
+			{
+				// Up to a full turn at the top
+				const auto t = static_cast<float>(f) / numFrames;
+				for (auto i = 0u; i < numVert; ++i)
+				{
+					const auto& p = mesh.Positions[i];
+					const auto angle = 6.2831853f * t * (maxY > minY ? (p.y - minY) / (maxY - minY) : 0.0f);
+					const auto c = cosf(angle), s = sinf(angle);
+					positions[i] = ObjLoader::float3(p.x * c - p.z * s, p.y, p.x * s + p.z * c);
+				}
+
+				vector<double> refitTimes;
+				for (auto n = 0u; n < numRepeats; ++n)
+				{
+					refitted.Refit(pPositions, stride, pIndices);
+					refitTimes.emplace_back(refitted.GetRefitStats().RefitTime);
+				}
+
+				vector<double> rebuildTimes;
+				for (auto n = 0u; n < numRepeats; ++n)
+				{
+					rebuilt.Build(pPositions, stride, numVert, pIndices, numIndices, options);
+					rebuildTimes.emplace_back(rebuilt.GetBuildStats().BuildTime);
+				}
+
+				adaptive.Refit(pPositions, stride, pIndices);
+				const auto isAdaptiveRebuilt = adaptive.NeedsRebuild();
+				if (isAdaptiveRebuilt) adaptive.Build(pPositions, stride, numVert, pIndices, numIndices, options);
+
+				const auto& refitStats = refitted.GetRefitStats();
+				snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"mesh\": %s, \"method\": \"%s\", \"frame\": %u, "
+					"\"refitSeconds\": %.6f, \"refitSahCost\": %.4f, \"degradation\": %.4f, \"needsRebuild\": %s, "
+					"\"rebuildSeconds\": %.6f, \"rebuildSahCost\": %.4f, \"adaptiveRebuilt\": %s, \"adaptiveSahCost\": %.4f }",
+					isFirst ? "" : ",", toJSON(mesh.Name).c_str(), method.first, f,
+					*min_element(refitTimes.cbegin(), refitTimes.cend()), refitStats.SAHCost, refitStats.Degradation,
+					toJSON(refitted.NeedsRebuild()), *min_element(rebuildTimes.cbegin(), rebuildTimes.cend()),
+					rebuilt.GetBuildStats().SAHCost, toJSON(isAdaptiveRebuilt), adaptive.GetRefitStats().SAHCost);
+				json += buffer;
+				isFirst = false;
+			}
+		}
+	}
+	json += "\n\t],\n\t\"cache\": [";
+
+	// Cold builds write the cache, warm ones map it.
+	isFirst = true;
+	options.Method = BVH::BINNED_SAH;
+	for (const auto& mesh : meshes)
+	{
+		fprintf(stderr, "%s: cache\n", mesh.Name.c_str());
+
+		const auto numVert = static_cast<uint32_t>(mesh.Positions.size());
+		const auto numIndices = static_cast<uint32_t>(mesh.Indices.size());
+		const auto pPositions = reinterpret_cast<const uint8_t*>(mesh.Positions.data());
+		const uint32_t stride = sizeof(ObjLoader::float3);
+		const auto cacheFileName = "BVHBenchmark." + mesh.Name + ".bvh";
+
+		vector<double> buildTimes, coldTimes, warmTimes;
+		auto success = true;
+		for (auto n = 0u; n < numRepeats; ++n)
+		{
+			BVH bvh;
+			bvh.Build(pPositions, stride, numVert, mesh.Indices.data(), numIndices, options);
+			buildTimes.emplace_back(bvh.GetBuildStats().BuildTime);
+
+			// Including the content hash and the write, which BuildTime leaves out
+			remove(cacheFileName.c_str());
+			const auto startTime = chrono::steady_clock::now();
+			bvh.Build(pPositions, stride, numVert, mesh.Indices.data(), numIndices, options, cacheFileName.c_str());
+			coldTimes.emplace_back(chrono::duration<double>(chrono::steady_clock::now() - startTime).count());
+			success = success && !bvh.GetBuildStats().IsCached;
+		}
+
+		uint32_t numNodes = 0;
+		for (auto n = 0u; n < numRepeats; ++n)
+		{
+			BVH bvh;
+			bvh.Build(pPositions, stride, numVert, mesh.Indices.data(), numIndices, options, cacheFileName.c_str());
+			warmTimes.emplace_back(bvh.GetBuildStats().BuildTime);
+			success = success && bvh.GetBuildStats().IsCached;
+			numNodes = bvh.GetNumNodes();
+		}
+
+		MappedFile cacheFile;
+		const auto fileSize = cacheFile.Open(cacheFileName.c_str()) ? cacheFile.GetSize() : 0;
+		cacheFile.Close();
+		remove(cacheFileName.c_str());
+
+		const auto buildTime = *min_element(buildTimes.cbegin(), buildTimes.cend());
+		const auto warmTime = *min_element(warmTimes.cbegin(), warmTimes.cend());
+		snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"mesh\": %s, \"success\": %s, \"nodes\": %u, \"fileBytes\": %zu, "
+			"\"buildSeconds\": %.6f, \"coldSeconds\": %.6f, \"warmSeconds\": %.6f, \"warmSpeedup\": %.1f }",
+			isFirst ? "" : ",", toJSON(mesh.Name).c_str(), toJSON(success), numNodes, fileSize, buildTime,
+			*min_element(coldTimes.cbegin(), coldTimes.cend()), warmTime, buildTime / warmTime);
+		json += buffer;
+		isFirst = false;
+	}
+	json += "\n\t]\n}\n";
+
+	if (outFileName.empty()) fputs(json.c_str(), stdout);
+	else
+	{
+		FILE* pFile;
+		fopen_s(&pFile, outFileName.c_str(), "w");
+		if (!pFile) return 1;
+
+		const auto success = fputs(json.c_str(), pFile) >= 0;
+		if (fclose(pFile) || !success) return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,723 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+// Import benchmark of XUSG::ObjLoader, reported as JSON
+// ObjLoaderBenchmark [--assets <dir>] [--synthetic <dir>] [--triangles <n>] [--repeat <n>]
+//	[--threads <n>] [--out <file>]
+// Each mesh is imported with every combination of needNorm, needAABB, forDX and swapYZ, and once
+// more with the post processes of RayTracer. The meshes are dragon.obj, bunny.obj and
+// TuringBowl.obj from --assets (Bin/Assets by default), and a grid without normals and a UV sphere
+// with texcoords and normals of --triangles triangles each (10M by default), which are written
+// to --synthetic (the temp directory by default) once. The normal, bounds and sanitization kernels
+// of the import are then timed on their own; sanitize only removes anything on its first run.
+// The ACMR and ATVR of a 32-entry FIFO post-transform cache are simulated for the welded vertices
+// of each mesh in file order and after OPTIMIZE_VERTEX_CACHE. The vertex fetches of the closest hits
+// of a camera and of random rays through each bundled mesh are replayed in file order and after
+// OPTIMIZE_VERTEX_CACHE and SORT_TRIANGLES_SPATIALLY, reporting the cache-line reuse distances.
+// Each mesh is also written with ExportCompressed() to --synthetic and imported back, reporting the
+// compression ratio, the decode throughput and the largest error of a position coordinate.
+// Last, a LOD chain of each bundled mesh is simplified, reporting the triangles and the Hausdorff
+// error per LOD.
+
+#include "XUSGObjLoader.h"
+#include "XUSGMeshSimplifier.h"
+#include "XUSGBVH.h"
+#include <cfloat>
+#include <filesystem>
+#include <random>
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace XUSG;
+
+//--------------------------------------------------------------------------------------
+// Allocation accounting
+//--------------------------------------------------------------------------------------
+static atomic<uint64_t> g_numAllocations(0);
+static atomic<uint64_t> g_allocatedBytes(0);
+static atomic<int64_t> g_liveBytes(0);
+static atomic<int64_t> g_peakLiveBytes(0);
+
+// Each block starts with its size, so that its release can be accounted for.
+static const size_t g_blockHeaderSize = alignof(max_align_t);
+
+static void* allocate(size_t size) noexcept
+{
+	const auto pBlock = static_cast<uint8_t*>(malloc(size + g_blockHeaderSize));
+	if (!pBlock) return nullptr;
+	memcpy(pBlock, &size, sizeof(size_t));
+
+	++g_numAllocations;
+	g_allocatedBytes += size;
+	const auto liveBytes = g_liveBytes += static_cast<int64_t>(size);
+	auto peakLiveBytes = g_peakLiveBytes.load();
+	while (liveBytes > peakLiveBytes && !g_peakLiveBytes.compare_exchange_weak(peakLiveBytes, liveBytes));
+
+	return pBlock + g_blockHeaderSize;
+}
+
+static void release(void* p) noexcept
+{
+	if (!p) return;
+
+	const auto pBlock = static_cast<uint8_t*>(p) - g_blockHeaderSize;
+	size_t size;
+	memcpy(&size, pBlock, sizeof(size_t));
+	g_liveBytes -= static_cast<int64_t>(size);
+	free(pBlock);
+}
+
+void* operator new(size_t size)
+{
+	const auto p = allocate(size);
+	if (!p) throw bad_alloc();
+
+	return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept { return allocate(size); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return allocate(size); }
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { release(p); }
+
+struct AllocationStats
+{
+	uint64_t NumAllocations;
+	uint64_t AllocatedBytes;
+	uint64_t PeakLiveBytes;	// Above the live bytes at the start
+};
+
+static int64_t resetAllocationStats()
+{
+	g_numAllocations = 0;
+	g_allocatedBytes = 0;
+	const auto liveBytes = g_liveBytes.load();
+	g_peakLiveBytes = liveBytes;
+
+	return liveBytes;
+}
+
+static AllocationStats getAllocationStats(int64_t startLiveBytes)
+{
+	return { g_numAllocations.load(), g_allocatedBytes.load(), static_cast<uint64_t>(g_peakLiveBytes.load() - startLiveBytes) };
+}
+
+//--------------------------------------------------------------------------------------
+// Peak resident set size
+//--------------------------------------------------------------------------------------
+#ifdef __linux__
+static const bool g_isPeakRSSPerCase = true;
+#else
+static const bool g_isPeakRSSPerCase = false;
+#endif
+
+static void resetPeakRSS()
+{
+#ifdef __linux__
+	// Sets VmHWM back to the current RSS
+	const auto pFile = fopen("/proc/self/clear_refs", "w");
+	if (pFile)
+	{
+		fputs("5", pFile);
+		fclose(pFile);
+	}
+#endif
+}
+
+static uint64_t getPeakRSS()
+{
+#if defined(__linux__)
+	auto peakKB = 0ull;
+	const auto pFile = fopen("/proc/self/status", "r");
+	if (pFile)
+	{
+		char line[256];
+		while (fgets(line, sizeof(line), pFile))
+			if (!strncmp(line, "VmHWM:", 6)) peakKB = strtoull(line + 6, nullptr, 10);
+		fclose(pFile);
+	}
+
+	return peakKB * 1024;
+#elif defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters = {};
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage = {};
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// Synthetic meshes
+//--------------------------------------------------------------------------------------
+static string getSyntheticHeader(const char* shape, uint32_t numTris)
+{
+	return string("# ObjLoaderBenchmark ") + shape + " " + to_string(numTris) + "\n";
+}
+
+static bool isSyntheticMeshValid(const string& fileName, const string& header)
+{
+	const auto pFile = fopen(fileName.c_str(), "rb");
+	if (!pFile) return false;
+
+	string line(header.size(), '\0');
+	const auto isValid = fread(&line[0], 1, line.size(), pFile) == line.size() && line == header;
+	fclose(pFile);
+
+	return isValid;
+}
+
+// A height field of n x n quads, without normals, so that they are recomputed
+static bool writeGrid(const string& fileName, uint32_t numTris)
+{
+	const auto header = getSyntheticHeader("grid", numTris);
+	if (isSyntheticMeshValid(fileName, header)) return true;
+
+	const auto pFile = fopen(fileName.c_str(), "wb");
+	if (!pFile) return false;
+	setvbuf(pFile, nullptr, _IOFBF, 1 << 20);
+	fputs(header.c_str(), pFile);
+
+	const auto n = static_cast<uint32_t>(ceil(sqrt(numTris / 2.0)));
+	for (auto y = 0u; y <= n; ++y)
+		for (auto x = 0u; x <= n; ++x)
+			fprintf(pFile, "v %.6f %.6f %.6f\n", x / static_cast<float>(n), y / static_cast<float>(n),
+				0.05f * sinf(x * 0.1f) * cosf(y * 0.1f));
+
+	for (auto y = 0u; y < n; ++y)
+		for (auto x = 0u; x < n; ++x)
+		{
+			const auto v0 = y * (n + 1) + x + 1;
+			const auto v1 = v0 + 1;
+			const auto v2 = v1 + n + 1;
+			const auto v3 = v0 + n + 1;
+			fprintf(pFile, "f %u %u %u\nf %u %u %u\n", v0, v1, v2, v0, v2, v3);
+		}
+
+	return fclose(pFile) == 0;
+}
+
+// A UV sphere of r rings and 2r segments, with texcoords and normals
+static bool writeSphere(const string& fileName, uint32_t numTris)
+{
+	const auto header = getSyntheticHeader("sphere", numTris);
+	if (isSyntheticMeshValid(fileName, header)) return true;
+
+	const auto pFile = fopen(fileName.c_str(), "wb");
+	if (!pFile) return false;
+	setvbuf(pFile, nullptr, _IOFBF, 1 << 20);
+	fputs(header.c_str(), pFile);
+
+	const auto numRings = static_cast<uint32_t>(ceil(sqrt(numTris / 4.0)));
+	const auto numSegments = numRings * 2;
+	const auto pi = 3.14159265f;
+	for (auto i = 0u; i <= numRings; ++i)
+		for (auto j = 0u; j <= numSegments; ++j)
+		{
+			const auto u = j / static_cast<float>(numSegments);
+			const auto v = i / static_cast<float>(numRings);
+			const auto sinTheta = sinf(v * pi);
+			const auto x = sinTheta * cosf(u * 2.0f * pi);
+			const auto y = cosf(v * pi);
+			const auto z = sinTheta * sinf(u * 2.0f * pi);
+			fprintf(pFile, "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn %.6f %.6f %.6f\n", x, y, z, u, v, x, y, z);
+		}
+
+	for (auto i = 0u; i < numRings; ++i)
+		for (auto j = 0u; j < numSegments; ++j)
+		{
+			const auto v0 = i * (numSegments + 1) + j + 1;
+			const auto v1 = v0 + 1;
+			const auto v2 = v1 + numSegments + 1;
+			const auto v3 = v0 + numSegments + 1;
+			fprintf(pFile, "f %u/%u/%u %u/%u/%u %u/%u/%u\nf %u/%u/%u %u/%u/%u %u/%u/%u\n",
+				v0, v0, v0, v1, v1, v1, v2, v2, v2, v0, v0, v0, v2, v2, v2, v3, v3, v3);
+		}
+
+	return fclose(pFile) == 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Benchmark
+//--------------------------------------------------------------------------------------
+struct MeshFile
+{
+	string Name;
+	string FileName;
+	uint64_t Size;
+};
+
+struct ImportCase
+{
+	bool NeedNorm;
+	bool NeedAABB;
+	bool ForDX;
+	bool SwapYZ;
+	uint32_t PostProcesses;
+};
+
+static ObjLoader::ImportOptions getImportOptions(uint32_t numThreads, uint32_t postProcesses = ObjLoader::POST_PROCESS_NONE)
+{
+	ObjLoader::ImportOptions options;
+	options.NumThreads = numThreads;
+	options.PostProcesses = postProcesses;
+
+	return options;
+}
+
+// Exposes the import kernels
+class KernelBenchmark : public ObjLoader
+{
+public:
+	using ObjLoader::recomputeNormals;
+	using ObjLoader::computeAABB;
+	using ObjLoader::sanitize;
+};
+
+static double getTime()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double getMedian(vector<double> times)
+{
+	sort(times.begin(), times.end());
+	const auto n = times.size();
+
+	return n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) * 0.5;
+}
+
+static string toJSON(const string& str)
+{
+	string json = "\"";
+	for (const auto& c : str)
+	{
+		if (c == '"' || c == '\\') json += '\\';
+		json += c;
+	}
+
+	return json + "\"";
+}
+
+static const char* toJSON(bool value)
+{
+	return value ? "true" : "false";
+}
+
+// 256x256 rays of a camera in front of the bounds, in scanline order, and as many between random
+// points on a sphere around the bounds and in them, which are as incoherent as rays can be
+static void generateRays(const ObjLoader::AABB& aabb, vector<BVH::Ray> rays[2])
+{
+	const float center[] = { (aabb.Min.x + aabb.Max.x) * 0.5f, (aabb.Min.y + aabb.Max.y) * 0.5f, (aabb.Min.z + aabb.Max.z) * 0.5f };
+	const float extent[] = { aabb.Max.x - aabb.Min.x, aabb.Max.y - aabb.Min.y, aabb.Max.z - aabb.Min.z };
+	const auto radius = 0.5f * sqrtf(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]);
+
+	// From -z at 2.5 radii, with a vertical field of view that just covers the bounding sphere
+	const uint32_t resolution = 256;
+	const auto tanHalfFOV = 0.45f;
+	for (auto y = 0u; y < resolution; ++y)
+	{
+		for (auto x = 0u; x < resolution; ++x)
+		{
+			const auto u = ((x + 0.5f) / resolution * 2.0f - 1.0f) * tanHalfFOV;
+			const auto v = (1.0f - (y + 0.5f) / resolution * 2.0f) * tanHalfFOV;
+			rays[0].push_back({ { center[0], center[1], center[2] - 2.5f * radius }, 0.0f, { u, v, 1.0f }, FLT_MAX });
+		}
+	}
+
+	mt19937 rng(1);
+	uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	for (auto i = 0u; i < resolution * resolution; ++i)
+	{
+		const auto z = uniform(rng) * 2.0f - 1.0f;
+		const auto r = sqrtf((max)(1.0f - z * z, 0.0f));
+		const auto phi = 6.2831853f * uniform(rng);
+		const float origin[] =
+		{
+			center[0] + 2.0f * radius * r * cosf(phi),
+			center[1] + 2.0f * radius * r * sinf(phi),
+			center[2] + 2.0f * radius * z
+		};
+
+		BVH::Ray ray = { { origin[0], origin[1], origin[2] }, 0.0f, {}, FLT_MAX };
+		for (uint8_t j = 0; j < 3; ++j)
+			ray.Direction[j] = center[j] + (uniform(rng) - 0.5f) * extent[j] - origin[j];
+		rays[1].emplace_back(ray);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	string assetDir = "Bin/Assets";
+	string syntheticDir = filesystem::temp_directory_path().string();
+	string outFileName;
+	auto numSyntheticTris = 10000000u;
+	auto numRepeats = 3u;
+	auto numThreads = 0u;
+	for (auto i = 1; i < argc; ++i)
+	{
+		const string arg = argv[i];
+		const auto hasValue = i + 1 < argc;
+		if (arg == "--assets" && hasValue) assetDir = argv[++i];
+		else if (arg == "--synthetic" && hasValue) syntheticDir = argv[++i];
+		else if (arg == "--triangles" && hasValue) numSyntheticTris = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--repeat" && hasValue) numRepeats = (max)(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1u);
+		else if (arg == "--threads" && hasValue) numThreads = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--out" && hasValue) outFileName = argv[++i];
+		else
+		{
+			fprintf(stderr, "Usage: %s [--assets <dir>] [--synthetic <dir>] [--triangles <n>] [--repeat <n>] "
+				"[--threads <n>] [--out <file>]\n", argv[0]);
+
+			return 1;
+		}
+	}
+
+	// Collect the meshes
+	vector<MeshFile> meshes;
+	for (const auto& name : { "dragon", "bunny", "TuringBowl" })
+		meshes.push_back({ name, (filesystem::path(assetDir) / (string(name) + ".obj")).string(), 0 });
+	const auto numAssetMeshes = meshes.size();
+
+	if (numSyntheticTris)
+	{
+		const auto suffix = to_string(numSyntheticTris);
+		const MeshFile grid = { "grid" + suffix, (filesystem::path(syntheticDir) / ("ObjLoaderBenchmark_grid" + suffix + ".obj")).string(), 0 };
+		const MeshFile sphere = { "sphere" + suffix, (filesystem::path(syntheticDir) / ("ObjLoaderBenchmark_sphere" + suffix + ".obj")).string(), 0 };
+		fprintf(stderr, "Writing the synthetic meshes to %s\n", syntheticDir.c_str());
+		if (writeGrid(grid.FileName, numSyntheticTris)) meshes.emplace_back(grid);
+		else fprintf(stderr, "Failed to write %s\n", grid.FileName.c_str());
+		if (writeSphere(sphere.FileName, numSyntheticTris)) meshes.emplace_back(sphere);
+		else fprintf(stderr, "Failed to write %s\n", sphere.FileName.c_str());
+	}
+
+	for (auto& mesh : meshes)
+	{
+		error_code ec;
+		mesh.Size = filesystem::file_size(mesh.FileName, ec);
+		if (ec) mesh.Size = 0;
+	}
+
+	vector<ImportCase> cases;
+	for (uint8_t i = 0; i < 16; ++i) cases.push_back({ (i & 1) != 0, (i & 2) != 0, (i & 4) != 0, (i & 8) != 0, ObjLoader::POST_PROCESS_NONE });
+	cases.push_back({ true, true, true, false, ObjLoader::WELD_VERTICES | ObjLoader::SORT_TRIANGLES_SPATIALLY |
+		ObjLoader::OPTIMIZE_VERTEX_CACHE | ObjLoader::BUILD_MESHLETS | ObjLoader::SPLIT_VERTEX_STREAMS |
+		ObjLoader::SANITIZE_MESH });
+
+	string json = "{\n\t\"benchmark\": \"ObjLoader\",\n";
+	json += "\t\"threads\": " + to_string(numThreads ? numThreads : (max)(thread::hardware_concurrency(), 1u)) + ",\n";
+	json += "\t\"repeat\": " + to_string(numRepeats) + ",\n";
+	json += string("\t\"peakRssPerCase\": ") + toJSON(g_isPeakRSSPerCase) + ",\n";
+	json += "\t\"imports\": [";
+
+	// Imports
+	char buffer[1024];
+	auto isFirst = true;
+	for (const auto& mesh : meshes)
+	{
+		if (!mesh.Size)
+		{
+			fprintf(stderr, "Skipping %s, which cannot be read\n", mesh.FileName.c_str());
+			continue;
+		}
+
+		for (const auto& c : cases)
+		{
+			fprintf(stderr, "%s: needNorm %d, needAABB %d, forDX %d, swapYZ %d, postProcesses 0x%x\n", mesh.Name.c_str(),
+				c.NeedNorm, c.NeedAABB, c.ForDX, c.SwapYZ, c.PostProcesses);
+
+			vector<double> times;
+			AllocationStats allocStats = {};
+			auto peakRSS = 0ull;
+			auto numVertices = 0u;
+			auto numTris = 0u;
+			auto success = true;
+			for (auto n = 0u; n < numRepeats && success; ++n)
+			{
+				resetPeakRSS();
+				const auto startLiveBytes = resetAllocationStats();
+				const auto startTime = getTime();
+				{
+					ObjLoader objLoader;
+					auto options = getImportOptions(numThreads, c.PostProcesses);
+					options.NeedNorm = c.NeedNorm;
+					options.NeedAABB = c.NeedAABB;
+					options.ForDX = c.ForDX;
+					options.SwapYZ = c.SwapYZ;
+					success = objLoader.Import(mesh.FileName.c_str(), options);
+					times.emplace_back(getTime() - startTime);
+					numVertices = objLoader.GetNumVertices();
+					numTris = objLoader.GetNumIndices() / 3;
+				}
+
+				// The first run is the one with the coldest caches and allocator.
+				if (n == 0)
+				{
+					allocStats = getAllocationStats(startLiveBytes);
+					peakRSS = getPeakRSS();
+				}
+			}
+
+			const auto minTime = *min_element(times.cbegin(), times.cend());
+			snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"mesh\": %s, \"file\": %s, \"bytes\": %llu, \"vertices\": %u, \"triangles\": %u, "
+				"\"needNorm\": %s, \"needAABB\": %s, \"forDX\": %s, \"swapYZ\": %s, \"postProcesses\": %u, \"success\": %s, "
+				"\"minSeconds\": %.6f, \"medianSeconds\": %.6f, \"mbPerSec\": %.2f, \"trianglesPerSec\": %.0f, "
+				"\"peakRssBytes\": %llu, \"allocations\": %llu, \"allocatedBytes\": %llu, \"peakHeapBytes\": %llu }",
+				isFirst ? "" : ",", toJSON(mesh.Name).c_str(), toJSON(mesh.FileName).c_str(), static_cast<unsigned long long>(mesh.Size),
+				numVertices, numTris, toJSON(c.NeedNorm), toJSON(c.NeedAABB), toJSON(c.ForDX), toJSON(c.SwapYZ), c.PostProcesses,
+				toJSON(success), minTime, getMedian(times), mesh.Size / minTime / 1e6, numTris / minTime,
+				static_cast<unsigned long long>(peakRSS), static_cast<unsigned long long>(allocStats.NumAllocations),
+				static_cast<unsigned long long>(allocStats.AllocatedBytes), static_cast<unsigned long long>(allocStats.PeakLiveBytes));
+			json += buffer;
+			isFirst = false;
+		}
+	}
+	json += "\n\t],\n\t\"kernels\": [";
+
+	// Kernels, on the vertices as imported without any post process
+	isFirst = true;
+	for (const auto& mesh : meshes)
+	{
+		KernelBenchmark objLoader;
+		auto options = getImportOptions(numThreads);
+		options.NeedAABB = false;
+		if (!mesh.Size || !objLoader.Import(mesh.FileName.c_str(), options)) continue;
+		fprintf(stderr, "%s: kernels\n", mesh.Name.c_str());
+
+		const auto numVertices = objLoader.GetNumVertices();
+		const auto numTris = objLoader.GetNumIndices() / 3;
+		const pair<const char*, function<void()>> kernels[] =
+		{
+			{ "recomputeNormals", [&]() { objLoader.recomputeNormals(numThreads); } },
+			{ "computeAABB", [&]() { objLoader.computeAABB(); } },
+			{ "sanitize", [&]() { objLoader.sanitize(numThreads); } }
+		};
+
+		for (const auto& kernel : kernels)
+		{
+			vector<double> times;
+			for (auto n = 0u; n < (max)(numRepeats, 5u); ++n)
+			{
+				const auto startTime = getTime();
+				kernel.second();
+				times.emplace_back(getTime() - startTime);
+			}
+
+			const auto minTime = *min_element(times.cbegin(), times.cend());
+			snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"mesh\": %s, \"kernel\": \"%s\", \"vertices\": %u, \"triangles\": %u, "
+				"\"minSeconds\": %.6f, \"medianSeconds\": %.6f, \"verticesPerSec\": %.0f }",
+				isFirst ? "" : ",", toJSON(mesh.Name).c_str(), kernel.first, numVertices, numTris,
+				minTime, getMedian(times), numVertices / minTime);
+			json += buffer;
+			isFirst = false;
+		}
+	}
+	json += "\n\t],\n\t\"vertexCache\": [";
+
+	// Post-transform cache of the welded vertices, in file order and after OPTIMIZE_VERTEX_CACHE
+	const uint32_t cacheSize = 32;
+	const uint32_t cacheOrders[] = { ObjLoader::WELD_VERTICES, ObjLoader::WELD_VERTICES | ObjLoader::OPTIMIZE_VERTEX_CACHE };
+	isFirst = true;
+	for (const auto& mesh : meshes)
+	{
+		if (!mesh.Size) continue;
+		fprintf(stderr, "%s: vertex cache\n", mesh.Name.c_str());
+
+		for (const auto& postProcesses : cacheOrders)
+		{
+			ObjLoader objLoader;
+			auto options = getImportOptions(numThreads, postProcesses);
+			options.NeedAABB = false;
+			if (!objLoader.Import(mesh.FileName.c_str(), options)) continue;
+
+			const auto stats = ObjLoader::SimulateVertexCache(objLoader.GetIndices(), objLoader.GetNumIndices(),
+				objLoader.GetNumVertices(), cacheSize);
+			snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"mesh\": %s, \"postProcesses\": %u, \"vertices\": %u, \"triangles\": %u, "
+				"\"cacheSize\": %u, \"acmr\": %.4f, \"atvr\": %.4f }",
+				isFirst ? "" : ",", toJSON(mesh.Name).c_str(), postProcesses, objLoader.GetNumVertices(),
+				objLoader.GetNumIndices() / 3, cacheSize, stats.ACMR, stats.ATVR);
+			json += buffer;
+			isFirst = false;
+		}
+	}
+	json += "\n\t],\n\t\"hitFetches\": [";
+
+	// Vertex fetches of the closest hits of a camera and of random rays through the bundled meshes,
+	// replayed in each triangle order. The rays depend on the bounds alone, so each order sees the
+	// same hits.
+	const uint32_t fetchOrders[] = { ObjLoader::WELD_VERTICES, ObjLoader::WELD_VERTICES | ObjLoader::OPTIMIZE_VERTEX_CACHE,
+		ObjLoader::WELD_VERTICES | ObjLoader::SORT_TRIANGLES_SPATIALLY };
+	const uint32_t numCacheLines[] = { 64, 512, 4096 };
+	isFirst = true;
+	for (auto i = 0u; i < numAssetMeshes; ++i)
+	{
+		const auto& mesh = meshes[i];
+		if (!mesh.Size) continue;
+		fprintf(stderr, "%s: hit fetches\n", mesh.Name.c_str());
+
+		vector<BVH::Ray> rays[2];
+		for (const auto& postProcesses : fetchOrders)
+		{
+			ObjLoader objLoader;
+			if (!objLoader.Import(mesh.FileName.c_str(), getImportOptions(numThreads, postProcesses))) continue;
+
+			if (rays[0].empty()) generateRays(objLoader.GetAABB(), rays);
+
+			BVH bvh;
+			BVH::BuildOptions options;
+			options.NumThreads = numThreads;
+			if (!bvh.Build(objLoader, options)) continue;
+
+			for (uint8_t j = 0; j < 2; ++j)
+			{
+				vector<uint32_t> primitiveIndices;
+				for (const auto& ray : rays[j])
+				{
+					BVH::Hit hit;
+					if (bvh.Intersect(ray, objLoader.GetPositions(), objLoader.GetPositionStride(), objLoader.GetIndices(), hit))
+						primitiveIndices.emplace_back(hit.PrimitiveIndex);
+				}
+
+				const auto stats = ObjLoader::ReplayHitFetches(objLoader.GetIndices(), objLoader.GetVertexStride(),
+					primitiveIndices.data(), static_cast<uint32_t>(primitiveIndices.size()));
+				const auto numWarmFetches = stats.NumFetches - stats.NumColdFetches;
+				snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"mesh\": %s, \"postProcesses\": %u, \"rays\": \"%s\", \"numRays\": %u, "
+					"\"hits\": %u, \"fetches\": %llu, \"coldFetches\": %llu, \"meanLog2Distance\": %.4f, "
+					"\"hitRatio64Lines\": %.4f, \"hitRatio512Lines\": %.4f, \"hitRatio4096Lines\": %.4f }",
+					isFirst ? "" : ",", toJSON(mesh.Name).c_str(), postProcesses, j ? "random" : "camera",
+					static_cast<uint32_t>(rays[j].size()), static_cast<uint32_t>(primitiveIndices.size()),
+					static_cast<unsigned long long>(stats.NumFetches), static_cast<unsigned long long>(stats.NumColdFetches),
+					numWarmFetches ? stats.SumLogDistances / numWarmFetches : 0.0, stats.GetHitRatio(numCacheLines[0]),
+					stats.GetHitRatio(numCacheLines[1]), stats.GetHitRatio(numCacheLines[2]));
+				json += buffer;
+				isFirst = false;
+			}
+		}
+	}
+	json += "\n\t],\n\t\"codec\": [";
+
+	// Round trips through the compressed format, in the triangle order it compresses best in
+	isFirst = true;
+	for (const auto& mesh : meshes)
+	{
+		ObjLoader objLoader;
+		if (!mesh.Size || !objLoader.Import(mesh.FileName.c_str(),
+			getImportOptions(numThreads, ObjLoader::WELD_VERTICES | ObjLoader::OPTIMIZE_VERTEX_CACHE))) continue;
+		fprintf(stderr, "%s: codec\n", mesh.Name.c_str());
+
+		const auto compressedFileName = (filesystem::path(syntheticDir) / ("ObjLoaderBenchmark_" + mesh.Name + ".xmsh")).string();
+		if (!objLoader.ExportCompressed(compressedFileName.c_str()))
+		{
+			fprintf(stderr, "Failed to write %s\n", compressedFileName.c_str());
+			continue;
+		}
+
+		// The fastest decode of the repeats. The texcoords are not kept, so the strides may differ.
+		ObjLoader::CodecStats stats = {};
+		auto maxPositionError = 0.0f;
+		auto success = true;
+		for (auto n = 0u; n < numRepeats && success; ++n)
+		{
+			ObjLoader decoded;
+			success = decoded.Import(compressedFileName.c_str(), getImportOptions(numThreads)) &&
+				decoded.GetNumVertices() == objLoader.GetNumVertices() && decoded.GetNumIndices() == objLoader.GetNumIndices();
+			if (!success) break;
+
+			if (n == 0 || decoded.GetCodecStats().DecodeTime < stats.DecodeTime) stats = decoded.GetCodecStats();
+			if (n == 0)
+			{
+				for (auto i = 0u; i < objLoader.GetNumVertices(); ++i)
+				{
+					float p[3], q[3];
+					memcpy(p, objLoader.GetVertices() + objLoader.GetVertexStride() * i, sizeof(p));
+					memcpy(q, decoded.GetVertices() + decoded.GetVertexStride() * i, sizeof(q));
+					for (uint8_t j = 0; j < 3; ++j) maxPositionError = (max)(fabsf(p[j] - q[j]), maxPositionError);
+				}
+			}
+		}
+		filesystem::remove(compressedFileName);
+
+		snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"mesh\": %s, \"objBytes\": %llu, \"success\": %s, \"encodedBytes\": %llu, "
+			"\"decodedBytes\": %llu, \"compressionRatio\": %.3f, \"decodeSeconds\": %.6f, \"decodeGBPerSec\": %.3f, "
+			"\"maxPositionError\": %.6g }",
+			isFirst ? "" : ",", toJSON(mesh.Name).c_str(), static_cast<unsigned long long>(mesh.Size), toJSON(success),
+			static_cast<unsigned long long>(stats.EncodedSize), static_cast<unsigned long long>(stats.DecodedSize),
+			stats.GetCompressionRatio(), stats.DecodeTime, stats.GetDecodeThroughput() / 1e9, maxPositionError);
+		json += buffer;
+		isFirst = false;
+	}
+	json += "\n\t],\n\t\"simplification\": [";
+
+	// LOD chains of the bundled meshes, each LOD simplified from the previous one
+	const float triangleRatios[] = { 0.5f, 0.25f, 0.125f, 0.0625f };
+	isFirst = true;
+	for (auto i = 0u; i < numAssetMeshes; ++i)
+	{
+		const auto& mesh = meshes[i];
+		ObjLoader objLoader;
+		if (!mesh.Size || !objLoader.Import(mesh.FileName.c_str(),
+			getImportOptions(numThreads, ObjLoader::WELD_VERTICES))) continue;
+		fprintf(stderr, "%s: simplification\n", mesh.Name.c_str());
+
+		const auto& aabb = objLoader.GetAABB();
+		const auto dx = aabb.Max.x - aabb.Min.x;
+		const auto dy = aabb.Max.y - aabb.Min.y;
+		const auto dz = aabb.Max.z - aabb.Min.z;
+		const auto diagonal = sqrtf(dx * dx + dy * dy + dz * dz);
+
+		MeshSimplifier simplifier;
+		const vector<uint32_t> indices(objLoader.GetIndices(), objLoader.GetIndices() + objLoader.GetNumIndices());
+		simplifier.Init(objLoader.GetVertices(), objLoader.GetNumVertices(), objLoader.GetVertexStride(),
+			indices.data(), static_cast<uint32_t>(indices.size()));
+
+		vector<MeshSimplifier::LOD> lods(size(triangleRatios));
+		for (auto j = 0u; j < lods.size(); ++j)
+		{
+			const auto startTime = getTime();
+			simplifier.Simplify(lods[j], j ? lods[j - 1].Indices : indices,
+				static_cast<uint32_t>(indices.size() / 3 * triangleRatios[j]));
+			const auto time = getTime() - startTime;
+
+			const auto& lod = lods[j];
+			snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"mesh\": %s, \"lod\": %u, \"triangleRatio\": %.4f, \"sourceTriangles\": %u, "
+				"\"triangles\": %u, \"hausdorffError\": %.6g, \"relativeError\": %.6g, \"seconds\": %.6f }",
+				isFirst ? "" : ",", toJSON(mesh.Name).c_str(), j + 1, triangleRatios[j], static_cast<uint32_t>(indices.size() / 3),
+				static_cast<uint32_t>(lod.Indices.size() / 3), lod.HausdorffError,
+				diagonal > 0.0f ? lod.HausdorffError / diagonal : 0.0f, time);
+			json += buffer;
+			isFirst = false;
+		}
+	}
+	json += "\n\t]\n}\n";
+
+	if (outFileName.empty()) fputs(json.c_str(), stdout);
+	else
+	{
+		FILE* pFile;
+		fopen_s(&pFile, outFileName.c_str(), "w");
+		if (!pFile) return 1;
+
+		const auto success = fputs(json.c_str(), pFile) >= 0;
+		if (fclose(pFile) || !success) return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,646 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+// Ray traversal benchmark of XUSG::TopLevelBVH and the wide XUSG BVHs, reported as JSON
+// TraversalBenchmark [--assets <dir>] [--mesh <name>] [--width <n>] [--height <n>] [--repeat <n>]
+//	[--max-grid <n>] [--out <file>] [--verify [<rays>]]
+// The scene is that of RayTracer: the ground cube scaled by (10, 0.5, 10) under --mesh (dragon by
+// default) from --assets (Bin/Assets by default), seen from (10, 10, -24) towards (0, 3, 0) with
+// a vertical field of view of 45 degrees. 3 ray sets are traced for the closest hits on a single
+// thread: primary rays through the pixel centers of --width x --height (640x360 by default), and
+// from their hits, mirror reflection rays and cosine-distributed diffuse rays about the geometric
+// normals. First, the rays that reach the model alone are traced through its binary BVH, its BVH4
+// and BVH8 collapsed from it, their quantized layouts, and the binary BVH and BVH8 of a build with
+// spatial splits, with the bytes per triangle of each layout and its speedup over the binary one
+// of the binned SAH build. Then the model is instanced on grids of 1x1, 2x2, 4x4 ... up to
+// --max-grid (16 by default) per side, each instance turned differently about the vertical axis,
+// with the ground and the camera distance scaled along, and the rays are traced through the top
+// level over the instances.
+// --verify instead traces <rays> (4096 by default) random rays through each bundled mesh with each of
+// the layouts above and a 30-bit LBVH, and through the top level over the ground and 2x2 instances of
+// it, for the closest and any hits, and compares them to brute force. It exits with 1 on any mismatch.
+
+#include "XUSGTopLevelBVH.h"
+#include <array>
+#include <cfloat>
+#include <random>
+
+using namespace std;
+using namespace XUSG;
+
+struct float3
+{
+	float x, y, z;
+};
+
+static float3 operator+(const float3& a, const float3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+static float3 operator-(const float3& a, const float3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+static float3 operator*(const float3& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+static float dot(const float3& a, const float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static float3 cross(const float3& a, const float3& b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+static float3 normalize(const float3& v) { return v * (1.0f / sqrtf(dot(v, v))); }
+
+static string toJSON(const string& str)
+{
+	string json = "\"";
+	for (const auto& c : str)
+	{
+		if (c == '"' || c == '\\') json += '\\';
+		json += c;
+	}
+
+	return json + "\"";
+}
+
+// The ground cube of RayTracer
+static const float3 g_cubeVertices[] =
+{
+	{ -1.0f, -1.0f, -1.0f }, { 1.0f, -1.0f, -1.0f }, { 1.0f, 1.0f, -1.0f }, { -1.0f, 1.0f, -1.0f },
+	{ -1.0f, -1.0f, 1.0f }, { 1.0f, -1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, { -1.0f, 1.0f, 1.0f }
+};
+static const uint32_t g_cubeIndices[] =
+{
+	0, 2, 1, 0, 3, 2,
+	4, 5, 6, 4, 6, 7,
+	0, 1, 5, 0, 5, 4,
+	3, 6, 2, 3, 7, 6,
+	0, 4, 7, 0, 7, 3,
+	1, 2, 6, 1, 6, 5
+};
+
+static BVH::Ray makeRay(const float3& origin, const float3& direction)
+{
+	return { { origin.x, origin.y, origin.z }, 0.0f, { direction.x, direction.y, direction.z }, FLT_MAX };
+}
+
+// The object-to-world matrix as 3 rows of 4 floats, of scale * rotation about y * translation
+static array<float, 12> getTransform(const float3& scale, float angle, const float3& translation)
+{
+	const auto c = cosf(angle), s = sinf(angle);
+
+	return
+	{
+		scale.x * c, 0.0f, scale.z * s, translation.x,
+		0.0f, scale.y, 0.0f, translation.y,
+		-scale.x * s, 0.0f, scale.z * c, translation.z
+	};
+}
+
+// Instance 0 is the ground, as GROUND of RayTracer, under grid x grid instances of the model spacing
+// apart, each turned differently about the vertical axis, with the ground scaled along
+static void getInstances(uint32_t grid, float spacing, const TopLevelBVH::BottomLevel& ground,
+	const TopLevelBVH::BottomLevel& model, vector<array<float, 12>>& transforms,
+	vector<const TopLevelBVH::BottomLevel*>& bottomLevels)
+{
+	const auto numInstances = 1 + grid * grid;
+	transforms.resize(numInstances);
+	bottomLevels.assign(numInstances, &model);
+
+	const auto gridScale = static_cast<float>(grid);
+	transforms[0] = getTransform({ 10.0f * gridScale, 0.5f, 10.0f * gridScale }, 0.0f, { 0.0f, -0.5f, 0.0f });
+	bottomLevels[0] = &ground;
+	for (auto i = 1u; i < numInstances; ++i)
+	{
+		const auto x = (i - 1) % grid, z = (i - 1) / grid;
+		transforms[i] = getTransform({ 1.0f, 1.0f, 1.0f }, 2.4f * i, { (x - (grid - 1) * 0.5f) * spacing,
+			0.0f, (z - (grid - 1) * 0.5f) * spacing });
+	}
+}
+
+// The world-space geometric normal of the hit triangle, facing the ray, by the inverse transpose
+// of the object-to-world matrix, which is identity without worldToObject
+static float3 getNormal(const TopLevelBVH::BottomLevel& geometry, const float* worldToObject,
+	const BVH::Ray& ray, const BVH::Hit& hit)
+{
+	float3 v[3];
+	for (uint8_t i = 0; i < 3; ++i)
+		memcpy(&v[i], geometry.pPositions + geometry.PositionStride * geometry.pIndices[hit.PrimitiveIndex * 3 + i], sizeof(float3));
+	const auto n = cross(v[1] - v[0], v[2] - v[0]);
+
+	const auto m = worldToObject;
+	auto normal = normalize(m ? float3{ m[0] * n.x + m[4] * n.y + m[8] * n.z,
+		m[1] * n.x + m[5] * n.y + m[9] * n.z, m[2] * n.x + m[6] * n.y + m[10] * n.z } : n);
+	const float3 direction = { ray.Direction[0], ray.Direction[1], ray.Direction[2] };
+
+	return dot(normal, direction) > 0.0f ? normal * -1.0f : normal;
+}
+
+// The primary, reflection and diffuse ray sets from the camera of RayTracer at cameraScale times its
+// distance. trace() finds the closest hit of a ray and its normal.
+static void generateRays(uint32_t width, uint32_t height, float cameraScale,
+	const function<bool(const BVH::Ray&, BVH::Hit&, float3&)>& trace, vector<BVH::Ray> rays[3])
+{
+	const float3 focusPt = { 0.0f, 3.0f, 0.0f };
+	const auto eyePt = focusPt + (float3{ 10.0f, 10.0f, -24.0f } - focusPt) * cameraScale;
+	const auto forward = normalize(focusPt - eyePt);
+	const auto right = normalize(cross({ 0.0f, 1.0f, 0.0f }, forward));
+	const auto up = cross(forward, right);
+	const auto tanHalfFOV = tanf(3.14159265f / 8.0f);
+	const auto aspectRatio = static_cast<float>(width) / height;
+	rays[0].reserve(width * height);
+	for (auto y = 0u; y < height; ++y)
+	{
+		for (auto x = 0u; x < width; ++x)
+		{
+			const auto u = ((x + 0.5f) / width * 2.0f - 1.0f) * tanHalfFOV * aspectRatio;
+			const auto v = (1.0f - (y + 0.5f) / height * 2.0f) * tanHalfFOV;
+			rays[0].emplace_back(makeRay(eyePt, forward + right * u + up * v));
+		}
+	}
+
+	// Secondary rays from the primary hits, offset off the surfaces
+	mt19937 rng(1);
+	uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	const auto epsilon = 1.0e-4f * 24.0f * cameraScale;
+	for (const auto& ray : rays[0])
+	{
+		BVH::Hit hit;
+		float3 n;
+		if (!trace(ray, hit, n)) continue;
+
+		const float3 direction = { ray.Direction[0], ray.Direction[1], ray.Direction[2] };
+		const auto origin = float3{ ray.Origin[0], ray.Origin[1], ray.Origin[2] } + direction * hit.T + n * epsilon;
+		rays[1].emplace_back(makeRay(origin, direction - n * (2.0f * dot(direction, n))));
+
+		const auto tangent = normalize(cross(fabsf(n.x) > 0.5f ? float3{ 0.0f, 1.0f, 0.0f } : float3{ 1.0f, 0.0f, 0.0f }, n));
+		const auto bitangent = cross(n, tangent);
+		const auto r = sqrtf(uniform(rng)), phi = 6.2831853f * uniform(rng);
+		rays[2].emplace_back(makeRay(origin, tangent * (r * cosf(phi)) + bitangent * (r * sinf(phi)) +
+			n * sqrtf((max)(1.0f - r * r, 0.0f))));
+	}
+}
+
+// Returns the shortest time of the repeats, and the number of hits
+static double traceRays(const vector<BVH::Ray>& rays, uint32_t numRepeats,
+	const function<bool(const BVH::Ray&, BVH::Hit&)>& trace, uint32_t& numHits)
+{
+	vector<double> times;
+	for (auto n = 0u; n < numRepeats; ++n)
+	{
+		numHits = 0;
+		const auto startTime = chrono::steady_clock::now();
+		for (const auto& ray : rays)
+		{
+			BVH::Hit hit;
+			numHits += trace(ray, hit) ? 1 : 0;
+		}
+		times.emplace_back(chrono::duration<double>(chrono::steady_clock::now() - startTime).count());
+	}
+
+	return *min_element(times.cbegin(), times.cend());
+}
+
+// Möller-Trumbore over all the triangles in index order, with the same operations as the BVHs, so that
+// a triangle hit is at the same distance. On a hit in [TMin, tMax], shortens tMax to it.
+static bool intersectTriangles(const BVH::Ray& ray, const TopLevelBVH::BottomLevel& geometry, uint32_t numIndices,
+	float& tMax, BVH::Hit& hit)
+{
+	const float3 origin = { ray.Origin[0], ray.Origin[1], ray.Origin[2] };
+	const float3 direction = { ray.Direction[0], ray.Direction[1], ray.Direction[2] };
+	auto isHit = false;
+	for (auto i = 0u; i < numIndices / 3; ++i)
+	{
+		float3 v[3];
+		for (uint8_t j = 0; j < 3; ++j)
+			memcpy(&v[j], geometry.pPositions + geometry.PositionStride * geometry.pIndices[i * 3 + j], sizeof(float3));
+
+		const auto e1 = v[1] - v[0], e2 = v[2] - v[0];
+		const auto p = cross(direction, e2);
+		const auto det = dot(e1, p);
+		if (det == 0.0f) continue;
+
+		const auto invDet = 1.0f / det;
+		const auto s = origin - v[0];
+		const auto u = dot(s, p) * invDet;
+		if (!(u >= 0.0f && u <= 1.0f)) continue;
+
+		const auto q = cross(s, e1);
+		const auto w = dot(direction, q) * invDet;
+		if (!(w >= 0.0f && u + w <= 1.0f)) continue;
+
+		const auto t = dot(e2, q) * invDet;
+		if (!(t >= ray.TMin && t <= tMax)) continue;
+
+		tMax = t;
+		hit = { t, { u, w }, i, 0 };
+		isHit = true;
+	}
+
+	return isHit;
+}
+
+// As TopLevelBVH::Intersect() without the top level: the ray is transformed into every instance.
+static bool intersectInstances(const BVH::Ray& ray, const TopLevelBVH& topLevel,
+	const vector<const TopLevelBVH::BottomLevel*>& bottomLevels, const vector<uint32_t>& numIndices, BVH::Hit& hit)
+{
+	auto tMax = ray.TMax;
+	auto isHit = false;
+	for (auto i = 0u; i < topLevel.GetNumInstances(); ++i)
+	{
+		const auto m = topLevel.GetWorldToObject(i);
+		BVH::Ray localRay;
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			localRay.Origin[j] = m[j * 4] * ray.Origin[0] + m[j * 4 + 1] * ray.Origin[1] + m[j * 4 + 2] * ray.Origin[2] + m[j * 4 + 3];
+			localRay.Direction[j] = m[j * 4] * ray.Direction[0] + m[j * 4 + 1] * ray.Direction[1] + m[j * 4 + 2] * ray.Direction[2];
+		}
+		localRay.TMin = ray.TMin;
+		localRay.TMax = tMax;
+
+		if (intersectTriangles(localRay, *bottomLevels[i], numIndices[i], tMax, hit))
+		{
+			hit.InstanceIndex = i;
+			isHit = true;
+		}
+	}
+
+	return isHit;
+}
+
+// Half of the rays are between random points on a sphere around the bounds and in them, and half
+// from random points in the bounds in random directions, up to random distances.
+static void generateRandomRays(const BVH::Node& bounds, uint32_t numRays, vector<BVH::Ray>& rays)
+{
+	const float3 minPt = { bounds.Min[0], bounds.Min[1], bounds.Min[2] };
+	const float3 extent = float3{ bounds.Max[0], bounds.Max[1], bounds.Max[2] } - minPt;
+	const auto center = minPt + extent * 0.5f;
+	const auto diagonal = sqrtf(dot(extent, extent));
+
+	mt19937 rng(1);
+	uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	const auto getPoint = [&]() { return minPt + float3{ extent.x * uniform(rng), extent.y * uniform(rng), extent.z * uniform(rng) }; };
+	const auto getDirection = [&]()
+	{
+		const auto z = uniform(rng) * 2.0f - 1.0f;
+		const auto r = sqrtf((max)(1.0f - z * z, 0.0f));
+		const auto phi = 6.2831853f * uniform(rng);
+
+		return float3{ r * cosf(phi), r * sinf(phi), z };
+	};
+
+	rays.clear();
+	for (auto i = 0u; i < numRays; ++i)
+	{
+		if (i % 2)
+		{
+			auto ray = makeRay(getPoint(), getDirection());
+			ray.TMax = diagonal * uniform(rng);
+			rays.emplace_back(ray);
+		}
+		else
+		{
+			const auto origin = center + getDirection() * diagonal;
+			rays.emplace_back(makeRay(origin, getPoint() - origin));
+		}
+	}
+}
+
+// A hit matches the reference if both miss, or both hit at the same distance, but not necessarily the
+// same triangle, since another one may be hit at the same distance.
+static bool isSameHit(bool isHit, const BVH::Hit& hit, bool isRefHit, const BVH::Hit& refHit)
+{
+	if (isHit != isRefHit) return false;
+
+	return !isHit || fabsf(hit.T - refHit.T) <= 1.0e-5f * (max)(fabsf(refHit.T), 1.0f);
+}
+
+// Traces numRays random rays through each bundled mesh with every node layout and build method, and
+// through a top level over the ground and 2x2 instances of it, for the closest and any hits, against
+// brute force. Returns the number of mismatching rays.
+static uint32_t verify(const string& assetDir, uint32_t numRays)
+{
+	using Trace = function<bool(const BVH::Ray&, BVH::Hit&, bool)>;
+
+	auto numMismatches = 0u;
+	for (const auto& meshName : { "dragon", "bunny", "TuringBowl" })
+	{
+		const auto fileName = assetDir + "/" + meshName + ".obj";
+		ObjLoader objLoader;
+		ObjLoader::ImportOptions options;
+		options.PostProcesses = ObjLoader::WELD_VERTICES | ObjLoader::SANITIZE_MESH | ObjLoader::SPLIT_VERTEX_STREAMS;
+		if (!objLoader.Import(fileName.c_str(), options))
+		{
+			fprintf(stderr, "%s cannot be imported\n", fileName.c_str());
+			++numMismatches;
+			continue;
+		}
+
+		BVH::BuildOptions spatialSplitOptions, lbvhOptions;
+		spatialSplitOptions.Method = BVH::SPATIAL_SPLIT_SAH;
+		lbvhOptions.Method = BVH::LBVH_30;
+
+		BVH groundBVH, modelBVH, modelSBVH, modelLBVH;
+		BVH4 modelBVH4;
+		BVH8 modelBVH8, modelSBVH8;
+		QuantizedBVH4 modelQBVH4;
+		QuantizedBVH8 modelQBVH8;
+		const auto isBuilt = groundBVH.Build(reinterpret_cast<const uint8_t*>(g_cubeVertices), sizeof(float3),
+			static_cast<uint32_t>(size(g_cubeVertices)), g_cubeIndices, static_cast<uint32_t>(size(g_cubeIndices))) &&
+			modelBVH.Build(objLoader) && modelSBVH.Build(objLoader, spatialSplitOptions) &&
+			modelLBVH.Build(objLoader, lbvhOptions) && modelBVH4.Build(modelBVH) && modelBVH8.Build(modelBVH) &&
+			modelSBVH8.Build(modelSBVH) && modelQBVH4.Build(modelBVH4) && modelQBVH8.Build(modelBVH8);
+
+		const TopLevelBVH::BottomLevel ground = { &groundBVH, reinterpret_cast<const uint8_t*>(g_cubeVertices), sizeof(float3), g_cubeIndices };
+		const TopLevelBVH::BottomLevel model = { &modelBVH, objLoader.GetPositions(), objLoader.GetPositionStride(), objLoader.GetIndices() };
+		const auto& modelRoot = modelBVH.GetNodes()[0];
+		const auto spacing = (max)(modelRoot.Max[0] - modelRoot.Min[0], modelRoot.Max[2] - modelRoot.Min[2]) * 1.2f;
+
+		vector<array<float, 12>> transforms;
+		vector<const TopLevelBVH::BottomLevel*> bottomLevels;
+		getInstances(2, spacing, ground, model, transforms, bottomLevels);
+		vector<const float*> pTransforms;
+		vector<uint32_t> numIndices;
+		for (auto i = 0u; i < transforms.size(); ++i)
+		{
+			pTransforms.emplace_back(transforms[i].data());
+			numIndices.emplace_back(bottomLevels[i] == &ground ? static_cast<uint32_t>(size(g_cubeIndices)) : objLoader.GetNumIndices());
+		}
+
+		TopLevelBVH topLevel;
+		if (!isBuilt || !topLevel.Build(static_cast<uint32_t>(bottomLevels.size()), bottomLevels.data(), pTransforms.data()))
+		{
+			fprintf(stderr, "%s: a BVH cannot be built\n", meshName);
+			++numMismatches;
+			continue;
+		}
+
+		const auto pPositions = model.pPositions;
+		const auto stride = model.PositionStride;
+		const auto pIndices = model.pIndices;
+		const pair<const char*, Trace> traces[] =
+		{
+			{ "binary", [&](const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit) { return modelBVH.Intersect(ray, pPositions, stride, pIndices, hit, acceptFirstHit); } },
+			{ "bvh4", [&](const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit) { return modelBVH4.Intersect(ray, pPositions, stride, pIndices, hit, acceptFirstHit); } },
+			{ "bvh8", [&](const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit) { return modelBVH8.Intersect(ray, pPositions, stride, pIndices, hit, acceptFirstHit); } },
+			{ "quantizedBVH4", [&](const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit) { return modelQBVH4.Intersect(ray, pPositions, stride, pIndices, hit, acceptFirstHit); } },
+			{ "quantizedBVH8", [&](const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit) { return modelQBVH8.Intersect(ray, pPositions, stride, pIndices, hit, acceptFirstHit); } },
+			{ "spatialSplitBinary", [&](const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit) { return modelSBVH.Intersect(ray, pPositions, stride, pIndices, hit, acceptFirstHit); } },
+			{ "spatialSplitBVH8", [&](const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit) { return modelSBVH8.Intersect(ray, pPositions, stride, pIndices, hit, acceptFirstHit); } },
+			{ "lbvh30Binary", [&](const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit) { return modelLBVH.Intersect(ray, pPositions, stride, pIndices, hit, acceptFirstHit); } },
+			{ "topLevel", [&](const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit) { return topLevel.Intersect(ray, hit, acceptFirstHit); } }
+		};
+		const auto topLevelTrace = &traces[size(traces) - 1];
+
+		// The references of the model alone, then of the instances
+		vector<BVH::Ray> rays[2];
+		vector<BVH::Hit> refHits[2];
+		vector<bool> isRefHits[2];
+		generateRandomRays(modelRoot, numRays, rays[0]);
+		generateRandomRays(topLevel.GetBVH().GetNodes()[0], numRays, rays[1]);
+		for (uint8_t i = 0; i < 2; ++i)
+		{
+			refHits[i].resize(numRays);
+			isRefHits[i].resize(numRays);
+			for (auto j = 0u; j < numRays; ++j)
+			{
+				auto tMax = rays[i][j].TMax;
+				isRefHits[i][j] = i ? intersectInstances(rays[i][j], topLevel, bottomLevels, numIndices, refHits[i][j]) :
+					intersectTriangles(rays[i][j], model, objLoader.GetNumIndices(), tMax, refHits[i][j]);
+			}
+		}
+
+		for (const auto& trace : traces)
+		{
+			const auto i = &trace == topLevelTrace ? 1 : 0;
+			auto numHits = 0u, numTraceMismatches = 0u;
+			for (auto j = 0u; j < numRays; ++j)
+			{
+				BVH::Hit hit, anyHit;
+				const auto isHit = trace.second(rays[i][j], hit, false);
+				const auto isAnyHit = trace.second(rays[i][j], anyHit, true);
+				numHits += isHit ? 1 : 0;
+				if (!isSameHit(isHit, hit, isRefHits[i][j], refHits[i][j]) || isAnyHit != isRefHits[i][j])
+				{
+					// The distances are -1 for a miss.
+					if (!numTraceMismatches)
+						fprintf(stderr, "%s, %s: ray %u hits at %g, and any hit %d, against %g by brute force\n", meshName,
+							trace.first, j, isHit ? hit.T : -1.0f, isAnyHit, isRefHits[i][j] ? refHits[i][j].T : -1.0f);
+					++numTraceMismatches;
+				}
+			}
+
+			printf("%s, %s: %u rays, %u hits, %u mismatches\n", meshName, trace.first, numRays, numHits, numTraceMismatches);
+			numMismatches += numTraceMismatches;
+		}
+	}
+
+	return numMismatches;
+}
+
+int main(int argc, char* argv[])
+{
+	string assetDir = "Bin/Assets";
+	string meshName = "dragon";
+	string outFileName;
+	auto width = 640u;
+	auto height = 360u;
+	auto numRepeats = 3u;
+	auto maxGrid = 16u;
+	auto numVerifyRays = 0u;
+	for (auto i = 1; i < argc; ++i)
+	{
+		const string arg = argv[i];
+		const auto hasValue = i + 1 < argc;
+		if (arg == "--assets" && hasValue) assetDir = argv[++i];
+		else if (arg == "--mesh" && hasValue) meshName = argv[++i];
+		else if (arg == "--width" && hasValue) width = (max)(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1u);
+		else if (arg == "--height" && hasValue) height = (max)(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1u);
+		else if (arg == "--repeat" && hasValue) numRepeats = (max)(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1u);
+		else if (arg == "--max-grid" && hasValue) maxGrid = (max)(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1u);
+		else if (arg == "--out" && hasValue) outFileName = argv[++i];
+		else if (arg == "--verify") numVerifyRays = i + 1 < argc && isdigit(argv[i + 1][0]) ?
+			(max)(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1u) : 4096;
+		else
+		{
+			fprintf(stderr, "Usage: %s [--assets <dir>] [--mesh <name>] [--width <n>] [--height <n>] "
+				"[--repeat <n>] [--max-grid <n>] [--out <file>] [--verify [<rays>]]\n", argv[0]);
+
+			return 1;
+		}
+	}
+
+	if (numVerifyRays)
+	{
+		const auto numMismatches = verify(assetDir, numVerifyRays);
+		printf(numMismatches ? "FAILED: %u mismatches\n" : "All hits match\n", numMismatches);
+
+		return numMismatches ? 1 : 0;
+	}
+
+	// Bottom levels
+	const auto fileName = assetDir + "/" + meshName + ".obj";
+	ObjLoader objLoader;
+	ObjLoader::ImportOptions options;
+	options.PostProcesses = ObjLoader::WELD_VERTICES | ObjLoader::SANITIZE_MESH | ObjLoader::SPLIT_VERTEX_STREAMS;
+	if (!objLoader.Import(fileName.c_str(), options))
+	{
+		fprintf(stderr, "%s cannot be imported\n", fileName.c_str());
+
+		return 1;
+	}
+
+	BVH groundBVH, modelBVH;
+	groundBVH.Build(reinterpret_cast<const uint8_t*>(g_cubeVertices), sizeof(float3),
+		static_cast<uint32_t>(size(g_cubeVertices)), g_cubeIndices, static_cast<uint32_t>(size(g_cubeIndices)));
+	if (!modelBVH.Build(objLoader)) return 1;
+
+	const TopLevelBVH::BottomLevel ground = { &groundBVH, reinterpret_cast<const uint8_t*>(g_cubeVertices), sizeof(float3), g_cubeIndices };
+	const TopLevelBVH::BottomLevel model = { &modelBVH, objLoader.GetPositions(), objLoader.GetPositionStride(), objLoader.GetIndices() };
+	const auto& modelRoot = modelBVH.GetNodes()[0];
+	const auto spacing = (max)(modelRoot.Max[0] - modelRoot.Min[0], modelRoot.Max[2] - modelRoot.Min[2]) * 1.2f;
+
+	string json = "{\n\t\"benchmark\": \"Traversal\",\n";
+	json += "\t\"mesh\": " + toJSON(meshName) + ",\n";
+	json += "\t\"triangles\": " + to_string(objLoader.GetNumIndices() / 3) + ",\n";
+	json += "\t\"width\": " + to_string(width) + ",\n";
+	json += "\t\"height\": " + to_string(height) + ",\n";
+	json += "\t\"repeat\": " + to_string(numRepeats) + ",\n";
+	json += "\t\"layouts\": [";
+
+	const char* const rayTypes[] = { "primary", "reflection", "diffuse" };
+	char buffer[1024];
+	auto isFirst = true;
+	{
+		fprintf(stderr, "Node layouts\n");
+
+		BVH4 modelBVH4;
+		BVH8 modelBVH8;
+		QuantizedBVH4 modelQBVH4;
+		QuantizedBVH8 modelQBVH8;
+		modelBVH4.Build(modelBVH);
+		modelBVH8.Build(modelBVH);
+		modelQBVH4.Build(modelBVH4);
+		modelQBVH8.Build(modelBVH8);
+
+		BVH::BuildOptions options;
+		options.Method = BVH::SPATIAL_SPLIT_SAH;
+		BVH modelSBVH;
+		BVH8 modelSBVH8;
+		if (!modelSBVH.Build(objLoader, options)) return 1;
+		modelSBVH8.Build(modelSBVH);
+
+		const auto pPositions = model.pPositions;
+		const auto stride = model.PositionStride;
+		const auto pIndices = model.pIndices;
+		vector<BVH::Ray> rays[3];
+		generateRays(width, height, 1.0f, [&](const BVH::Ray& ray, BVH::Hit& hit, float3& normal)
+		{
+			if (!modelBVH.Intersect(ray, pPositions, stride, pIndices, hit)) return false;
+			normal = getNormal(model, nullptr, ray, hit);
+
+			return true;
+		}, rays);
+
+		const function<bool(const BVH::Ray&, BVH::Hit&)> traces[] =
+		{
+			[&](const BVH::Ray& ray, BVH::Hit& hit) { return modelBVH.Intersect(ray, pPositions, stride, pIndices, hit); },
+			[&](const BVH::Ray& ray, BVH::Hit& hit) { return modelBVH4.Intersect(ray, pPositions, stride, pIndices, hit); },
+			[&](const BVH::Ray& ray, BVH::Hit& hit) { return modelBVH8.Intersect(ray, pPositions, stride, pIndices, hit); },
+			[&](const BVH::Ray& ray, BVH::Hit& hit) { return modelQBVH4.Intersect(ray, pPositions, stride, pIndices, hit); },
+			[&](const BVH::Ray& ray, BVH::Hit& hit) { return modelQBVH8.Intersect(ray, pPositions, stride, pIndices, hit); },
+			[&](const BVH::Ray& ray, BVH::Hit& hit) { return modelSBVH.Intersect(ray, pPositions, stride, pIndices, hit); },
+			[&](const BVH::Ray& ray, BVH::Hit& hit) { return modelSBVH8.Intersect(ray, pPositions, stride, pIndices, hit); }
+		};
+		const char* const layouts[] =
+		{
+			"binary", "bvh4", "bvh8", "quantizedBVH4", "quantizedBVH8", "spatialSplitBinary", "spatialSplitBVH8"
+		};
+		const uint32_t numNodes[] =
+		{
+			modelBVH.GetNumNodes(), modelBVH4.GetNumNodes(), modelBVH8.GetNumNodes(),
+			modelQBVH4.GetNumNodes(), modelQBVH8.GetNumNodes(), modelSBVH.GetNumNodes(), modelSBVH8.GetNumNodes()
+		};
+		const size_t nodeSizes[] =
+		{
+			sizeof(BVH::Node), sizeof(BVH4::Node), sizeof(BVH8::Node),
+			sizeof(QuantizedBVH4::Node), sizeof(QuantizedBVH8::Node), sizeof(BVH::Node), sizeof(BVH8::Node)
+		};
+		const uint32_t numPrimitives[] =
+		{
+			modelBVH.GetNumPrimitives(), modelBVH4.GetNumPrimitives(), modelBVH8.GetNumPrimitives(),
+			modelQBVH4.GetNumPrimitives(), modelQBVH8.GetNumPrimitives(), modelSBVH.GetNumPrimitives(), modelSBVH8.GetNumPrimitives()
+		};
+
+		// Of the nodes and the primitive indices
+		const auto numTris = objLoader.GetNumIndices() / 3;
+		for (uint8_t t = 0; t < size(rays); ++t)
+		{
+			const auto numRays = static_cast<uint32_t>(rays[t].size());
+			auto binaryTime = 0.0;
+			for (uint8_t l = 0; l < size(traces); ++l)
+			{
+				auto numHits = 0u;
+				const auto minTime = traceRays(rays[t], numRepeats, traces[l], numHits);
+				if (l == 0) binaryTime = minTime;
+				const auto nodeBytes = numNodes[l] * nodeSizes[l];
+				const auto primIndexBytes = sizeof(uint32_t) * numPrimitives[l];
+				snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"layout\": \"%s\", \"nodes\": %u, \"nodeBytes\": %zu, "
+					"\"bytesPerTriangle\": %.2f, \"rays\": \"%s\", \"numRays\": %u, \"hitRatio\": %.4f, \"minSeconds\": %.6f, "
+					"\"raysPerSec\": %.0f, \"speedup\": %.3f }", isFirst ? "" : ",", layouts[l], numNodes[l], nodeBytes,
+					static_cast<double>(nodeBytes + primIndexBytes) / numTris, rayTypes[t], numRays, numRays ? static_cast<double>(numHits) / numRays : 0.0, minTime,
+					minTime > 0.0 ? numRays / minTime : 0.0, minTime > 0.0 ? binaryTime / minTime : 0.0);
+				json += buffer;
+				isFirst = false;
+			}
+		}
+	}
+	json += "\n\t],\n\t\"scenes\": [";
+
+	isFirst = true;
+	for (auto grid = 1u; grid <= maxGrid; grid *= 2)
+	{
+		const auto numInstances = 1 + grid * grid;
+		fprintf(stderr, "%u instances\n", numInstances);
+
+		vector<array<float, 12>> transforms;
+		vector<const TopLevelBVH::BottomLevel*> bottomLevels;
+		getInstances(grid, spacing, ground, model, transforms, bottomLevels);
+		const auto gridScale = static_cast<float>(grid);
+
+		vector<const float*> pTransforms(numInstances);
+		for (auto i = 0u; i < numInstances; ++i) pTransforms[i] = transforms[i].data();
+
+		TopLevelBVH topLevel;
+		const auto startTime = chrono::steady_clock::now();
+		if (!topLevel.Build(numInstances, bottomLevels.data(), pTransforms.data())) return 1;
+		const auto buildTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+		vector<BVH::Ray> rays[3];
+		generateRays(width, height, gridScale, [&](const BVH::Ray& ray, BVH::Hit& hit, float3& normal)
+		{
+			if (!topLevel.Intersect(ray, hit)) return false;
+			normal = getNormal(*bottomLevels[hit.InstanceIndex], topLevel.GetWorldToObject(hit.InstanceIndex), ray, hit);
+
+			return true;
+		}, rays);
+
+		for (uint8_t t = 0; t < size(rays); ++t)
+		{
+			auto numHits = 0u;
+			const auto minTime = traceRays(rays[t], numRepeats,
+				[&](const BVH::Ray& ray, BVH::Hit& hit) { return topLevel.Intersect(ray, hit); }, numHits);
+			const auto numRays = static_cast<uint32_t>(rays[t].size());
+			snprintf(buffer, sizeof(buffer), "%s\n\t\t{ \"instances\": %u, \"topLevelBuildSeconds\": %.6f, \"rays\": \"%s\", "
+				"\"numRays\": %u, \"hitRatio\": %.4f, \"minSeconds\": %.6f, \"raysPerSec\": %.0f }",
+				isFirst ? "" : ",", numInstances, buildTime, rayTypes[t], numRays,
+				numRays ? static_cast<double>(numHits) / numRays : 0.0, minTime, minTime > 0.0 ? numRays / minTime : 0.0);
+			json += buffer;
+			isFirst = false;
+		}
+	}
+	json += "\n\t]\n}\n";
+
+	if (outFileName.empty()) fputs(json.c_str(), stdout);
+	else
+	{
+		FILE* pFile;
+		fopen_s(&pFile, outFileName.c_str(), "w");
+		if (!pFile) return 1;
+
+		const auto success = fputs(json.c_str(), pFile) >= 0;
+		if (fclose(pFile) || !success) return 1;
+	}
+
+	return 0;
+}
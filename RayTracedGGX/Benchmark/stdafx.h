@@ -0,0 +1,68 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+// Force-included in place of the application's stdafx.h, so that the loader builds without D3D.
+
+#pragma once
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <chrono>
+
+#ifndef _MSC_VER
+inline int fopen_s(FILE** ppFile, const char* pszFilename, const char* pszMode)
+{
+	*ppFile = fopen(pszFilename, pszMode);
+
+	return *ppFile ? 0 : errno;
+}
+
+// The buffer sizes passed after each %s are ignored by the standard functions, which are called
+// through va_list, so that the formats are not checked against the extra arguments.
+inline int fscanf_s(FILE* pFile, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	const auto result = vfscanf(pFile, format, args);
+	va_end(args);
+
+	return result;
+}
+
+inline int sscanf_s(const char* buffer, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	const auto result = vsscanf(buffer, format, args);
+	va_end(args);
+
+	return result;
+}
+#endif
@@ -3,7 +3,6 @@
 //--------------------------------------------------------------------------------------
 
 #include "RayTracer.h"
-#include "Optional/XUSGObjLoader.h"
 #include "DirectXPackedVector.h"
 
 using namespace std;
@@ -54,6 +53,7 @@ const wchar_t* RayTracer::ClosestHitShaderNames[] = { L"closestHitReflection", L
 const wchar_t* RayTracer::MissShaderName = L"missMain";
 
 RayTracer::RayTracer() :
+	m_culledTriangleRatio(0.0f),
 	m_instances()
 {
 	m_shaderLib = ShaderLib::MakeShared();
@@ -64,8 +64,7 @@ RayTracer::~RayTracer()
 }
 
 bool RayTracer::Init(RayTracing::CommandList* pCommandList, const DescriptorTableLib::sptr& descriptorTableLib,
-	uint32_t width, uint32_t height, vector<Resource::uptr>& uploaders, GeometryBuffer* pGeometries,
-	RayTracing::BottomLevelAS::uptr bottomLevelASes[NUM_MESH], const char* fileName, const wchar_t* envFileName,
+	uint32_t width, uint32_t height, vector<Resource::uptr>& uploaders, const wchar_t* envFileName,
 	Format rtFormat, const XMFLOAT4& posScale, uint8_t maxGBufferMips)
 {
 	const auto pDevice = pCommandList->GetRTDevice();
@@ -79,12 +78,7 @@ bool RayTracer::Init(RayTracing::CommandList* pCommandList, const DescriptorTabl
 	m_viewport = XMUINT2(width, height);
 	m_posScale = posScale;
 
-	// Load inputs
-	ObjLoader objLoader;
-	if (!objLoader.Import(fileName, true, true)) return false;
-	XUSG_N_RETURN(createVB(pCommandList, objLoader.GetNumVertices(), objLoader.GetVertexStride(), objLoader.GetVertices(), uploaders), false);
-	XUSG_N_RETURN(createIB(pCommandList, objLoader.GetNumIndices(), objLoader.GetIndices(), uploaders), false);
-
+	// Load inputs; the model mesh is loaded by LoadMesh()
 	XUSG_N_RETURN(createGroundMesh(pCommandList, uploaders), false);
 
 	// Create output views
@@ -149,12 +143,21 @@ bool RayTracer::Init(RayTracing::CommandList* pCommandList, const DescriptorTabl
 			8192, false, m_lightProbe, uploaders.back().get(), &alphaMode), false);
 	}
 
-	// Build acceleration structures
-	XUSG_N_RETURN(buildAccelerationStructures(pCommandList, pGeometries, bottomLevelASes), false);
-
 	return true;
 }
 
+bool RayTracer::LoadMesh(RayTracing::CommandList* pCommandList, const ObjLoader& objLoader,
+	vector<Resource::uptr>& uploaders, GeometryBuffer* pGeometries, RayTracing::BottomLevelAS::uptr bottomLevelASes[NUM_MESH])
+{
+	m_meshlets.assign(objLoader.GetMeshlets(), objLoader.GetMeshlets() + objLoader.GetNumMeshlets());
+	XUSG_N_RETURN(createVB(pCommandList, MODEL_OBJ, objLoader.GetNumVertices(), objLoader.GetPositionStride(),
+		objLoader.GetPositions(), objLoader.GetAttributeStride(), objLoader.GetAttributes(), uploaders), false);
+	XUSG_N_RETURN(createIB(pCommandList, objLoader.GetNumIndices(), objLoader.GetIndices(), uploaders), false);
+
+	// Build acceleration structures
+	return buildAccelerationStructures(pCommandList, pGeometries, bottomLevelASes);
+}
+
 bool RayTracer::BuildAccelerationStructures(RayTracing::CommandList* pCommandList,
 	const RayTracing::BottomLevelAS::uptr bottomLevelASes[NUM_MESH])
 {
@@ -295,6 +298,42 @@ void RayTracer::UpdateFrame(const RayTracing::Device* pDevice, uint8_t frameInde
 			s_frameIndex %= n;
 		}
 
+		// Cull the meshlets of the model in its object space for the visibility pass
+		if (!m_meshlets.empty())
+		{
+			// Frustum planes from the columns of the world-view-projection matrix
+			const auto worldViewProjT = XMMatrixTranspose(worlds[MODEL_OBJ] * viewProj);
+			float planes[6][4];
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(planes[0]), worldViewProjT.r[3] + worldViewProjT.r[0]);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(planes[1]), worldViewProjT.r[3] - worldViewProjT.r[0]);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(planes[2]), worldViewProjT.r[3] + worldViewProjT.r[1]);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(planes[3]), worldViewProjT.r[3] - worldViewProjT.r[1]);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(planes[4]), worldViewProjT.r[2]);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(planes[5]), worldViewProjT.r[3] - worldViewProjT.r[2]);
+
+			XMFLOAT3 localEyePt;
+			XMStoreFloat3(&localEyePt, XMVector3Transform(eyePt, XMMatrixInverse(nullptr, worlds[MODEL_OBJ])));
+
+			const auto numMeshlets = static_cast<uint32_t>(m_meshlets.size());
+			m_visibleMeshlets.resize(numMeshlets);
+			const auto numVisible = ObjLoader::CullMeshlets(m_visibleMeshlets.data(), m_meshlets.data(), numMeshlets,
+				ObjLoader::float3(localEyePt.x, localEyePt.y, localEyePt.z), planes);
+
+			// Merge the adjacent visible meshlets into index ranges
+			auto numVisibleIndices = 0u;
+			m_drawRanges.clear();
+			for (auto i = 0u; i < numVisible; ++i)
+			{
+				const auto& meshlet = m_meshlets[m_visibleMeshlets[i]];
+				const auto numIndices = meshlet.NumTriangles * 3;
+				if (!m_drawRanges.empty() && m_drawRanges.back().x + m_drawRanges.back().y == meshlet.FirstIndex)
+					m_drawRanges.back().y += numIndices;
+				else m_drawRanges.emplace_back(meshlet.FirstIndex, numIndices);
+				numVisibleIndices += numIndices;
+			}
+			m_culledTriangleRatio = 1.0f - numVisibleIndices / static_cast<float>(m_numIndices[MODEL_OBJ]);
+		}
+
 		for (auto i = 0u; i < NUM_MESH; ++i)
 		{
 			const auto pCbData = static_cast<CBPerObject*>(m_cbPerOjects[i]->Map(frameIndex));
@@ -390,18 +429,55 @@ const DepthStencil::sptr RayTracer::GetDepth() const
 	return m_depth;
 }
 
-bool RayTracer::createVB(XUSG::CommandList* pCommandList, uint32_t numVert,
-	uint32_t stride, const uint8_t* pData, vector<Resource::uptr>& uploaders)
+float RayTracer::GetCulledTriangleRatio() const
 {
-	auto& vertexBuffer = m_vertexBuffers[MODEL_OBJ];
-	vertexBuffer = VertexBuffer::MakeUnique();
-	XUSG_N_RETURN(vertexBuffer->Create(pCommandList->GetDevice(), numVert, sizeof(Vertex),
-		ResourceFlag::NONE, MemoryType::DEFAULT, 1, nullptr, 1,
-		nullptr, 1, nullptr, MemoryFlag::NONE, L"MeshVB"), false);
-	uploaders.emplace_back(Resource::MakeUnique());
+	return m_culledTriangleRatio;
+}
 
-	return vertexBuffer->Upload(pCommandList, uploaders.back().get(), pData,
-		sizeof(Vertex) * numVert, 0, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+bool RayTracer::ReadBackVisibility(RayTracing::CommandList* pCommandList, uint8_t frameIndex,
+	Buffer* pReadBuffers[2], uint32_t* pRowPitch)
+{
+	for (uint8_t i = 0; i < 2; ++i)
+	{
+		visibility(pCommandList, frameIndex, i != 0);
+		XUSG_N_RETURN(m_visBuffer->ReadBack(pCommandList, pReadBuffers[i], pRowPitch), false);
+	}
+
+	return true;
+}
+
+bool RayTracer::createVB(XUSG::CommandList* pCommandList, MeshIndex mesh, uint32_t numVert,
+	uint32_t positionStride, const uint8_t* pPositions, uint32_t attributeStride,
+	const uint8_t* pAttributes, vector<Resource::uptr>& uploaders)
+{
+	// The hit shaders need the normals
+	if (!pAttributes) return false;
+
+	const wstring meshName = mesh == GROUND ? L"Ground" : L"Mesh";
+	vector<XMFLOAT3> packed;
+	const auto createStream = [&](VertexBuffer::uptr& vertexBuffer, uint32_t stride, const uint8_t* pData, const wchar_t* name)
+	{
+		// Gather the float3 at the start of each element, unless already packed
+		if (stride != sizeof(XMFLOAT3))
+		{
+			packed.resize(numVert);
+			for (auto i = 0u; i < numVert; ++i) memcpy(&packed[i], pData + stride * i, sizeof(XMFLOAT3));
+			pData = reinterpret_cast<const uint8_t*>(packed.data());
+		}
+
+		vertexBuffer = VertexBuffer::MakeUnique();
+		XUSG_N_RETURN(vertexBuffer->Create(pCommandList->GetDevice(), numVert, sizeof(XMFLOAT3),
+			ResourceFlag::NONE, MemoryType::DEFAULT, 1, nullptr, 1,
+			nullptr, 1, nullptr, MemoryFlag::NONE, (meshName + name).c_str()), false);
+		uploaders.emplace_back(Resource::MakeUnique());
+
+		return vertexBuffer->Upload(pCommandList, uploaders.back().get(), pData,
+			sizeof(XMFLOAT3) * numVert, 0, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+	};
+
+	XUSG_N_RETURN(createStream(m_vertexBuffers[mesh], positionStride, pPositions, L"VB"), false);
+
+	return createStream(m_attributeBuffers[mesh], attributeStride, pAttributes, L"AttributeVB");
 }
 
 bool RayTracer::createIB(XUSG::CommandList* pCommandList, uint32_t numIndices,
@@ -460,15 +536,9 @@ bool RayTracer::createGroundMesh(XUSG::CommandList* pCommandList, vector<Resourc
 			{ XMFLOAT3(-1.0f, 1.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 1.0f) },
 		};
 
-		auto& vertexBuffer = m_vertexBuffers[GROUND];
-		vertexBuffer = VertexBuffer::MakeUnique();
-		XUSG_N_RETURN(vertexBuffer->Create(pDevice, static_cast<uint32_t>(size(vertices)),
-			sizeof(Vertex), ResourceFlag::NONE, MemoryType::DEFAULT, 1, nullptr, 1, nullptr,
-			1, nullptr, MemoryFlag::NONE, L"GroundVB"), false);
-		uploaders.push_back(Resource::MakeUnique());
-
-		XUSG_N_RETURN(vertexBuffer->Upload(pCommandList, uploaders.back().get(), vertices,
-			sizeof(vertices), 0, ResourceState::NON_PIXEL_SHADER_RESOURCE), false);
+		XUSG_N_RETURN(createVB(pCommandList, GROUND, static_cast<uint32_t>(size(vertices)),
+			sizeof(Vertex), reinterpret_cast<const uint8_t*>(&vertices[0].Pos),
+			sizeof(Vertex), reinterpret_cast<const uint8_t*>(&vertices[0].Nrm), uploaders), false);
 	}
 
 	// Index Buffer
@@ -515,8 +585,7 @@ bool RayTracer::createInputLayout()
 	// Define the vertex input layout.
 	const InputElement inputElements[] =
 	{
-		{ "POSITION",	0, Format::R32G32B32_FLOAT,	0, 0,								InputClassification::PER_VERTEX_DATA, 0 },
-		{ "NORMAL",		0, Format::R32G32B32_FLOAT,	0, D3D12_APPEND_ALIGNED_ELEMENT,	InputClassification::PER_VERTEX_DATA, 0 }
+		{ "POSITION",	0, Format::R32G32B32_FLOAT,	0, 0,	InputClassification::PER_VERTEX_DATA, 0 }
 	};
 
 	XUSG_X_RETURN(m_pInputLayout, m_graphicsPipelineLib->CreateInputLayout(inputElements, static_cast<uint32_t>(size(inputElements))), false);
@@ -532,7 +601,7 @@ bool RayTracer::createPipelineLayouts(const RayTracing::Device* pDevice)
 	{
 		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
 		pipelineLayout->SetRootCBV(0, 0, 0, Shader::Stage::VS);
-		pipelineLayout->SetConstants(1, XUSG_UINT32_SIZE_OF(uint32_t), 0, 0, Shader::Stage::PS);
+		pipelineLayout->SetConstants(1, XUSG_UINT32_SIZE_OF(uint32_t[2]), 0, 0, Shader::Stage::PS);
 		XUSG_X_RETURN(m_pipelineLayouts[VISIBILITY_LAYOUT], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
 			PipelineLayoutFlag::ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT, L"VisibilityPipelineLayout"), false);
 	}
@@ -545,6 +614,7 @@ bool RayTracer::createPipelineLayouts(const RayTracing::Device* pDevice)
 		pipelineLayout->SetRootSRV(ACCELERATION_STRUCTURE, 0, 0, DescriptorFlag::DATA_STATIC);
 		pipelineLayout->SetRange(INDEX_BUFFERS, DescriptorType::SRV, NUM_MESH, 0, 1);
 		pipelineLayout->SetRange(VERTEX_BUFFERS, DescriptorType::SRV, NUM_MESH, 0, 2);
+		pipelineLayout->SetRange(ATTRIBUTE_BUFFERS, DescriptorType::SRV, NUM_MESH, 0, 3);
 		pipelineLayout->SetRootCBV(MATERIALS, 0);
 		pipelineLayout->SetRootCBV(CONSTANTS, 1);
 		pipelineLayout->SetRange(SHADER_RESOURCES, DescriptorType::SRV, 2, 1);
@@ -632,6 +702,15 @@ bool RayTracer::createDescriptorTables()
 		XUSG_X_RETURN(m_srvTables[SRV_TABLE_VB], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
 	}
 
+	// Attribute buffer SRVs
+	{
+		Descriptor descriptors[NUM_MESH];
+		for (auto i = 0u; i < NUM_MESH; ++i) descriptors[i] = m_attributeBuffers[i]->GetSRV();
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		descriptorTable->SetDescriptors(0, static_cast<uint32_t>(size(descriptors)), descriptors);
+		XUSG_X_RETURN(m_srvTables[SRV_TABLE_AB], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+
 	// Ray-tracing SRVs
 	{
 		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
@@ -748,7 +827,7 @@ bool RayTracer::buildShaderTables(const RayTracing::Device* pDevice)
 	return true;
 }
 
-void RayTracer::visibility(XUSG::CommandList* pCommandList, uint8_t frameIndex)
+void RayTracer::visibility(XUSG::CommandList* pCommandList, uint8_t frameIndex, bool cullMeshlets)
 {
 	// Set barriers
 	ResourceBarrier barriers[2];
@@ -786,7 +865,20 @@ void RayTracer::visibility(XUSG::CommandList* pCommandList, uint8_t frameIndex)
 		pCommandList->IASetVertexBuffers(0, 1, &m_vertexBuffers[i]->GetVBV());
 		pCommandList->IASetIndexBuffer(m_indexBuffers[i]->GetIBV());
 
-		pCommandList->DrawIndexed(m_numIndices[i], 1, 0, 0, 0);
+		if (cullMeshlets && i == MODEL_OBJ && !m_meshlets.empty())
+		{
+			// SV_PrimitiveID restarts from 0 at each draw, so pass the first triangle of the range.
+			for (const auto& range : m_drawRanges)
+			{
+				pCommandList->SetGraphics32BitConstant(1, range.x / 3, 1);
+				pCommandList->DrawIndexed(range.y, 1, range.x, 0, 0);
+			}
+		}
+		else
+		{
+			pCommandList->SetGraphics32BitConstant(1, 0, 1);
+			pCommandList->DrawIndexed(m_numIndices[i], 1, 0, 0, 0);
+		}
 	}
 }
 
@@ -798,6 +890,7 @@ void RayTracer::rayTrace(const RayTracing::CommandList* pCommandList, uint8_t fr
 	pCommandList->SetTopLevelAccelerationStructure(ACCELERATION_STRUCTURE, m_topLevelAS.get());
 	pCommandList->SetComputeDescriptorTable(INDEX_BUFFERS, m_srvTables[SRV_TABLE_IB]);
 	pCommandList->SetComputeDescriptorTable(VERTEX_BUFFERS, m_srvTables[SRV_TABLE_VB]);
+	pCommandList->SetComputeDescriptorTable(ATTRIBUTE_BUFFERS, m_srvTables[SRV_TABLE_AB]);
 	pCommandList->SetComputeRootConstantBufferView(MATERIALS, m_cbMaterials.get());
 	pCommandList->SetComputeRootConstantBufferView(CONSTANTS, m_cbRaytracing.get(), m_cbRaytracing->GetCBVOffset(frameIndex));
 	pCommandList->SetComputeDescriptorTable(SHADER_RESOURCES, m_srvTables[SRV_TABLE_RO]);
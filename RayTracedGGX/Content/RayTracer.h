@@ -6,6 +6,7 @@
 
 #include "Advanced/XUSGAdvanced.h"
 #include "RayTracing/XUSGRayTracing.h"
+#include "Optional/XUSGObjLoader.h"
 
 class RayTracer
 {
@@ -22,9 +23,12 @@ public:
 	virtual ~RayTracer();
 
 	bool Init(XUSG::RayTracing::CommandList* pCommandList, const XUSG::DescriptorTableLib::sptr& descriptorTableLib,
-		uint32_t width, uint32_t height, std::vector<XUSG::Resource::uptr>& uploaders, XUSG::RayTracing::GeometryBuffer* pGeometries,
-		XUSG::RayTracing::BottomLevelAS::uptr bottomLevelASes[NUM_MESH], const char* fileName, const wchar_t* envFileName,
+		uint32_t width, uint32_t height, std::vector<XUSG::Resource::uptr>& uploaders, const wchar_t* envFileName,
 		XUSG::Format rtFormat, const DirectX::XMFLOAT4& posScale = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f), uint8_t maxGBufferMips = 1);
+	// Init() does not need the mesh, so the mesh can still be importing meanwhile.
+	bool LoadMesh(XUSG::RayTracing::CommandList* pCommandList, const XUSG::ObjLoader& objLoader,
+		std::vector<XUSG::Resource::uptr>& uploaders, XUSG::RayTracing::GeometryBuffer* pGeometries,
+		XUSG::RayTracing::BottomLevelAS::uptr bottomLevelASes[NUM_MESH]);
 	bool BuildAccelerationStructures(XUSG::RayTracing::CommandList* pCommandList,
 		const XUSG::RayTracing::BottomLevelAS::uptr bottomLevelASes[NUM_MESH]);
 	bool Postinit(const XUSG::RayTracing::Device* pDevice);
@@ -41,6 +45,12 @@ public:
 	const XUSG::Texture2D::uptr* GetRayTracingOutputs() const;
 	const XUSG::RenderTarget::uptr* GetGBuffers() const;
 	const XUSG::DepthStencil::sptr GetDepth() const;
+	float GetCulledTriangleRatio() const;
+
+	// Renders the visibility buffer of the current view without and then with the meshlet culling, and
+	// reads each back. They match, since the culling only drops the triangles that cover no pixel.
+	bool ReadBackVisibility(XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex,
+		XUSG::Buffer* pReadBuffers[2], uint32_t* pRowPitch);
 
 	static const uint8_t FrameCount = 3;
 
@@ -73,6 +83,7 @@ protected:
 		ACCELERATION_STRUCTURE,
 		INDEX_BUFFERS,
 		VERTEX_BUFFERS,
+		ATTRIBUTE_BUFFERS,
 		MATERIALS,
 		CONSTANTS,
 		SHADER_RESOURCES,
@@ -92,6 +103,7 @@ protected:
 	{
 		SRV_TABLE_IB,
 		SRV_TABLE_VB,
+		SRV_TABLE_AB,
 		SRV_TABLE_RO,
 		SRV_TABLE_LP,
 
@@ -106,8 +118,11 @@ protected:
 		NUM_HIT_GROUP
 	};
 
-	bool createVB(XUSG::CommandList* pCommandList, uint32_t numVert, uint32_t stride,
-		const uint8_t* pData, std::vector<XUSG::Resource::uptr>& uploaders);
+	// The positions go to a packed stream for the acceleration structure builds and the visibility
+	// pass, and the normals to another for hit shading; either may be interleaved in the source.
+	bool createVB(XUSG::CommandList* pCommandList, MeshIndex mesh, uint32_t numVert,
+		uint32_t positionStride, const uint8_t* pPositions, uint32_t attributeStride,
+		const uint8_t* pAttributes, std::vector<XUSG::Resource::uptr>& uploaders);
 	bool createIB(XUSG::CommandList* pCommandList, uint32_t numIndices,
 		const uint32_t* pData, std::vector<XUSG::Resource::uptr>& uploaders);
 	bool createGroundMesh(XUSG::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders);
@@ -120,11 +135,16 @@ protected:
 		XUSG::RayTracing::GeometryBuffer* pGeometries, XUSG::RayTracing::BottomLevelAS::uptr bottomLevelASes[NUM_MESH]);
 	bool buildShaderTables(const XUSG::RayTracing::Device* pDevice);
 
-	void visibility(XUSG::CommandList* pCommandList, uint8_t frameIndex);
+	void visibility(XUSG::CommandList* pCommandList, uint8_t frameIndex, bool cullMeshlets = true);
 	void rayTrace(const XUSG::RayTracing::CommandList* pCommandList, uint8_t frameIndex);
 
 	uint32_t			m_numIndices[NUM_MESH];
 
+	std::vector<XUSG::ObjLoader::Meshlet> m_meshlets;
+	std::vector<uint32_t>			m_visibleMeshlets;
+	std::vector<DirectX::XMUINT2>	m_drawRanges;	// First index and index count of the visible model triangles
+	float				m_culledTriangleRatio;
+
 	DirectX::XMUINT2	m_viewport;
 	DirectX::XMFLOAT4	m_posScale;
 	DirectX::XMFLOAT4X4 m_worlds[NUM_MESH];
@@ -144,6 +164,7 @@ protected:
 	XUSG::Framebuffer			m_framebuffer;
 
 	XUSG::VertexBuffer::uptr	m_vertexBuffers[NUM_MESH];
+	XUSG::VertexBuffer::uptr	m_attributeBuffers[NUM_MESH];
 	XUSG::IndexBuffer::uptr		m_indexBuffers[NUM_MESH];
 
 	XUSG::Texture2D::uptr		m_outputViews[NUM_HIT_GROUP];
@@ -10,6 +10,7 @@
 cbuffer cbPerObject
 {
 	uint g_instanceIdx;
+	uint g_firstPrimitive;	// SV_PrimitiveID restarts from 0 at each draw of the culled index ranges
 };
 
 //--------------------------------------------------------------------------------------
@@ -20,5 +21,5 @@ uint main(uint primitiveId : SV_PrimitiveID, bool isFrontFace : SV_IsFrontFace)
 	//const uint frontFaceBit = isFrontFace ? 1 : 0;
 
 	//return ((frontFaceBit << 31) | (g_instanceIdx << PRIMITIVE_BITS) | primitiveId) + 1;
-	return ((g_instanceIdx << PRIMITIVE_BITS) | primitiveId) + 1;
+	return ((g_instanceIdx << PRIMITIVE_BITS) | (g_firstPrimitive + primitiveId)) + 1;
 }
@@ -0,0 +1,49 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// Quantized vertex layout of ObjLoader::QUANTIZE_VERTICES (12 bytes); with
+// SPLIT_VERTEX_STREAMS, Pos and Nrm are in a stream each
+//--------------------------------------------------------------------------------------
+struct QuantizedVertex
+{
+	uint2	Pos;	// 16-bit UNORM x, y, z within the mesh AABB, and 16 bits of padding
+	uint	Nrm;	// 2x16-bit SNORM octahedral normal
+};
+
+//--------------------------------------------------------------------------------------
+// Decode a position; posMin and posExtent are the mesh AABB min and max - min
+//--------------------------------------------------------------------------------------
+float3 decodePosition(uint2 pos, float3 posMin, float3 posExtent)
+{
+	const float3 q = float3(pos.x & 0xffff, pos.x >> 16, pos.y & 0xffff);
+
+	return posMin + q * (posExtent / 65535.0);
+}
+
+//--------------------------------------------------------------------------------------
+// Decode an octahedral normal
+// [Cigolle et al. 2014, "A Survey of Efficient Representations for Independent Unit Vectors"]
+//--------------------------------------------------------------------------------------
+float3 decodeNormal(uint nrm)
+{
+	const int2 q = int2(nrm << 16, nrm) >> 16;
+	float2 uv = max(q / 32767.0, -1.0);
+	const float z = 1.0 - abs(uv.x) - abs(uv.y);
+
+	// Unfold the lower hemisphere
+	const float t = max(-z, 0.0);
+	uv -= select(uv >= 0.0, t, -t);
+
+	return normalize(float3(uv, z));
+}
+
+//--------------------------------------------------------------------------------------
+// Decode a vertex, e.g. for getVertices() with a StructuredBuffer<QuantizedVertex>
+//--------------------------------------------------------------------------------------
+void decodeVertex(QuantizedVertex vertex, float3 posMin, float3 posExtent, out float3 pos, out float3 nrm)
+{
+	pos = decodePosition(vertex.Pos, posMin, posExtent);
+	nrm = decodeNormal(vertex.Nrm);
+}
@@ -79,7 +79,8 @@ StructuredBuffer<float3>	g_roSHCoeffs	: register (t3);
 
 // IA buffers
 Buffer<uint>				g_indexBuffers[]	: register (t0, space1);
-StructuredBuffer<Vertex>	g_vertexBuffers[]	: register (t0, space2);
+StructuredBuffer<float3>	g_vertexBuffers[]	: register (t0, space2);	// Positions
+StructuredBuffer<float3>	g_attribBuffers[]	: register (t0, space3);	// Normals
 
 //--------------------------------------------------------------------------------------
 // Samplers
@@ -237,10 +238,13 @@ void getVertices(out Vertex vertices[3], uint meshIdx, uint primIdx)
 		g_indexBuffers[NonUniformResourceIndex(meshIdx)][baseIdx + 2]
 	};
 
-	// Retrieve corresponding vertex normals for the triangle vertices.
+	// Retrieve corresponding vertex positions and normals for the triangle vertices.
 	[unroll]
 	for (uint i = 0; i < 3; ++i)
-		vertices[i] = g_vertexBuffers[NonUniformResourceIndex(meshIdx)][indices[i]];
+	{
+		vertices[i].Pos = g_vertexBuffers[NonUniformResourceIndex(meshIdx)][indices[i]];
+		vertices[i].Nrm = g_attribBuffers[NonUniformResourceIndex(meshIdx)][indices[i]];
+	}
 }
 
 //--------------------------------------------------------------------------------------
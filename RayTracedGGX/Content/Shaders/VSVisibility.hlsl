@@ -8,7 +8,6 @@
 struct VSIn
 {
 	float3	Pos	: POSITION;
-	float3	Nrm	: NORMAL;
 };
 
 //--------------------------------------------------------------------------------------
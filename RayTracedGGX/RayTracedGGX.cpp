@@ -37,7 +37,14 @@ RayTracedGGX::RayTracedGGX(uint32_t width, uint32_t height, std::wstring name) :
 	m_meshFileName("Assets/dragon.obj"),
 	m_envFileName(L"Assets/rnl_cross.dds"),
 	m_meshPosScale(0.0f, 0.0f, 0.0f, 1.0f),
-	m_screenShot(0)
+	m_sanitizeMesh(false),
+	m_meshImportTime(0.0),
+	m_meshImportWaitTime(0.0),
+	m_meshSanitizeStats(),
+	m_screenShot(0),
+	m_visRowPitch(0),
+	m_visCulledTriangleRatio(0.0f),
+	m_visibilityCheck(0)
 {
 #if defined (_DEBUG)
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
@@ -60,8 +67,34 @@ RayTracedGGX::~RayTracedGGX()
 
 void RayTracedGGX::OnInit()
 {
+	// Import the mesh while the device, the pipeline objects and the environment map are being set up.
+#if defined (_DEBUG)
+	const auto startTime = chrono::steady_clock::now();
+#endif
+	m_objLoader = make_unique<ObjLoader>();
+	ObjLoader::ImportOptions importOptions;
+	importOptions.UseCache = true;
+	importOptions.PostProcesses = ObjLoader::WELD_VERTICES | ObjLoader::SORT_TRIANGLES_SPATIALLY |
+		ObjLoader::OPTIMIZE_VERTEX_CACHE | ObjLoader::BUILD_MESHLETS | ObjLoader::SPLIT_VERTEX_STREAMS |
+		(m_sanitizeMesh ? ObjLoader::SANITIZE_MESH : ObjLoader::POST_PROCESS_NONE);
+	m_meshImport = m_objLoader->ImportAsync(m_meshFileName.c_str(), importOptions);
+
 	LoadPipeline();
 	LoadAssets();
+
+#if defined (_DEBUG)
+	// Report how much of the import has been hidden behind the setup.
+	const auto startupTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+	wstringstream report;
+	report << fixed << setprecision(1) << L"Startup: " << startupTime * 1000.0 << L" ms, mesh import: "
+		<< m_meshImportTime * 1000.0 << L" ms, waited for the import: " << m_meshImportWaitTime * 1000.0
+		<< L" ms, saved by the overlap: " << (m_meshImportTime - m_meshImportWaitTime) * 1000.0 << L" ms\n";
+	if (m_sanitizeMesh)
+		report << L"Mesh sanitization removed " << m_meshSanitizeStats.NumDegenerateTriangles << L" degenerate, "
+			<< m_meshSanitizeStats.NumDuplicateTriangles << L" duplicate and " << m_meshSanitizeStats.NumNonFiniteTriangles
+			<< L" non-finite triangles, and " << m_meshSanitizeStats.NumUnreferencedVertices << L" unreferenced vertices\n";
+	OutputDebugString(report.str().c_str());
+#endif
 }
 
 // Load the rendering pipeline dependencies.
@@ -209,9 +242,20 @@ void RayTracedGGX::LoadAssets()
 	{
 		GeometryBuffer geometries[RayTracer::NUM_MESH];
 		m_rayTracer = make_unique<RayTracer>();
-		XUSG_N_RETURN(m_rayTracer->Init(pCommandList, m_descriptorTableLib, m_width, m_height, uploaders, geometries,
-			bottomLevelASes, m_meshFileName.c_str(), m_envFileName.c_str(), Format::R8G8B8A8_UNORM, m_meshPosScale),
+		XUSG_N_RETURN(m_rayTracer->Init(pCommandList, m_descriptorTableLib, m_width, m_height, uploaders,
+			m_envFileName.c_str(), Format::R8G8B8A8_UNORM, m_meshPosScale), ThrowIfFailed(E_FAIL));
+
+		// Wait for the mesh imported since OnInit()
+		const auto waitStartTime = chrono::steady_clock::now();
+		const auto isImported = m_meshImport.get();
+		m_meshImportWaitTime = chrono::duration<double>(chrono::steady_clock::now() - waitStartTime).count();
+		m_meshImportTime = m_objLoader->GetImportTime();
+		m_meshSanitizeStats = m_objLoader->GetSanitizeStats();
+		XUSG_N_RETURN(isImported, ThrowIfFailed(E_FAIL));
+
+		XUSG_N_RETURN(m_rayTracer->LoadMesh(pCommandList, *m_objLoader, uploaders, geometries, bottomLevelASes),
 			ThrowIfFailed(E_FAIL));
+		m_objLoader.reset();
 	}
 
 	// Close the command list and execute it to begin the initial GPU setup.
@@ -503,10 +547,12 @@ void RayTracedGGX::ParseCommandLineArgs(wchar_t* argv[], int argc)
 			if (hasNextArgValue(i)) i += swscanf_s(argv[i + 1], L"%f", &m_meshPosScale.z);
 			if (hasNextArgValue(i)) i += swscanf_s(argv[i + 1], L"%f", &m_meshPosScale.w);
 		}
+		else if (isArgMatched(i, L"sanitize")) m_sanitizeMesh = true;
 		else if (isArgMatched(i, L"env"))
 		{
 			if (hasNextArgValue(i)) m_envFileName = argv[++i];
 		}
+		else if (isArgMatched(i, L"checkVisibility")) m_visibilityCheck = 1;
 	}
 }
 
@@ -530,6 +576,17 @@ void RayTracedGGX::PopulateCommandList()
 	pCommandList->SetDescriptorHeaps(1, &descriptorHeap);
 
 	m_rayTracer->UpdateAccelerationStructure(pCommandList, m_frameIndex);
+
+	// Visibility-buffer check helper
+	if (m_visibilityCheck == 1)
+	{
+		for (auto& readBuffer : m_visReadBuffers) if (!readBuffer) readBuffer = Buffer::MakeUnique();
+		Buffer* pReadBuffers[] = { m_visReadBuffers[0].get(), m_visReadBuffers[1].get() };
+		m_rayTracer->ReadBackVisibility(pCommandList, m_frameIndex, pReadBuffers, &m_visRowPitch);
+		m_visCulledTriangleRatio = m_rayTracer->GetCulledTriangleRatio();
+		m_visibilityCheck = 2;
+	}
+
 	m_rayTracer->Render(pCommandList, m_frameIndex);
 
 	ResourceBarrier barriers[3];
@@ -598,6 +655,16 @@ void RayTracedGGX::PopulateGeometryCommandList(CommandType commandType)
 	const auto descriptorHeap = m_descriptorTableLib->GetDescriptorHeap(CBV_SRV_UAV_HEAP);
 	pCommandList->SetDescriptorHeaps(1, &descriptorHeap);
 
+	// Visibility-buffer check helper
+	if (m_visibilityCheck == 1)
+	{
+		for (auto& readBuffer : m_visReadBuffers) if (!readBuffer) readBuffer = Buffer::MakeUnique();
+		Buffer* pReadBuffers[] = { m_visReadBuffers[0].get(), m_visReadBuffers[1].get() };
+		m_rayTracer->ReadBackVisibility(pCommandList, m_frameIndex, pReadBuffers, &m_visRowPitch);
+		m_visCulledTriangleRatio = m_rayTracer->GetCulledTriangleRatio();
+		m_visibilityCheck = 2;
+	}
+
 	m_rayTracer->RenderVisibility(pCommandList, m_frameIndex, true);
 
 	XUSG_N_RETURN(pCommandList->Close(), ThrowIfFailed(E_FAIL));
@@ -714,6 +781,17 @@ void RayTracedGGX::MoveToNextFrame()
 		}
 		else ++m_screenShot;
 	}
+
+	// Visibility-buffer check helper
+	if (m_visibilityCheck > 1)
+	{
+		if (m_visibilityCheck > FrameCount)
+		{
+			CheckVisibility();
+			m_visibilityCheck = 0;
+		}
+		else ++m_visibilityCheck;
+	}
 }
 
 void RayTracedGGX::SaveImage(char const* fileName, Buffer* pImageBuffer, uint32_t w, uint32_t h, uint32_t rowPitch, uint8_t comp)
@@ -738,6 +816,40 @@ void RayTracedGGX::SaveImage(char const* fileName, Buffer* pImageBuffer, uint32_
 	pImageBuffer->Unmap();
 }
 
+// Compares the visibility buffers rendered without and with the meshlet culling. The IDs of the unculled
+// draws are the triangle indices, so any mismatch is a triangle misidentified by the culled draws.
+void RayTracedGGX::CheckVisibility()
+{
+	const auto pRefData = static_cast<const uint8_t*>(m_visReadBuffers[0]->Map(nullptr));
+	const auto pData = static_cast<const uint8_t*>(m_visReadBuffers[1]->Map(nullptr));
+
+	auto numModelPixels = 0u;
+	auto numMismatches = 0u;
+	for (auto i = 0u; i < m_height; ++i)
+	{
+		const auto pRefRow = reinterpret_cast<const uint32_t*>(pRefData + m_visRowPitch * i);
+		const auto pRow = reinterpret_cast<const uint32_t*>(pData + m_visRowPitch * i);
+		for (auto j = 0u; j < m_width; ++j)
+		{
+			// The IDs are ((instance << 24) | primitive) + 1, with 0 for the background.
+			numModelPixels += pRefRow[j] && (pRefRow[j] - 1) >> 24 == RayTracer::MODEL_OBJ ? 1 : 0;
+			numMismatches += pRow[j] != pRefRow[j] ? 1 : 0;
+		}
+	}
+
+	m_visReadBuffers[1]->Unmap();
+	m_visReadBuffers[0]->Unmap();
+
+	wstringstream report;
+	report << fixed << setprecision(1) << L"Visibility check: " << numMismatches << L" of "
+		<< m_width * m_height << L" pixels (" << numModelPixels << L" of the model) mismatch with "
+		<< m_visCulledTriangleRatio * 100.0f << L"% of the model triangles culled";
+	if (m_visCulledTriangleRatio <= 0.0f || m_visCulledTriangleRatio >= 1.0f)
+		report << L", which is inconclusive since the view is not partly culled";
+	report << L"\n";
+	OutputDebugString(report.str().c_str());
+}
+
 double RayTracedGGX::CalculateFrameStats(float* pTimeStep)
 {
 	static auto frameCnt = 0u;
@@ -767,6 +879,7 @@ double RayTracedGGX::CalculateFrameStats(float* pTimeStep)
 		windowText << L"    [A] " << (m_asyncCompute ? L"Async compute" : L"Single command list");
 		windowText << L"    [\x2190][\x2192] Current mesh: " << meshNames[m_currentMesh];
 		windowText << L"    [\x2191][\x2193] Metallic: " << m_metallics[m_currentMesh];
+		windowText << L"    Culled triangles: " << m_rayTracer->GetCulledTriangleRatio() * 100.0f << L"%";
 		windowText << L"    [F11] screen shot";
 		SetCustomWindowText(windowText.str().c_str());
 	}
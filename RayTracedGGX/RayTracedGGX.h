@@ -122,12 +122,26 @@ private:
 	std::wstring m_envFileName;
 	std::string m_meshFileName;
 	XMFLOAT4 m_meshPosScale;
+	bool m_sanitizeMesh;
+
+	// Asynchronous mesh import
+	std::unique_ptr<XUSG::ObjLoader> m_objLoader;
+	std::future<bool> m_meshImport;
+	double m_meshImportTime;
+	double m_meshImportWaitTime;
+	XUSG::ObjLoader::SanitizeStats m_meshSanitizeStats;
 
 	// Screen-shot helpers and state
 	XUSG::Buffer::uptr	m_readBuffer;
 	uint32_t			m_rowPitch;
 	uint8_t				m_screenShot;
 
+	// Visibility-buffer check helpers and state
+	XUSG::Buffer::uptr	m_visReadBuffers[2];
+	uint32_t			m_visRowPitch;
+	float				m_visCulledTriangleRatio;
+	uint8_t				m_visibilityCheck;
+
 	void LoadPipeline();
 	void LoadAssets();
 	void PopulateCommandList();
@@ -139,6 +153,7 @@ private:
 	void MoveToNextFrame();
 	void SaveImage(char const* fileName, XUSG::Buffer* pImageBuffer,
 		uint32_t w, uint32_t h, uint32_t rowPitch, uint8_t comp = 3);
+	void CheckVisibility();
 	double CalculateFrameStats(float* fTimeStep = nullptr);
 
 	// Ray tracing
@@ -0,0 +1,2654 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "XUSGBVH.h"
+#include <cfloat>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if !defined(XUSG_BVH_NO_SIMD) && (defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__))
+#define XUSG_BVH_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(XUSG_BVH_SSE2) && defined(__AVX2__)
+#define XUSG_BVH_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace XUSG;
+
+struct Box
+{
+	float Min[3];
+	float Max[3];
+};
+
+struct Bin
+{
+	Box Bounds;
+	uint32_t Count;
+};
+
+struct BinSet
+{
+	Bin Bins[3][BVH::MaxBins];
+};
+
+// The per-triangle data, as separate x, y and z arrays kept in the order of the primitive indices,
+// so that the nodes are binned over contiguous ranges
+struct BuildContext
+{
+	BVH::BuildOptions Options;
+	vector<float> Centroids[3];
+	vector<float> Mins[3];
+	vector<float> Maxs[3];
+
+	uint32_t* pPrimIndices;
+	BVH::Node* pNodes;				// In the order of allocation
+	atomic<uint32_t> NumNodes;
+	atomic<uint32_t> NumTasks;		// Running besides the calling thread
+
+	// The triangles, for the spatial splits; pIndices is null for a build over boxes.
+	const uint8_t* pPositions;
+	uint32_t PositionStride;
+	const uint32_t* pIndices;
+	atomic<uint32_t> NumReferences;	// In the leaves so far
+	float MinOverlap;				// Of the object split children for a spatial split, as a half area
+};
+
+// Subtrees of fewer triangles are built by the task of their parent, and nodes of fewer
+// triangles are binned by a single thread.
+static const uint32_t g_minTaskSize = 1024;
+static const uint32_t g_minBinChunkSize = 16384;
+static const uint32_t g_minSortChunkSize = 16384;
+
+static void parallelFor(uint32_t numTasks, uint32_t numThreads, const function<void(uint32_t)>& func)
+{
+	atomic<uint32_t> nextTask(0);
+	const auto worker = [&]()
+	{
+		for (auto i = nextTask++; i < numTasks; i = nextTask++) func(i);
+	};
+
+	// The calling thread works as well
+	vector<thread> threads;
+	numThreads = (min)(numThreads, numTasks);
+	for (auto i = 1u; i < numThreads; ++i) threads.emplace_back(worker);
+	worker();
+
+	for (auto& t : threads) t.join();
+}
+
+static void resetBox(Box& box)
+{
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		box.Min[i] = FLT_MAX;
+		box.Max[i] = -FLT_MAX;
+	}
+}
+
+static void growBox(Box& box, const Box& other)
+{
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		box.Min[i] = (min)(box.Min[i], other.Min[i]);
+		box.Max[i] = (max)(box.Max[i], other.Max[i]);
+	}
+}
+
+// Half the surface area, which suffices for the ratios of the SAH
+static float halfArea(const Box& box)
+{
+	const auto dx = box.Max[0] - box.Min[0];
+	const auto dy = box.Max[1] - box.Min[1];
+	const auto dz = box.Max[2] - box.Min[2];
+
+	return dx >= 0.0f ? dx * dy + dy * dz + dz * dx : 0.0f;
+}
+
+// A NaN centroid goes to the first bin.
+static uint32_t getBinIndex(float centroid, float centroidMin, float scale, uint32_t numBins)
+{
+	const auto b = (centroid - centroidMin) * scale;
+
+	return b > 0.0f ? (b < static_cast<float>(numBins) ? static_cast<uint32_t>(b) : numBins - 1) : 0;
+}
+
+static void swapPrimitives(BuildContext& context, uint32_t i, uint32_t j)
+{
+	swap(context.pPrimIndices[i], context.pPrimIndices[j]);
+	for (uint8_t k = 0; k < 3; ++k)
+	{
+		swap(context.Centroids[k][i], context.Centroids[k][j]);
+		swap(context.Mins[k][i], context.Mins[k][j]);
+		swap(context.Maxs[k][i], context.Maxs[k][j]);
+	}
+}
+
+// The number of chunks for a parallel pass over count triangles, 1 if not worth it
+static uint32_t getNumChunks(const BuildContext& context, uint32_t count)
+{
+	// The threads not running tasks help with the nodes that are binned before the tasks spread
+	const auto numThreads = context.Options.NumThreads / (context.NumTasks + 1);
+
+	return (max)((min)(numThreads, count / g_minBinChunkSize), 1u);
+}
+
+static void computeBounds(const BuildContext& context, uint32_t first, uint32_t count, Box& bounds, Box& centroidBounds)
+{
+	const auto numChunks = getNumChunks(context, count);
+	vector<Box> chunkBounds(numChunks), chunkCentroidBounds(numChunks);
+	parallelFor(numChunks, numChunks, [&](uint32_t i)
+	{
+		auto& b = chunkBounds[i];
+		auto& c = chunkCentroidBounds[i];
+		resetBox(b);
+		resetBox(c);
+
+		const auto end = first + static_cast<uint32_t>(static_cast<uint64_t>(count) * (i + 1) / numChunks);
+		for (auto j = first + static_cast<uint32_t>(static_cast<uint64_t>(count) * i / numChunks); j < end; ++j)
+		{
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				b.Min[k] = (min)(b.Min[k], context.Mins[k][j]);
+				b.Max[k] = (max)(b.Max[k], context.Maxs[k][j]);
+				c.Min[k] = (min)(c.Min[k], context.Centroids[k][j]);
+				c.Max[k] = (max)(c.Max[k], context.Centroids[k][j]);
+			}
+		}
+	});
+
+	bounds = chunkBounds[0];
+	centroidBounds = chunkCentroidBounds[0];
+	for (auto i = 1u; i < numChunks; ++i)
+	{
+		growBox(bounds, chunkBounds[i]);
+		growBox(centroidBounds, chunkCentroidBounds[i]);
+	}
+}
+
+static void binTriangles(const BuildContext& context, uint32_t first, uint32_t count,
+	const Box& centroidBounds, const float scales[3], uint32_t numBins, BinSet& binSet)
+{
+	const auto binRange = [&](BinSet& chunkBinSet, uint32_t begin, uint32_t end)
+	{
+		auto& bins = chunkBinSet.Bins;
+		for (uint8_t a = 0; a < 3; ++a)
+		{
+			for (auto k = 0u; k < numBins; ++k)
+			{
+				resetBox(bins[a][k].Bounds);
+				bins[a][k].Count = 0;
+			}
+		}
+
+		auto j = begin;
+#ifdef XUSG_BVH_SSE2
+		// The 3 axes at a time, with the bin bounds kept as vectors until the end
+		__m128 binMins[3][BVH::MaxBins], binMaxs[3][BVH::MaxBins];
+		for (uint8_t a = 0; a < 3; ++a)
+		{
+			for (auto k = 0u; k < numBins; ++k)
+			{
+				binMins[a][k] = _mm_set1_ps(FLT_MAX);
+				binMaxs[a][k] = _mm_set1_ps(-FLT_MAX);
+			}
+		}
+
+		const auto centroidMin = _mm_setr_ps(centroidBounds.Min[0], centroidBounds.Min[1], centroidBounds.Min[2], 0.0f);
+		const auto scale = _mm_setr_ps(scales[0], scales[1], scales[2], 0.0f);
+		const auto maxBin = _mm_set1_ps(static_cast<float>(numBins - 1));
+		for (; j < end; ++j)
+		{
+			const auto mins = _mm_setr_ps(context.Mins[0][j], context.Mins[1][j], context.Mins[2][j], 0.0f);
+			const auto maxs = _mm_setr_ps(context.Maxs[0][j], context.Maxs[1][j], context.Maxs[2][j], 0.0f);
+			const auto centroid = _mm_setr_ps(context.Centroids[0][j], context.Centroids[1][j], context.Centroids[2][j], 0.0f);
+
+			// The maximum with 0 comes second, so that it replaces a NaN as in getBinIndex().
+			const auto b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(centroid, centroidMin), scale), _mm_setzero_ps()), maxBin);
+			alignas(16) int32_t binIndices[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(binIndices), _mm_cvttps_epi32(b));
+			for (uint8_t a = 0; a < 3; ++a)
+			{
+				const auto k = binIndices[a];
+				binMins[a][k] = _mm_min_ps(binMins[a][k], mins);
+				binMaxs[a][k] = _mm_max_ps(binMaxs[a][k], maxs);
+				++bins[a][k].Count;
+			}
+		}
+
+		for (uint8_t a = 0; a < 3; ++a)
+		{
+			for (auto k = 0u; k < numBins; ++k)
+			{
+				alignas(16) float vals[4];
+				_mm_store_ps(vals, binMins[a][k]);
+				memcpy(bins[a][k].Bounds.Min, vals, sizeof(bins[a][k].Bounds.Min));
+				_mm_store_ps(vals, binMaxs[a][k]);
+				memcpy(bins[a][k].Bounds.Max, vals, sizeof(bins[a][k].Bounds.Max));
+			}
+		}
+#endif
+
+		for (; j < end; ++j)
+		{
+			const float mins[] = { context.Mins[0][j], context.Mins[1][j], context.Mins[2][j] };
+			const float maxs[] = { context.Maxs[0][j], context.Maxs[1][j], context.Maxs[2][j] };
+			const float centroid[] = { context.Centroids[0][j], context.Centroids[1][j], context.Centroids[2][j] };
+			for (uint8_t a = 0; a < 3; ++a)
+			{
+				auto& bin = bins[a][getBinIndex(centroid[a], centroidBounds.Min[a], scales[a], numBins)];
+				for (uint8_t k = 0; k < 3; ++k)
+				{
+					bin.Bounds.Min[k] = (min)(bin.Bounds.Min[k], mins[k]);
+					bin.Bounds.Max[k] = (max)(bin.Bounds.Max[k], maxs[k]);
+				}
+				++bin.Count;
+			}
+		}
+	};
+
+	const auto numChunks = getNumChunks(context, count);
+	if (numChunks <= 1) return binRange(binSet, first, first + count);
+
+	vector<BinSet> chunkBinSets(numChunks);
+	parallelFor(numChunks, numChunks, [&](uint32_t i)
+	{
+		binRange(chunkBinSets[i], first + static_cast<uint32_t>(static_cast<uint64_t>(count) * i / numChunks),
+			first + static_cast<uint32_t>(static_cast<uint64_t>(count) * (i + 1) / numChunks));
+	});
+
+	binSet = chunkBinSets[0];
+	for (auto i = 1u; i < numChunks; ++i)
+	{
+		for (uint8_t a = 0; a < 3; ++a)
+		{
+			for (auto k = 0u; k < numBins; ++k)
+			{
+				auto& bin = binSet.Bins[a][k];
+				const auto& chunkBin = chunkBinSets[i].Bins[a][k];
+				growBox(bin.Bounds, chunkBin.Bounds);
+				bin.Count += chunkBin.Count;
+			}
+		}
+	}
+}
+
+// Builds the subtree of the node at nodeIdx over the triangles [first, first + count) of the
+// primitive indices, whose bounds are already known. The smaller child is built recursively, as a
+// task if a thread is free, and the larger one in the loop, so that the recursion stays shallow.
+static void buildNode(BuildContext& context, uint32_t nodeIdx, uint32_t first, uint32_t count,
+	Box bounds, Box centroidBounds)
+{
+	const auto& options = context.Options;
+	vector<future<void>> tasks;
+
+	while (true)
+	{
+		auto& node = context.pNodes[nodeIdx];
+		memcpy(node.Min, bounds.Min, sizeof(node.Min));
+		memcpy(node.Max, bounds.Max, sizeof(node.Max));
+		node.Offset = first;
+		node.NumPrimitives = count;
+		if (count <= 1) break;
+
+		// Find the cheapest split plane between the bins over the centroid bounds
+		const auto numBins = (min)(options.NumBins, count / 2 + 2);
+		float scales[3];
+		auto canSplit = false;
+		for (uint8_t a = 0; a < 3; ++a)
+		{
+			const auto extent = centroidBounds.Max[a] - centroidBounds.Min[a];
+			scales[a] = extent > 0.0f ? static_cast<float>(numBins) / extent : 0.0f;
+			canSplit = canSplit || extent > 0.0f;
+		}
+
+		auto bestAxis = 0u;
+		auto bestSplit = 0u;
+		auto bestCost = FLT_MAX;
+		BinSet binSet;
+		if (canSplit)
+		{
+			binTriangles(context, first, count, centroidBounds, scales, numBins, binSet);
+
+			for (uint8_t a = 0; a < 3; ++a)
+			{
+				if (scales[a] <= 0.0f) continue;
+				const auto& bins = binSet.Bins[a];
+
+				// Sweep from the right for the costs of the right sides, then from the left
+				float rightCosts[BVH::MaxBins];
+				Box box;
+				resetBox(box);
+				auto n = 0u;
+				for (auto k = numBins - 1; k > 0; --k)
+				{
+					growBox(box, bins[k].Bounds);
+					n += bins[k].Count;
+					rightCosts[k] = halfArea(box) * n;
+				}
+
+				resetBox(box);
+				n = 0;
+				for (auto k = 1u; k < numBins; ++k)
+				{
+					growBox(box, bins[k - 1].Bounds);
+					n += bins[k - 1].Count;
+					if (n == 0 || n == count) continue;
+
+					const auto cost = halfArea(box) * n + rightCosts[k];
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = a;
+						bestSplit = k;
+					}
+				}
+			}
+		}
+
+		// Costs scaled by the half area of the node, which keeps them comparable when it is 0
+		const auto area = halfArea(bounds);
+		const auto leafCost = options.IntersectionCost * count * area;
+		const auto splitCost = options.TraversalCost * area + options.IntersectionCost * bestCost;
+		if (count <= options.MaxLeafSize && leafCost <= splitCost) break;
+
+		// Partition the triangles, taking the bounds of each side from the bins and gathering the
+		// centroid bounds on the way
+		uint32_t leftCount;
+		Box leftBounds, leftCentroidBounds, rightBounds, rightCentroidBounds;
+		if (bestCost < FLT_MAX)
+		{
+			const auto centroidMin = centroidBounds.Min[bestAxis];
+			const auto scale = scales[bestAxis];
+			resetBox(leftCentroidBounds);
+			resetBox(rightCentroidBounds);
+			auto i = first;
+			auto j = first + count;
+			while (i < j)
+			{
+				const float centroid[] = { context.Centroids[0][i], context.Centroids[1][i], context.Centroids[2][i] };
+				const auto isLeft = getBinIndex(centroid[bestAxis], centroidMin, scale, numBins) < bestSplit;
+				auto& sideCentroidBounds = isLeft ? leftCentroidBounds : rightCentroidBounds;
+				for (uint8_t k = 0; k < 3; ++k)
+				{
+					sideCentroidBounds.Min[k] = (min)(sideCentroidBounds.Min[k], centroid[k]);
+					sideCentroidBounds.Max[k] = (max)(sideCentroidBounds.Max[k], centroid[k]);
+				}
+
+				if (isLeft) ++i;
+				else swapPrimitives(context, i, --j);
+			}
+			leftCount = i - first;
+
+			const auto& bins = binSet.Bins[bestAxis];
+			resetBox(leftBounds);
+			resetBox(rightBounds);
+			for (auto k = 0u; k < numBins; ++k) growBox(k < bestSplit ? leftBounds : rightBounds, bins[k].Bounds);
+		}
+		else
+		{
+			// All centroids coincide, so any halves do equally well
+			leftCount = count / 2;
+			computeBounds(context, first, leftCount, leftBounds, leftCentroidBounds);
+			computeBounds(context, first + leftCount, count - leftCount, rightBounds, rightCentroidBounds);
+		}
+
+		const auto childIdx = context.NumNodes.fetch_add(2);
+		node.Offset = childIdx;
+		node.NumPrimitives = 0;
+
+		// The smaller side goes first
+		const auto rightCount = count - leftCount;
+		const auto isLeftSmaller = leftCount <= rightCount;
+		const auto smallIdx = isLeftSmaller ? childIdx : childIdx + 1;
+		const auto smallFirst = isLeftSmaller ? first : first + leftCount;
+		const auto smallCount = isLeftSmaller ? leftCount : rightCount;
+		const auto& smallBounds = isLeftSmaller ? leftBounds : rightBounds;
+		const auto& smallCentroidBounds = isLeftSmaller ? leftCentroidBounds : rightCentroidBounds;
+
+		if (smallCount >= g_minTaskSize && context.NumTasks + 1 < options.NumThreads)
+		{
+			++context.NumTasks;
+			tasks.emplace_back(async(launch::async, [&context, smallIdx, smallFirst, smallCount, smallBounds, smallCentroidBounds]()
+			{
+				buildNode(context, smallIdx, smallFirst, smallCount, smallBounds, smallCentroidBounds);
+				--context.NumTasks;
+			}));
+		}
+		else buildNode(context, smallIdx, smallFirst, smallCount, smallBounds, smallCentroidBounds);
+
+		nodeIdx = isLeftSmaller ? childIdx + 1 : childIdx;
+		first = isLeftSmaller ? first + leftCount : first;
+		count = isLeftSmaller ? rightCount : leftCount;
+		bounds = isLeftSmaller ? rightBounds : leftBounds;
+		centroidBounds = isLeftSmaller ? rightCentroidBounds : leftCentroidBounds;
+	}
+
+	for (auto& task : tasks) task.get();
+}
+
+static void buildBinnedSAH(BuildContext& context, const Box& bounds, const Box& centroidBounds, vector<BVH::Node>& nodes)
+{
+	// A tree of n leaves has 2 * n - 1 nodes.
+	const auto numTris = static_cast<uint32_t>(context.Centroids[0].size());
+	vector<BVH::Node> taskNodes(2 * numTris - 1);
+	context.pNodes = taskNodes.data();
+	context.NumNodes = 1;
+	buildNode(context, 0, 0, numTris, bounds, centroidBounds);
+
+	// Lay the nodes out depth-first, each pair of children after the subtree of the left sibling of
+	// its parent, so that the layout does not depend on the order in which the tasks ran.
+	nodes.resize(context.NumNodes);
+	nodes[0] = taskNodes[0];
+	auto numNodes = 1u;
+	vector<uint32_t> stack(1, 0);
+	while (!stack.empty())
+	{
+		auto& node = nodes[stack.back()];
+		stack.pop_back();
+		if (node.NumPrimitives > 0) continue;
+
+		const auto childIdx = numNodes;
+		nodes[childIdx] = taskNodes[node.Offset];
+		nodes[childIdx + 1] = taskNodes[node.Offset + 1];
+		node.Offset = childIdx;
+		numNodes += 2;
+
+		stack.emplace_back(childIdx + 1);
+		stack.emplace_back(childIdx);
+	}
+}
+
+// A triangle, or the part of it within Bounds after spatial splits
+struct Reference
+{
+	Box Bounds;
+	uint32_t PrimIdx;
+};
+
+struct SpatialBin
+{
+	Box Bounds;
+	uint32_t NumEntries;	// References starting in the bin
+	uint32_t NumExits;		// References ending in the bin
+};
+
+static void growBox(Box& box, const float* point)
+{
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		box.Min[i] = (min)(box.Min[i], point[i]);
+		box.Max[i] = (max)(box.Max[i], point[i]);
+	}
+}
+
+static void intersectBoxes(Box& box, const Box& other)
+{
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		box.Min[i] = (max)(box.Min[i], other.Min[i]);
+		box.Max[i] = (min)(box.Max[i], other.Max[i]);
+	}
+}
+
+static bool isEmpty(const Box& box)
+{
+	return !(box.Min[0] <= box.Max[0] && box.Min[1] <= box.Max[1] && box.Min[2] <= box.Max[2]);
+}
+
+// Position of the plane between the spatial bins k - 1 and k
+static float getSplitPosition(const Box& bounds, uint8_t axis, uint32_t k, uint32_t numBins)
+{
+	return bounds.Min[axis] + (bounds.Max[axis] - bounds.Min[axis]) * k / numBins;
+}
+
+static void loadTriangle(const BuildContext& context, uint32_t primIdx, float v[3][3])
+{
+	const auto pTriIndices = &context.pIndices[primIdx * 3];
+	for (uint8_t j = 0; j < 3; ++j)
+		memcpy(v[j], context.pPositions + static_cast<size_t>(context.PositionStride) * pTriIndices[j], sizeof(v[j]));
+}
+
+// Bounds of the parts of triangle v of a reference on either side of the plane at position on the
+// axis, from the vertices on each side and the edge crossings, within the reference bounds. A part
+// is empty if the reference does not reach that side.
+static void splitReference(const float v[3][3], const Box& refBounds, uint8_t axis, float position, Box& left, Box& right)
+{
+	resetBox(left);
+	resetBox(right);
+	for (uint8_t j = 0; j < 3; ++j)
+	{
+		const auto& v0 = v[j];
+		const auto& v1 = v[(j + 1) % 3];
+		const auto p0 = v0[axis], p1 = v1[axis];
+		if (p0 <= position) growBox(left, v0);
+		if (p0 >= position) growBox(right, v0);
+
+		if ((p0 < position && p1 > position) || (p0 > position && p1 < position))
+		{
+			const auto t = (position - p0) / (p1 - p0);
+			float p[3];
+			for (uint8_t k = 0; k < 3; ++k) p[k] = v0[k] + (v1[k] - v0[k]) * t;
+			p[axis] = position;
+			growBox(left, p);
+			growBox(right, p);
+		}
+	}
+
+	left.Max[axis] = (min)(left.Max[axis], position);
+	right.Min[axis] = (max)(right.Min[axis], position);
+	intersectBoxes(left, refBounds);
+	intersectBoxes(right, refBounds);
+}
+
+// Builds the subtree of the node at nodeIdx over refs, as buildNode(), at the cheapest of the object
+// splits and, where the children of that overlap by more than MinOverlap, the spatial splits of the
+// node bounds at the bin boundaries, which may duplicate up to budget references in the subtree
+// [Stich et al. 2009, "Spatial Splits in Bounding Volume Hierarchies"]. The budget left after a
+// split goes to the children by their reference counts, so that the tree does not depend on the
+// order in which the tasks run.
+static void buildSpatialNode(BuildContext& context, uint32_t nodeIdx, vector<Reference>& refs, Box bounds, uint32_t budget)
+{
+	const auto& options = context.Options;
+	vector<future<void>> tasks;
+
+	while (true)
+	{
+		const auto count = static_cast<uint32_t>(refs.size());
+		auto& node = context.pNodes[nodeIdx];
+		memcpy(node.Min, bounds.Min, sizeof(node.Min));
+		memcpy(node.Max, bounds.Max, sizeof(node.Max));
+		node.NumPrimitives = count;
+
+		// Object split: binned over the centroids of the reference bounds
+		const auto numBins = (min)(options.NumBins, count / 2 + 2);
+		Box centroidBounds;
+		resetBox(centroidBounds);
+		for (const auto& ref : refs)
+		{
+			float centroid[3];
+			for (uint8_t k = 0; k < 3; ++k) centroid[k] = (ref.Bounds.Min[k] + ref.Bounds.Max[k]) * 0.5f;
+			growBox(centroidBounds, centroid);
+		}
+
+		float scales[3];
+		for (uint8_t a = 0; a < 3; ++a)
+		{
+			const auto extent = centroidBounds.Max[a] - centroidBounds.Min[a];
+			scales[a] = extent > 0.0f ? static_cast<float>(numBins) / extent : 0.0f;
+		}
+
+		auto objectAxis = 0u;
+		auto objectSplit = 0u;
+		auto objectCost = FLT_MAX;
+		Box objectLeftBounds, objectRightBounds;
+		resetBox(objectLeftBounds);
+		resetBox(objectRightBounds);
+		if (count > 1)
+		{
+			Bin bins[3][BVH::MaxBins];
+			for (uint8_t a = 0; a < 3; ++a)
+			{
+				for (auto k = 0u; k < numBins; ++k)
+				{
+					resetBox(bins[a][k].Bounds);
+					bins[a][k].Count = 0;
+				}
+			}
+
+			for (const auto& ref : refs)
+			{
+				for (uint8_t a = 0; a < 3; ++a)
+				{
+					if (scales[a] <= 0.0f) continue;
+					const auto centroid = (ref.Bounds.Min[a] + ref.Bounds.Max[a]) * 0.5f;
+					auto& bin = bins[a][getBinIndex(centroid, centroidBounds.Min[a], scales[a], numBins)];
+					growBox(bin.Bounds, ref.Bounds);
+					++bin.Count;
+				}
+			}
+
+			for (uint8_t a = 0; a < 3; ++a)
+			{
+				if (scales[a] <= 0.0f) continue;
+
+				// Sweep from the right for the costs of the right sides, then from the left
+				float rightCosts[BVH::MaxBins];
+				Box rightBounds[BVH::MaxBins];
+				Box box;
+				resetBox(box);
+				auto n = 0u;
+				for (auto k = numBins - 1; k > 0; --k)
+				{
+					growBox(box, bins[a][k].Bounds);
+					n += bins[a][k].Count;
+					rightCosts[k] = halfArea(box) * n;
+					rightBounds[k] = box;
+				}
+
+				resetBox(box);
+				n = 0;
+				for (auto k = 1u; k < numBins; ++k)
+				{
+					growBox(box, bins[a][k - 1].Bounds);
+					n += bins[a][k - 1].Count;
+					if (n == 0 || n == count) continue;
+
+					const auto cost = halfArea(box) * n + rightCosts[k];
+					if (cost < objectCost)
+					{
+						objectCost = cost;
+						objectAxis = a;
+						objectSplit = k;
+						objectLeftBounds = box;
+						objectRightBounds = rightBounds[k];
+					}
+				}
+			}
+		}
+
+		// Spatial split, where the children of the object split overlap enough to be worth it
+		uint8_t spatialAxis = 0;
+		auto spatialSplit = 0u;
+		auto spatialCost = FLT_MAX;
+		auto overlap = 0.0f;
+		if (objectCost < FLT_MAX)
+		{
+			auto overlapBounds = objectLeftBounds;
+			intersectBoxes(overlapBounds, objectRightBounds);
+			overlap = isEmpty(overlapBounds) ? 0.0f : halfArea(overlapBounds);
+		}
+
+		if (count > 1 && budget > 0 && (objectCost == FLT_MAX || overlap > context.MinOverlap))
+		{
+			const auto numSpatialBins = options.NumBins;
+			for (uint8_t a = 0; a < 3; ++a)
+			{
+				const auto extent = bounds.Max[a] - bounds.Min[a];
+				if (!(extent > 0.0f)) continue;
+
+				SpatialBin bins[BVH::MaxBins];
+				for (auto k = 0u; k < numSpatialBins; ++k)
+				{
+					resetBox(bins[k].Bounds);
+					bins[k].NumEntries = bins[k].NumExits = 0;
+				}
+
+				// Each reference is clipped into the bins it spans.
+				const auto scale = static_cast<float>(numSpatialBins) / extent;
+				for (const auto& ref : refs)
+				{
+					const auto firstBin = getBinIndex(ref.Bounds.Min[a], bounds.Min[a], scale, numSpatialBins);
+					const auto lastBin = (max)(getBinIndex(ref.Bounds.Max[a], bounds.Min[a], scale, numSpatialBins), firstBin);
+					auto part = ref.Bounds;
+					float v[3][3];
+					if (firstBin < lastBin) loadTriangle(context, ref.PrimIdx, v);
+					for (auto k = firstBin; k < lastBin; ++k)
+					{
+						Box left, right;
+						splitReference(v, part, a, getSplitPosition(bounds, a, k + 1, numSpatialBins), left, right);
+						if (!isEmpty(left)) growBox(bins[k].Bounds, left);
+						part = right;
+					}
+					if (!isEmpty(part)) growBox(bins[lastBin].Bounds, part);
+					++bins[firstBin].NumEntries;
+					++bins[lastBin].NumExits;
+				}
+
+				float rightCosts[BVH::MaxBins];
+				uint32_t rightCounts[BVH::MaxBins];
+				Box box;
+				resetBox(box);
+				auto n = 0u;
+				for (auto k = numSpatialBins - 1; k > 0; --k)
+				{
+					growBox(box, bins[k].Bounds);
+					n += bins[k].NumExits;
+					rightCosts[k] = halfArea(box) * n;
+					rightCounts[k] = n;
+				}
+
+				resetBox(box);
+				n = 0;
+				for (auto k = 1u; k < numSpatialBins; ++k)
+				{
+					growBox(box, bins[k - 1].Bounds);
+					n += bins[k - 1].NumEntries;
+					if (n == 0 || rightCounts[k] == 0 || n + rightCounts[k] - count > budget) continue;
+
+					const auto cost = halfArea(box) * n + rightCosts[k];
+					if (cost < spatialCost)
+					{
+						spatialCost = cost;
+						spatialAxis = a;
+						spatialSplit = k;
+					}
+				}
+			}
+		}
+
+		// Costs scaled by the half area of the node, which keeps them comparable when it is 0
+		const auto area = halfArea(bounds);
+		const auto leafCost = options.IntersectionCost * count * area;
+		const auto splitCost = options.TraversalCost * area + options.IntersectionCost * (min)(objectCost, spatialCost);
+		if (count <= 1 || (count <= options.MaxLeafSize && leafCost <= splitCost)) break;
+
+		vector<Reference> leftRefs, rightRefs;
+		Box leftBounds, rightBounds;
+		resetBox(leftBounds);
+		resetBox(rightBounds);
+		if (spatialCost < objectCost)
+		{
+			// The straddling references are split, unless moving one wholly to a side is cheaper
+			// [Stich et al. 2009]. The sides of the others are known first.
+			const auto position = getSplitPosition(bounds, spatialAxis, spatialSplit, options.NumBins);
+			vector<uint32_t> straddling;
+			for (auto i = 0u; i < count; ++i)
+			{
+				const auto& ref = refs[i];
+				if (ref.Bounds.Max[spatialAxis] <= position)
+				{
+					leftRefs.emplace_back(ref);
+					growBox(leftBounds, ref.Bounds);
+				}
+				else if (ref.Bounds.Min[spatialAxis] >= position)
+				{
+					rightRefs.emplace_back(ref);
+					growBox(rightBounds, ref.Bounds);
+				}
+				else straddling.emplace_back(i);
+			}
+
+			for (const auto& i : straddling)
+			{
+				const auto& ref = refs[i];
+				float v[3][3];
+				Box left, right;
+				loadTriangle(context, ref.PrimIdx, v);
+				splitReference(v, ref.Bounds, spatialAxis, position, left, right);
+				const auto leftCount = static_cast<float>(leftRefs.size());
+				const auto rightCount = static_cast<float>(rightRefs.size());
+
+				auto leftUnion = leftBounds, rightUnion = rightBounds;
+				growBox(leftUnion, ref.Bounds);
+				growBox(rightUnion, ref.Bounds);
+				auto splitLeft = leftBounds, splitRight = rightBounds;
+				if (!isEmpty(left)) growBox(splitLeft, left);
+				if (!isEmpty(right)) growBox(splitRight, right);
+				const auto splitCost = halfArea(splitLeft) * (leftCount + 1.0f) + halfArea(splitRight) * (rightCount + 1.0f);
+				const auto leftOnlyCost = halfArea(leftUnion) * (leftCount + 1.0f) + halfArea(rightBounds) * rightCount;
+				const auto rightOnlyCost = halfArea(leftBounds) * leftCount + halfArea(rightUnion) * (rightCount + 1.0f);
+
+				if (isEmpty(right) || (!isEmpty(left) && leftOnlyCost < splitCost && leftOnlyCost <= rightOnlyCost))
+				{
+					leftRefs.emplace_back(ref);
+					leftBounds = leftUnion;
+				}
+				else if (isEmpty(left) || rightOnlyCost < splitCost)
+				{
+					rightRefs.emplace_back(ref);
+					rightBounds = rightUnion;
+				}
+				else
+				{
+					leftRefs.push_back({ left, ref.PrimIdx });
+					rightRefs.push_back({ right, ref.PrimIdx });
+					leftBounds = splitLeft;
+					rightBounds = splitRight;
+				}
+			}
+		}
+
+		// Fall back to the object split if the references have all gone to one side
+		if (leftRefs.empty() || rightRefs.empty())
+		{
+			leftRefs.clear();
+			rightRefs.clear();
+			resetBox(leftBounds);
+			resetBox(rightBounds);
+			for (auto i = 0u; i < count; ++i)
+			{
+				const auto& ref = refs[i];
+				// All centroids coincide without an object split, so any halves do equally well
+				const auto isLeft = objectCost < FLT_MAX ? getBinIndex((ref.Bounds.Min[objectAxis] + ref.Bounds.Max[objectAxis]) * 0.5f,
+					centroidBounds.Min[objectAxis], scales[objectAxis], numBins) < objectSplit : i < count / 2;
+				(isLeft ? leftRefs : rightRefs).emplace_back(ref);
+				growBox(isLeft ? leftBounds : rightBounds, ref.Bounds);
+			}
+		}
+
+		refs.clear();
+		refs.shrink_to_fit();
+
+		const auto childIdx = context.NumNodes.fetch_add(2);
+		node.Offset = childIdx;
+		node.NumPrimitives = 0;
+
+		// Share the budget left
+		const auto leftCount = static_cast<uint32_t>(leftRefs.size());
+		const auto rightCount = static_cast<uint32_t>(rightRefs.size());
+		budget -= (min)(leftCount + rightCount - count, budget);
+		const auto leftBudget = static_cast<uint32_t>(static_cast<uint64_t>(budget) * leftCount / (leftCount + rightCount));
+
+		// The smaller side goes first
+		const auto isLeftSmaller = leftCount <= rightCount;
+		const auto smallIdx = isLeftSmaller ? childIdx : childIdx + 1;
+		auto& smallRefs = isLeftSmaller ? leftRefs : rightRefs;
+		const auto& smallBounds = isLeftSmaller ? leftBounds : rightBounds;
+		const auto smallBudget = isLeftSmaller ? leftBudget : budget - leftBudget;
+
+		if (smallRefs.size() >= g_minTaskSize && context.NumTasks + 1 < options.NumThreads)
+		{
+			++context.NumTasks;
+			tasks.emplace_back(async(launch::async, [&context, smallIdx, smallRefs = move(smallRefs), smallBounds, smallBudget]() mutable
+			{
+				buildSpatialNode(context, smallIdx, smallRefs, smallBounds, smallBudget);
+				--context.NumTasks;
+			}));
+		}
+		else buildSpatialNode(context, smallIdx, smallRefs, smallBounds, smallBudget);
+
+		nodeIdx = isLeftSmaller ? childIdx + 1 : childIdx;
+		refs.swap(isLeftSmaller ? rightRefs : leftRefs);
+		bounds = isLeftSmaller ? rightBounds : leftBounds;
+		budget = isLeftSmaller ? budget - leftBudget : leftBudget;
+	}
+
+	// A leaf
+	auto& node = context.pNodes[nodeIdx];
+	node.Offset = context.NumReferences.fetch_add(static_cast<uint32_t>(refs.size()));
+	for (auto i = 0u; i < static_cast<uint32_t>(refs.size()); ++i) context.pPrimIndices[node.Offset + i] = refs[i].PrimIdx;
+
+	for (auto& task : tasks) task.get();
+}
+
+static void buildSpatialSplits(BuildContext& context, const Box& bounds, vector<BVH::Node>& nodes, vector<uint32_t>& primIndices)
+{
+	// At most budget references are added, and a tree of n leaves has 2 * n - 1 nodes.
+	const auto numTris = static_cast<uint32_t>(context.Centroids[0].size());
+	const auto budget = static_cast<uint32_t>((min)(static_cast<double>(numTris) * (max)(context.Options.SpatialSplitBudget, 0.0f),
+		static_cast<double>(UINT32_MAX / 2 - numTris)));
+	vector<Reference> refs(numTris);
+	for (auto i = 0u; i < numTris; ++i)
+	{
+		for (uint8_t k = 0; k < 3; ++k)
+		{
+			refs[i].Bounds.Min[k] = context.Mins[k][i];
+			refs[i].Bounds.Max[k] = context.Maxs[k][i];
+		}
+		refs[i].PrimIdx = i;
+	}
+
+	vector<BVH::Node> taskNodes(2 * (numTris + budget) - 1);
+	vector<uint32_t> taskPrimIndices(numTris + budget);
+	context.pNodes = taskNodes.data();
+	context.pPrimIndices = taskPrimIndices.data();
+	context.NumNodes = 1;
+	context.NumReferences = 0;
+	context.MinOverlap = context.Options.SpatialSplitOverlap * halfArea(bounds);
+	buildSpatialNode(context, 0, refs, bounds, budget);
+
+	// Lay the nodes out as buildBinnedSAH() does, and the primitive indices in the order of the leaves
+	nodes.resize(context.NumNodes);
+	primIndices.resize(context.NumReferences);
+	nodes[0] = taskNodes[0];
+	auto numNodes = 1u;
+	auto numPrimitives = 0u;
+	vector<uint32_t> stack(1, 0);
+	while (!stack.empty())
+	{
+		auto& node = nodes[stack.back()];
+		stack.pop_back();
+		if (node.NumPrimitives > 0)
+		{
+			memcpy(&primIndices[numPrimitives], &taskPrimIndices[node.Offset], sizeof(uint32_t) * node.NumPrimitives);
+			node.Offset = numPrimitives;
+			numPrimitives += node.NumPrimitives;
+			continue;
+		}
+
+		const auto childIdx = numNodes;
+		nodes[childIdx] = taskNodes[node.Offset];
+		nodes[childIdx + 1] = taskNodes[node.Offset + 1];
+		node.Offset = childIdx;
+		numNodes += 2;
+
+		stack.emplace_back(childIdx + 1);
+		stack.emplace_back(childIdx);
+	}
+	context.pPrimIndices = primIndices.data();
+}
+
+static uint32_t countLeadingZeros(uint64_t v)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	return _BitScanReverse64(&index, v) ? 63 - index : 64;
+#else
+	return v ? __builtin_clzll(v) : 64;
+#endif
+}
+
+static uint32_t expandBits10(uint32_t v)
+{
+	// Insert two zero bits after each of the 10 low bits
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+
+	return v;
+}
+
+static uint64_t expandBits21(uint64_t v)
+{
+	// Insert two zero bits after each of the 21 low bits
+	v &= 0x1FFFFF;
+	v = (v | (v << 32)) & 0x001F00000000FFFF;
+	v = (v | (v << 16)) & 0x001F0000FF0000FF;
+	v = (v | (v << 8)) & 0x100F00F00F00F00F;
+	v = (v | (v << 4)) & 0x10C30C30C30C30C3;
+	v = (v | (v << 2)) & 0x1249249249249249;
+
+	return v;
+}
+
+// Stable LSD radix sort of the keys and their values by the numBits low bits of the keys, 11 bits
+// per pass. Each chunk of the keys counts its digits, and scatters after the same digits of the
+// earlier chunks. A pass is skipped if all keys have the same digit.
+static void radixSort(vector<uint64_t>& keys, vector<uint32_t>& values, uint32_t numBits, uint32_t numThreads)
+{
+	const uint32_t digitBits = 11;
+	const uint32_t numDigits = 1 << digitBits;
+	const auto n = static_cast<uint32_t>(keys.size());
+	const auto numChunks = (max)((min)(numThreads, n / g_minSortChunkSize), 1u);
+	const auto getChunkStart = [n, numChunks](uint32_t i) { return static_cast<uint32_t>(static_cast<uint64_t>(n) * i / numChunks); };
+
+	vector<uint64_t> tmpKeys(n);
+	vector<uint32_t> tmpValues(n);
+	vector<uint32_t> offsets(numChunks * numDigits);
+	for (auto shift = 0u; shift < numBits; shift += digitBits)
+	{
+		parallelFor(numChunks, numChunks, [&](uint32_t i)
+		{
+			const auto pCounts = &offsets[numDigits * i];
+			fill(pCounts, pCounts + numDigits, 0);
+			const auto end = getChunkStart(i + 1);
+			for (auto j = getChunkStart(i); j < end; ++j) ++pCounts[(keys[j] >> shift) & (numDigits - 1)];
+		});
+
+		auto offset = 0u;
+		auto isSorted = false;
+		for (auto d = 0u; d < numDigits && !isSorted; ++d)
+		{
+			const auto start = offset;
+			for (auto i = 0u; i < numChunks; ++i)
+			{
+				const auto count = offsets[numDigits * i + d];
+				offsets[numDigits * i + d] = offset;
+				offset += count;
+			}
+			isSorted = offset - start == n;
+		}
+		if (isSorted) continue;
+
+		parallelFor(numChunks, numChunks, [&](uint32_t i)
+		{
+			const auto pOffsets = &offsets[numDigits * i];
+			const auto end = getChunkStart(i + 1);
+			for (auto j = getChunkStart(i); j < end; ++j)
+			{
+				const auto k = pOffsets[(keys[j] >> shift) & (numDigits - 1)]++;
+				tmpKeys[k] = keys[j];
+				tmpValues[k] = values[j];
+			}
+		});
+		keys.swap(tmpKeys);
+		values.swap(tmpValues);
+	}
+}
+
+// Updates the bounds of the nodes bottom-up from those of the leaves, in parallel over the leaves:
+// the second child to finish goes on to its parent, so that each inner node is done exactly once,
+// after both of its children [Karras 2012, "Maximizing Parallelism in the Construction of BVHs,
+// Octrees, and k-d Trees"]. getLeafBounds returns the sum of the half areas of the triangle bounds
+// of a leaf. Returns the SAH cost of the nodes, not yet over the root area, summed by each thread
+// over the nodes it has done, and sets primitiveArea to the sum of the triangle areas.
+template<typename T>
+static double updateBoundsBottomUp(BVH::Node* pNodes, const uint32_t* pParents, const vector<uint32_t>& leaves,
+	uint32_t numThreads, float traversalCost, float intersectionCost, const T& getLeafBounds, double& primitiveArea)
+{
+	const auto numNodes = static_cast<uint32_t>(leaves.size() * 2 - 1);
+	vector<atomic<uint32_t>> visits(numNodes);
+	const auto numLeaves = static_cast<uint32_t>(leaves.size());
+	const auto numChunks = (numLeaves + g_minBinChunkSize - 1) / g_minBinChunkSize;
+	vector<double> costs(numChunks), primitiveAreas(numChunks);
+	parallelFor(numChunks, numThreads, [&](uint32_t c)
+	{
+		auto cost = 0.0;
+		auto primArea = 0.0;
+		const auto end = (min)((c + 1) * g_minBinChunkSize, numLeaves);
+		for (auto i = c * g_minBinChunkSize; i < end; ++i)
+		{
+			auto nodeIdx = leaves[i];
+			Box box;
+			primArea += getLeafBounds(pNodes[nodeIdx], box);
+			memcpy(pNodes[nodeIdx].Min, box.Min, sizeof(box.Min));
+			memcpy(pNodes[nodeIdx].Max, box.Max, sizeof(box.Max));
+			cost += static_cast<double>(intersectionCost) * pNodes[nodeIdx].NumPrimitives * halfArea(box);
+
+			for (nodeIdx = pParents[nodeIdx]; nodeIdx != UINT32_MAX; nodeIdx = pParents[nodeIdx])
+			{
+				if (visits[nodeIdx].fetch_add(1, memory_order_acq_rel) == 0) break;
+
+				auto& node = pNodes[nodeIdx];
+				const auto& left = pNodes[node.Offset];
+				const auto& right = pNodes[node.Offset + 1];
+				for (uint8_t k = 0; k < 3; ++k)
+				{
+					box.Min[k] = (min)(left.Min[k], right.Min[k]);
+					box.Max[k] = (max)(left.Max[k], right.Max[k]);
+				}
+				memcpy(node.Min, box.Min, sizeof(box.Min));
+				memcpy(node.Max, box.Max, sizeof(box.Max));
+				cost += static_cast<double>(traversalCost) * halfArea(box);
+			}
+		}
+		costs[c] = cost;
+		primitiveAreas[c] = primArea;
+	});
+
+	auto cost = 0.0;
+	primitiveArea = 0.0;
+	for (auto i = 0u; i < numChunks; ++i)
+	{
+		cost += costs[i];
+		primitiveArea += primitiveAreas[i];
+	}
+
+	return cost;
+}
+
+// Linear BVH [Lauterbach et al. 2009, "Fast BVH Construction on GPUs"]: the triangles are sorted by
+// the Morton codes of their centroids within the mesh bounds, and the hierarchy is that of the
+// binary radix tree over the sorted codes [Karras 2012], whose inner nodes are found independently
+// of each other. The radix tree is then laid out depth-first in the node format of the binned build,
+// with the subtrees of up to MaxLeafSize triangles as leaves, and the bounds are filled in bottom-up.
+static void buildLinear(BuildContext& context, const Box& bounds, vector<BVH::Node>& nodes,
+	vector<uint32_t>& parents, vector<uint32_t>& leaves)
+{
+	const auto& options = context.Options;
+	const auto numTris = static_cast<uint32_t>(context.Centroids[0].size());
+	const auto numThreads = options.NumThreads;
+	const auto is63Bit = options.Method == BVH::LBVH_63;
+	const auto numCells = is63Bit ? (1u << 21) : (1u << 10);
+	const auto maxCell = static_cast<float>(numCells - 1);
+
+	// Morton codes, with the triangle index as the value
+	float scales[3];
+	for (uint8_t k = 0; k < 3; ++k)
+	{
+		const auto extent = bounds.Max[k] - bounds.Min[k];
+		scales[k] = extent > 0.0f ? numCells / extent : 0.0f;
+	}
+
+	vector<uint64_t> codes(numTris);
+	vector<uint32_t> primIndices(numTris);
+	const auto numChunks = (numTris + g_minSortChunkSize - 1) / g_minSortChunkSize;
+	parallelFor(numChunks, numThreads, [&](uint32_t c)
+	{
+		const auto end = (min)((c + 1) * g_minSortChunkSize, numTris);
+		for (auto i = c * g_minSortChunkSize; i < end; ++i)
+		{
+			uint32_t cells[3];
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				// NaN goes to the first cell.
+				const auto cell = (context.Centroids[k][i] - bounds.Min[k]) * scales[k];
+				cells[k] = cell > 0.0f ? (cell < maxCell ? static_cast<uint32_t>(cell) : numCells - 1) : 0;
+			}
+
+			codes[i] = is63Bit ? (expandBits21(cells[0]) << 2) | (expandBits21(cells[1]) << 1) | expandBits21(cells[2]) :
+				(expandBits10(cells[0]) << 2) | (expandBits10(cells[1]) << 1) | expandBits10(cells[2]);
+			primIndices[i] = i;
+		}
+	});
+
+	radixSort(codes, primIndices, is63Bit ? 63 : 30, numThreads);
+	memcpy(context.pPrimIndices, primIndices.data(), sizeof(uint32_t) * numTris);
+
+	// The radix tree has numTris - 1 inner nodes, the first being the root; a child is a leaf,
+	// i.e. a sorted triangle, if its high bit is set. Equal codes are told apart by their positions.
+	const uint32_t leafBit = 0x80000000;
+	const auto numInner = numTris - 1;
+	vector<uint32_t> children(numInner * 2), rangeEnds(numInner);
+	const auto delta = [&codes, numTris](uint32_t i, int64_t j) -> int32_t
+	{
+		if (j < 0 || j >= numTris) return -1;
+		const auto x = codes[i] ^ codes[static_cast<uint32_t>(j)];
+
+		return x ? countLeadingZeros(x) : 64 + countLeadingZeros(i ^ static_cast<uint64_t>(j)) - 32;
+	};
+
+	const auto numInnerChunks = (numInner + g_minSortChunkSize - 1) / g_minSortChunkSize;
+	parallelFor(numInnerChunks, numThreads, [&](uint32_t c)
+	{
+		const auto end = (min)((c + 1) * g_minSortChunkSize, numInner);
+		for (auto i = c * g_minSortChunkSize; i < end; ++i)
+		{
+			// The direction of the range, and its other end by an exponential then a binary search
+			const int64_t d = delta(i, i + 1) > delta(i, static_cast<int64_t>(i) - 1) ? 1 : -1;
+			const auto deltaMin = delta(i, i - d);
+			int64_t lMax = 2;
+			while (delta(i, i + lMax * d) > deltaMin) lMax *= 2;
+
+			int64_t l = 0;
+			for (auto t = lMax / 2; t > 0; t /= 2) if (delta(i, i + (l + t) * d) > deltaMin) l += t;
+			const auto j = i + l * d;
+
+			// The split, where the common prefix of the range ends
+			const auto deltaNode = delta(i, j);
+			int64_t s = 0;
+			for (auto t = l; t > 1;)
+			{
+				t = (t + 1) / 2;
+				if (delta(i, i + (s + t) * d) > deltaNode) s += t;
+			}
+			const auto split = static_cast<uint32_t>(i + s * d + (min)(d, int64_t(0)));
+
+			const auto first = static_cast<uint32_t>((min)(static_cast<int64_t>(i), j));
+			const auto last = static_cast<uint32_t>((max)(static_cast<int64_t>(i), j));
+			children[i * 2] = first == split ? split | leafBit : split;
+			children[i * 2 + 1] = last == split + 1 ? (split + 1) | leafBit : split + 1;
+			rangeEnds[i] = d > 0 ? last : first;
+		}
+	});
+
+	// Depth-first layout, with the parents and leaves for the bounds
+	const auto getRange = [&](uint32_t child, uint32_t& first, uint32_t& count)
+	{
+		if (child & leafBit)
+		{
+			first = child & ~leafBit;
+			count = 1;
+		}
+		else
+		{
+			first = (min)(child, rangeEnds[child]);
+			count = (max)(child, rangeEnds[child]) - first + 1;
+		}
+	};
+
+	nodes.resize(2 * numTris - 1);
+	parents.resize(nodes.size());
+	leaves.clear();
+	leaves.reserve(numTris);
+	parents[0] = UINT32_MAX;
+	auto numNodes = 1u;
+	vector<pair<uint32_t, uint32_t>> stack(1, make_pair(numTris > 1 ? 0 : leafBit, 0u));
+	while (!stack.empty())
+	{
+		const auto child = stack.back().first;
+		const auto nodeIdx = stack.back().second;
+		stack.pop_back();
+
+		auto& node = nodes[nodeIdx];
+		uint32_t first, count;
+		getRange(child, first, count);
+		if (count <= options.MaxLeafSize)
+		{
+			node.Offset = first;
+			node.NumPrimitives = count;
+			leaves.emplace_back(nodeIdx);
+			continue;
+		}
+
+		node.Offset = numNodes;
+		node.NumPrimitives = 0;
+		parents[numNodes] = parents[numNodes + 1] = nodeIdx;
+		stack.emplace_back(children[child * 2 + 1], numNodes + 1);
+		stack.emplace_back(children[child * 2], numNodes);
+		numNodes += 2;
+	}
+	nodes.resize(numNodes);
+	parents.resize(numNodes);
+
+	double primitiveArea;
+	updateBoundsBottomUp(nodes.data(), parents.data(), leaves, numThreads, options.TraversalCost, options.IntersectionCost,
+		[&](const BVH::Node& leaf, Box& box)
+	{
+		resetBox(box);
+		for (auto i = leaf.Offset; i < leaf.Offset + leaf.NumPrimitives; ++i)
+		{
+			const auto p = primIndices[i];
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				box.Min[k] = (min)(box.Min[k], context.Mins[k][p]);
+				box.Max[k] = (max)(box.Max[k], context.Maxs[k][p]);
+			}
+		}
+
+		return 0.0f;
+	}, primitiveArea);
+}
+
+// Builds the tree over the per-primitive data of the context, by any method. The spatial splits
+// replace the primitive indices, and leave the per-primitive data in the order of the primitives;
+// boxes cannot be split, and are built with binned SAH instead.
+static void buildTree(BuildContext& context, vector<BVH::Node>& nodes, vector<uint32_t>& primIndices,
+	vector<uint32_t>& parents, vector<uint32_t>& leaves)
+{
+	context.NumTasks = 0;
+	context.pPrimIndices = primIndices.data();
+
+	Box bounds, centroidBounds;
+	computeBounds(context, 0, static_cast<uint32_t>(context.Centroids[0].size()), bounds, centroidBounds);
+	const auto method = context.Options.Method;
+	if (method == BVH::SPATIAL_SPLIT_SAH && context.pIndices) buildSpatialSplits(context, bounds, nodes, primIndices);
+	else if (method == BVH::BINNED_SAH || method == BVH::SPATIAL_SPLIT_SAH) buildBinnedSAH(context, bounds, centroidBounds, nodes);
+	else buildLinear(context, bounds, nodes, parents, leaves);
+}
+
+// Slab test of the ray against the node bounds within [tMin, tMax], which gives the entry distance
+static inline bool intersectBox(const BVH::Node& node, const float* origin, const float* invDir,
+	float tMin, float tMax, float& tEntry)
+{
+	for (uint8_t k = 0; k < 3; ++k)
+	{
+		const auto t0 = (node.Min[k] - origin[k]) * invDir[k];
+		const auto t1 = (node.Max[k] - origin[k]) * invDir[k];
+		tMin = (max)(tMin, (min)(t0, t1));
+		tMax = (min)(tMax, (max)(t0, t1));
+	}
+	tEntry = tMin;
+
+	return tMin <= tMax;
+}
+
+// Möller-Trumbore, with no culling of back faces. On a hit in [tMin, tMax], shortens tMax to it.
+static inline bool intersectTriangle(const BVH::Ray& ray, const float v[3][3], float tMin, float& tMax,
+	float barycentrics[2])
+{
+	const auto cross = [](const float* a, const float* b, float* c)
+	{
+		c[0] = a[1] * b[2] - a[2] * b[1];
+		c[1] = a[2] * b[0] - a[0] * b[2];
+		c[2] = a[0] * b[1] - a[1] * b[0];
+	};
+	const auto dot = [](const float* a, const float* b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; };
+
+	const float e1[] = { v[1][0] - v[0][0], v[1][1] - v[0][1], v[1][2] - v[0][2] };
+	const float e2[] = { v[2][0] - v[0][0], v[2][1] - v[0][1], v[2][2] - v[0][2] };
+	float p[3];
+	cross(ray.Direction, e2, p);
+	const auto det = dot(e1, p);
+	if (det == 0.0f) return false;
+
+	const auto invDet = 1.0f / det;
+	const float s[] = { ray.Origin[0] - v[0][0], ray.Origin[1] - v[0][1], ray.Origin[2] - v[0][2] };
+	const auto u = dot(s, p) * invDet;
+	if (!(u >= 0.0f && u <= 1.0f)) return false;
+
+	float q[3];
+	cross(s, e1, q);
+	const auto w = dot(ray.Direction, q) * invDet;
+	if (!(w >= 0.0f && u + w <= 1.0f)) return false;
+
+	const auto t = dot(e2, q) * invDet;
+	if (!(t >= tMin && t <= tMax)) return false;
+
+	tMax = t;
+	barycentrics[0] = u;
+	barycentrics[1] = w;
+
+	return true;
+}
+
+// Depth-first from the root, into the nearer child first with the other one on the stack, which holds
+// at most a node per level. The nodes entered beyond the closest hit so far are skipped.
+template<typename T>
+static bool traverse(const BVH::Node* pNodes, const uint32_t* pPrimIndices, uint32_t maxDepth,
+	const BVH::Ray& ray, bool acceptFirstHit, const T& intersect)
+{
+	struct StackEntry
+	{
+		uint32_t NodeIdx;
+		float TEntry;
+	};
+
+	StackEntry localStack[64];
+	vector<StackEntry> heapStack;
+	auto pStack = localStack;
+	if (maxDepth > size(localStack))
+	{
+		heapStack.resize(maxDepth);
+		pStack = heapStack.data();
+	}
+
+	float invDir[3];
+	for (uint8_t k = 0; k < 3; ++k) invDir[k] = 1.0f / ray.Direction[k];
+
+	auto tMax = ray.TMax;
+	float tEntry;
+	if (!intersectBox(pNodes[0], ray.Origin, invDir, ray.TMin, tMax, tEntry)) return false;
+
+	auto isHit = false;
+	auto nodeIdx = 0u;
+	auto stackSize = 0u;
+	while (true)
+	{
+		const auto& node = pNodes[nodeIdx];
+		if (node.NumPrimitives > 0)
+		{
+			for (auto i = node.Offset; i < node.Offset + node.NumPrimitives; ++i)
+			{
+				if (intersect(pPrimIndices[i], tMax))
+				{
+					if (acceptFirstHit) return true;
+					isHit = true;
+				}
+			}
+		}
+		else
+		{
+			float tEntries[2];
+			const auto isHit0 = intersectBox(pNodes[node.Offset], ray.Origin, invDir, ray.TMin, tMax, tEntries[0]);
+			const auto isHit1 = intersectBox(pNodes[node.Offset + 1], ray.Origin, invDir, ray.TMin, tMax, tEntries[1]);
+			if (isHit0 && isHit1)
+			{
+				const uint32_t farChild = tEntries[1] < tEntries[0] ? 0 : 1;
+				pStack[stackSize++] = { node.Offset + farChild, tEntries[farChild] };
+				nodeIdx = node.Offset + (farChild ^ 1);
+				continue;
+			}
+			if (isHit0 || isHit1)
+			{
+				nodeIdx = node.Offset + (isHit0 ? 0 : 1);
+				continue;
+			}
+		}
+
+		while (stackSize > 0 && pStack[stackSize - 1].TEntry > tMax) --stackSize;
+		if (stackSize == 0) break;
+		nodeIdx = pStack[--stackSize].NodeIdx;
+	}
+
+	return isHit;
+}
+
+// Quantized positions are 16-bit UNORM within the AABB.
+static void dequantizePositions(vector<ObjLoader::float3>& positions, const ObjLoader& objLoader)
+{
+	const auto& aabb = objLoader.GetAABB();
+	const float scales[] =
+	{
+		(aabb.Max.x - aabb.Min.x) / 65535.0f,
+		(aabb.Max.y - aabb.Min.y) / 65535.0f,
+		(aabb.Max.z - aabb.Min.z) / 65535.0f
+	};
+
+	const auto numVert = objLoader.GetNumVertices();
+	const auto pPositions = objLoader.GetPositions();
+	const auto stride = objLoader.GetPositionStride();
+	positions.resize(numVert);
+	for (auto i = 0u; i < numVert; ++i)
+	{
+		uint16_t q[3];
+		memcpy(q, pPositions + stride * i, sizeof(q));
+		positions[i] = ObjLoader::float3(aabb.Min.x + q[0] * scales[0],
+			aabb.Min.y + q[1] * scales[1], aabb.Min.z + q[2] * scales[2]);
+	}
+}
+
+struct BVH::CacheHeader
+{
+	char		Magic[4];
+	uint32_t	Version;
+	uint32_t	NodeSize;
+	uint32_t	NumIndices;
+	uint64_t	ContentHash;	// Of the positions and indices
+	uint32_t	Method;
+	uint32_t	NumBins;
+	uint32_t	MaxLeafSize;
+	float		TraversalCost;
+	float		IntersectionCost;
+	float		SpatialSplitOverlap;
+	float		SpatialSplitBudget;
+	uint32_t	NumNodes;
+	uint32_t	NumPrimitives;
+	float		SAHCost;
+	uint32_t	NumLeaves;
+	uint32_t	MaxDepth;
+	double		CostPerPrimitiveArea;
+	uint64_t	NodeOffset;			// 64-byte aligned
+	uint64_t	PrimIndexOffset;	// 64-byte aligned
+};
+
+static const char g_cacheMagic[] = { 'X', 'B', 'V', 'H' };
+static const uint32_t g_cacheVersion = 2;
+static const uint64_t g_cacheAlignment = 64;
+
+static inline uint64_t alignCacheOffset(uint64_t offset)
+{
+	return (offset + g_cacheAlignment - 1) / g_cacheAlignment * g_cacheAlignment;
+}
+
+static uint64_t hashGeometry(const uint8_t* pPositions, uint32_t positionStride, uint32_t numVertices,
+	const uint32_t* pIndices, uint32_t numIndices)
+{
+	// FNV-1a over 32-bit words, with an xorshift to fold the high bits back down
+	const uint64_t prime = 0x100000001b3;
+	auto h = 0xcbf29ce484222325 ^ numVertices;
+	const auto hashWord = [&h, prime](uint32_t word)
+	{
+		h = (h ^ word) * prime;
+		h ^= h >> 29;
+	};
+
+	for (auto i = 0u; i < numVertices; ++i)
+	{
+		uint32_t words[3];
+		memcpy(words, pPositions + static_cast<size_t>(positionStride) * i, sizeof(words));
+		for (const auto& word : words) hashWord(word);
+	}
+
+	hashWord(numIndices);
+	for (auto i = 0u; i < numIndices; ++i) hashWord(pIndices[i]);
+
+	return h;
+}
+
+// Whether the nodes are a tree in depth-first order of at most maxDepth levels, with the leaves in
+// the range of the primitive indices, and those in the range of the triangles, so that a traversal
+// of a cache file that is corrupt, or forged, stays in bounds
+static bool isValidTree(const BVH::Node* pNodes, uint32_t numNodes, const uint32_t* pPrimIndices,
+	uint32_t numPrimitives, uint32_t numTris, uint32_t maxDepth)
+{
+	vector<uint32_t> depths(numNodes, 0);
+	depths[0] = 1;
+	for (auto i = 0u; i < numNodes; ++i)
+	{
+		const auto& node = pNodes[i];
+		if (depths[i] == 0 || depths[i] > maxDepth) return false;
+
+		if (node.NumPrimitives > 0)
+		{
+			if (node.Offset > numPrimitives || node.NumPrimitives > numPrimitives - node.Offset) return false;
+		}
+		else
+		{
+			if (node.Offset <= i || node.Offset >= numNodes - 1 || depths[node.Offset] || depths[node.Offset + 1]) return false;
+			depths[node.Offset] = depths[node.Offset + 1] = depths[i] + 1;
+		}
+	}
+
+	for (auto i = 0u; i < numPrimitives; ++i) if (pPrimIndices[i] >= numTris) return false;
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// BVH
+//--------------------------------------------------------------------------------------
+
+BVH::BuildOptions::BuildOptions() :
+	Method(BINNED_SAH),
+	NumBins(16),
+	MaxLeafSize(4),
+	NumThreads(0),
+	TraversalCost(1.0f),
+	IntersectionCost(1.0f),
+	SpatialSplitOverlap(1.0e-5f),
+	SpatialSplitBudget(0.3f)
+{
+}
+
+BVH::BVH() :
+	m_buildStats(),
+	m_refitStats(),
+	m_costPerPrimitiveArea(0.0),
+	m_isOverBoxes(false),
+	m_pCacheHeader(nullptr)
+{
+}
+
+BVH::~BVH()
+{
+}
+
+bool BVH::Build(const ObjLoader& objLoader, const BuildOptions& options, const char* pszCacheFilename)
+{
+	if (!objLoader.IsQuantized())
+		return Build(objLoader.GetPositions(), objLoader.GetPositionStride(), objLoader.GetNumVertices(),
+			objLoader.GetIndices(), objLoader.GetNumIndices(), options, pszCacheFilename);
+
+	vector<ObjLoader::float3> positions;
+	dequantizePositions(positions, objLoader);
+
+	return Build(reinterpret_cast<const uint8_t*>(positions.data()), static_cast<uint32_t>(sizeof(ObjLoader::float3)),
+		objLoader.GetNumVertices(), objLoader.GetIndices(), objLoader.GetNumIndices(), options, pszCacheFilename);
+}
+
+bool BVH::Build(const uint8_t* pPositions, uint32_t positionStride, uint32_t numVertices,
+	const uint32_t* pIndices, uint32_t numIndices, const BuildOptions& options, const char* pszCacheFilename)
+{
+	const auto startTime = chrono::steady_clock::now();
+
+	m_nodes.clear();
+	m_primIndices.clear();
+	m_parents.clear();
+	m_leaves.clear();
+	m_buildStats = {};
+	m_refitStats = {};
+	m_cache.Close();
+	m_pCacheHeader = nullptr;
+	m_isOverBoxes = false;
+
+	const auto numTris = numIndices / 3;
+	if (numTris == 0) return false;
+	for (auto i = 0u; i < numTris * 3; ++i) if (pIndices[i] >= numVertices) return false;
+
+	BuildContext context;
+	context.Options = options;
+	context.Options.NumBins = (min)((max)(options.NumBins, 2u), MaxBins);
+	context.Options.MaxLeafSize = (max)(options.MaxLeafSize, 1u);
+	context.Options.NumThreads = options.NumThreads ? options.NumThreads : (max)(thread::hardware_concurrency(), 1u);
+	m_buildOptions = context.Options;
+
+	// Try the cache file.
+	const auto contentHash = pszCacheFilename ? hashGeometry(pPositions, positionStride, numVertices, pIndices, numIndices) : 0;
+	if (pszCacheFilename && loadCache(pszCacheFilename, contentHash, numIndices))
+	{
+		m_buildStats.BuildTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+		return true;
+	}
+
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		context.Centroids[i].resize(numTris);
+		context.Mins[i].resize(numTris);
+		context.Maxs[i].resize(numTris);
+	}
+
+	// The triangle bounds and centroids
+	m_primIndices.resize(numTris);
+	const auto numChunks = (numTris + g_minBinChunkSize - 1) / g_minBinChunkSize;
+	vector<double> primitiveAreas(numChunks);
+	parallelFor(numChunks, context.Options.NumThreads, [&](uint32_t c)
+	{
+		auto primArea = 0.0;
+		const auto end = (min)((c + 1) * g_minBinChunkSize, numTris);
+		for (auto i = c * g_minBinChunkSize; i < end; ++i)
+		{
+			Box triBox;
+			float v[3][3];
+			for (uint8_t j = 0; j < 3; ++j) memcpy(v[j], pPositions + static_cast<size_t>(positionStride) * pIndices[i * 3 + j], sizeof(v[j]));
+
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				const auto minVal = (min)((min)(v[0][k], v[1][k]), v[2][k]);
+				const auto maxVal = (max)((max)(v[0][k], v[1][k]), v[2][k]);
+				context.Mins[k][i] = triBox.Min[k] = minVal;
+				context.Maxs[k][i] = triBox.Max[k] = maxVal;
+				context.Centroids[k][i] = (minVal + maxVal) * 0.5f;
+			}
+			primArea += halfArea(triBox);
+			m_primIndices[i] = i;
+		}
+		primitiveAreas[c] = primArea;
+	});
+
+	auto primitiveArea = 0.0;
+	for (const auto& chunkArea : primitiveAreas) primitiveArea += chunkArea;
+
+	context.pPositions = pPositions;
+	context.PositionStride = positionStride;
+	context.pIndices = pIndices;
+	buildTree(context, m_nodes, m_primIndices, m_parents, m_leaves);
+
+	// A triangle counts once per leaf that refers to it, as in the refits.
+	if (m_primIndices.size() > numTris)
+	{
+		primitiveArea = 0.0;
+		for (const auto& i : m_primIndices)
+		{
+			Box triBox;
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				triBox.Min[k] = context.Mins[k][i];
+				triBox.Max[k] = context.Maxs[k][i];
+			}
+			primitiveArea += halfArea(triBox);
+		}
+	}
+
+	m_buildStats.BuildTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+	computeBuildStats(primitiveArea);
+	m_refitStats.SAHCost = m_buildStats.SAHCost;
+	m_refitStats.Degradation = 1.0f;
+
+	// A failure to write the cache is not a build failure.
+	if (pszCacheFilename) saveCache(pszCacheFilename, contentHash, numIndices);
+
+	return true;
+}
+
+bool BVH::Build(const float* pBounds, uint32_t numPrimitives, const BuildOptions& options)
+{
+	const auto startTime = chrono::steady_clock::now();
+
+	m_nodes.clear();
+	m_primIndices.clear();
+	m_parents.clear();
+	m_leaves.clear();
+	m_buildStats = {};
+	m_refitStats = {};
+	m_cache.Close();
+	m_pCacheHeader = nullptr;
+	m_isOverBoxes = true;
+	if (numPrimitives == 0) return false;
+
+	BuildContext context;
+	context.Options = options;
+	context.Options.NumBins = (min)((max)(options.NumBins, 2u), MaxBins);
+	context.Options.MaxLeafSize = (max)(options.MaxLeafSize, 1u);
+	context.Options.NumThreads = options.NumThreads ? options.NumThreads : (max)(thread::hardware_concurrency(), 1u);
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		context.Centroids[i].resize(numPrimitives);
+		context.Mins[i].resize(numPrimitives);
+		context.Maxs[i].resize(numPrimitives);
+	}
+
+	m_primIndices.resize(numPrimitives);
+	auto primitiveArea = 0.0;
+	for (auto i = 0u; i < numPrimitives; ++i)
+	{
+		Box box;
+		memcpy(&box, &pBounds[i * 6], sizeof(box));
+		for (uint8_t k = 0; k < 3; ++k)
+		{
+			context.Mins[k][i] = box.Min[k];
+			context.Maxs[k][i] = box.Max[k];
+			context.Centroids[k][i] = (box.Min[k] + box.Max[k]) * 0.5f;
+		}
+		primitiveArea += halfArea(box);
+		m_primIndices[i] = i;
+	}
+
+	context.pIndices = nullptr;
+	buildTree(context, m_nodes, m_primIndices, m_parents, m_leaves);
+
+	m_buildStats.BuildTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+	m_buildOptions = context.Options;
+	computeBuildStats(primitiveArea);
+	m_refitStats.SAHCost = m_buildStats.SAHCost;
+	m_refitStats.Degradation = 1.0f;
+
+	return true;
+}
+
+bool BVH::Refit(const ObjLoader& objLoader, uint32_t numThreads)
+{
+	if (!objLoader.IsQuantized())
+		return Refit(objLoader.GetPositions(), objLoader.GetPositionStride(), objLoader.GetIndices(), numThreads);
+
+	vector<ObjLoader::float3> positions;
+	dequantizePositions(positions, objLoader);
+
+	return Refit(reinterpret_cast<const uint8_t*>(positions.data()), static_cast<uint32_t>(sizeof(ObjLoader::float3)),
+		objLoader.GetIndices(), numThreads);
+}
+
+bool BVH::Refit(const uint8_t* pPositions, uint32_t positionStride, const uint32_t* pIndices, uint32_t numThreads)
+{
+	if (GetNumNodes() == 0 || m_isOverBoxes) return false;
+
+	// A mapped tree is read-only.
+	if (m_pCacheHeader)
+	{
+		m_nodes.assign(GetNodes(), GetNodes() + GetNumNodes());
+		m_primIndices.assign(GetPrimitiveIndices(), GetPrimitiveIndices() + GetNumPrimitives());
+		m_pCacheHeader = nullptr;
+		m_cache.Close();
+	}
+
+	const auto startTime = chrono::steady_clock::now();
+	if (m_parents.size() != m_nodes.size()) computeParents();
+
+	numThreads = numThreads ? numThreads : (max)(thread::hardware_concurrency(), 1u);
+	double primitiveArea;
+	const auto cost = updateBoundsBottomUp(m_nodes.data(), m_parents.data(), m_leaves, numThreads,
+		m_buildOptions.TraversalCost, m_buildOptions.IntersectionCost, [&](const Node& leaf, Box& box)
+	{
+		auto area = 0.0f;
+		resetBox(box);
+		for (auto i = leaf.Offset; i < leaf.Offset + leaf.NumPrimitives; ++i)
+		{
+			Box triBox;
+			resetBox(triBox);
+			const auto pTriIndices = &pIndices[m_primIndices[i] * 3];
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				float v[3];
+				memcpy(v, pPositions + static_cast<size_t>(positionStride) * pTriIndices[j], sizeof(v));
+				for (uint8_t k = 0; k < 3; ++k)
+				{
+					triBox.Min[k] = (min)(triBox.Min[k], v[k]);
+					triBox.Max[k] = (max)(triBox.Max[k], v[k]);
+				}
+			}
+			growBox(box, triBox);
+			area += halfArea(triBox);
+		}
+
+		return area;
+	}, primitiveArea);
+
+	computeRefitStats(cost, primitiveArea);
+	m_refitStats.RefitTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+	return true;
+}
+
+bool BVH::Refit(const float* pBounds, uint32_t numThreads)
+{
+	if (GetNumNodes() == 0 || !m_isOverBoxes) return false;
+
+	const auto startTime = chrono::steady_clock::now();
+	if (m_parents.size() != m_nodes.size()) computeParents();
+
+	numThreads = numThreads ? numThreads : (max)(thread::hardware_concurrency(), 1u);
+	double primitiveArea;
+	const auto cost = updateBoundsBottomUp(m_nodes.data(), m_parents.data(), m_leaves, numThreads,
+		m_buildOptions.TraversalCost, m_buildOptions.IntersectionCost, [&](const Node& leaf, Box& box)
+	{
+		auto area = 0.0f;
+		resetBox(box);
+		for (auto i = leaf.Offset; i < leaf.Offset + leaf.NumPrimitives; ++i)
+		{
+			Box primBox;
+			memcpy(&primBox, &pBounds[m_primIndices[i] * 6], sizeof(primBox));
+			growBox(box, primBox);
+			area += halfArea(primBox);
+		}
+
+		return area;
+	}, primitiveArea);
+
+	computeRefitStats(cost, primitiveArea);
+	m_refitStats.RefitTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+	return true;
+}
+
+bool BVH::Intersect(const Ray& ray, const uint8_t* pPositions, uint32_t positionStride,
+	const uint32_t* pIndices, Hit& hit, bool acceptFirstHit) const
+{
+	if (GetNumNodes() == 0) return false;
+
+	return traverse(GetNodes(), GetPrimitiveIndices(), m_buildStats.MaxDepth, ray, acceptFirstHit,
+		[&](uint32_t primIdx, float& tMax)
+	{
+		float v[3][3];
+		const auto pTriIndices = &pIndices[primIdx * 3];
+		for (uint8_t j = 0; j < 3; ++j) memcpy(v[j], pPositions + static_cast<size_t>(positionStride) * pTriIndices[j], sizeof(v[j]));
+		if (!intersectTriangle(ray, v, ray.TMin, tMax, hit.Barycentrics)) return false;
+
+		hit.T = tMax;
+		hit.PrimitiveIndex = primIdx;
+		hit.InstanceIndex = 0;
+
+		return true;
+	});
+}
+
+bool BVH::Intersect(const Ray& ray, const function<bool(uint32_t, float&)>& intersect, bool acceptFirstHit) const
+{
+	if (GetNumNodes() == 0) return false;
+
+	return traverse(GetNodes(), GetPrimitiveIndices(), m_buildStats.MaxDepth, ray, acceptFirstHit, intersect);
+}
+
+uint32_t BVH::GetNumNodes() const
+{
+	return m_pCacheHeader ? m_pCacheHeader->NumNodes : static_cast<uint32_t>(m_nodes.size());
+}
+
+const BVH::Node* BVH::GetNodes() const
+{
+	return m_pCacheHeader ? reinterpret_cast<const Node*>(m_cache.GetData() + m_pCacheHeader->NodeOffset) : m_nodes.data();
+}
+
+uint32_t BVH::GetNumPrimitives() const
+{
+	return m_pCacheHeader ? m_pCacheHeader->NumPrimitives : static_cast<uint32_t>(m_primIndices.size());
+}
+
+const uint32_t* BVH::GetPrimitiveIndices() const
+{
+	return m_pCacheHeader ? reinterpret_cast<const uint32_t*>(m_cache.GetData() + m_pCacheHeader->PrimIndexOffset) :
+		m_primIndices.data();
+}
+
+const BVH::BuildStats& BVH::GetBuildStats() const
+{
+	return m_buildStats;
+}
+
+const BVH::RefitStats& BVH::GetRefitStats() const
+{
+	return m_refitStats;
+}
+
+bool BVH::NeedsRebuild(float maxDegradation) const
+{
+	return m_refitStats.Degradation > maxDegradation;
+}
+
+bool BVH::loadCache(const char* pszFilename, uint64_t contentHash, uint32_t numIndices)
+{
+	if (!m_cache.Open(pszFilename)) return false;
+
+	// Validate the cache against the geometry and the build options
+	const auto cacheSize = m_cache.GetSize();
+	const auto pHeader = reinterpret_cast<const CacheHeader*>(m_cache.GetData());
+	const auto& options = m_buildOptions;
+	auto isValid = cacheSize >= sizeof(CacheHeader) &&
+		memcmp(pHeader->Magic, g_cacheMagic, sizeof(g_cacheMagic)) == 0 &&
+		pHeader->Version == g_cacheVersion && pHeader->NodeSize == sizeof(Node) &&
+		pHeader->NumIndices == numIndices && pHeader->ContentHash == contentHash &&
+		pHeader->Method == options.Method && pHeader->NumBins == options.NumBins &&
+		pHeader->MaxLeafSize == options.MaxLeafSize && pHeader->TraversalCost == options.TraversalCost &&
+		pHeader->IntersectionCost == options.IntersectionCost &&
+		pHeader->SpatialSplitOverlap == options.SpatialSplitOverlap && pHeader->SpatialSplitBudget == options.SpatialSplitBudget;
+
+	isValid = isValid && pHeader->NumNodes > 0 &&
+		pHeader->NodeOffset % g_cacheAlignment == 0 && pHeader->PrimIndexOffset % g_cacheAlignment == 0 &&
+		pHeader->NodeOffset >= sizeof(CacheHeader) &&
+		pHeader->PrimIndexOffset >= pHeader->NodeOffset + sizeof(Node) * static_cast<uint64_t>(pHeader->NumNodes) &&
+		pHeader->PrimIndexOffset + sizeof(uint32_t) * static_cast<uint64_t>(pHeader->NumPrimitives) <= cacheSize;
+
+	isValid = isValid && isValidTree(reinterpret_cast<const Node*>(m_cache.GetData() + pHeader->NodeOffset),
+		pHeader->NumNodes, reinterpret_cast<const uint32_t*>(m_cache.GetData() + pHeader->PrimIndexOffset),
+		pHeader->NumPrimitives, numIndices / 3, pHeader->MaxDepth);
+
+	if (!isValid)
+	{
+		m_cache.Close();
+
+		return false;
+	}
+
+	m_pCacheHeader = pHeader;
+	m_buildStats.SAHCost = pHeader->SAHCost;
+	m_buildStats.NumLeaves = pHeader->NumLeaves;
+	m_buildStats.MaxDepth = pHeader->MaxDepth;
+	m_buildStats.IsCached = true;
+	m_refitStats.SAHCost = pHeader->SAHCost;
+	m_refitStats.Degradation = 1.0f;
+	m_costPerPrimitiveArea = pHeader->CostPerPrimitiveArea;
+
+	return true;
+}
+
+bool BVH::saveCache(const char* pszFilename, uint64_t contentHash, uint32_t numIndices) const
+{
+	CacheHeader header = {};
+	memcpy(header.Magic, g_cacheMagic, sizeof(g_cacheMagic));
+	header.Version = g_cacheVersion;
+	header.NodeSize = sizeof(Node);
+	header.NumIndices = numIndices;
+	header.ContentHash = contentHash;
+	header.Method = m_buildOptions.Method;
+	header.NumBins = m_buildOptions.NumBins;
+	header.MaxLeafSize = m_buildOptions.MaxLeafSize;
+	header.TraversalCost = m_buildOptions.TraversalCost;
+	header.IntersectionCost = m_buildOptions.IntersectionCost;
+	header.SpatialSplitOverlap = m_buildOptions.SpatialSplitOverlap;
+	header.SpatialSplitBudget = m_buildOptions.SpatialSplitBudget;
+	header.NumNodes = GetNumNodes();
+	header.NumPrimitives = GetNumPrimitives();
+	header.SAHCost = m_buildStats.SAHCost;
+	header.NumLeaves = m_buildStats.NumLeaves;
+	header.MaxDepth = m_buildStats.MaxDepth;
+	header.CostPerPrimitiveArea = m_costPerPrimitiveArea;
+	header.NodeOffset = alignCacheOffset(sizeof(CacheHeader));
+	header.PrimIndexOffset = alignCacheOffset(header.NodeOffset + sizeof(Node) * header.NumNodes);
+
+	// Write to a uniquely named file first and then move it in place,
+	// so that a concurrent build never maps a partially written cache.
+	const auto salt = hash<thread::id>()(this_thread::get_id()) ^ chrono::steady_clock::now().time_since_epoch().count();
+	const auto tmpFileName = string(pszFilename) + "." + to_string(salt) + ".tmp";
+
+	FILE* pFile;
+	fopen_s(&pFile, tmpFileName.c_str(), "wb");
+	if (!pFile) return false;
+
+	static const uint8_t padding[g_cacheAlignment] = {};
+	const auto nodePadding = static_cast<size_t>(header.NodeOffset - sizeof(CacheHeader));
+	const auto primIndexPadding = static_cast<size_t>(header.PrimIndexOffset - header.NodeOffset - sizeof(Node) * header.NumNodes);
+	auto success = fwrite(&header, sizeof(CacheHeader), 1, pFile) == 1;
+	success = success && fwrite(padding, 1, nodePadding, pFile) == nodePadding;
+	success = success && fwrite(GetNodes(), sizeof(Node), header.NumNodes, pFile) == header.NumNodes;
+	success = success && fwrite(padding, 1, primIndexPadding, pFile) == primIndexPadding;
+	success = success && fwrite(GetPrimitiveIndices(), sizeof(uint32_t), header.NumPrimitives, pFile) == header.NumPrimitives;
+	success = fclose(pFile) == 0 && success;
+
+#ifdef _WIN32
+	success = success && MoveFileExA(tmpFileName.c_str(), pszFilename, MOVEFILE_REPLACE_EXISTING);
+#else
+	success = success && rename(tmpFileName.c_str(), pszFilename) == 0;
+#endif
+	if (!success) remove(tmpFileName.c_str());
+
+	return success;
+}
+
+void BVH::computeBuildStats(double primitiveArea)
+{
+	const auto& options = m_buildOptions;
+	const auto getHalfArea = [](const Node& node)
+	{
+		Box box;
+		memcpy(box.Min, node.Min, sizeof(box.Min));
+		memcpy(box.Max, node.Max, sizeof(box.Max));
+
+		return halfArea(box);
+	};
+
+	// The costs are summed over the nodes in the units of the root area.
+	double cost = 0.0;
+	vector<pair<uint32_t, uint32_t>> stack(1, make_pair(0u, 1u));
+	while (!stack.empty())
+	{
+		const auto nodeIdx = stack.back().first;
+		const auto depth = stack.back().second;
+		stack.pop_back();
+
+		const auto& node = m_nodes[nodeIdx];
+		m_buildStats.MaxDepth = (max)(m_buildStats.MaxDepth, depth);
+		if (node.NumPrimitives > 0)
+		{
+			cost += static_cast<double>(options.IntersectionCost) * node.NumPrimitives * getHalfArea(node);
+			++m_buildStats.NumLeaves;
+		}
+		else
+		{
+			cost += static_cast<double>(options.TraversalCost) * getHalfArea(node);
+			stack.emplace_back(node.Offset + 1, depth + 1);
+			stack.emplace_back(node.Offset, depth + 1);
+		}
+	}
+
+	const auto rootArea = getHalfArea(m_nodes[0]);
+	m_buildStats.SAHCost = static_cast<float>(rootArea > 0.0f ? cost / rootArea : cost);
+	m_costPerPrimitiveArea = primitiveArea > 0.0 ? cost / primitiveArea : 0.0;
+}
+
+void BVH::computeRefitStats(double cost, double primitiveArea)
+{
+	Box rootBounds;
+	memcpy(rootBounds.Min, m_nodes[0].Min, sizeof(rootBounds.Min));
+	memcpy(rootBounds.Max, m_nodes[0].Max, sizeof(rootBounds.Max));
+	const auto rootArea = halfArea(rootBounds);
+	m_refitStats.SAHCost = static_cast<float>(rootArea > 0.0f ? cost / rootArea : cost);
+	// Either ratio alone misses a kind of degradation; see NeedsRebuild().
+	const auto areaDegradation = primitiveArea > 0.0 && m_costPerPrimitiveArea > 0.0 ?
+		static_cast<float>(cost / primitiveArea / m_costPerPrimitiveArea) : 1.0f;
+	const auto sahDegradation = m_buildStats.SAHCost > 0.0f ? m_refitStats.SAHCost / m_buildStats.SAHCost : 1.0f;
+	m_refitStats.Degradation = (max)(areaDegradation, sahDegradation);
+}
+
+void BVH::computeParents()
+{
+	const auto numNodes = static_cast<uint32_t>(m_nodes.size());
+	m_parents.resize(numNodes);
+	m_leaves.clear();
+	m_parents[0] = UINT32_MAX;
+	for (auto i = 0u; i < numNodes; ++i)
+	{
+		const auto& node = m_nodes[i];
+		if (node.NumPrimitives > 0) m_leaves.emplace_back(i);
+		else m_parents[node.Offset] = m_parents[node.Offset + 1] = i;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Wide BVH
+//--------------------------------------------------------------------------------------
+
+// The slab distances of a box are (bound * InvDir - OriginInvDir) per axis, from the near bounds of
+// the axes in which the ray goes, which are the max ones when its direction is negative.
+struct Slabs
+{
+	float InvDir[3];
+	float OriginInvDir[3];
+	bool IsNegative[3];
+};
+
+static uint32_t countTrailingZeros(uint32_t v)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	return _BitScanForward(&index, v) ? index : 32;
+#else
+	return v ? __builtin_ctz(v) : 32;
+#endif
+}
+
+// Returns the mask of the 4 boxes that the ray enters within [tMin, tMax], and their entry distances
+static inline uint32_t intersectBoxes4(const float* const pNears[3], const float* const pFars[3],
+	const Slabs& slabs, float tMin, float tMax, float* tEntries)
+{
+#ifdef XUSG_BVH_SSE2
+	auto tNear = _mm_set1_ps(tMin);
+	auto tFar = _mm_set1_ps(tMax);
+	for (uint8_t k = 0; k < 3; ++k)
+	{
+		const auto invDir = _mm_set1_ps(slabs.InvDir[k]);
+		const auto originInvDir = _mm_set1_ps(slabs.OriginInvDir[k]);
+		tNear = _mm_max_ps(tNear, _mm_sub_ps(_mm_mul_ps(_mm_load_ps(pNears[k]), invDir), originInvDir));
+		tFar = _mm_min_ps(tFar, _mm_sub_ps(_mm_mul_ps(_mm_load_ps(pFars[k]), invDir), originInvDir));
+	}
+	_mm_storeu_ps(tEntries, tNear);
+
+	return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)));
+#else
+	auto mask = 0u;
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		auto tNear = tMin, tFar = tMax;
+		for (uint8_t k = 0; k < 3; ++k)
+		{
+			tNear = (max)(tNear, pNears[k][i] * slabs.InvDir[k] - slabs.OriginInvDir[k]);
+			tFar = (min)(tFar, pFars[k][i] * slabs.InvDir[k] - slabs.OriginInvDir[k]);
+		}
+		tEntries[i] = tNear;
+		mask |= tNear <= tFar ? 1u << i : 0u;
+	}
+
+	return mask;
+#endif
+}
+
+static inline uint32_t intersectBoxes8(const float* const pNears[3], const float* const pFars[3],
+	const Slabs& slabs, float tMin, float tMax, float* tEntries)
+{
+#ifdef XUSG_BVH_AVX2
+	auto tNear = _mm256_set1_ps(tMin);
+	auto tFar = _mm256_set1_ps(tMax);
+	for (uint8_t k = 0; k < 3; ++k)
+	{
+		const auto invDir = _mm256_set1_ps(slabs.InvDir[k]);
+		const auto originInvDir = _mm256_set1_ps(slabs.OriginInvDir[k]);
+		tNear = _mm256_max_ps(tNear, _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(pNears[k]), invDir), originInvDir));
+		tFar = _mm256_min_ps(tFar, _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(pFars[k]), invDir), originInvDir));
+	}
+	_mm256_storeu_ps(tEntries, tNear);
+
+	return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+#else
+	const float* const pNears1[] = { pNears[0] + 4, pNears[1] + 4, pNears[2] + 4 };
+	const float* const pFars1[] = { pFars[0] + 4, pFars[1] + 4, pFars[2] + 4 };
+
+	return intersectBoxes4(pNears, pFars, slabs, tMin, tMax, tEntries) |
+		(intersectBoxes4(pNears1, pFars1, slabs, tMin, tMax, tEntries + 4) << 4);
+#endif
+}
+
+// A direction of 0 would make the slabs NaN where a bound meets the origin.
+static Slabs getSlabs(const BVH::Ray& ray)
+{
+	Slabs slabs;
+	for (uint8_t k = 0; k < 3; ++k)
+	{
+		auto dir = ray.Direction[k];
+		if (fabsf(dir) < 1.0e-20f) dir = dir < 0.0f ? -1.0e-20f : 1.0e-20f;
+		slabs.InvDir[k] = 1.0f / dir;
+		slabs.OriginInvDir[k] = ray.Origin[k] * slabs.InvDir[k];
+		slabs.IsNegative[k] = slabs.InvDir[k] < 0.0f;
+	}
+
+	return slabs;
+}
+
+// Traversal of the wide layouts from node 0, nearest hit child first. intersectChildren(nodeIdx,
+// tMax, tEntries, offsets, numPrimitives) returns the mask of the children of a node that the ray
+// enters, and sets their entry distances, and their node or first primitive with their counts.
+// Each inner node visited leaves at most N - 1 more entries on the stack.
+template<uint8_t N, typename T>
+static bool traverseWide(uint32_t maxDepth, const uint32_t* pPrimIndices, const BVH::Ray& ray,
+	const uint8_t* pPositions, uint32_t positionStride, const uint32_t* pIndices, BVH::Hit& hit,
+	bool acceptFirstHit, const T& intersectChildren)
+{
+	struct StackEntry
+	{
+		uint32_t Offset;
+		uint32_t NumPrimitives;
+		float TEntry;
+	};
+
+	StackEntry localStack[256];
+	vector<StackEntry> heapStack;
+	auto pStack = localStack;
+	const auto maxStackSize = maxDepth * (N - 1) + 1;
+	if (maxStackSize > size(localStack))
+	{
+		heapStack.resize(maxStackSize);
+		pStack = heapStack.data();
+	}
+
+	auto tMax = ray.TMax;
+	auto isHit = false;
+	auto stackSize = 1u;
+	pStack[0] = { 0, 0, ray.TMin };
+	while (stackSize > 0)
+	{
+		const auto entry = pStack[--stackSize];
+		if (entry.TEntry > tMax) continue;
+
+		if (entry.NumPrimitives > 0)
+		{
+			for (auto i = entry.Offset; i < entry.Offset + entry.NumPrimitives; ++i)
+			{
+				const auto primIdx = pPrimIndices[i];
+				float v[3][3];
+				const auto pTriIndices = &pIndices[primIdx * 3];
+				for (uint8_t j = 0; j < 3; ++j) memcpy(v[j], pPositions + static_cast<size_t>(positionStride) * pTriIndices[j], sizeof(v[j]));
+				if (!intersectTriangle(ray, v, ray.TMin, tMax, hit.Barycentrics)) continue;
+
+				hit.T = tMax;
+				hit.PrimitiveIndex = primIdx;
+				hit.InstanceIndex = 0;
+				if (acceptFirstHit) return true;
+				isHit = true;
+			}
+
+			continue;
+		}
+
+		float tEntries[N];
+		uint32_t offsets[N], numPrimitives[N];
+		auto mask = intersectChildren(entry.Offset, tMax, tEntries, offsets, numPrimitives);
+
+		// Pushed in the order of decreasing entry distances, so that the nearest is popped first
+		const auto first = stackSize;
+		for (; mask; mask &= mask - 1)
+		{
+			const auto i = countTrailingZeros(mask);
+			const StackEntry child = { offsets[i], numPrimitives[i], tEntries[i] };
+			auto j = stackSize++;
+			for (; j > first && pStack[j - 1].TEntry < child.TEntry; --j) pStack[j] = pStack[j - 1];
+			pStack[j] = child;
+		}
+	}
+
+	return isHit;
+}
+
+template<uint8_t N>
+WideBVH<N>::WideBVH() :
+	m_maxDepth(0)
+{
+}
+
+template<uint8_t N>
+WideBVH<N>::~WideBVH()
+{
+}
+
+template<uint8_t N>
+bool WideBVH<N>::Build(const BVH& bvh)
+{
+	m_nodes.clear();
+	m_primIndices.assign(bvh.GetPrimitiveIndices(), bvh.GetPrimitiveIndices() + bvh.GetNumPrimitives());
+	m_maxDepth = 0;
+	if (bvh.GetNumNodes() == 0) return false;
+
+	const auto pBinaryNodes = bvh.GetNodes();
+	const auto getHalfArea = [pBinaryNodes](uint32_t i)
+	{
+		Box box;
+		memcpy(box.Min, pBinaryNodes[i].Min, sizeof(box.Min));
+		memcpy(box.Max, pBinaryNodes[i].Max, sizeof(box.Max));
+
+		return halfArea(box);
+	};
+
+	struct Task
+	{
+		uint32_t NodeIdx;
+		uint32_t BinaryNodeIdx;
+		uint32_t Depth;
+	};
+
+	m_nodes.emplace_back();
+	vector<Task> stack(1, Task{ 0, 0, 1 });
+	while (!stack.empty())
+	{
+		const auto task = stack.back();
+		stack.pop_back();
+		m_maxDepth = (max)(m_maxDepth, task.Depth);
+
+		// Opens the largest inner child until there are N, or only leaves
+		uint32_t children[N] = { task.BinaryNodeIdx };
+		uint8_t numChildren = 1;
+		while (numChildren < N)
+		{
+			auto largest = UINT8_MAX;
+			auto largestArea = -1.0f;
+			for (uint8_t i = 0; i < numChildren; ++i)
+			{
+				if (pBinaryNodes[children[i]].NumPrimitives > 0) continue;
+				const auto area = getHalfArea(children[i]);
+				if (area > largestArea)
+				{
+					largest = i;
+					largestArea = area;
+				}
+			}
+			if (largest == UINT8_MAX) break;
+
+			const auto offset = pBinaryNodes[children[largest]].Offset;
+			children[largest] = offset;
+			children[numChildren++] = offset + 1;
+		}
+
+		Node node;
+		for (uint8_t i = 0; i < N; ++i)
+		{
+			if (i < numChildren)
+			{
+				const auto& child = pBinaryNodes[children[i]];
+				for (uint8_t k = 0; k < 3; ++k)
+				{
+					node.Min[k][i] = child.Min[k];
+					node.Max[k][i] = child.Max[k];
+				}
+
+				node.NumPrimitives[i] = child.NumPrimitives;
+				if (child.NumPrimitives > 0) node.Offset[i] = child.Offset;
+				else
+				{
+					node.Offset[i] = static_cast<uint32_t>(m_nodes.size());
+					m_nodes.emplace_back();
+					stack.push_back(Task{ node.Offset[i], children[i], task.Depth + 1 });
+				}
+			}
+			else
+			{
+				for (uint8_t k = 0; k < 3; ++k)
+				{
+					node.Min[k][i] = FLT_MAX;
+					node.Max[k][i] = -FLT_MAX;
+				}
+				node.Offset[i] = 0;
+				node.NumPrimitives[i] = 0;
+			}
+		}
+		m_nodes[task.NodeIdx] = node;
+	}
+
+	return true;
+}
+
+template<uint8_t N>
+bool WideBVH<N>::Intersect(const BVH::Ray& ray, const uint8_t* pPositions, uint32_t positionStride,
+	const uint32_t* pIndices, BVH::Hit& hit, bool acceptFirstHit) const
+{
+	if (m_nodes.empty()) return false;
+
+	const auto slabs = getSlabs(ray);
+
+	return traverseWide<N>(m_maxDepth, m_primIndices.data(), ray, pPositions, positionStride, pIndices, hit, acceptFirstHit,
+		[&](uint32_t nodeIdx, float tMax, float* tEntries, uint32_t* offsets, uint32_t* numPrimitives)
+	{
+		const auto& node = m_nodes[nodeIdx];
+		const float* const pNears[] =
+		{
+			slabs.IsNegative[0] ? node.Max[0] : node.Min[0],
+			slabs.IsNegative[1] ? node.Max[1] : node.Min[1],
+			slabs.IsNegative[2] ? node.Max[2] : node.Min[2]
+		};
+		const float* const pFars[] =
+		{
+			slabs.IsNegative[0] ? node.Min[0] : node.Max[0],
+			slabs.IsNegative[1] ? node.Min[1] : node.Max[1],
+			slabs.IsNegative[2] ? node.Min[2] : node.Max[2]
+		};
+
+		const auto mask = N == 8 ? intersectBoxes8(pNears, pFars, slabs, ray.TMin, tMax, tEntries) :
+			intersectBoxes4(pNears, pFars, slabs, ray.TMin, tMax, tEntries);
+		for (auto bits = mask; bits; bits &= bits - 1)
+		{
+			const auto i = countTrailingZeros(bits);
+			offsets[i] = node.Offset[i];
+			numPrimitives[i] = node.NumPrimitives[i];
+		}
+
+		return mask;
+	});
+}
+
+template<uint8_t N>
+uint32_t WideBVH<N>::GetNumNodes() const
+{
+	return static_cast<uint32_t>(m_nodes.size());
+}
+
+template<uint8_t N>
+const typename WideBVH<N>::Node* WideBVH<N>::GetNodes() const
+{
+	return m_nodes.data();
+}
+
+template<uint8_t N>
+uint32_t WideBVH<N>::GetNumPrimitives() const
+{
+	return static_cast<uint32_t>(m_primIndices.size());
+}
+
+template<uint8_t N>
+const uint32_t* WideBVH<N>::GetPrimitiveIndices() const
+{
+	return m_primIndices.data();
+}
+
+template<uint8_t N>
+uint32_t WideBVH<N>::GetMaxDepth() const
+{
+	return m_maxDepth;
+}
+
+template class XUSG::WideBVH<4>;
+template class XUSG::WideBVH<8>;
+
+//--------------------------------------------------------------------------------------
+// Quantized wide BVH
+//--------------------------------------------------------------------------------------
+
+// The slab distances of the quantized bounds q are q * Scales + Offsets per axis, with the grid
+// steps and the node origin folded into the slabs of the ray.
+static inline uint32_t intersectQuantizedBoxes4(const uint8_t* const pNears[3], const uint8_t* const pFars[3],
+	const float scales[3], const float offsets[3], float tMin, float tMax, float* tEntries)
+{
+#ifdef XUSG_BVH_SSE2
+	const auto load = [](const uint8_t* p)
+	{
+		int32_t q;
+		memcpy(&q, p, sizeof(q));
+		const auto zero = _mm_setzero_si128();
+
+		return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(q), zero), zero));
+	};
+
+	auto tNear = _mm_set1_ps(tMin);
+	auto tFar = _mm_set1_ps(tMax);
+	for (uint8_t k = 0; k < 3; ++k)
+	{
+		const auto scale = _mm_set1_ps(scales[k]);
+		const auto offset = _mm_set1_ps(offsets[k]);
+		tNear = _mm_max_ps(tNear, _mm_add_ps(_mm_mul_ps(load(pNears[k]), scale), offset));
+		tFar = _mm_min_ps(tFar, _mm_add_ps(_mm_mul_ps(load(pFars[k]), scale), offset));
+	}
+	_mm_storeu_ps(tEntries, tNear);
+
+	return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)));
+#else
+	auto mask = 0u;
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		auto tNear = tMin, tFar = tMax;
+		for (uint8_t k = 0; k < 3; ++k)
+		{
+			tNear = (max)(tNear, pNears[k][i] * scales[k] + offsets[k]);
+			tFar = (min)(tFar, pFars[k][i] * scales[k] + offsets[k]);
+		}
+		tEntries[i] = tNear;
+		mask |= tNear <= tFar ? 1u << i : 0u;
+	}
+
+	return mask;
+#endif
+}
+
+static inline uint32_t intersectQuantizedBoxes8(const uint8_t* const pNears[3], const uint8_t* const pFars[3],
+	const float scales[3], const float offsets[3], float tMin, float tMax, float* tEntries)
+{
+#ifdef XUSG_BVH_AVX2
+	const auto load = [](const uint8_t* p)
+	{
+		return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+	};
+
+	auto tNear = _mm256_set1_ps(tMin);
+	auto tFar = _mm256_set1_ps(tMax);
+	for (uint8_t k = 0; k < 3; ++k)
+	{
+		const auto scale = _mm256_set1_ps(scales[k]);
+		const auto offset = _mm256_set1_ps(offsets[k]);
+		tNear = _mm256_max_ps(tNear, _mm256_add_ps(_mm256_mul_ps(load(pNears[k]), scale), offset));
+		tFar = _mm256_min_ps(tFar, _mm256_add_ps(_mm256_mul_ps(load(pFars[k]), scale), offset));
+	}
+	_mm256_storeu_ps(tEntries, tNear);
+
+	return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+#else
+	const uint8_t* const pNears1[] = { pNears[0] + 4, pNears[1] + 4, pNears[2] + 4 };
+	const uint8_t* const pFars1[] = { pFars[0] + 4, pFars[1] + 4, pFars[2] + 4 };
+
+	return intersectQuantizedBoxes4(pNears, pFars, scales, offsets, tMin, tMax, tEntries) |
+		(intersectQuantizedBoxes4(pNears1, pFars1, scales, offsets, tMin, tMax, tEntries + 4) << 4);
+#endif
+}
+
+// 2^exponent, for exponents of normal floats
+static inline float getPowerOf2(int32_t exponent)
+{
+	const auto bits = static_cast<uint32_t>(exponent + 127) << 23;
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+
+	return value;
+}
+
+template<uint8_t N>
+QuantizedWideBVH<N>::QuantizedWideBVH() :
+	m_maxDepth(0)
+{
+}
+
+template<uint8_t N>
+QuantizedWideBVH<N>::~QuantizedWideBVH()
+{
+}
+
+template<uint8_t N>
+bool QuantizedWideBVH<N>::Build(const WideBVH<N>& bvh)
+{
+	m_nodes.clear();
+	m_primIndices.clear();
+	m_maxDepth = bvh.GetMaxDepth();
+	if (bvh.GetNumNodes() == 0) return false;
+
+	const auto pWideNodes = bvh.GetNodes();
+	const auto pWidePrimIndices = bvh.GetPrimitiveIndices();
+	m_primIndices.reserve(bvh.GetNumPrimitives());
+
+	m_nodes.emplace_back();
+	vector<pair<uint32_t, uint32_t>> stack(1, make_pair(0u, 0u));
+	while (!stack.empty())
+	{
+		const auto nodeIdx = stack.back().first;
+		const auto& wideNode = pWideNodes[stack.back().second];
+		stack.pop_back();
+
+		Node node = {};
+		uint8_t numInner = 0;
+		Box bounds;
+		resetBox(bounds);
+		for (uint8_t i = 0; i < N; ++i)
+		{
+			if (wideNode.Min[0][i] > wideNode.Max[0][i]) continue;
+			node.ChildMask |= 1 << i;
+			numInner += wideNode.NumPrimitives[i] > 0 ? 0 : 1;
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				bounds.Min[k] = (min)(bounds.Min[k], wideNode.Min[k][i]);
+				bounds.Max[k] = (max)(bounds.Max[k], wideNode.Max[k][i]);
+			}
+		}
+
+		// The smallest grid steps of 255 to cover the node
+		float steps[3];
+		for (uint8_t k = 0; k < 3; ++k)
+		{
+			const auto extent = bounds.Max[k] - bounds.Min[k];
+			auto exponent = extent > 0.0f ? static_cast<int32_t>(ceilf(log2f(extent / 255.0f))) : -64;
+			exponent = (min)((max)(exponent, -64), 127);
+			while (exponent < 127 && getPowerOf2(exponent) * 255.0f < extent) ++exponent;
+			node.Origin[k] = bounds.Min[k];
+			node.Exponents[k] = static_cast<int8_t>(exponent);
+			steps[k] = getPowerOf2(exponent);
+		}
+
+		node.ChildBase = static_cast<uint32_t>(m_nodes.size());
+		node.PrimitiveBase = static_cast<uint32_t>(m_primIndices.size());
+		m_nodes.resize(m_nodes.size() + numInner);
+
+		uint8_t innerIdx = 0;
+		for (uint8_t i = 0; i < N; ++i)
+		{
+			if ((node.ChildMask & (1 << i)) == 0)
+			{
+				for (uint8_t k = 0; k < 3; ++k)
+				{
+					node.QMin[k][i] = UINT8_MAX;
+					node.QMax[k][i] = 0;
+				}
+				continue;
+			}
+
+			// Rounded outwards, then widened until the decoded bounds contain the exact ones
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				const auto origin = node.Origin[k];
+				auto qMin = static_cast<int32_t>(floorf((wideNode.Min[k][i] - origin) / steps[k]));
+				auto qMax = static_cast<int32_t>(ceilf((wideNode.Max[k][i] - origin) / steps[k]));
+				qMin = (min)((max)(qMin, 0), 255);
+				qMax = (min)((max)(qMax, 0), 255);
+				while (qMin > 0 && origin + qMin * steps[k] > wideNode.Min[k][i]) --qMin;
+				while (qMax < 255 && origin + qMax * steps[k] < wideNode.Max[k][i]) ++qMax;
+				node.QMin[k][i] = static_cast<uint8_t>(qMin);
+				node.QMax[k][i] = static_cast<uint8_t>(qMax);
+			}
+
+			const auto numPrimitives = wideNode.NumPrimitives[i];
+			if (numPrimitives > 0)
+			{
+				const auto offset = static_cast<uint32_t>(m_primIndices.size()) - node.PrimitiveBase;
+				if (offset + numPrimitives > 255)
+				{
+					m_nodes.clear();
+					m_primIndices.clear();
+
+					return false;
+				}
+
+				node.ChildOffsets[i] = static_cast<uint8_t>(offset);
+				node.NumPrimitives[i] = static_cast<uint8_t>(numPrimitives);
+				const auto pLeafPrimIndices = &pWidePrimIndices[wideNode.Offset[i]];
+				m_primIndices.insert(m_primIndices.end(), pLeafPrimIndices, pLeafPrimIndices + numPrimitives);
+			}
+			else
+			{
+				node.ChildOffsets[i] = innerIdx;
+				stack.emplace_back(node.ChildBase + innerIdx++, wideNode.Offset[i]);
+			}
+		}
+		m_nodes[nodeIdx] = node;
+	}
+
+	return true;
+}
+
+template<uint8_t N>
+bool QuantizedWideBVH<N>::Intersect(const BVH::Ray& ray, const uint8_t* pPositions, uint32_t positionStride,
+	const uint32_t* pIndices, BVH::Hit& hit, bool acceptFirstHit) const
+{
+	if (m_nodes.empty()) return false;
+
+	const auto slabs = getSlabs(ray);
+
+	return traverseWide<N>(m_maxDepth, m_primIndices.data(), ray, pPositions, positionStride, pIndices, hit, acceptFirstHit,
+		[&](uint32_t nodeIdx, float tMax, float* tEntries, uint32_t* offsets, uint32_t* numPrimitives)
+	{
+		const auto& node = m_nodes[nodeIdx];
+		float scales[3], offsetsT[3];
+		for (uint8_t k = 0; k < 3; ++k)
+		{
+			scales[k] = getPowerOf2(node.Exponents[k]) * slabs.InvDir[k];
+			offsetsT[k] = node.Origin[k] * slabs.InvDir[k] - slabs.OriginInvDir[k];
+		}
+
+		const uint8_t* const pNears[] =
+		{
+			slabs.IsNegative[0] ? node.QMax[0] : node.QMin[0],
+			slabs.IsNegative[1] ? node.QMax[1] : node.QMin[1],
+			slabs.IsNegative[2] ? node.QMax[2] : node.QMin[2]
+		};
+		const uint8_t* const pFars[] =
+		{
+			slabs.IsNegative[0] ? node.QMin[0] : node.QMax[0],
+			slabs.IsNegative[1] ? node.QMin[1] : node.QMax[1],
+			slabs.IsNegative[2] ? node.QMin[2] : node.QMax[2]
+		};
+
+		const auto mask = (N == 8 ? intersectQuantizedBoxes8(pNears, pFars, scales, offsetsT, ray.TMin, tMax, tEntries) :
+			intersectQuantizedBoxes4(pNears, pFars, scales, offsetsT, ray.TMin, tMax, tEntries)) & node.ChildMask;
+		for (auto bits = mask; bits; bits &= bits - 1)
+		{
+			const auto i = countTrailingZeros(bits);
+			offsets[i] = node.ChildOffsets[i] + (node.NumPrimitives[i] > 0 ? node.PrimitiveBase : node.ChildBase);
+			numPrimitives[i] = node.NumPrimitives[i];
+		}
+
+		return mask;
+	});
+}
+
+template<uint8_t N>
+uint32_t QuantizedWideBVH<N>::GetNumNodes() const
+{
+	return static_cast<uint32_t>(m_nodes.size());
+}
+
+template<uint8_t N>
+const typename QuantizedWideBVH<N>::Node* QuantizedWideBVH<N>::GetNodes() const
+{
+	return m_nodes.data();
+}
+
+template<uint8_t N>
+uint32_t QuantizedWideBVH<N>::GetNumPrimitives() const
+{
+	return static_cast<uint32_t>(m_primIndices.size());
+}
+
+template<uint8_t N>
+const uint32_t* QuantizedWideBVH<N>::GetPrimitiveIndices() const
+{
+	return m_primIndices.data();
+}
+
+template class XUSG::QuantizedWideBVH<4>;
+template class XUSG::QuantizedWideBVH<8>;
@@ -0,0 +1,264 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "XUSGObjLoader.h"
+
+namespace XUSG
+{
+	// Binary bounding volume hierarchy over the triangles of a mesh, built on the CPU
+	// The nodes are split top-down at the best of NumBins candidate planes per axis under the surface
+	// area heuristic [Wald 2007, "On fast Construction of SAH-based Bounding Volume Hierarchies"].
+	// The per-triangle centroids and bounds are kept as separate x, y and z arrays for the binning,
+	// the subtrees are built as parallel tasks, and the binning of the nodes too large for the tasks
+	// to keep the threads busy is split across the threads itself.
+	// With SPATIAL_SPLIT_SAH, a node whose best children overlap may instead be split at a plane
+	// across its triangles, each of which then goes to both sides, clipped to them [Stich et al.
+	// 2009, "Spatial Splits in Bounding Volume Hierarchies"], within a budget of added references.
+	// A BVH over boxes, which cannot be clipped, is built with BINNED_SAH instead.
+	class BVH
+	{
+	public:
+		// The 2 children of an inner node are consecutive, and the nodes are in depth-first order
+		// regardless of the thread count.
+		struct Node
+		{
+			float		Min[3];
+			uint32_t	Offset;			// First child of an inner node, or first primitive of a leaf
+			float		Max[3];
+			uint32_t	NumPrimitives;	// 0 for an inner node
+		};
+
+		enum BuildMethod : uint8_t
+		{
+			BINNED_SAH,		// Top-down, at the cheapest of the bin boundaries under the SAH
+			LBVH_30,		// Linear, from the 30-bit Morton codes of the triangle centroids
+			LBVH_63,		// Linear, from 63-bit Morton codes, for meshes too dense for 10 bits per axis
+			SPATIAL_SPLIT_SAH	// As BINNED_SAH, also at planes across triangles where the children would overlap
+		};
+
+		struct BuildOptions
+		{
+			BuildMethod Method;			// BINNED_SAH by default
+			uint32_t NumBins;			// Candidate planes + 1 per axis, 2 to MaxBins
+			uint32_t MaxLeafSize;		// Larger nodes are always split; smaller ones when the SAH favors it
+			uint32_t NumThreads;		// 0 uses all hardware threads; the tree does not depend on it
+			float TraversalCost;		// Of visiting a node, relative to
+			float IntersectionCost;		// that of testing a triangle
+			float SpatialSplitOverlap;	// Of the object split children over the root, as a surface area ratio,
+										// above which SPATIAL_SPLIT_SAH tries spatial splits
+			float SpatialSplitBudget;	// Triangle references that the spatial splits may add, per triangle
+
+			BuildOptions();
+		};
+
+		struct BuildStats
+		{
+			double BuildTime;			// Seconds, without computing the other stats
+			float SAHCost;				// Expected cost of a ray through the root bounds
+			uint32_t NumLeaves;
+			uint32_t MaxDepth;
+			bool IsCached;				// Mapped from the cache file instead of built
+		};
+
+		struct RefitStats
+		{
+			double RefitTime;			// Seconds
+			float SAHCost;				// Of the tree with the refitted bounds
+			float Degradation;			// Over the tree as built; see NeedsRebuild()
+		};
+
+		// As RayDesc of DXR; the direction need not be normalized, and t is in its units.
+		struct Ray
+		{
+			float Origin[3];
+			float TMin;
+			float Direction[3];
+			float TMax;
+		};
+
+		struct Hit
+		{
+			float T;
+			float Barycentrics[2];		// Weights of the 2nd and 3rd vertices, as in DXR
+			uint32_t PrimitiveIndex;	// Triangle of the index buffer
+			uint32_t InstanceIndex;		// Set by TopLevelBVH; 0 otherwise
+		};
+
+		BVH();
+		virtual ~BVH();
+
+		// Over GetPositions() and GetIndices(), decoding the positions if they are quantized
+		bool Build(const ObjLoader& objLoader, const BuildOptions& options = BuildOptions(),
+			const char* pszCacheFilename = nullptr);
+		// The positions are 3 floats at each positionStride, and each 3 indices are a triangle.
+		// Fails if there are no triangles or an index is not less than numVertices.
+		// pszCacheFilename, if any, is mapped instead of building when it holds a tree built with the
+		// same options over the same positions and indices, by content, and is (re)written otherwise.
+		// The tree is mapped read-only, and copied out on the first refit.
+		bool Build(const uint8_t* pPositions, uint32_t positionStride, uint32_t numVertices,
+			const uint32_t* pIndices, uint32_t numIndices, const BuildOptions& options = BuildOptions(),
+			const char* pszCacheFilename = nullptr);
+		// Over axis-aligned boxes, e.g. the world bounds of instances, of 6 floats each: the min then
+		// the max corner. Such a BVH can only be traversed with a callback, and refitted over boxes.
+		bool Build(const float* pBounds, uint32_t numPrimitives, const BuildOptions& options = BuildOptions());
+
+		// Recomputes the bounds bottom-up for new positions of the same triangles, e.g. after a
+		// deformation or a transform of the vertices, keeping the tree and the primitive indices.
+		// pIndices must be the index buffer of the build. Fails if nothing has been built, or if the
+		// BVH has been built over boxes.
+		bool Refit(const ObjLoader& objLoader, uint32_t numThreads = 0);
+		bool Refit(const uint8_t* pPositions, uint32_t positionStride, const uint32_t* pIndices,
+			uint32_t numThreads = 0);
+		// As above, for new bounds of the same boxes, e.g. of moved instances, in the layout of the
+		// build. Fails if nothing has been built, or if the BVH has been built over triangles.
+		bool Refit(const float* pBounds, uint32_t numThreads = 0);
+
+		// Finds the closest triangle hit in [TMin, TMax], or any hit if acceptFirstHit, over the
+		// positions and indices of the build, or new ones of the same triangles after a refit
+		bool Intersect(const Ray& ray, const uint8_t* pPositions, uint32_t positionStride,
+			const uint32_t* pIndices, Hit& hit, bool acceptFirstHit = false) const;
+		// Visits the primitives of the leaves the ray enters, nearer children first. intersect(i, tMax)
+		// tests primitive i, and on a hit in [TMin, tMax], shortens tMax to it and returns true.
+		bool Intersect(const Ray& ray, const std::function<bool(uint32_t, float&)>& intersect,
+			bool acceptFirstHit = false) const;
+
+		uint32_t GetNumNodes() const;
+		const Node* GetNodes() const;
+		// The triangles of the leaves, in leaf order; a leaf refers to a range of them. After spatial
+		// splits, a triangle may be in several leaves, and the refits bound the whole of it in each,
+		// so that a refitted SPATIAL_SPLIT_SAH tree is degraded even if the positions are the same.
+		uint32_t GetNumPrimitives() const;
+		const uint32_t* GetPrimitiveIndices() const;
+
+		const BuildStats& GetBuildStats() const;
+		// Of the last Refit() since the last Build()
+		const RefitStats& GetRefitStats() const;
+
+		// Whether the refits have degraded the tree by more than maxDegradation, so that a rebuild
+		// is likely to pay for itself in traversal time. The degradation is the larger of 2 ratios
+		// to the tree as built, as neither catches every deformation: the SAH cost, which drops when
+		// the mesh gets more compact even as the tree gets worse, and the unnormalized SAH cost over
+		// the sum of the half areas of the triangle bounds, which stays flat when the mesh spreads out.
+		bool NeedsRebuild(float maxDegradation = 1.2f) const;
+
+		static constexpr uint32_t MaxBins = 32;
+
+	protected:
+		struct CacheHeader;
+
+		bool loadCache(const char* pszFilename, uint64_t contentHash, uint32_t numIndices);
+		bool saveCache(const char* pszFilename, uint64_t contentHash, uint32_t numIndices) const;
+		void computeBuildStats(double primitiveArea);
+		void computeRefitStats(double cost, double primitiveArea);
+		void computeParents();
+
+		std::vector<Node>		m_nodes;
+		std::vector<uint32_t>	m_primIndices;
+		std::vector<uint32_t>	m_parents;	// For the refits; UINT32_MAX for the root
+		std::vector<uint32_t>	m_leaves;
+
+		BuildOptions			m_buildOptions;
+		BuildStats				m_buildStats;
+		RefitStats				m_refitStats;
+		double					m_costPerPrimitiveArea;
+		bool					m_isOverBoxes;
+
+		MappedFile				m_cache;
+		const CacheHeader*		m_pCacheHeader;
+	};
+
+	// BVH of N = 4 or 8 children per node, collapsed from a binary BVH for SIMD traversal
+	// [Dammertz et al. 2008, "Shallow Bounding Volume Hierarchies for Fast SIMD Ray Tracing of
+	// Incoherent Rays"]. The child bounds are kept per axis, so that a ray is tested against all the
+	// children of a node at once: with SSE for 4 and AVX2 for 8, when built with __AVX2__ defined.
+	template<uint8_t N>
+	class WideBVH
+	{
+	public:
+		// A BVH4 node is 2 cache lines, of which the bounds take 96 bytes, and a BVH8 node is 4.
+		struct alignas(64) Node
+		{
+			float		Min[3][N];			// Of the children per axis; Min > Max for an empty slot
+			float		Max[3][N];
+			uint32_t	Offset[N];			// Inner child node, or first primitive of a leaf child
+			uint32_t	NumPrimitives[N];	// 0 for an inner child
+		};
+
+		WideBVH();
+		virtual ~WideBVH();
+
+		// Each node takes the children of the largest inner nodes of its binary subtree, by surface
+		// area, until it has N of them. The leaves and primitive indices are those of the binary BVH.
+		bool Build(const BVH& bvh);
+
+		// As BVH::Intersect(), over the geometry of the binary BVH. The hit children of a node are
+		// visited nearest first.
+		bool Intersect(const BVH::Ray& ray, const uint8_t* pPositions, uint32_t positionStride,
+			const uint32_t* pIndices, BVH::Hit& hit, bool acceptFirstHit = false) const;
+
+		uint32_t GetNumNodes() const;
+		const Node* GetNodes() const;
+		uint32_t GetNumPrimitives() const;
+		const uint32_t* GetPrimitiveIndices() const;
+		uint32_t GetMaxDepth() const;
+
+	protected:
+		std::vector<Node>		m_nodes;
+		std::vector<uint32_t>	m_primIndices;
+		uint32_t				m_maxDepth;
+	};
+
+	using BVH4 = WideBVH<4>;
+	using BVH8 = WideBVH<8>;
+
+	// Wide BVH with the child bounds quantized to 8 bits in a frame of the node, on a grid of a power
+	// of 2 per axis from its min corner [Ylitie et al. 2017, "Efficient Incoherent Ray Traversal on
+	// GPUs Through Compressed Wide BVHs"]. The decoded bounds contain the exact ones, so the hits are
+	// the same as those of the uncompressed layouts. The inner children of a node are consecutive
+	// nodes, and the primitives of its leaf children are consecutive from a base too, so that a child
+	// only needs a byte of offset. A node of QuantizedBVH4 is then a cache line, and one of
+	// QuantizedBVH8 is 2, against 2 and 4 of the uncompressed layouts.
+	template<uint8_t N>
+	class QuantizedWideBVH
+	{
+	public:
+		struct alignas(64) Node
+		{
+			float		Origin[3];			// Min corner of the node
+			int8_t		Exponents[3];		// Of the grid steps per axis
+			uint8_t		ChildMask;			// Bit i is set if slot i has a child
+			uint8_t		QMin[3][N];			// Of the children per axis
+			uint8_t		QMax[3][N];
+			uint32_t	ChildBase;			// First inner child node
+			uint32_t	PrimitiveBase;		// First primitive of the leaf children
+			uint8_t		ChildOffsets[N];	// From ChildBase, or from PrimitiveBase for a leaf child
+			uint8_t		NumPrimitives[N];	// 0 for an inner child
+		};
+
+		QuantizedWideBVH();
+		virtual ~QuantizedWideBVH();
+
+		// Fails if the leaf children of a node hold more than 255 primitives together.
+		bool Build(const WideBVH<N>& bvh);
+
+		// As BVH::Intersect(), over the geometry of the binary BVH the wide one was collapsed from
+		bool Intersect(const BVH::Ray& ray, const uint8_t* pPositions, uint32_t positionStride,
+			const uint32_t* pIndices, BVH::Hit& hit, bool acceptFirstHit = false) const;
+
+		uint32_t GetNumNodes() const;
+		const Node* GetNodes() const;
+		uint32_t GetNumPrimitives() const;
+		const uint32_t* GetPrimitiveIndices() const;
+
+	protected:
+		std::vector<Node>		m_nodes;
+		std::vector<uint32_t>	m_primIndices;
+		uint32_t				m_maxDepth;
+	};
+
+	using QuantizedBVH4 = QuantizedWideBVH<4>;
+	using QuantizedBVH8 = QuantizedWideBVH<8>;
+}
@@ -0,0 +1,126 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "XUSGMappedFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace XUSG;
+
+MappedFile::MappedFile() :
+	m_pData(nullptr),
+	m_size(0),
+	m_timeStamp(0),
+#ifdef _WIN32
+	m_hFile(INVALID_HANDLE_VALUE),
+	m_hMapping(nullptr)
+#else
+	m_fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const char* pszFilename)
+{
+	Close();
+
+#ifdef _WIN32
+	m_hFile = CreateFileA(pszFilename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_hFile == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart <= 0)
+	{
+		Close();
+
+		return false;
+	}
+	m_size = static_cast<size_t>(size.QuadPart);
+
+	FILETIME lastWriteTime;
+	if (GetFileTime(m_hFile, nullptr, nullptr, &lastWriteTime))
+		m_timeStamp = (static_cast<uint64_t>(lastWriteTime.dwHighDateTime) << 32) | lastWriteTime.dwLowDateTime;
+
+	m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_hMapping)
+	{
+		Close();
+
+		return false;
+	}
+
+	m_pData = static_cast<const char*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	m_fd = open(pszFilename, O_RDONLY);
+	if (m_fd < 0) return false;
+
+	struct stat st;
+	if (fstat(m_fd, &st) || st.st_size <= 0)
+	{
+		Close();
+
+		return false;
+	}
+	m_size = static_cast<size_t>(st.st_size);
+	m_timeStamp = static_cast<uint64_t>(st.st_mtime);
+
+	const auto pData = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	m_pData = pData == MAP_FAILED ? nullptr : static_cast<const char*>(pData);
+	if (m_pData) madvise(const_cast<char*>(m_pData), m_size, MADV_SEQUENTIAL);
+#endif
+
+	if (!m_pData)
+	{
+		Close();
+
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (m_pData) UnmapViewOfFile(m_pData);
+	if (m_hMapping) CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE) CloseHandle(m_hFile);
+	m_hMapping = nullptr;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if (m_pData) munmap(const_cast<char*>(m_pData), m_size);
+	if (m_fd >= 0) close(m_fd);
+	m_fd = -1;
+#endif
+
+	m_pData = nullptr;
+	m_size = 0;
+	m_timeStamp = 0;
+}
+
+const char* MappedFile::GetData() const
+{
+	return m_pData;
+}
+
+size_t MappedFile::GetSize() const
+{
+	return m_size;
+}
+
+uint64_t MappedFile::GetTimeStamp() const
+{
+	return m_timeStamp;
+}
@@ -0,0 +1,35 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+namespace XUSG
+{
+	// Read-only memory mapping of a whole file
+	class MappedFile
+	{
+	public:
+		MappedFile();
+		virtual ~MappedFile();
+
+		bool Open(const char* pszFilename);
+		void Close();
+
+		const char* GetData() const;
+		size_t GetSize() const;
+		uint64_t GetTimeStamp() const;
+
+	protected:
+		const char* m_pData;
+		size_t		m_size;
+		uint64_t	m_timeStamp;
+
+#ifdef _WIN32
+		void*		m_hFile;
+		void*		m_hMapping;
+#else
+		int			m_fd;
+#endif
+	};
+}
@@ -0,0 +1,198 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "XUSGMeshCodec.h"
+
+#if !defined(XUSG_MESH_CODEC_NO_SIMD) && (defined(_M_X64) || defined(__SSSE3__))
+#define XUSG_MESH_CODEC_SSSE3
+#include <tmmintrin.h>
+#endif
+
+using namespace std;
+using namespace XUSG;
+
+#ifdef XUSG_MESH_CODEC_SSSE3
+// For each control byte, the shuffle gathering the 4 values from the data into 32-bit lanes,
+// and the number of data bytes they take
+struct ShuffleTables
+{
+	alignas(16) uint8_t Shuffles[256][16];
+	uint8_t Lengths[256];
+
+	ShuffleTables()
+	{
+		for (auto c = 0u; c < 256; ++c)
+		{
+			uint8_t pos = 0;
+			for (uint8_t k = 0; k < 4; ++k)
+			{
+				const auto length = static_cast<uint8_t>(((c >> (k * 2)) & 3) + 1);
+				for (uint8_t b = 0; b < 4; ++b) Shuffles[c][k * 4 + b] = b < length ? pos + b : 0x80;
+				pos += length;
+			}
+			Lengths[c] = pos;
+		}
+	}
+};
+
+static const ShuffleTables& getShuffleTables()
+{
+	static const ShuffleTables tables;
+
+	return tables;
+}
+#endif
+
+// A stream is the size of the value data, the control bytes, and the value data.
+// With is16Bit, the values are uint16_t at each srcStride, and their differences wrap around at 16 bits.
+static void encodeDeltas(vector<uint8_t>& data, const uint8_t* pSrc, uint32_t srcStride, uint32_t numValues, bool is16Bit)
+{
+	const auto streamOffset = data.size();
+	const auto controlOffset = streamOffset + sizeof(uint32_t);
+	const auto numControls = (numValues + 3) / 4;
+	data.resize(controlOffset + numControls, 0);
+
+	auto prev = 0u;
+	for (auto i = 0u; i < numValues; ++i)
+	{
+		auto value = 0u;
+		if (is16Bit)
+		{
+			uint16_t value16;
+			memcpy(&value16, pSrc + srcStride * i, sizeof(uint16_t));
+			value = value16;
+		}
+		else memcpy(&value, pSrc + srcStride * i, sizeof(uint32_t));
+
+		const auto delta = is16Bit ? static_cast<int16_t>(value - prev) : static_cast<int32_t>(value - prev);
+		const auto zigzag = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+		prev = value;
+
+		const uint8_t length = zigzag < (1u << 8) ? 1 : (zigzag < (1u << 16) ? 2 : (zigzag < (1u << 24) ? 3 : 4));
+		data[controlOffset + i / 4] |= (length - 1) << (i % 4 * 2);
+		for (uint8_t b = 0; b < length; ++b) data.emplace_back(static_cast<uint8_t>(zigzag >> (b * 8)));
+	}
+
+	const auto valueDataSize = static_cast<uint32_t>(data.size() - controlOffset - numControls);
+	memcpy(&data[streamOffset], &valueDataSize, sizeof(uint32_t));
+}
+
+// Without is16Bit, the values are stored contiguously, and dstStride is ignored.
+static size_t decodeDeltas(uint8_t* pDst, uint32_t dstStride, uint32_t numValues,
+	const uint8_t* pData, size_t dataSize, bool is16Bit)
+{
+	const size_t numControls = (numValues + 3) / 4;
+	if (dataSize < sizeof(uint32_t) + numControls) return 0;
+
+	uint32_t valueDataSize;
+	memcpy(&valueDataSize, pData, sizeof(uint32_t));
+	if (valueDataSize > dataSize - sizeof(uint32_t) - numControls) return 0;
+
+	const auto pControls = pData + sizeof(uint32_t);
+	auto pValues = pControls + numControls;
+	const auto pValuesEnd = pValues + valueDataSize;
+	dstStride = is16Bit ? dstStride : sizeof(uint32_t);
+
+	auto prev = 0u;
+	auto i = 0u;
+#ifdef XUSG_MESH_CODEC_SSSE3
+	// 4 values at a time while a full 16-byte load stays within the value data
+	const auto& tables = getShuffleTables();
+	const auto one = _mm_set1_epi32(1);
+	auto prevs = _mm_setzero_si128();
+	for (; i + 4 <= numValues && pValuesEnd - pValues >= 16; i += 4)
+	{
+		const auto control = pControls[i / 4];
+		auto v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pValues)),
+			_mm_load_si128(reinterpret_cast<const __m128i*>(tables.Shuffles[control])));
+		pValues += tables.Lengths[control];
+
+		// Undo the zigzag, then the differences by a prefix sum
+		v = _mm_xor_si128(_mm_srli_epi32(v, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, one)));
+		v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+		v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+		v = _mm_add_epi32(v, prevs);
+		prevs = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+
+		const auto pDstValues = pDst + dstStride * i;
+		if (is16Bit)
+		{
+			const uint16_t values[] =
+			{
+				static_cast<uint16_t>(_mm_extract_epi16(v, 0)), static_cast<uint16_t>(_mm_extract_epi16(v, 2)),
+				static_cast<uint16_t>(_mm_extract_epi16(v, 4)), static_cast<uint16_t>(_mm_extract_epi16(v, 6))
+			};
+			for (uint8_t k = 0; k < 4; ++k) memcpy(pDstValues + dstStride * k, &values[k], sizeof(uint16_t));
+		}
+		else _mm_storeu_si128(reinterpret_cast<__m128i*>(pDstValues), v);
+	}
+	prev = static_cast<uint32_t>(_mm_cvtsi128_si32(prevs));
+#endif
+
+	for (; i < numValues; ++i)
+	{
+		const auto length = ((pControls[i / 4] >> (i % 4 * 2)) & 3) + 1;
+		if (pValuesEnd - pValues < length) return 0;
+
+		auto zigzag = 0u;
+		for (auto b = 0; b < length; ++b) zigzag |= static_cast<uint32_t>(pValues[b]) << (b * 8);
+		pValues += length;
+		prev += (zigzag >> 1) ^ (0u - (zigzag & 1));
+
+		if (is16Bit)
+		{
+			const auto value = static_cast<uint16_t>(prev);
+			memcpy(pDst + dstStride * i, &value, sizeof(uint16_t));
+		}
+		else memcpy(pDst + dstStride * i, &prev, sizeof(uint32_t));
+	}
+
+	return pValues == pValuesEnd ? static_cast<size_t>(pValuesEnd - pData) : 0;
+}
+
+void MeshCodec::EncodeVertices(vector<uint8_t>& data, const uint8_t* pVertices, uint32_t numVertices, uint32_t stride)
+{
+	// One stream per channel, so that each is predicted by the same channel of the previous vertex
+	const auto numChannels = stride / static_cast<uint32_t>(sizeof(uint16_t));
+	for (auto c = 0u; c < numChannels; ++c)
+		if (c != 3) encodeDeltas(data, pVertices + sizeof(uint16_t) * c, stride, numVertices, true);
+}
+
+void MeshCodec::EncodeIndices(vector<uint8_t>& data, const uint32_t* pIndices, uint32_t numIndices)
+{
+	encodeDeltas(data, reinterpret_cast<const uint8_t*>(pIndices), sizeof(uint32_t), numIndices, false);
+}
+
+size_t MeshCodec::DecodeVertices(uint8_t* pVertices, uint32_t numVertices, uint32_t stride,
+	const uint8_t* pData, size_t dataSize)
+{
+	size_t offset = 0;
+	const auto numChannels = stride / static_cast<uint32_t>(sizeof(uint16_t));
+	for (auto c = 0u; c < numChannels; ++c)
+	{
+		if (c == 3)
+		{
+			for (auto i = 0u; i < numVertices; ++i) memset(pVertices + stride * i + sizeof(uint16_t) * c, 0, sizeof(uint16_t));
+			continue;
+		}
+
+		const auto size = decodeDeltas(pVertices + sizeof(uint16_t) * c, stride, numVertices,
+			pData + offset, dataSize - offset, true);
+		if (!size) return 0;
+		offset += size;
+	}
+
+	return offset;
+}
+
+size_t MeshCodec::DecodeIndices(uint32_t* pIndices, uint32_t numIndices, uint32_t numVertices,
+	const uint8_t* pData, size_t dataSize)
+{
+	const auto size = decodeDeltas(reinterpret_cast<uint8_t*>(pIndices), sizeof(uint32_t), numIndices, pData, dataSize, false);
+
+	auto isValid = size > 0;
+	for (auto i = 0u; i < numIndices; ++i) isValid &= pIndices[i] < numVertices;
+
+	return isValid ? size : 0;
+}
@@ -0,0 +1,33 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+namespace XUSG
+{
+	// Compact coding of index buffers and quantized vertices
+	// Each sequence is coded as the zigzagged differences of consecutive values in Stream VByte
+	// [Lemire et al. 2018, "Stream VByte: Faster Byte-Oriented Integer Compression"], i.e. 1 to 4
+	// bytes per value with the lengths packed 4 to a control byte ahead of the data, so that a
+	// decoder reads 4 values with a single byte shuffle. The indices are thus predicted by the
+	// previous index, which is close after a cache-optimized triangle order and vertices in order of
+	// first use, and the vertex attributes by the previous vertex, per channel.
+	// The SSSE3 decoder is built for x64 and whenever __SSSE3__ is defined; define
+	// XUSG_MESH_CODEC_NO_SIMD to build the scalar decoder only.
+	class MeshCodec
+	{
+	public:
+		// The vertices are the uint16_t channels at each stride, e.g. the quantized layout of ObjLoader,
+		// whose 4th channel is the padding after x, y and z and is neither coded nor decoded.
+		static void EncodeVertices(std::vector<uint8_t>& data, const uint8_t* pVertices, uint32_t numVertices, uint32_t stride);
+		static void EncodeIndices(std::vector<uint8_t>& data, const uint32_t* pIndices, uint32_t numIndices);
+
+		// Return the number of bytes read from pData, or 0 if it is truncated or malformed.
+		// DecodeIndices also fails on an index not less than numVertices.
+		static size_t DecodeVertices(uint8_t* pVertices, uint32_t numVertices, uint32_t stride,
+			const uint8_t* pData, size_t dataSize);
+		static size_t DecodeIndices(uint32_t* pIndices, uint32_t numIndices, uint32_t numVertices,
+			const uint8_t* pData, size_t dataSize);
+	};
+}
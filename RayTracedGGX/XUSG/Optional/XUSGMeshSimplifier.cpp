@@ -0,0 +1,463 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "XUSGMeshSimplifier.h"
+#include <cfloat>
+
+using namespace std;
+using namespace XUSG;
+
+//--------------------------------------------------------------------------------------
+// Uniform grid over triangles for closest-point queries
+//--------------------------------------------------------------------------------------
+class MeshSimplifier::TriangleGrid
+{
+public:
+	TriangleGrid(const vector<float3>& positions, const vector<uint32_t>& indices) :
+		m_positions(positions),
+		m_indices(indices)
+	{
+		const auto numTri = static_cast<uint32_t>(indices.size() / 3);
+		m_min = m_max = positions[indices[0]];
+		for (const auto& vi : indices)
+		{
+			const auto& p = positions[vi];
+			m_min = { (min)(p.x, m_min.x), (min)(p.y, m_min.y), (min)(p.z, m_min.z) };
+			m_max = { (max)(p.x, m_max.x), (max)(p.y, m_max.y), (max)(p.z, m_max.z) };
+		}
+
+		// About one triangle per cell
+		const float3 extent = { m_max.x - m_min.x, m_max.y - m_min.y, m_max.z - m_min.z };
+		const auto volume = (max)(extent.x, 1e-6f) * (max)(extent.y, 1e-6f) * (max)(extent.z, 1e-6f);
+		m_cellSize = (max)(cbrtf(volume / numTri), 1e-6f);
+		m_dims[0] = (min)(static_cast<uint32_t>(extent.x / m_cellSize) + 1, 1024u);
+		m_dims[1] = (min)(static_cast<uint32_t>(extent.y / m_cellSize) + 1, 1024u);
+		m_dims[2] = (min)(static_cast<uint32_t>(extent.z / m_cellSize) + 1, 1024u);
+		m_cellSize = (max)((max)(extent.x / m_dims[0], extent.y / m_dims[1]), (max)(extent.z / m_dims[2], 1e-6f));
+
+		// Bin the triangles by their bounding boxes in 2 passes
+		const auto numCells = m_dims[0] * m_dims[1] * m_dims[2];
+		m_cellOffsets.assign(numCells + 1, 0);
+		for (auto pass = 0u; pass < 2; ++pass)
+		{
+			if (pass)
+			{
+				for (auto i = 0u; i < numCells; ++i) m_cellOffsets[i + 1] += m_cellOffsets[i];
+				m_cellTris.resize(m_cellOffsets[numCells]);
+			}
+
+			vector<uint32_t> cellCounts(pass ? numCells : 0, 0);
+			for (auto i = 0u; i < numTri; ++i)
+			{
+				uint32_t lo[3], hi[3];
+				getCellRange(i, lo, hi);
+				for (auto z = lo[2]; z <= hi[2]; ++z)
+					for (auto y = lo[1]; y <= hi[1]; ++y)
+						for (auto x = lo[0]; x <= hi[0]; ++x)
+						{
+							const auto cell = (z * m_dims[1] + y) * m_dims[0] + x;
+							if (pass) m_cellTris[m_cellOffsets[cell] + cellCounts[cell]++] = i;
+							else ++m_cellOffsets[cell + 1];
+						}
+			}
+		}
+	}
+
+	// Returns early with any distance not greater than lowerBound once one is found, since a
+	// max-of-min search only needs the distances that exceed its running maximum.
+	float GetDistance(const float3& p, float lowerBound = 0.0f) const
+	{
+		// Search rings of cells outwards until no closer triangle is possible
+		int32_t c[3];
+		for (uint8_t i = 0; i < 3; ++i)
+			c[i] = (min)((max)(static_cast<int32_t>(((&p.x)[i] - (&m_min.x)[i]) / m_cellSize), 0), static_cast<int32_t>(m_dims[i]) - 1);
+
+		auto bestSq = FLT_MAX;
+		const auto maxRing = static_cast<int32_t>((max)((max)(m_dims[0], m_dims[1]), m_dims[2]));
+		for (auto r = 0; r <= maxRing; ++r)
+		{
+			for (auto z = c[2] - r; z <= c[2] + r; ++z)
+			{
+				if (z < 0 || z >= static_cast<int32_t>(m_dims[2])) continue;
+				for (auto y = c[1] - r; y <= c[1] + r; ++y)
+				{
+					if (y < 0 || y >= static_cast<int32_t>(m_dims[1])) continue;
+					const auto isShell = z == c[2] - r || z == c[2] + r || y == c[1] - r || y == c[1] + r;
+					for (auto x = c[0] - r; x <= c[0] + r; x += isShell ? 1 : 2 * (max)(r, 1))
+					{
+						if (x < 0 || x >= static_cast<int32_t>(m_dims[0])) continue;
+						const auto cell = (z * m_dims[1] + y) * m_dims[0] + x;
+						for (auto i = m_cellOffsets[cell]; i < m_cellOffsets[cell + 1]; ++i)
+							bestSq = (min)(getDistanceSq(p, m_cellTris[i]), bestSq);
+						if (bestSq <= lowerBound * lowerBound) return sqrtf(bestSq);
+					}
+				}
+			}
+
+			// Cells beyond ring r are at least r cells away
+			if (bestSq <= (r * m_cellSize) * (r * m_cellSize)) break;
+		}
+
+		return sqrtf(bestSq);
+	}
+
+protected:
+	void getCellRange(uint32_t tri, uint32_t lo[3], uint32_t hi[3]) const
+	{
+		for (uint8_t i = 0; i < 3; ++i)
+		{
+			auto minVal = FLT_MAX, maxVal = -FLT_MAX;
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				const auto val = (&m_positions[m_indices[tri * 3 + j]].x)[i];
+				minVal = (min)(val, minVal);
+				maxVal = (max)(val, maxVal);
+			}
+			lo[i] = (min)(static_cast<uint32_t>((max)((minVal - (&m_min.x)[i]) / m_cellSize, 0.0f)), m_dims[i] - 1);
+			hi[i] = (min)(static_cast<uint32_t>((max)((maxVal - (&m_min.x)[i]) / m_cellSize, 0.0f)), m_dims[i] - 1);
+		}
+	}
+
+	float getDistanceSq(const float3& p, uint32_t tri) const
+	{
+		// Closest point on triangle by Voronoi regions
+		// [Ericson 2005, "Real-Time Collision Detection", 5.1.5]
+		const auto& a = m_positions[m_indices[tri * 3]];
+		const auto& b = m_positions[m_indices[tri * 3 + 1]];
+		const auto& c = m_positions[m_indices[tri * 3 + 2]];
+		const auto sub = [](const float3& u, const float3& v) { return float3{ u.x - v.x, u.y - v.y, u.z - v.z }; };
+		const auto dot = [](const float3& u, const float3& v) { return u.x * v.x + u.y * v.y + u.z * v.z; };
+		const auto lerp2 = [](const float3& o, const float3& u, const float3& v, float s, float t)
+		{
+			return float3{ o.x + u.x * s + v.x * t, o.y + u.y * s + v.y * t, o.z + u.z * s + v.z * t };
+		};
+		const auto distSq = [&](const float3& q) { const auto d = sub(p, q); return dot(d, d); };
+
+		const auto ab = sub(b, a), ac = sub(c, a), ap = sub(p, a);
+		const auto d1 = dot(ab, ap), d2 = dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f) return distSq(a);
+
+		const auto bp = sub(p, b);
+		const auto d3 = dot(ab, bp), d4 = dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3) return distSq(b);
+
+		const auto vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return distSq(lerp2(a, ab, ac, d1 / (d1 - d3), 0.0f));
+
+		const auto cp = sub(p, c);
+		const auto d5 = dot(ab, cp), d6 = dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6) return distSq(c);
+
+		const auto vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return distSq(lerp2(a, ab, ac, 0.0f, d2 / (d2 - d6)));
+
+		const auto va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+		{
+			const auto w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+			const auto bc = sub(c, b);
+
+			return distSq(float3{ b.x + bc.x * w, b.y + bc.y * w, b.z + bc.z * w });
+		}
+
+		const auto sum = va + vb + vc;
+		if (sum == 0.0f) return distSq(a);	// Degenerate triangle
+
+		return distSq(lerp2(a, ab, ac, vb / sum, vc / sum));
+	}
+
+	const vector<float3>&	m_positions;
+	vector<uint32_t>		m_indices;
+	vector<uint32_t>		m_cellOffsets;
+	vector<uint32_t>		m_cellTris;
+	float3					m_min;
+	float3					m_max;
+	float					m_cellSize;
+	uint32_t				m_dims[3];
+};
+
+//--------------------------------------------------------------------------------------
+// Quadric helpers
+//--------------------------------------------------------------------------------------
+static inline void addPlaneQuadric(double A[10], double a, double b, double c, double d, double w)
+{
+	A[0] += w * a * a; A[1] += w * a * b; A[2] += w * a * c; A[3] += w * a * d;
+	A[4] += w * b * b; A[5] += w * b * c; A[6] += w * b * d;
+	A[7] += w * c * c; A[8] += w * c * d;
+	A[9] += w * d * d;
+}
+
+static inline double evalQuadric(const double A[10], const double B[10], double x, double y, double z)
+{
+	// v^T (A + B) v with v = (x, y, z, 1)
+	double Q[10];
+	for (uint8_t i = 0; i < 10; ++i) Q[i] = A[i] + B[i];
+
+	return x * (Q[0] * x + 2.0 * (Q[1] * y + Q[2] * z + Q[3])) +
+		y * (Q[4] * y + 2.0 * (Q[5] * z + Q[6])) +
+		z * (Q[7] * z + 2.0 * Q[8]) + Q[9];
+}
+
+//--------------------------------------------------------------------------------------
+// Mesh simplifier
+//--------------------------------------------------------------------------------------
+MeshSimplifier::MeshSimplifier()
+{
+}
+
+MeshSimplifier::~MeshSimplifier()
+{
+}
+
+void MeshSimplifier::Init(const uint8_t* pVertices, uint32_t numVertices, uint32_t stride,
+	const uint32_t* pIndices, uint32_t numIndices, bool preserveSeams)
+{
+	m_positions.resize(numVertices);
+	for (auto i = 0u; i < numVertices; ++i) memcpy(&m_positions[i], pVertices + stride * i, sizeof(float3));
+	m_indices.assign(pIndices, pIndices + numIndices);
+
+	if (!preserveSeams)
+	{
+		// Refer the split vertices to the first vertex at the same position
+		vector<uint32_t> order(numVertices);
+		for (auto i = 0u; i < numVertices; ++i) order[i] = i;
+		sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+		{
+			const auto cmp = memcmp(&m_positions[a], &m_positions[b], sizeof(float3));
+
+			return cmp < 0 || (cmp == 0 && a < b);
+		});
+
+		vector<uint32_t> remap(numVertices);
+		for (auto i = 0u; i < numVertices; ++i)
+			remap[order[i]] = i && !memcmp(&m_positions[order[i]], &m_positions[order[i - 1]], sizeof(float3)) ?
+				remap[order[i - 1]] : order[i];
+		for (auto& vi : m_indices) vi = remap[vi];
+	}
+
+	// Lock the vertices on the edges that are not shared by exactly 2 triangles. Unless the split
+	// vertices are referred to a single one, they make their edges boundaries, so the attribute
+	// seams are preserved as well.
+	unordered_map<uint64_t, uint32_t> edgeCounts;
+	edgeCounts.reserve(numIndices);
+	for (auto i = 0u; i < numIndices; ++i)
+	{
+		const auto v0 = m_indices[i];
+		const auto v1 = m_indices[i % 3 == 2 ? i - 2 : i + 1];
+		++edgeCounts[(static_cast<uint64_t>((min)(v0, v1)) << 32) | (max)(v0, v1)];
+	}
+
+	m_isLocked.assign(numVertices, false);
+	for (const auto& edge : edgeCounts)
+	{
+		if (edge.second == 2) continue;
+		m_isLocked[static_cast<uint32_t>(edge.first >> 32)] = true;
+		m_isLocked[static_cast<uint32_t>(edge.first)] = true;
+	}
+
+	m_srcGrid = numIndices ? make_unique<TriangleGrid>(m_positions, m_indices) : nullptr;
+}
+
+void MeshSimplifier::BuildLODChain(vector<LOD>& lods, const float* pTriangleRatios, uint32_t numLODs)
+{
+	const auto numTri = static_cast<uint32_t>(m_indices.size() / 3);
+
+	lods.resize(numLODs);
+	for (auto i = 0u; i < numLODs; ++i)
+	{
+		const auto targetNumTri = static_cast<uint32_t>(numTri * pTriangleRatios[i]);
+		Simplify(lods[i], i ? lods[i - 1].Indices : m_indices, targetNumTri);
+	}
+}
+
+void MeshSimplifier::Simplify(LOD& lod, const vector<uint32_t>& srcIndices, uint32_t targetNumTriangles)
+{
+	const auto numVert = static_cast<uint32_t>(m_positions.size());
+	lod.Indices = srcIndices;
+	auto& indices = lod.Indices;
+
+	// Area-weighted plane quadrics of the triangles around each vertex
+	vector<Quadric> quadrics(numVert, Quadric());
+	for (auto i = 0u; i + 2 < indices.size(); i += 3)
+	{
+		const auto& p0 = getPosition(indices[i]);
+		const auto& p1 = getPosition(indices[i + 1]);
+		const auto& p2 = getPosition(indices[i + 2]);
+		const double e1[] = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+		const double e2[] = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+		double n[] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		const auto l = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (l <= 0.0) continue;
+
+		for (auto& c : n) c /= l;
+		const auto d = -(n[0] * p0.x + n[1] * p0.y + n[2] * p0.z);
+		for (uint8_t j = 0; j < 3; ++j) addPlaneQuadric(quadrics[indices[i + j]].A, n[0], n[1], n[2], d, l * 0.5);
+	}
+
+	struct Collapse
+	{
+		double Cost;
+		uint32_t Src;
+		uint32_t Dst;
+	};
+
+	// Collapse in passes: rank all candidate half-edge collapses, then apply the cheapest
+	// ones that do not touch the neighborhood of another collapse in the same pass.
+	vector<Collapse> collapses;
+	vector<uint32_t> remap(numVert);
+	vector<uint32_t> passIds(numVert, UINT32_MAX);
+	vector<uint32_t> linkMarks(numVert, 0);
+	auto stamp = 0u;
+	vector<uint32_t> adjOffsets, adjTris, numAdjTris;
+	for (auto pass = 0u; indices.size() / 3 > targetNumTriangles; ++pass)
+	{
+		const auto numTri = static_cast<uint32_t>(indices.size() / 3);
+
+		// Vertex-triangle adjacency
+		adjOffsets.assign(numVert + 1, 0);
+		for (const auto& vi : indices) ++adjOffsets[vi + 1];
+		for (auto i = 0u; i < numVert; ++i) adjOffsets[i + 1] += adjOffsets[i];
+		numAdjTris.assign(numVert, 0);
+		adjTris.resize(indices.size());
+		for (auto i = 0u; i < numTri * 3; ++i) adjTris[adjOffsets[indices[i]] + numAdjTris[indices[i]]++] = i / 3;
+
+		collapses.clear();
+		for (auto i = 0u; i < numTri * 3; ++i)
+		{
+			const auto src = indices[i];
+			const auto dst = indices[i % 3 == 2 ? i - 2 : i + 1];
+			for (const auto& c : { Collapse{ 0.0, src, dst }, Collapse{ 0.0, dst, src } })
+			{
+				if (m_isLocked[c.Src]) continue;
+				const auto& p = getPosition(c.Dst);
+				collapses.push_back({ evalQuadric(quadrics[c.Src].A, quadrics[c.Dst].A, p.x, p.y, p.z), c.Src, c.Dst });
+			}
+		}
+		sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+		{
+			return a.Cost < b.Cost || (a.Cost == b.Cost && (a.Src < b.Src || (a.Src == b.Src && a.Dst < b.Dst)));
+		});
+
+		for (auto i = 0u; i < numVert; ++i) remap[i] = i;
+		auto numRemoved = 0u;
+		const auto numToRemove = numTri - targetNumTriangles;
+		for (const auto& c : collapses)
+		{
+			if (numRemoved >= numToRemove) break;
+			if (passIds[c.Src] == pass || passIds[c.Dst] == pass) continue;
+
+			// The link condition: the vertices adjacent to both ends must be exactly the opposite
+			// vertices of the shared triangles, otherwise the collapse pinches the surface, e.g.
+			// closes a band of triangles between 2 rings. Neighbors of the destination are marked
+			// with the stamp, and the opposite vertices of the shared triangles with stamp + 1.
+			stamp += 2;
+			for (auto j = adjOffsets[c.Dst]; j < adjOffsets[c.Dst] + numAdjTris[c.Dst]; ++j)
+				for (uint8_t k = 0; k < 3; ++k) linkMarks[indices[adjTris[j] * 3 + k]] = stamp;
+
+			auto numShared = 0u;
+			for (auto j = adjOffsets[c.Src]; j < adjOffsets[c.Src] + numAdjTris[c.Src]; ++j)
+			{
+				const auto pTri = &indices[adjTris[j] * 3];
+				if (pTri[0] != c.Dst && pTri[1] != c.Dst && pTri[2] != c.Dst) continue;
+				for (uint8_t k = 0; k < 3; ++k) linkMarks[pTri[k]] = stamp + 1;
+				++numShared;
+			}
+			if (numShared == 0) continue;
+
+			// Reject the collapse if a remaining triangle around the source would flip or turn
+			// by more than 60 degrees.
+			auto isValid = true;
+			const auto& q = getPosition(c.Dst);
+			for (auto j = adjOffsets[c.Src]; j < adjOffsets[c.Src] + numAdjTris[c.Src] && isValid; ++j)
+			{
+				const auto pTri = &indices[adjTris[j] * 3];
+				if (pTri[0] == c.Dst || pTri[1] == c.Dst || pTri[2] == c.Dst) continue;
+
+				float3 p[3], r[3];
+				for (uint8_t k = 0; k < 3; ++k)
+				{
+					if (pTri[k] != c.Src && linkMarks[pTri[k]] == stamp) isValid = false;
+					p[k] = getPosition(pTri[k]);
+					r[k] = pTri[k] == c.Src ? q : p[k];
+				}
+				const auto normal = [](const float3 v[3])
+				{
+					const float3 e1 = { v[1].x - v[0].x, v[1].y - v[0].y, v[1].z - v[0].z };
+					const float3 e2 = { v[2].x - v[0].x, v[2].y - v[0].y, v[2].z - v[0].z };
+
+					return float3{ e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x };
+				};
+				const auto n0 = normal(p), n1 = normal(r);
+				const auto n0n1 = n0.x * n1.x + n0.y * n1.y + n0.z * n1.z;
+				const auto n0Sq = n0.x * n0.x + n0.y * n0.y + n0.z * n0.z;
+				const auto n1Sq = n1.x * n1.x + n1.y * n1.y + n1.z * n1.z;
+				isValid = isValid && n0n1 > 0.0f && n0n1 * n0n1 > 0.25f * n0Sq * n1Sq;
+			}
+			if (!isValid) continue;
+
+			// Apply, and freeze the 1-ring of the source for the rest of the pass
+			remap[c.Src] = c.Dst;
+			for (uint8_t k = 0; k < 10; ++k) quadrics[c.Dst].A[k] += quadrics[c.Src].A[k];
+			for (auto j = adjOffsets[c.Src]; j < adjOffsets[c.Src] + numAdjTris[c.Src]; ++j)
+				for (uint8_t k = 0; k < 3; ++k) passIds[indices[adjTris[j] * 3 + k]] = pass;
+			numRemoved += numShared;
+		}
+
+		if (numRemoved == 0) break;
+
+		// Rewrite the triangles, and drop the collapsed ones
+		auto numIndices = 0u;
+		for (auto i = 0u; i < numTri; ++i)
+		{
+			const auto v0 = remap[indices[i * 3]];
+			const auto v1 = remap[indices[i * 3 + 1]];
+			const auto v2 = remap[indices[i * 3 + 2]];
+			if (v0 == v1 || v1 == v2 || v2 == v0) continue;
+			indices[numIndices++] = v0;
+			indices[numIndices++] = v1;
+			indices[numIndices++] = v2;
+		}
+		indices.resize(numIndices);
+	}
+
+	lod.HausdorffError = ComputeHausdorffError(indices);
+}
+
+float MeshSimplifier::ComputeHausdorffError(const vector<uint32_t>& indices) const
+{
+	if (indices.empty() || !m_srcGrid) return 0.0f;
+
+	// Sample each surface at the vertices, edge midpoints and centroids of its triangles,
+	// and take the larger of the 2 one-sided distances.
+	const auto sampleMaxDistance = [this](const vector<uint32_t>& sampled, const TriangleGrid& grid)
+	{
+		auto maxDist = 0.0f;
+		for (auto i = 0u; i + 2 < sampled.size(); i += 3)
+		{
+			const auto& a = getPosition(sampled[i]);
+			const auto& b = getPosition(sampled[i + 1]);
+			const auto& c = getPosition(sampled[i + 2]);
+			const float3 samples[] =
+			{
+				a, b, c,
+				{ (a.x + b.x) * 0.5f, (a.y + b.y) * 0.5f, (a.z + b.z) * 0.5f },
+				{ (b.x + c.x) * 0.5f, (b.y + c.y) * 0.5f, (b.z + c.z) * 0.5f },
+				{ (c.x + a.x) * 0.5f, (c.y + a.y) * 0.5f, (c.z + a.z) * 0.5f },
+				{ (a.x + b.x + c.x) / 3.0f, (a.y + b.y + c.y) / 3.0f, (a.z + b.z + c.z) / 3.0f }
+			};
+			for (const auto& p : samples) maxDist = (max)(grid.GetDistance(p, maxDist), maxDist);
+		}
+
+		return maxDist;
+	};
+
+	const TriangleGrid grid(m_positions, indices);
+
+	return (max)(sampleMaxDistance(m_indices, grid), sampleMaxDistance(indices, *m_srcGrid));
+}
+
+const MeshSimplifier::float3& MeshSimplifier::getPosition(uint32_t i) const
+{
+	return m_positions[i];
+}
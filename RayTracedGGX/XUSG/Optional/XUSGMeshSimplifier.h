@@ -0,0 +1,60 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+namespace XUSG
+{
+	// Quadric-error-metric simplification by half-edge collapses
+	// [Garland and Heckbert 1997, "Surface Simplification Using Quadric Error Metrics"]
+	// The LODs index into the vertex buffer of the source mesh, so they can share it, e.g. for a
+	// proxy BLAS. Boundary and non-manifold edges are preserved, and so are attribute seams unless
+	// disabled, in which case the LODs refer to a single vertex per position.
+	class MeshSimplifier
+	{
+	public:
+		struct LOD
+		{
+			std::vector<uint32_t> Indices;
+			float HausdorffError;	// Symmetric, object space, sampled at vertices, edge midpoints and centroids
+		};
+
+		MeshSimplifier();
+		virtual ~MeshSimplifier();
+
+		// pVertices starts with a float3 position at each stride, e.g. the float layout of ObjLoader.
+		void Init(const uint8_t* pVertices, uint32_t numVertices, uint32_t stride,
+			const uint32_t* pIndices, uint32_t numIndices, bool preserveSeams = true);
+
+		// Each LOD is simplified from the previous one; the triangle ratios are relative to the
+		// source mesh and decreasing. A LOD stops short of its ratio when no valid collapse is left.
+		void BuildLODChain(std::vector<LOD>& lods, const float* pTriangleRatios, uint32_t numLODs);
+		void Simplify(LOD& lod, const std::vector<uint32_t>& srcIndices, uint32_t targetNumTriangles);
+
+		float ComputeHausdorffError(const std::vector<uint32_t>& indices) const;
+
+	protected:
+		struct float3
+		{
+			float x;
+			float y;
+			float z;
+		};
+
+		struct Quadric
+		{
+			double A[10];	// Upper triangle of the symmetric 4x4 matrix
+		};
+
+		class TriangleGrid;
+
+		const float3& getPosition(uint32_t i) const;
+
+		std::vector<float3>		m_positions;
+		std::vector<uint32_t>	m_indices;
+		std::vector<bool>		m_isLocked;
+
+		std::unique_ptr<TriangleGrid> m_srcGrid;
+	};
+}
@@ -3,266 +3,1946 @@
 //--------------------------------------------------------------------------------------
 
 #include "XUSGObjLoader.h"
+#include "XUSGMeshCodec.h"
+
+#if !defined(XUSG_OBJ_LOADER_NO_SIMD) && (defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__))
+#define XUSG_OBJ_LOADER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(XUSG_OBJ_LOADER_SSE2) && defined(__AVX2__)
+#define XUSG_OBJ_LOADER_AVX2
+#include <immintrin.h>
+#endif
 
 using namespace std;
 using namespace XUSG;
 
-ObjLoader::ObjLoader()
+struct ObjLoader::CacheHeader
+{
+	char		Magic[4];
+	uint32_t	Version;
+	uint64_t	SourceSize;
+	uint64_t	SourceTimeStamp;
+	uint64_t	SourceHash;
+	uint32_t	ImportFlags;
+	uint32_t	Stride;
+	uint32_t	NumVertices;
+	uint32_t	NumIndices;
+	uint32_t	NumMeshlets;
+	uint32_t	NumSubmeshes;
+	uint32_t	NumMaterials;
+	uint32_t	MaterialLibSize;	// The mtllib names, each terminated by '\0'
+	uint64_t	MaterialLibHash;	// Of the contents of the mtllib files
+	AABB		BoundingBox;
+	QuantizationError QuantError;
+	SanitizeStats Sanitization;
+	uint64_t	VertexOffset;	// 64-byte aligned
+	uint64_t	IndexOffset;	// 64-byte aligned
+	uint64_t	MeshletOffset;	// 64-byte aligned
+	uint64_t	SubmeshOffset;	// 64-byte aligned
+	uint64_t	MaterialOffset;	// 64-byte aligned
+	uint64_t	MaterialLibOffset;
+};
+
+static const char g_cacheMagic[] = { 'X', 'O', 'B', 'J' };
+static const uint32_t g_cacheVersion = 5;
+static const uint64_t g_cacheAlignment = 64;
+
+// Followed by the submeshes, the materials, and the MeshCodec vertex and index streams
+struct CompressedMeshHeader
+{
+	char		Magic[4];
+	uint32_t	Version;
+	uint32_t	Stride;	// Of the quantized layout
+	uint32_t	NumVertices;
+	uint32_t	NumIndices;
+	uint32_t	NumSubmeshes;
+	uint32_t	NumMaterials;
+	ObjLoader::AABB BoundingBox;	// Of the quantization
+};
+
+static const char g_compressedMagic[] = { 'X', 'M', 'S', 'H' };
+static const uint32_t g_compressedVersion = 1;
+
+static inline uint64_t alignCacheOffset(uint64_t offset)
 {
+	return (offset + g_cacheAlignment - 1) / g_cacheAlignment * g_cacheAlignment;
 }
 
-ObjLoader::~ObjLoader()
+static inline bool isDigit(char c)
 {
+	return c >= '0' && c <= '9';
 }
 
-bool ObjLoader::Import(const char* pszFilename, bool needNorm, bool needAABB, bool forDX, bool swapYZ)
+static inline bool isBlank(char c)
 {
-	FILE* pFile;
-	fopen_s(&pFile, pszFilename, "r");
+	return c == ' ' || c == '\t' || c == '\r';
+}
 
-	if (!pFile) return false;
+static inline const char* skipBlanks(const char* p, const char* pEnd)
+{
+	while (p < pEnd && isBlank(*p)) ++p;
 
-	m_stride = sizeof(float3);
-	m_stride += needNorm ? sizeof(float3) : 0;
+	return p;
+}
 
-	// Import the OBJ file.
-	uint32_t numTexc, numNorm;
-	importGeometryFirstPass(pFile, numTexc, numNorm);
-	rewind(pFile);
-	importGeometrySecondPass(pFile, numTexc, numNorm, forDX, swapYZ);
-	fclose(pFile);
+static inline const char* skipLine(const char* p, const char* pEnd)
+{
+	const auto pEol = static_cast<const char*>(memchr(p, '\n', pEnd - p));
 
-	// Perform post import tasks.
-	if (needNorm && !numNorm) recomputeNormals();
-	if (needAABB) computeAABB();
+	return pEol ? pEol + 1 : pEnd;
+}
 
-	return true;
+static inline const char* parseInt(const char* p, const char* pEnd, int64_t& value)
+{
+	const auto neg = p < pEnd && *p == '-';
+	auto q = p < pEnd && (*p == '-' || *p == '+') ? p + 1 : p;
+	if (q >= pEnd || !isDigit(*q)) return p;
+
+	int64_t i = 0;
+	for (; q < pEnd && isDigit(*q); ++q) i = i * 10 + (*q - '0');
+	value = neg ? -i : i;
+
+	return q;
 }
 
-const uint32_t ObjLoader::GetNumVertices() const
+static const char* parseFloat(const char* p, const char* pEnd, float& value)
 {
-	return static_cast<uint32_t>(m_vertices.size() / GetVertexStride());
+	static const double pow10[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	const auto pStart = p;
+	const auto neg = p < pEnd && *p == '-';
+	if (p < pEnd && (*p == '-' || *p == '+')) ++p;
+
+	// Fast path: up to 15 significant digits are exact in a double, and so is 10^n for n <= 22,
+	// so the quotient below is correctly rounded.
+	uint64_t mantissa = 0;
+	auto numDigits = 0u;
+	auto numFracDigits = 0u;
+	for (; p < pEnd && isDigit(*p); ++p, ++numDigits) mantissa = mantissa * 10 + (*p - '0');
+	if (p < pEnd && *p == '.')
+		for (++p; p < pEnd && isDigit(*p); ++p, ++numDigits, ++numFracDigits)
+			mantissa = mantissa * 10 + (*p - '0');
+
+	auto isFastPath = numDigits > 0 && numDigits <= 15 && numFracDigits < size(pow10) &&
+		(p >= pEnd || (*p != 'e' && *p != 'E'));
+	if (isFastPath)
+	{
+		const auto d = static_cast<double>(mantissa) / pow10[numFracDigits];
+
+		// Rounding the double to float again is only wrong when the double lands exactly
+		// on a float rounding midpoint, so leave those rare cases to the CRT.
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(d));
+		isFastPath = (bits & 0x1fffffff) != 0x10000000;
+		if (isFastPath) value = neg ? -static_cast<float>(d) : static_cast<float>(d);
+	}
+
+	if (!isFastPath)
+	{
+		// Exponents, long mantissas, inf and nan
+		p = pStart;
+		while (p < pEnd && !isBlank(*p) && *p != '\n') ++p;
+		const string token(pStart, p);
+		char* pTokenEnd;
+		value = strtof(token.c_str(), &pTokenEnd);
+		p = pStart + (pTokenEnd - token.c_str());
+	}
+
+	return p;
 }
 
-const uint32_t ObjLoader::GetNumIndices() const
+static string parseName(const char* p, const char* pEnd)
 {
-	return static_cast<uint32_t>(m_indices.size());
+	// The rest of the line without the surrounding blanks
+	p = skipBlanks(p, pEnd);
+	auto pNameEnd = p;
+	while (pNameEnd < pEnd && *pNameEnd != '\n') ++pNameEnd;
+	while (pNameEnd > p && isBlank(pNameEnd[-1])) --pNameEnd;
+
+	return string(p, pNameEnd);
 }
 
-const uint32_t ObjLoader::GetVertexStride() const
+static uint32_t findOrAddName(vector<string>& names, const string& name)
 {
-	return m_stride;
+	const auto i = static_cast<uint32_t>(find(names.cbegin(), names.cend(), name) - names.cbegin());
+	if (i == names.size()) names.emplace_back(name);
+
+	return i;
 }
 
-const uint8_t* ObjLoader::GetVertices() const
+static void parseNames(const char* p, const char* pEnd, vector<string>& names)
 {
-	return m_vertices.data();
+	// Blank-separated names on the rest of the line, each added once
+	for (p = skipBlanks(p, pEnd); p < pEnd && *p != '\n'; p = skipBlanks(p, pEnd))
+	{
+		const auto pName = p;
+		while (p < pEnd && !isBlank(*p) && *p != '\n') ++p;
+		findOrAddName(names, string(pName, p));
+	}
 }
 
-const uint32_t* ObjLoader::GetIndices() const
+static string getDirectory(const char* pszFilename)
 {
-	return m_indices.data();
+	const string path(pszFilename);
+
+	return path.substr(0, path.find_last_of("/\\") + 1);
 }
 
-const ObjLoader::AABB& ObjLoader::GetAABB() const
+// Sets the index counts from the starts of the next submeshes, drops the empty ones,
+// and mirrors the ranges if the index buffer has been reversed.
+static void finalizeSubmeshes(vector<ObjLoader::Submesh>& submeshes, uint32_t numIndices, bool isReversed)
 {
-	return m_aabb;
+	auto numSubmeshes = 0u;
+	for (auto i = 0u; i < submeshes.size(); ++i)
+	{
+		auto submesh = submeshes[i];
+		submesh.NumIndices = (i + 1 < submeshes.size() ? submeshes[i + 1].FirstIndex : numIndices) - submesh.FirstIndex;
+		if (submesh.NumIndices) submeshes[numSubmeshes++] = submesh;
+	}
+	submeshes.resize(numSubmeshes);
+
+	if (isReversed)
+	{
+		for (auto& submesh : submeshes) submesh.FirstIndex = numIndices - submesh.FirstIndex - submesh.NumIndices;
+		reverse(submeshes.begin(), submeshes.end());
+	}
 }
 
-void ObjLoader::importGeometryFirstPass(FILE* pFile, uint32_t& numTexc, uint32_t& numNorm)
+ObjLoader::ImportOptions::ImportOptions() :
+	NeedNorm(true),
+	NeedAABB(true),
+	ForDX(true),
+	SwapYZ(false),
+	UseCache(false),
+	NumThreads(0),
+	PostProcesses(POST_PROCESS_NONE)
 {
-	auto v = 0u;
-	auto vt = 0u;
-	auto vn = 0u;
-	char buffer[256] = { 0 };
+}
 
-	auto numVert = 0u;
-	auto numTri = 0u;
-	numTexc = 0;
-	numNorm = 0;
+ObjLoader::ObjLoader() :
+	m_isQuantized(false),
+	m_isSplit(false),
+	m_quantError(),
+	m_sanitizeStats(),
+	m_importTime(0.0),
+	m_codecStats(),
+	m_pCacheHeader(nullptr)
+{
+}
 
-	while (fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer))) != EOF)
+ObjLoader::~ObjLoader()
+{
+}
+
+// The start of a submesh at o, g or usemtl; MaterialName indexes the names of the chunk,
+// or is UINT32_MAX to keep the material of the previous submesh.
+struct GroupStart
+{
+	uint32_t FirstIndex;
+	uint32_t MaterialName;
+};
+
+struct GeometryChunk
+{
+	vector<ObjLoader::float3> Positions;
+	vector<ObjLoader::float3> Normals;
+	vector<uint32_t> Indices;
+	vector<uint32_t> NIndices;
+	vector<uint32_t> RelIndices;	// Offsets in Indices of relative (negative) references
+	vector<uint32_t> RelNIndices;	// Offsets in NIndices of relative (negative) references
+	vector<GroupStart> GroupStarts;
+	vector<string> MaterialNames;
+	vector<string> MaterialLibs;
+	uint32_t NumTexc = 0;
+};
+
+// Relative indices are resolved against the elements of the chunk, and rebased
+// onto the elements of the preceding chunks when the chunks are stitched together.
+static void parseGeometryChunk(const char* p, const char* pEnd, GeometryChunk& chunk, bool forDX, bool swapYZ)
+{
+	for (; p < pEnd; p = skipLine(p, pEnd))
 	{
-		switch (buffer[0])
+		p = skipBlanks(p, pEnd);
+		if (p >= pEnd) break;
+
+		// Read the keyword
+		const auto pKeyword = p;
+		while (p < pEnd && !isBlank(*p) && *p != '\n') ++p;
+		const auto keywordLen = p - pKeyword;
+
+		if (keywordLen == 1 && pKeyword[0] == 'f') // v, v//vn, v/vt, or v/vt/vn.
 		{
-		case 'f':   // v, v//vn, v/vt, v/vt/vn.
-			fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer)));
+			uint32_t v[3] = { 0 };
+			uint32_t vn[3] = { 0 };
+			bool isRelV[3] = { false };
+			bool isRelVn[3] = { false };
 
-			if (strstr(buffer, "//")) // v//vn
+			for (auto i = 0u;; ++i)
 			{
-				sscanf_s(buffer, "%u//%u", &v, &vn);
-				fscanf_s(pFile, "%u//%u", &v, &vn);
-				fscanf_s(pFile, "%u//%u", &v, &vn);
-				++numTri;
+				int64_t vi;
+				p = skipBlanks(p, pEnd);
+				const auto pNext = parseInt(p, pEnd, vi);
+				if (pNext == p) break;
+				p = pNext;
+				isRelV[2] = vi < 0;
+				v[2] = static_cast<uint32_t>(vi < 0 ? vi + static_cast<int64_t>(chunk.Positions.size()) : vi - 1);
+
+				vn[2] = 0;
+				isRelVn[2] = false;
+				if (p < pEnd && *p == '/')
+				{
+					p = parseInt(p + 1, pEnd, vi); // Texcoord indices are unused
+					if (p < pEnd && *p == '/')
+					{
+						vi = 1;
+						p = parseInt(p + 1, pEnd, vi);
+						isRelVn[2] = vi < 0;
+						vn[2] = static_cast<uint32_t>(vi < 0 ? vi + static_cast<int64_t>(chunk.Normals.size()) : vi - 1);
+					}
+				}
 
-				while (fscanf_s(pFile, "%u//%u", &v, &vn) > 0) ++numTri;
+				// Triangulate as a fan
+				if (i >= 2)
+				{
+					// Normal indices are only recorded once they become nonzero; missing ones are zero.
+					const auto hasNIndices = !chunk.NIndices.empty() || !chunk.Normals.empty() || (vn[0] | vn[1] | vn[2]);
+					if (hasNIndices) chunk.NIndices.resize(chunk.Indices.size());
+					for (uint8_t j = 0; j < 3; ++j)
+					{
+						if (isRelV[j]) chunk.RelIndices.push_back(static_cast<uint32_t>(chunk.Indices.size()));
+						if (isRelVn[j]) chunk.RelNIndices.push_back(static_cast<uint32_t>(chunk.Indices.size()));
+						chunk.Indices.push_back(v[j]);
+						if (hasNIndices) chunk.NIndices.push_back(vn[j]);
+					}
+				}
+
+				const auto j = (min)(i, 1u);
+				v[j] = v[2];
+				vn[j] = vn[2];
+				isRelV[j] = isRelV[2];
+				isRelVn[j] = isRelVn[2];
 			}
-			else if (sscanf_s(buffer, "%u/%u/%u", &v, &vt, &vn) == 3) // v/vt/vn
+		}
+		else if (keywordLen == 1 && pKeyword[0] == 'v')
+		{
+			ObjLoader::float3 pos(0.0f, 0.0f, 0.0f);
+			p = parseFloat(skipBlanks(p, pEnd), pEnd, pos.x);
+			p = parseFloat(skipBlanks(p, pEnd), pEnd, pos.y);
+			p = parseFloat(skipBlanks(p, pEnd), pEnd, pos.z);
+			if (swapYZ)
 			{
-				fscanf_s(pFile, "%u/%u/%u", &v, &vt, &vn);
-				fscanf_s(pFile, "%u/%u/%u", &v, &vt, &vn);
-				++numTri;
-
-				while (fscanf_s(pFile, "%u/%u/%u", &v, &vt, &vn) > 0) ++numTri;
-
-				//m_hasTexcoord = true;
+				const auto tmp = pos.y;
+				pos.y = pos.z;
+				pos.z = tmp;
 			}
-			else if (sscanf_s(buffer, "%u/%u", &v, &vt) == 2) // v/vt
+			pos.z = forDX ? -pos.z : pos.z;
+			chunk.Positions.push_back(pos);
+		}
+		else if (keywordLen == 2 && pKeyword[0] == 'v' && pKeyword[1] == 'n')
+		{
+			ObjLoader::float3 norm(0.0f, 0.0f, 0.0f);
+			p = parseFloat(skipBlanks(p, pEnd), pEnd, norm.x);
+			p = parseFloat(skipBlanks(p, pEnd), pEnd, norm.y);
+			p = parseFloat(skipBlanks(p, pEnd), pEnd, norm.z);
+			if (swapYZ)
 			{
-				fscanf_s(pFile, "%u/%u", &v, &vt);
-				fscanf_s(pFile, "%u/%u", &v, &vt);
-				++numTri;
+				const auto tmp = norm.y;
+				norm.y = norm.z;
+				norm.z = tmp;
+			}
+			norm.z = forDX ? -norm.z : norm.z;
+			chunk.Normals.push_back(norm);
+		}
+		else if (keywordLen == 2 && pKeyword[0] == 'v' && pKeyword[1] == 't') ++chunk.NumTexc;
+		else if (keywordLen == 1 && (pKeyword[0] == 'o' || pKeyword[0] == 'g'))
+			chunk.GroupStarts.push_back({ static_cast<uint32_t>(chunk.Indices.size()), UINT32_MAX });
+		else if (keywordLen == 6 && memcmp(pKeyword, "usemtl", 6) == 0)
+		{
+			const auto materialName = findOrAddName(chunk.MaterialNames, parseName(p, pEnd));
+			chunk.GroupStarts.push_back({ static_cast<uint32_t>(chunk.Indices.size()), materialName });
+		}
+		else if (keywordLen == 6 && memcmp(pKeyword, "mtllib", 6) == 0) parseNames(p, pEnd, chunk.MaterialLibs);
+	}
+}
 
-				while (fscanf_s(pFile, "%u/%u", &v, &vt) > 0) ++numTri;
+static void parallelFor(uint32_t numTasks, uint32_t numThreads, const function<void(uint32_t)>& func)
+{
+	atomic<uint32_t> nextTask(0);
+	const auto worker = [&]()
+	{
+		for (auto i = nextTask++; i < numTasks; i = nextTask++) func(i);
+	};
 
-				//m_hasTexcoord = true;
-			}
-			else // v
-			{
-				fscanf_s(pFile, "%u", &v);
-				fscanf_s(pFile, "%u", &v);
-				++numTri;
+	// The calling thread works as well
+	vector<thread> threads;
+	numThreads = (min)(numThreads, numTasks);
+	for (auto i = 1u; i < numThreads; ++i) threads.emplace_back(worker);
+	worker();
 
-				while (fscanf_s(pFile, "%u", &v) > 0)
-					++numTri;
-			}
-			break;
+	for (auto& t : threads) t.join();
+}
 
-		case 'v':   // v, vt, or vn
-			switch (buffer[1])
-			{
-			case '\0':
-				fgets(buffer, sizeof(buffer), pFile);
-				++numVert;
-				break;
-			case 't':
-				fgets(buffer, sizeof(buffer), pFile);
-				++numTexc;
-				break;
-			case 'n':
-				fgets(buffer, sizeof(buffer), pFile);
-				++numNorm;
-				break;
-			default:
-				break;
-			}
-			break;
+static uint64_t hashBytes(const char* pData, size_t size)
+{
+	// FNV-1a over 64-bit words, with an xorshift to fold the high bits back down
+	const uint64_t prime = 0x100000001b3;
+	auto h = 0xcbf29ce484222325 ^ size;
 
-		default:
-			fgets(buffer, sizeof(buffer), pFile);
-			break;
-		}
+	auto i = size_t(0);
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, &pData[i], sizeof(word));
+		h = (h ^ word) * prime;
+		h ^= h >> 29;
 	}
 
-	// Allocate memory for the OBJ model data.
-	const auto numIdx = numTri * 3;
-	m_stride += m_stride <= sizeof(float3) && numNorm ? sizeof(float3) : 0;
-	m_stride += numTexc ? sizeof(float[2]) : 0;
-	m_vertices.reserve(m_stride * (max)((max)(numVert, numTexc), numNorm));
-	m_vertices.resize(m_stride * numVert);
-	m_indices.resize(numIdx);
+	for (; i < size; ++i) h = (h ^ static_cast<uint8_t>(pData[i])) * prime;
+
+	return h;
 }
 
-void ObjLoader::importGeometrySecondPass(FILE* pFile, uint32_t numTexc, uint32_t numNorm, bool forDX, bool swapYZ)
+static uint64_t hashMaterialLibs(const string& directory, const vector<string>& libs)
 {
-	auto numVert = 0u;
-	auto numTri = 0u;
-	char buffer[256] = { 0 };
+	// A missing file hashes as an empty one
+	auto h = hashBytes(nullptr, 0);
+	for (const auto& lib : libs)
+	{
+		MappedFile file;
+		const auto libHash = file.Open((directory + lib).c_str()) ? hashBytes(file.GetData(), file.GetSize()) : hashBytes(nullptr, 0);
+		h = (h ^ libHash) * 0x100000001b3;
+		h ^= h >> 29;
+	}
 
-	vector<float3> normals;
-	vector<uint32_t> tIndices, nIndices;
-	if (numTexc) tIndices.resize(m_indices.size());
-	if (numNorm) nIndices.resize(m_indices.size());
-	normals.reserve(numNorm);
+	return h;
+}
 
-	while (fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer))) != EOF)
+bool ObjLoader::Import(const char* pszFilename, bool needNorm, bool needAABB, bool forDX, bool swapYZ)
+{
+	ImportOptions options;
+	options.NeedNorm = needNorm;
+	options.NeedAABB = needAABB;
+	options.ForDX = forDX;
+	options.SwapYZ = swapYZ;
+
+	return Import(pszFilename, options);
+}
+
+bool ObjLoader::Import(const char* pszFilename, const ImportOptions& options)
+{
+	const auto needNorm = options.NeedNorm;
+	const auto needAABB = options.NeedAABB;
+	const auto forDX = options.ForDX;
+	const auto swapYZ = options.SwapYZ;
+	const auto numThreads = options.NumThreads;
+	const auto postProcesses = options.PostProcesses;
+	auto useCache = options.UseCache;
+
+	const auto startTime = chrono::steady_clock::now();
+	const auto getElapsedTime = [&startTime]() { return chrono::duration<double>(chrono::steady_clock::now() - startTime).count(); };
+
+	m_stride = sizeof(float3);
+	m_stride += needNorm ? sizeof(float3) : 0;
+	m_vertices.clear();
+	m_indices.clear();
+	m_meshlets.clear();
+	m_submeshes.clear();
+	m_materials.clear();
+	m_materialNames.clear();
+	m_materialLibs.clear();
+	m_isQuantized = (postProcesses & QUANTIZE_VERTICES) == QUANTIZE_VERTICES;
+	m_isSplit = (postProcesses & SPLIT_VERTEX_STREAMS) == SPLIT_VERTEX_STREAMS;
+	m_quantError = QuantizationError();
+	m_sanitizeStats = SanitizeStats();
+	m_importTime = 0.0;
+	m_codecStats = CodecStats();
+	m_cache.Close();
+	m_pCacheHeader = nullptr;
+
+	// Try the binary cache next to the OBJ file.
+	MappedFile file;
+	const auto isMapped = file.Open(pszFilename);
+	const auto isCompressed = isMapped && file.GetSize() >= sizeof(g_compressedMagic) &&
+		memcmp(file.GetData(), g_compressedMagic, sizeof(g_compressedMagic)) == 0;
+	useCache = useCache && !isCompressed;
+	const auto cacheFileName = string(pszFilename) + ".cache";
+	const auto importFlags = (needNorm ? 1u : 0u) | (needAABB ? 2u : 0u) | (forDX ? 4u : 0u) | (swapYZ ? 8u : 0u) | (postProcesses << 4);
+	const auto weld = (postProcesses & WELD_VERTICES) == WELD_VERTICES;
+	const auto sourceHash = useCache && isMapped ? hashBytes(file.GetData(), file.GetSize()) : 0;
+	if (useCache && isMapped && loadCache(cacheFileName.c_str(), file, sourceHash, importFlags))
 	{
-		switch (buffer[0])
-		{
-		case 'f': // v, v//vn, v/vt, or v/vt/vn.
-			loadIndices(pFile, numTri, numTexc, numNorm, nIndices, tIndices);
-			break;
-		case 'v': // v, vn, or vt.
-			switch (buffer[1])
-			{
-			case '\0': // v
-			{
-				auto& p = getPosition(numVert++);
-				fscanf_s(pFile, "%f %f %f", &p.x, &p.y, &p.z);
-				if (swapYZ)
-				{
-					const auto tmp = p.y;
-					p.y = p.z;
-					p.z = tmp;
-				}
-				p.z = forDX ? -p.z : p.z;
-				break;
-			}
-			case 'n':
-				normals.emplace_back();
-				fscanf_s(pFile, "%f %f %f",
-					&normals.back().x,
-					&normals.back().y,
-					&normals.back().z);
-				if (swapYZ)
-				{
-					const auto tmp = normals.back().y;
-					normals.back().y = normals.back().z;
-					normals.back().z = tmp;
-				}
-				normals.back().z = forDX ? -normals.back().z : normals.back().z;
-			default:
-				break;
-			}
-			break;
+		m_importTime = getElapsedTime();
 
-		default:
-			fgets(buffer, sizeof(buffer), pFile);
-			break;
-		}
+		return true;
+	}
+
+	// Import the OBJ file.
+	uint32_t numNorm;
+	if (isCompressed)
+	{
+		if (!importCompressed(file.GetData(), file.GetSize(), numNorm)) return false;
+	}
+	else if (isMapped) importGeometryChunked(file.GetData(), file.GetSize(), numThreads, numNorm, forDX, swapYZ, weld);
+	else
+	{
+		// Fall back to buffered I/O if the file cannot be mapped, e.g. it is empty
+		FILE* pFile;
+		fopen_s(&pFile, pszFilename, "r");
+
+		if (!pFile) return false;
+
+		uint32_t numTexc;
+		importGeometryFirstPass(pFile, numTexc, numNorm);
+		rewind(pFile);
+		importGeometrySecondPass(pFile, numTexc, numNorm, forDX, swapYZ, weld);
+		fclose(pFile);
 	}
 
-	computePerVertexNormals(normals, nIndices);
+	if (!isCompressed) loadMaterials(pszFilename);
+
+	// Perform post import tasks.
+	if (postProcesses & SANITIZE_MESH) sanitize(numThreads);
+	if (needNorm && !numNorm) recomputeNormals(numThreads);
+	if (needAABB || m_isQuantized) computeAABB();
+
+	// With both orderings, the spatial sort gives the vertex cache optimizer a coherent start
+	if (postProcesses & SORT_TRIANGLES_SPATIALLY) sortTrianglesByMortonCode();
+	if (postProcesses & OPTIMIZE_VERTEX_CACHE) optimizeVertexCache();
+	if (postProcesses & BUILD_MESHLETS) buildMeshlets();
+	if (postProcesses & (SORT_TRIANGLES_SPATIALLY | OPTIMIZE_VERTEX_CACHE | BUILD_MESHLETS)) reorderVerticesByFirstUse();
+	if (m_isQuantized) quantizeVertices();
+	if (m_isSplit) splitVertexStreams();
+
+	// A failure to write the cache is not an import failure.
+	if (useCache && isMapped) saveCache(cacheFileName.c_str(), file, sourceHash, importFlags);
+	m_importTime = getElapsedTime();
 
-	if ((forDX && !swapYZ) || (!forDX && swapYZ)) reverse(m_indices.begin(), m_indices.end());
+	return true;
 }
 
-void ObjLoader::loadIndices(FILE* pFile, uint32_t& numTri, uint32_t numTexc,
-	uint32_t numNorm, vector<uint32_t>& nIndices, vector<uint32_t>& tIndices)
+future<bool> ObjLoader::ImportAsync(const char* pszFilename, const ImportOptions& options)
 {
-	int64_t vi;
-	uint32_t v[3] = { 0 };
-	uint32_t vt[3] = { 0 };
-	uint32_t vn[3] = { 0 };
+	const string fileName(pszFilename);
 
-	const auto numVert = GetNumVertices();
+	return async(launch::async, [=]()
+	{
+		return Import(fileName.c_str(), options);
+	});
+}
 
-	for (uint8_t i = 0; i < 3; ++i)
+// Grows in fixed-size pages, so that it never copies, nor holds twice its memory while growing
+template<typename T>
+class PagedArray
+{
+public:
+	PagedArray(size_t& memoryUsage, size_t memoryCap) :
+		m_memoryUsage(memoryUsage),
+		m_memoryCap(memoryCap),
+		m_size(0)
 	{
-		fscanf_s(pFile, "%lld", &vi);
-		v[i] = static_cast<uint32_t>(vi < 0 ? vi + numVert : vi - 1);
-		m_indices[numTri * 3 + i] = v[i];
+	}
 
-		if (tIndices.size() > 0)
+	bool PushBack(const T& element)
+	{
+		if (m_size == m_pages.size() << PageBits)
 		{
-			fscanf_s(pFile, "/%lld", &vi);
-			vt[i] = static_cast<uint32_t>(vi < 0 ? vi + numTexc : vi - 1);
-			tIndices[numTri * 3 + i] = vt[i];
+			const auto pageSize = sizeof(T) << PageBits;
+			if (pageSize > m_memoryCap - m_memoryUsage) return false;
+			m_pages.emplace_back(new T[size_t(1) << PageBits]);
+			m_memoryUsage += pageSize;
 		}
-		else if (nIndices.size() > 0) fscanf_s(pFile, "/");
+		(*this)[m_size++] = element;
 
-		if (nIndices.size() > 0)
-		{
-			fscanf_s(pFile, "/%lld", &vi);
-			vn[i] = static_cast<uint32_t>(vi < 0 ? vi + numNorm : vi - 1);
-			nIndices[numTri * 3 + i] = vn[i];
-		}
+		return true;
 	}
-	++numTri;
 
-	v[1] = v[2];
-	vt[1] = vt[2];
-	vn[1] = vn[2];
+	T& operator[](size_t i) { return m_pages[i >> PageBits][i & ((size_t(1) << PageBits) - 1)]; }
+	size_t GetSize() const { return m_size; }
+
+protected:
+	static const uint32_t PageBits = 14;
+
+	vector<unique_ptr<T[]>> m_pages;
+	size_t&	m_memoryUsage;
+	size_t	m_memoryCap;
+	size_t	m_size;
+};
+
+bool ObjLoader::ImportStreamed(const char* pszFilename, const StreamCallback& onBatch,
+	uint32_t batchSize, size_t memoryCap, bool needNorm, bool forDX, bool swapYZ)
+{
+	// The vertex made for each (position, normal) index pair. The first pair of a position is
+	// stored with it, and any further ones are chained in a separate array.
+	struct VertexRef
+	{
+		uint32_t NormalIndex;
+		uint32_t Vertex;
+		uint32_t Next;
+	};
+
+	const auto stride = static_cast<uint32_t>(sizeof(float3)) * (needNorm ? 2 : 1);
+	const size_t readSize = 1 << 20;
+	batchSize = (max)(batchSize, 1u);
+
+	// The read and batch buffers are allocated upfront; a line longer than the read buffer grows it.
+	auto memoryUsage = readSize + static_cast<size_t>(batchSize) * 3 * (stride + sizeof(uint32_t) + (needNorm ? 1 : 0));
+	if (memoryUsage > memoryCap) return false;
+
+	FILE* pFile;
+	fopen_s(&pFile, pszFilename, "rb");
+	if (!pFile) return false;
+
+	vector<char> buffer(readSize);
+	vector<uint8_t> batchVertices(static_cast<size_t>(batchSize) * 3 * stride);
+	vector<uint32_t> batchIndices(static_cast<size_t>(batchSize) * 3);
+	vector<uint8_t> needsNormal(needNorm ? static_cast<size_t>(batchSize) * 3 : 0);
+	PagedArray<float3> positions(memoryUsage, memoryCap);
+	PagedArray<float3> normals(memoryUsage, memoryCap);
+	PagedArray<VertexRef> vertexRefs(memoryUsage, memoryCap);
+	PagedArray<VertexRef> splitRefs(memoryUsage, memoryCap);
+	PagedArray<uint32_t> vertexPositions(memoryUsage, memoryCap);	// Only for the normals
+
+	StreamBatch batch = {};
+	batch.pVertices = batchVertices.data();
+	batch.pIndices = batchIndices.data();
+	batch.Stride = stride;
+
+	// The unit face normals of the batch summed per vertex, as by recomputeNormals(), for the
+	// new vertices without a normal in the file
+	const auto computeNormals = [&]()
+	{
+		if (find(needsNormal.cbegin(), needsNormal.cbegin() + batch.NumVertices, 1) == needsNormal.cbegin() + batch.NumVertices) return;
+
+		const auto getNewNormal = [&](uint32_t vertex)
+		{
+			const auto i = vertex - batch.FirstVertex;
+
+			return i < batch.NumVertices && needsNormal[i] ?
+				reinterpret_cast<float3*>(&batchVertices[static_cast<size_t>(i) * stride + sizeof(float3)]) : nullptr;
+		};
+
+		for (auto i = 0u; i < batch.NumIndices; i += 3)
+		{
+			const auto pTri = &batchIndices[i];
+			float3* pNormals[] = { getNewNormal(pTri[0]), getNewNormal(pTri[1]), getNewNormal(pTri[2]) };
+			if (!pNormals[0] && !pNormals[1] && !pNormals[2]) continue;
+
+			const auto& p0 = positions[vertexPositions[pTri[0]]];
+			const auto& p1 = positions[vertexPositions[pTri[1]]];
+			const auto& p2 = positions[vertexPositions[pTri[2]]];
+			const float3 e1(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+			const float3 e2(p2.x - p1.x, p2.y - p1.y, p2.z - p1.z);
+			const float3 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+			const auto l = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+			if (!(l > 0.0f)) continue;
+
+			for (const auto& pNormal : pNormals)
+			{
+				if (!pNormal) continue;
+				pNormal->x += n.x / l;
+				pNormal->y += n.y / l;
+				pNormal->z += n.z / l;
+			}
+		}
+
+		for (auto i = 0u; i < batch.NumVertices; ++i)
+		{
+			if (!needsNormal[i]) continue;
+			const auto pNormal = getNewNormal(batch.FirstVertex + i);
+			const auto l = sqrt(pNormal->x * pNormal->x + pNormal->y * pNormal->y + pNormal->z * pNormal->z);
+			if (!(l > 0.0f)) continue;
+			pNormal->x /= l;
+			pNormal->y /= l;
+			pNormal->z /= l;
+		}
+	};
+
+	const auto flush = [&]()
+	{
+		if (batch.NumIndices == 0 && batch.NumVertices == 0) return true;
+		if (needNorm) computeNormals();
+		if (!onBatch(batch)) return false;
+		batch.FirstVertex += batch.NumVertices;
+		batch.NumVertices = 0;
+		batch.NumIndices = 0;
+
+		return true;
+	};
+
+	const auto findVertex = [&](uint32_t vi, uint32_t vni, uint32_t& vertex)
+	{
+		// Find the vertex of the pair, or make one in the current batch
+		auto pRef = &vertexRefs[vi];
+		if (pRef->Vertex != UINT32_MAX)
+		{
+			while (pRef->NormalIndex != vni && pRef->Next != UINT32_MAX) pRef = &splitRefs[pRef->Next];
+			if (pRef->NormalIndex == vni)
+			{
+				vertex = pRef->Vertex;
+
+				return true;
+			}
+
+			if (!splitRefs.PushBack({ vni, UINT32_MAX, UINT32_MAX })) return false;
+			pRef->Next = static_cast<uint32_t>(splitRefs.GetSize() - 1);
+			pRef = &splitRefs[pRef->Next];
+		}
+		else pRef->NormalIndex = vni;
+
+		if (batch.NumVertices == batchSize * 3 && !flush()) return false;
+		vertex = pRef->Vertex = batch.FirstVertex + batch.NumVertices;
+		const auto pDst = &batchVertices[static_cast<size_t>(batch.NumVertices++) * stride];
+		memcpy(pDst, &positions[vi], sizeof(float3));
+		if (needNorm)
+		{
+			if (!vertexPositions.PushBack(vi)) return false;
+			needsNormal[batch.NumVertices - 1] = vni == UINT32_MAX;
+
+			float3 n(0.0f, 0.0f, 0.0f);
+			if (vni != UINT32_MAX)
+			{
+				n = normals[vni];
+				const auto l = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+				if (l > 0.0f)
+				{
+					n.x /= l;
+					n.y /= l;
+					n.z /= l;
+				}
+			}
+			memcpy(pDst + sizeof(float3), &n, sizeof(float3));
+		}
+
+		return true;
+	};
+
+	const auto parseVector = [&](const char* p, const char* pEnd)
+	{
+		float3 v(0.0f, 0.0f, 0.0f);
+		p = parseFloat(skipBlanks(p, pEnd), pEnd, v.x);
+		p = parseFloat(skipBlanks(p, pEnd), pEnd, v.y);
+		p = parseFloat(skipBlanks(p, pEnd), pEnd, v.z);
+		if (swapYZ)
+		{
+			const auto tmp = v.y;
+			v.y = v.z;
+			v.z = tmp;
+		}
+		v.z = forDX ? -v.z : v.z;
+
+		return v;
+	};
+
+	// Returns false to abort on an out-of-range index, the memory cap, or a cancelled batch.
+	const auto parseLine = [&](const char* p, const char* pEnd)
+	{
+		p = skipBlanks(p, pEnd);
+		const auto pKeyword = p;
+		while (p < pEnd && !isBlank(*p) && *p != '\n') ++p;
+		const auto keywordLen = p - pKeyword;
+
+		if (keywordLen == 1 && pKeyword[0] == 'f') // v, v//vn, v/vt, or v/vt/vn.
+		{
+			const auto numPos = static_cast<int64_t>(positions.GetSize());
+			const auto numNorm = static_cast<int64_t>(normals.GetSize());
+			uint32_t v[3] = { 0 };
+
+			// Start a new batch unless the face fits in this one, so that the normals computed for
+			// its vertices take all of its triangles. Only a face larger than a batch is split.
+			auto numFaceVerts = 0u;
+			for (auto q = skipBlanks(p, pEnd); q < pEnd && *q != '\n'; q = skipBlanks(q, pEnd), ++numFaceVerts)
+				while (q < pEnd && !isBlank(*q) && *q != '\n') ++q;
+			if (numFaceVerts >= 3 && (batch.NumVertices + numFaceVerts > batchSize * 3 ||
+				batch.NumIndices + (numFaceVerts - 2) * 3 > batchSize * 3) && !flush()) return false;
+
+			for (auto i = 0u;; ++i)
+			{
+				int64_t vi;
+				p = skipBlanks(p, pEnd);
+				const auto pNext = parseInt(p, pEnd, vi);
+				if (pNext == p) break;
+				p = pNext;
+				vi = vi < 0 ? vi + numPos : vi - 1;
+				if (vi < 0 || vi >= numPos) return false;
+
+				// Without normals, a vertex is made per position.
+				auto vni = int64_t(-1);
+				if (p < pEnd && *p == '/')
+				{
+					int64_t vti;
+					p = parseInt(p + 1, pEnd, vti); // Texcoord indices are unused
+					if (p < pEnd && *p == '/')
+					{
+						const auto pNormal = p + 1;
+						p = parseInt(pNormal, pEnd, vni);
+						if (p == pNormal || !needNorm) vni = -1;
+						else
+						{
+							vni = vni < 0 ? vni + numNorm : vni - 1;
+							if (vni < 0 || vni >= numNorm) return false;
+						}
+					}
+				}
+
+				if (!findVertex(static_cast<uint32_t>(vi), vni < 0 ? UINT32_MAX : static_cast<uint32_t>(vni), v[2])) return false;
+
+				// Triangulate as a fan, with the winding reversed per triangle where the whole
+				// index buffer is reversed by Import()
+				if (i >= 2)
+				{
+					const auto reverseWinding = (forDX && !swapYZ) || (!forDX && swapYZ);
+					const auto pDst = &batchIndices[batch.NumIndices];
+					pDst[0] = reverseWinding ? v[2] : v[0];
+					pDst[1] = v[1];
+					pDst[2] = reverseWinding ? v[0] : v[2];
+					batch.NumIndices += 3;
+					if (batch.NumIndices == batchSize * 3 && !flush()) return false;
+				}
+
+				v[(min)(i, 1u)] = v[2];
+			}
+		}
+		else if (keywordLen == 1 && pKeyword[0] == 'v')
+		{
+			if (!positions.PushBack(parseVector(p, pEnd))) return false;
+			if (!vertexRefs.PushBack({ UINT32_MAX, UINT32_MAX, UINT32_MAX })) return false;
+		}
+		else if (needNorm && keywordLen == 2 && pKeyword[0] == 'v' && pKeyword[1] == 'n')
+		{
+			if (!normals.PushBack(parseVector(p, pEnd))) return false;
+		}
+
+		return true;
+	};
+
+	// Parse the complete lines in the read buffer, and carry the incomplete last one over.
+	auto success = true;
+	auto numCarried = size_t(0);
+	for (auto isEof = false; success && !isEof;)
+	{
+		if (numCarried == buffer.size())
+		{
+			// Grow for a line longer than the buffer, with both buffers alive while resizing
+			if (buffer.size() * 2 > memoryCap - memoryUsage)
+			{
+				success = false;
+				break;
+			}
+			memoryUsage += buffer.size();
+			buffer.resize(buffer.size() * 2);
+		}
+
+		const auto numRead = fread(buffer.data() + numCarried, 1, buffer.size() - numCarried, pFile);
+		isEof = numRead < buffer.size() - numCarried;
+		success = !ferror(pFile);
+
+		const auto pData = buffer.data();
+		const auto pEnd = pData + numCarried + numRead;
+		auto p = static_cast<const char*>(pData);
+		while (success && p < pEnd)
+		{
+			auto pEol = static_cast<const char*>(memchr(p, '\n', pEnd - p));
+			if (!pEol && !isEof) break;
+			pEol = pEol ? pEol : pEnd;
+			success = parseLine(p, pEol);
+			p = pEol < pEnd ? pEol + 1 : pEnd;
+		}
+
+		numCarried = pEnd - p;
+		memmove(pData, p, numCarried);
+	}
+	fclose(pFile);
+
+	return success && flush();
+}
+
+uint32_t ObjLoader::GetNumVertices() const
+{
+	return m_pCacheHeader ? m_pCacheHeader->NumVertices : static_cast<uint32_t>(m_vertices.size() / GetVertexStride());
+}
+
+uint32_t ObjLoader::GetNumIndices() const
+{
+	return m_pCacheHeader ? m_pCacheHeader->NumIndices : static_cast<uint32_t>(m_indices.size());
+}
+
+uint32_t ObjLoader::GetVertexStride() const
+{
+	return m_stride;
+}
+
+const uint8_t* ObjLoader::GetVertices() const
+{
+	return m_pCacheHeader ? reinterpret_cast<const uint8_t*>(m_cache.GetData() + m_pCacheHeader->VertexOffset) : m_vertices.data();
+}
+
+const uint32_t* ObjLoader::GetIndices() const
+{
+	return m_pCacheHeader ? reinterpret_cast<const uint32_t*>(m_cache.GetData() + m_pCacheHeader->IndexOffset) : m_indices.data();
+}
+
+const ObjLoader::AABB& ObjLoader::GetAABB() const
+{
+	return m_aabb;
+}
+
+uint32_t ObjLoader::GetPositionStride() const
+{
+	return m_isSplit ? getPositionSize() : m_stride;
+}
+
+uint32_t ObjLoader::GetAttributeStride() const
+{
+	const auto positionSize = getPositionSize();
+	if (m_stride <= positionSize) return 0;
+
+	return m_isSplit ? m_stride - positionSize : m_stride;
+}
+
+const uint8_t* ObjLoader::GetPositions() const
+{
+	return GetVertices();
+}
+
+const uint8_t* ObjLoader::GetAttributes() const
+{
+	if (!GetAttributeStride()) return nullptr;
+
+	const auto positionSize = getPositionSize();
+
+	return GetVertices() + (m_isSplit ? static_cast<size_t>(positionSize) * GetNumVertices() : positionSize);
+}
+
+double ObjLoader::GetImportTime() const
+{
+	return m_importTime;
+}
+
+// The position stream followed by the attribute stream, from the interleaved vertices and back
+static void splitStreams(uint8_t* pDst, const uint8_t* pSrc, uint32_t numVertices, uint32_t stride, uint32_t positionSize)
+{
+	const auto attributeSize = stride - positionSize;
+	const auto pAttributes = pDst + static_cast<size_t>(positionSize) * numVertices;
+	for (auto i = 0u; i < numVertices; ++i)
+	{
+		memcpy(pDst + positionSize * i, pSrc + stride * i, positionSize);
+		memcpy(pAttributes + attributeSize * i, pSrc + stride * i + positionSize, attributeSize);
+	}
+}
+
+static void interleaveStreams(uint8_t* pDst, const uint8_t* pSrc, uint32_t numVertices, uint32_t stride, uint32_t positionSize)
+{
+	const auto attributeSize = stride - positionSize;
+	const auto pAttributes = pSrc + static_cast<size_t>(positionSize) * numVertices;
+	for (auto i = 0u; i < numVertices; ++i)
+	{
+		memcpy(pDst + stride * i, pSrc + positionSize * i, positionSize);
+		memcpy(pDst + stride * i + positionSize, pAttributes + attributeSize * i, attributeSize);
+	}
+}
+
+bool ObjLoader::ExportCompressed(const char* pszFilename) const
+{
+	const auto numVert = GetNumVertices();
+	const auto stride = GetVertexStride();
+
+	CompressedMeshHeader header = {};
+	memcpy(header.Magic, g_compressedMagic, sizeof(g_compressedMagic));
+	header.Version = g_compressedVersion;
+	header.NumVertices = numVert;
+	header.NumIndices = GetNumIndices();
+	header.NumSubmeshes = GetNumSubmeshes();
+	header.NumMaterials = GetNumMaterials();
+
+	// The codec takes the interleaved layout.
+	vector<uint8_t> interleaved;
+	auto pVertices = GetVertices();
+	if (m_isSplit)
+	{
+		interleaved.resize(static_cast<size_t>(stride) * numVert);
+		interleaveStreams(interleaved.data(), pVertices, numVert, stride, getPositionSize());
+		pVertices = interleaved.data();
+	}
+
+	// Quantize within the bounds of the positions, unless already quantized
+	vector<uint8_t> quantized;
+	if (m_isQuantized)
+	{
+		header.Stride = stride;
+		header.BoundingBox = m_aabb;
+	}
+	else
+	{
+		auto& aabb = header.BoundingBox;
+		for (auto i = 0u; i < numVert; ++i)
+		{
+			float3 p;
+			memcpy(&p, pVertices + stride * i, sizeof(float3));
+			aabb.Min = i ? float3((min)(p.x, aabb.Min.x), (min)(p.y, aabb.Min.y), (min)(p.z, aabb.Min.z)) : p;
+			aabb.Max = i ? float3((max)(p.x, aabb.Max.x), (max)(p.y, aabb.Max.y), (max)(p.z, aabb.Max.z)) : p;
+		}
+
+		header.Stride = GetQuantizedStride(stride);
+		quantized.resize(static_cast<size_t>(header.Stride) * numVert);
+		QuantizeVertices(quantized.data(), pVertices, numVert, stride, aabb);
+		pVertices = quantized.data();
+	}
+
+	const auto pSubmeshes = reinterpret_cast<const uint8_t*>(GetSubmeshes());
+	const auto pMaterials = reinterpret_cast<const uint8_t*>(GetMaterials());
+	vector<uint8_t> data(reinterpret_cast<const uint8_t*>(&header), reinterpret_cast<const uint8_t*>(&header + 1));
+	data.insert(data.end(), pSubmeshes, pSubmeshes + sizeof(Submesh) * header.NumSubmeshes);
+	data.insert(data.end(), pMaterials, pMaterials + sizeof(Material) * header.NumMaterials);
+	MeshCodec::EncodeVertices(data, pVertices, numVert, header.Stride);
+	MeshCodec::EncodeIndices(data, GetIndices(), header.NumIndices);
+
+	FILE* pFile;
+	fopen_s(&pFile, pszFilename, "wb");
+	if (!pFile) return false;
+
+	const auto success = fwrite(data.data(), 1, data.size(), pFile) == data.size();
+
+	return fclose(pFile) == 0 && success;
+}
+
+const ObjLoader::CodecStats& ObjLoader::GetCodecStats() const
+{
+	return m_codecStats;
+}
+
+uint32_t ObjLoader::GetNumMeshlets() const
+{
+	return m_pCacheHeader ? m_pCacheHeader->NumMeshlets : static_cast<uint32_t>(m_meshlets.size());
+}
+
+const ObjLoader::Meshlet* ObjLoader::GetMeshlets() const
+{
+	return m_pCacheHeader ? reinterpret_cast<const Meshlet*>(m_cache.GetData() + m_pCacheHeader->MeshletOffset) : m_meshlets.data();
+}
+
+uint32_t ObjLoader::GetNumSubmeshes() const
+{
+	return m_pCacheHeader ? m_pCacheHeader->NumSubmeshes : static_cast<uint32_t>(m_submeshes.size());
+}
+
+const ObjLoader::Submesh* ObjLoader::GetSubmeshes() const
+{
+	return m_pCacheHeader ? reinterpret_cast<const Submesh*>(m_cache.GetData() + m_pCacheHeader->SubmeshOffset) : m_submeshes.data();
+}
+
+uint32_t ObjLoader::GetNumMaterials() const
+{
+	return m_pCacheHeader ? m_pCacheHeader->NumMaterials : static_cast<uint32_t>(m_materials.size());
+}
+
+const ObjLoader::Material* ObjLoader::GetMaterials() const
+{
+	return m_pCacheHeader ? reinterpret_cast<const Material*>(m_cache.GetData() + m_pCacheHeader->MaterialOffset) : m_materials.data();
+}
+
+uint32_t ObjLoader::CullMeshlets(uint32_t* pVisible, const Meshlet* pMeshlets, uint32_t numMeshlets,
+	const float3& eyePt, const float planes[6][4])
+{
+	// Normalize the planes so that their distances compare against the radii
+	float normPlanes[6][4];
+	for (uint8_t i = 0; i < 6; ++i)
+	{
+		const auto l = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+		for (uint8_t j = 0; j < 4; ++j) normPlanes[i][j] = l > 0.0f ? planes[i][j] / l : planes[i][j];
+	}
+
+	auto numVisible = 0u;
+	for (auto i = 0u; i < numMeshlets; ++i)
+	{
+		const auto& meshlet = pMeshlets[i];
+		const auto& c = meshlet.Center;
+
+		// The sphere is outside any plane
+		auto isCulled = false;
+		for (uint8_t j = 0; j < 6 && !isCulled; ++j)
+			isCulled = normPlanes[j][0] * c.x + normPlanes[j][1] * c.y + normPlanes[j][2] * c.z + normPlanes[j][3] < -meshlet.Radius;
+
+		// All triangles face away from the eye for every point in the sphere
+		// [Kapoulkine, meshoptimizer, "meshopt_computeMeshletBounds"]
+		if (!isCulled)
+		{
+			const float3 v(c.x - eyePt.x, c.y - eyePt.y, c.z - eyePt.z);
+			const auto l = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+			const auto& a = meshlet.ConeAxis;
+			isCulled = v.x * a.x + v.y * a.y + v.z * a.z >= meshlet.ConeCutoff * l + meshlet.Radius;
+		}
+
+		if (!isCulled) pVisible[numVisible++] = i;
+	}
+
+	return numVisible;
+}
+
+bool ObjLoader::IsQuantized() const
+{
+	return m_isQuantized;
+}
+
+bool ObjLoader::HasSplitStreams() const
+{
+	return m_isSplit;
+}
+
+const ObjLoader::SanitizeStats& ObjLoader::GetSanitizeStats() const
+{
+	return m_sanitizeStats;
+}
+
+const ObjLoader::QuantizationError& ObjLoader::GetQuantizationError() const
+{
+	return m_quantError;
+}
+
+uint32_t ObjLoader::GetQuantizedStride(uint32_t stride)
+{
+	// 16-bit UNORM x, y, z and padding, then a 2x16-bit SNORM octahedral normal if present
+	return sizeof(uint16_t[4]) + (stride >= sizeof(float3[2]) ? sizeof(uint32_t) : 0);
+}
+
+static inline float unormScale(float minVal, float maxVal)
+{
+	return maxVal > minVal ? 65535.0f / (maxVal - minVal) : 0.0f;
+}
+
+static inline uint16_t encodeUnorm16(float val, float minVal, float scale)
+{
+	return static_cast<uint16_t>(lrintf((max)((min)((val - minVal) * scale, 65535.0f), 0.0f)));
+}
+
+static inline uint32_t encodeOctahedral(const ObjLoader::float3& n)
+{
+	// Project onto the octahedron |x| + |y| + |z| = 1, and fold the lower hemisphere over the diagonals
+	const auto l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	const auto invL1 = l1 > 0.0f ? 1.0f / l1 : 0.0f;
+	auto u = n.x * invL1;
+	auto v = n.y * invL1;
+	if (n.z < 0.0f)
+	{
+		const auto w = u;
+		u = copysignf(1.0f - fabsf(v), w);
+		v = copysignf(1.0f - fabsf(w), v);
+	}
+
+	const auto qu = lrintf((max)((min)(u, 1.0f), -1.0f) * 32767.0f);
+	const auto qv = lrintf((max)((min)(v, 1.0f), -1.0f) * 32767.0f);
+
+	return (static_cast<uint32_t>(qu) & 0xffff) | (static_cast<uint32_t>(qv) << 16);
+}
+
+static inline ObjLoader::float3 decodeOctahedral(uint32_t q)
+{
+	auto u = (max)(static_cast<int16_t>(q & 0xffff) * (1.0f / 32767.0f), -1.0f);
+	auto v = (max)(static_cast<int16_t>(q >> 16) * (1.0f / 32767.0f), -1.0f);
+	const auto z = 1.0f - fabsf(u) - fabsf(v);
+	const auto t = (max)(-z, 0.0f);
+	u -= copysignf(t, u);
+	v -= copysignf(t, v);
+	const auto invL = 1.0f / sqrtf(u * u + v * v + z * z);
+
+	return ObjLoader::float3(u * invL, v * invL, z * invL);
+}
+
+void ObjLoader::QuantizeVertices(uint8_t* pDst, const uint8_t* pSrc, uint32_t numVertices,
+	uint32_t stride, const AABB& aabb)
+{
+	const auto hasNormal = stride >= sizeof(float3[2]);
+	const auto dstStride = GetQuantizedStride(stride);
+	const float3 scale(unormScale(aabb.Min.x, aabb.Max.x), unormScale(aabb.Min.y, aabb.Max.y), unormScale(aabb.Min.z, aabb.Max.z));
+
+	auto i = 0u;
+#ifdef XUSG_OBJ_LOADER_SSE2
+	// 4 vertices at a time in SoA form; the 16-byte loads read past the last float3 of a
+	// vertex, so the last vertex is always left to the scalar loop.
+	const auto minX = _mm_set1_ps(aabb.Min.x), minY = _mm_set1_ps(aabb.Min.y), minZ = _mm_set1_ps(aabb.Min.z);
+	const auto scaleX = _mm_set1_ps(scale.x), scaleY = _mm_set1_ps(scale.y), scaleZ = _mm_set1_ps(scale.z);
+	const auto zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), unormMax = _mm_set1_ps(65535.0f);
+	const auto snormMax = _mm_set1_ps(32767.0f), signMask = _mm_set1_ps(-0.0f);
+	const auto unormBias = _mm_set1_epi32(32768), signFlip = _mm_set1_epi16(-32768);
+	const auto encodeUnorm = [&](__m128 val, __m128 minVal, __m128 scl)
+	{
+		// Bias to the int16 range for the signed saturating pack
+		const auto q = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_sub_ps(val, minVal), scl), unormMax), zero));
+		return _mm_sub_epi32(q, unormBias);
+	};
+	const auto copySign = [&](__m128 mag, __m128 sgn) { return _mm_or_ps(_mm_andnot_ps(signMask, mag), _mm_and_ps(signMask, sgn)); };
+	const auto absVal = [&](__m128 val) { return _mm_andnot_ps(signMask, val); };
+
+	for (; i + 4 < numVertices; i += 4)
+	{
+		const auto pSrcVert = pSrc + stride * i;
+		const auto pDstVert = pDst + dstStride * i;
+
+		auto x = _mm_loadu_ps(reinterpret_cast<const float*>(pSrcVert));
+		auto y = _mm_loadu_ps(reinterpret_cast<const float*>(pSrcVert + stride));
+		auto z = _mm_loadu_ps(reinterpret_cast<const float*>(pSrcVert + stride * 2));
+		auto w = _mm_loadu_ps(reinterpret_cast<const float*>(pSrcVert + stride * 3));
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		// [x0..3, z0..3] and [y0..3, 0] interleave to x, y, z, 0 per vertex
+		const auto xz = _mm_xor_si128(_mm_packs_epi32(encodeUnorm(x, minX, scaleX), encodeUnorm(z, minZ, scaleZ)), signFlip);
+		const auto y0 = _mm_xor_si128(_mm_packs_epi32(encodeUnorm(y, minY, scaleY), _mm_sub_epi32(_mm_setzero_si128(), unormBias)), signFlip);
+		const auto xy = _mm_unpacklo_epi16(xz, y0);
+		const auto z0 = _mm_unpackhi_epi16(xz, y0);
+		const auto v01 = _mm_unpacklo_epi32(xy, z0);
+		const auto v23 = _mm_unpackhi_epi32(xy, z0);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(pDstVert), v01);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(pDstVert + dstStride), _mm_unpackhi_epi64(v01, v01));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(pDstVert + dstStride * 2), v23);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(pDstVert + dstStride * 3), _mm_unpackhi_epi64(v23, v23));
+
+		if (hasNormal)
+		{
+			x = _mm_loadu_ps(reinterpret_cast<const float*>(pSrcVert + sizeof(float3)));
+			y = _mm_loadu_ps(reinterpret_cast<const float*>(pSrcVert + stride + sizeof(float3)));
+			z = _mm_loadu_ps(reinterpret_cast<const float*>(pSrcVert + stride * 2 + sizeof(float3)));
+			w = _mm_loadu_ps(reinterpret_cast<const float*>(pSrcVert + stride * 3 + sizeof(float3)));
+			_MM_TRANSPOSE4_PS(x, y, z, w);
+
+			const auto l1 = _mm_add_ps(_mm_add_ps(absVal(x), absVal(y)), absVal(z));
+			const auto invL1 = _mm_and_ps(_mm_div_ps(one, l1), _mm_cmpgt_ps(l1, zero));
+			auto u = _mm_mul_ps(x, invL1);
+			auto v = _mm_mul_ps(y, invL1);
+			const auto isLower = _mm_cmplt_ps(z, zero);
+			const auto foldedU = copySign(_mm_sub_ps(one, absVal(v)), u);
+			const auto foldedV = copySign(_mm_sub_ps(one, absVal(u)), v);
+			u = _mm_or_ps(_mm_and_ps(isLower, foldedU), _mm_andnot_ps(isLower, u));
+			v = _mm_or_ps(_mm_and_ps(isLower, foldedV), _mm_andnot_ps(isLower, v));
+
+			const auto qu = _mm_cvtps_epi32(_mm_mul_ps(_mm_max_ps(_mm_min_ps(u, one), _mm_sub_ps(zero, one)), snormMax));
+			const auto qv = _mm_cvtps_epi32(_mm_mul_ps(_mm_max_ps(_mm_min_ps(v, one), _mm_sub_ps(zero, one)), snormMax));
+			const auto uv = _mm_packs_epi32(qu, qv);
+			auto q = _mm_unpacklo_epi16(uv, _mm_unpackhi_epi64(uv, uv));
+			for (uint8_t j = 0; j < 4; ++j, q = _mm_srli_si128(q, 4))
+			{
+				const auto nrm = static_cast<uint32_t>(_mm_cvtsi128_si32(q));
+				memcpy(pDstVert + dstStride * j + sizeof(uint16_t[4]), &nrm, sizeof(uint32_t));
+			}
+		}
+	}
+#endif
+
+	for (; i < numVertices; ++i)
+	{
+		float3 p, n;
+		memcpy(&p, pSrc + stride * i, sizeof(float3));
+		const uint16_t q[] = { encodeUnorm16(p.x, aabb.Min.x, scale.x), encodeUnorm16(p.y, aabb.Min.y, scale.y), encodeUnorm16(p.z, aabb.Min.z, scale.z), 0 };
+		memcpy(pDst + dstStride * i, q, sizeof(q));
+
+		if (hasNormal)
+		{
+			memcpy(&n, pSrc + stride * i + sizeof(float3), sizeof(float3));
+			const auto nrm = encodeOctahedral(n);
+			memcpy(pDst + dstStride * i + sizeof(q), &nrm, sizeof(uint32_t));
+		}
+	}
+}
+
+void ObjLoader::DequantizeVertices(uint8_t* pDst, const uint8_t* pSrc, uint32_t numVertices,
+	uint32_t stride, const AABB& aabb)
+{
+	const auto hasNormal = stride >= sizeof(float3[2]);
+	const auto srcStride = GetQuantizedStride(stride);
+	const float3 step((aabb.Max.x - aabb.Min.x) / 65535.0f, (aabb.Max.y - aabb.Min.y) / 65535.0f, (aabb.Max.z - aabb.Min.z) / 65535.0f);
+
+	auto i = 0u;
+#ifdef XUSG_OBJ_LOADER_SSE2
+	const auto minPt = _mm_setr_ps(aabb.Min.x, aabb.Min.y, aabb.Min.z, 0.0f);
+	const auto stepPt = _mm_setr_ps(step.x, step.y, step.z, 0.0f);
+	const auto zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), invSnormMax = _mm_set1_ps(1.0f / 32767.0f);
+	const auto signMask = _mm_set1_ps(-0.0f);
+	const auto store3 = [](uint8_t* pDst, __m128 val)
+	{
+		_mm_storel_pi(reinterpret_cast<__m64*>(pDst), val);
+		_mm_store_ss(reinterpret_cast<float*>(pDst) + 2, _mm_movehl_ps(val, val));
+	};
+	const auto absVal = [&](__m128 val) { return _mm_andnot_ps(signMask, val); };
+
+	for (; i + 4 <= numVertices; i += 4)
+	{
+		const auto pSrcVert = pSrc + srcStride * i;
+		const auto pDstVert = pDst + stride * i;
+
+		// Positions in AoS form: x, y, z, 0 per vertex
+		for (uint8_t j = 0; j < 4; ++j)
+		{
+			const auto q = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pSrcVert + srcStride * j));
+			const auto p = _mm_add_ps(minPt, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(q, _mm_setzero_si128())), stepPt));
+			store3(pDstVert + stride * j, p);
+		}
+
+		if (hasNormal)
+		{
+			// Normals in SoA form
+			uint32_t nrms[4];
+			for (uint8_t j = 0; j < 4; ++j) memcpy(&nrms[j], pSrcVert + srcStride * j + sizeof(uint16_t[4]), sizeof(uint32_t));
+			const auto q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(nrms));
+			auto u = _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(q, 16), 16)), invSnormMax), _mm_sub_ps(zero, one));
+			auto v = _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(q, 16)), invSnormMax), _mm_sub_ps(zero, one));
+			auto z = _mm_sub_ps(_mm_sub_ps(one, absVal(u)), absVal(v));
+			const auto t = _mm_max_ps(_mm_sub_ps(zero, z), zero);
+			u = _mm_sub_ps(u, _mm_or_ps(t, _mm_and_ps(signMask, u)));
+			v = _mm_sub_ps(v, _mm_or_ps(t, _mm_and_ps(signMask, v)));
+			const auto invL = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v)), _mm_mul_ps(z, z))));
+			u = _mm_mul_ps(u, invL);
+			v = _mm_mul_ps(v, invL);
+			z = _mm_mul_ps(z, invL);
+			auto w = zero;
+			_MM_TRANSPOSE4_PS(u, v, z, w);
+			store3(pDstVert + sizeof(float3), u);
+			store3(pDstVert + stride + sizeof(float3), v);
+			store3(pDstVert + stride * 2 + sizeof(float3), z);
+			store3(pDstVert + stride * 3 + sizeof(float3), w);
+		}
+	}
+#endif
+
+	for (; i < numVertices; ++i)
+	{
+		uint16_t q[4];
+		memcpy(q, pSrc + srcStride * i, sizeof(q));
+		const float3 p(aabb.Min.x + q[0] * step.x, aabb.Min.y + q[1] * step.y, aabb.Min.z + q[2] * step.z);
+		memcpy(pDst + stride * i, &p, sizeof(float3));
+
+		if (hasNormal)
+		{
+			uint32_t nrm;
+			memcpy(&nrm, pSrc + srcStride * i + sizeof(q), sizeof(uint32_t));
+			const auto n = decodeOctahedral(nrm);
+			memcpy(pDst + stride * i + sizeof(float3), &n, sizeof(float3));
+		}
+	}
+
+	// Texcoords are not quantized
+	if (stride % sizeof(float3))
+		for (i = 0; i < numVertices; ++i)
+			memset(pDst + stride * (i + 1) - sizeof(float[2]), 0, sizeof(float[2]));
+}
+
+ObjLoader::VertexCacheStats ObjLoader::SimulateVertexCache(const uint32_t* pIndices,
+	uint32_t numIndices, uint32_t numVertices, uint32_t cacheSize)
+{
+	// FIFO post-transform cache: a vertex is resident until cacheSize misses after its own.
+	vector<uint32_t> missStamps(numVertices, 0);
+	auto numMisses = 0u;
+	auto numReferenced = 0u;
+	for (auto i = 0u; i < numIndices; ++i)
+	{
+		auto& missStamp = missStamps[pIndices[i]];
+		numReferenced += missStamp ? 0 : 1;
+		if (!missStamp || numMisses - missStamp >= cacheSize) missStamp = ++numMisses;
+	}
+
+	VertexCacheStats stats;
+	stats.ACMR = numIndices ? static_cast<float>(numMisses) / (numIndices / 3) : 0.0f;
+	stats.ATVR = numReferenced ? static_cast<float>(numMisses) / numReferenced : 0.0f;
+
+	return stats;
+}
+
+float ObjLoader::CodecStats::GetCompressionRatio() const
+{
+	return EncodedSize ? static_cast<float>(DecodedSize) / EncodedSize : 0.0f;
+}
+
+double ObjLoader::CodecStats::GetDecodeThroughput() const
+{
+	return DecodeTime > 0.0 ? DecodedSize / DecodeTime : 0.0;
+}
+
+float ObjLoader::FetchReuseStats::GetHitRatio(uint32_t numLines) const
+{
+	// Fully associative LRU of numLines lines: hits are the fetches with a reuse distance below it.
+	// Histogram buckets are powers of 2, so numLines is rounded down to one.
+	auto numHits = 0ull;
+	for (auto i = 0u; i < std::size(Histogram) && (1ull << i) <= numLines; ++i) numHits += Histogram[i];
+
+	return NumFetches ? static_cast<float>(numHits) / NumFetches : 0.0f;
+}
+
+ObjLoader::FetchReuseStats ObjLoader::ReplayHitFetches(const uint32_t* pIndices, uint32_t vertexStride,
+	const uint32_t* pPrimitiveIndices, uint32_t numHits, uint32_t cacheLineSize)
+{
+	// Replays the loads of getVertices() in RayTracing.hlsl for a trace of hit PrimitiveIndex()
+	// values: the 3 indices, then the 3 vertices. The reuse distance of a cache-line access is
+	// the number of distinct lines accessed since the previous access to the same line, counted
+	// with a Fenwick tree over the time of the most recent access to each line.
+	FetchReuseStats stats = {};
+
+	vector<uint64_t> lines;
+	lines.reserve(numHits * 6ull);
+	const uint64_t vbTag = 1ull << 63;
+	for (auto i = 0u; i < numHits; ++i)
+	{
+		const auto primIdx = pPrimitiveIndices[i];
+		const auto ibOffset = sizeof(uint32_t) * 3ull * primIdx;
+		for (auto offset = ibOffset / cacheLineSize; offset <= (ibOffset + 11) / cacheLineSize; ++offset)
+			lines.emplace_back(offset);
+
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			const auto vbOffset = static_cast<uint64_t>(vertexStride) * pIndices[primIdx * 3 + j];
+			for (auto offset = vbOffset / cacheLineSize; offset <= (vbOffset + vertexStride - 1) / cacheLineSize; ++offset)
+				lines.emplace_back(vbTag | offset);
+		}
+	}
+
+	const auto numAccesses = static_cast<uint32_t>(lines.size());
+	vector<uint32_t> lastAccesses(numAccesses);
+	{
+		// Map each line to the last time it was accessed
+		vector<uint64_t> sortedLines(lines);
+		sort(sortedLines.begin(), sortedLines.end());
+		sortedLines.erase(unique(sortedLines.begin(), sortedLines.end()), sortedLines.end());
+		vector<uint32_t> lastTimes(sortedLines.size(), 0);
+		for (auto t = 0u; t < numAccesses; ++t)
+		{
+			auto& lastTime = lastTimes[lower_bound(sortedLines.begin(), sortedLines.end(), lines[t]) - sortedLines.begin()];
+			lastAccesses[t] = lastTime;	// 1-based, 0 for the first access
+			lastTime = t + 1;
+		}
+	}
+
+	// Fenwick tree marking the accesses that are the most recent one to their line
+	vector<uint32_t> fenwick(numAccesses + 1, 0);
+	const auto update = [&fenwick, numAccesses](uint32_t i, int32_t delta)
+	{
+		for (; i <= numAccesses; i += i & (~i + 1)) fenwick[i] += delta;
+	};
+	const auto prefixSum = [&fenwick](uint32_t i)
+	{
+		auto sum = 0u;
+		for (; i > 0; i -= i & (~i + 1)) sum += fenwick[i];
+
+		return sum;
+	};
+
+	auto numMarked = 0u;
+	for (auto t = 0u; t < numAccesses; ++t)
+	{
+		const auto lastAccess = lastAccesses[t];
+		if (lastAccess)
+		{
+			const auto distance = numMarked - prefixSum(lastAccess);
+			auto bucket = 0u;
+			while ((1ull << bucket) <= distance) ++bucket;
+			++stats.Histogram[bucket];
+			stats.SumLogDistances += log2(distance + 1.0);
+			update(lastAccess, -1);
+			--numMarked;
+		}
+		else ++stats.NumColdFetches;
+
+		update(t + 1, 1);
+		++numMarked;
+	}
+	stats.NumFetches = numAccesses;
+
+	return stats;
+}
+
+bool ObjLoader::loadCache(const char* pszFilename, const MappedFile& source, uint64_t sourceHash, uint32_t importFlags)
+{
+	if (!m_cache.Open(pszFilename)) return false;
+
+	// Validate the cache against the source file and the import options
+	const auto cacheSize = m_cache.GetSize();
+	const auto pHeader = reinterpret_cast<const CacheHeader*>(m_cache.GetData());
+	auto isValid = cacheSize >= sizeof(CacheHeader) &&
+		memcmp(pHeader->Magic, g_cacheMagic, sizeof(g_cacheMagic)) == 0 &&
+		pHeader->Version == g_cacheVersion && pHeader->ImportFlags == importFlags &&
+		pHeader->SourceSize == source.GetSize() && pHeader->SourceTimeStamp == source.GetTimeStamp() &&
+		pHeader->SourceHash == sourceHash;
+
+	isValid = isValid && pHeader->Stride >= sizeof(uint16_t[4]) && pHeader->Stride % sizeof(float) == 0 &&
+		pHeader->VertexOffset % g_cacheAlignment == 0 && pHeader->IndexOffset % g_cacheAlignment == 0 &&
+		pHeader->VertexOffset >= sizeof(CacheHeader) &&
+		pHeader->IndexOffset >= pHeader->VertexOffset + static_cast<uint64_t>(pHeader->Stride) * pHeader->NumVertices &&
+		pHeader->MeshletOffset % g_cacheAlignment == 0 &&
+		pHeader->MeshletOffset >= pHeader->IndexOffset + sizeof(uint32_t) * static_cast<uint64_t>(pHeader->NumIndices) &&
+		pHeader->SubmeshOffset % g_cacheAlignment == 0 &&
+		pHeader->SubmeshOffset >= pHeader->MeshletOffset + sizeof(Meshlet) * static_cast<uint64_t>(pHeader->NumMeshlets) &&
+		pHeader->MaterialOffset % g_cacheAlignment == 0 &&
+		pHeader->MaterialOffset >= pHeader->SubmeshOffset + sizeof(Submesh) * static_cast<uint64_t>(pHeader->NumSubmeshes) &&
+		pHeader->MaterialLibOffset >= pHeader->MaterialOffset + sizeof(Material) * static_cast<uint64_t>(pHeader->NumMaterials) &&
+		pHeader->MaterialLibOffset + pHeader->MaterialLibSize <= cacheSize &&
+		(pHeader->MaterialLibSize == 0 || m_cache.GetData()[pHeader->MaterialLibOffset + pHeader->MaterialLibSize - 1] == '\0');
+
+	// The materials are only valid for the current contents of the mtllib files
+	vector<string> materialLibs;
+	if (isValid)
+	{
+		const auto pLibs = m_cache.GetData() + pHeader->MaterialLibOffset;
+		for (auto i = 0u; i < pHeader->MaterialLibSize; i += static_cast<uint32_t>(materialLibs.back().size()) + 1)
+			materialLibs.emplace_back(pLibs + i);
+		isValid = pHeader->MaterialLibHash == hashMaterialLibs(getDirectory(pszFilename), materialLibs);
+	}
+
+	if (!isValid)
+	{
+		m_cache.Close();
+
+		return false;
+	}
+
+	m_pCacheHeader = pHeader;
+	m_materialLibs.swap(materialLibs);
+	m_stride = pHeader->Stride;
+	m_aabb = pHeader->BoundingBox;
+	m_quantError = pHeader->QuantError;
+	m_sanitizeStats = pHeader->Sanitization;
+
+	return true;
+}
+
+bool ObjLoader::saveCache(const char* pszFilename, const MappedFile& source, uint64_t sourceHash, uint32_t importFlags) const
+{
+	CacheHeader header = {};
+	memcpy(header.Magic, g_cacheMagic, sizeof(g_cacheMagic));
+	header.Version = g_cacheVersion;
+	header.SourceSize = source.GetSize();
+	header.SourceTimeStamp = source.GetTimeStamp();
+	header.SourceHash = sourceHash;
+	header.ImportFlags = importFlags;
+	header.Stride = GetVertexStride();
+	header.NumVertices = GetNumVertices();
+	header.NumIndices = GetNumIndices();
+	header.NumMeshlets = GetNumMeshlets();
+	header.NumSubmeshes = GetNumSubmeshes();
+	header.NumMaterials = GetNumMaterials();
+	header.BoundingBox = m_aabb;
+	header.QuantError = m_quantError;
+	header.Sanitization = m_sanitizeStats;
+
+	string materialLibs;
+	for (const auto& lib : m_materialLibs) materialLibs.append(lib.c_str(), lib.size() + 1);
+	header.MaterialLibSize = static_cast<uint32_t>(materialLibs.size());
+	header.MaterialLibHash = hashMaterialLibs(getDirectory(pszFilename), m_materialLibs);
+
+	const auto vertexDataSize = static_cast<uint64_t>(header.Stride) * header.NumVertices;
+	header.VertexOffset = alignCacheOffset(sizeof(CacheHeader));
+	header.IndexOffset = alignCacheOffset(header.VertexOffset + vertexDataSize);
+	header.MeshletOffset = alignCacheOffset(header.IndexOffset + sizeof(uint32_t) * header.NumIndices);
+	header.SubmeshOffset = alignCacheOffset(header.MeshletOffset + sizeof(Meshlet) * header.NumMeshlets);
+	header.MaterialOffset = alignCacheOffset(header.SubmeshOffset + sizeof(Submesh) * header.NumSubmeshes);
+	header.MaterialLibOffset = header.MaterialOffset + sizeof(Material) * header.NumMaterials;
+
+	// Write to a uniquely named file first and then move it in place,
+	// so that a concurrent import never maps a partially written cache.
+	const auto salt = hash<thread::id>()(this_thread::get_id()) ^ chrono::steady_clock::now().time_since_epoch().count();
+	const auto tmpFileName = string(pszFilename) + "." + to_string(salt) + ".tmp";
+
+	FILE* pFile;
+	fopen_s(&pFile, tmpFileName.c_str(), "wb");
+	if (!pFile) return false;
+
+	static const uint8_t padding[g_cacheAlignment] = {};
+	const auto vertexPadding = static_cast<size_t>(header.VertexOffset - sizeof(CacheHeader));
+	const auto indexPadding = static_cast<size_t>(header.IndexOffset - header.VertexOffset - vertexDataSize);
+	const auto meshletPadding = static_cast<size_t>(header.MeshletOffset - header.IndexOffset - sizeof(uint32_t) * header.NumIndices);
+	const auto submeshPadding = static_cast<size_t>(header.SubmeshOffset - header.MeshletOffset - sizeof(Meshlet) * header.NumMeshlets);
+	const auto materialPadding = static_cast<size_t>(header.MaterialOffset - header.SubmeshOffset - sizeof(Submesh) * header.NumSubmeshes);
+	auto success = fwrite(&header, sizeof(CacheHeader), 1, pFile) == 1;
+	success = success && fwrite(padding, 1, vertexPadding, pFile) == vertexPadding;
+	success = success && fwrite(GetVertices(), 1, static_cast<size_t>(vertexDataSize), pFile) == vertexDataSize;
+	success = success && fwrite(padding, 1, indexPadding, pFile) == indexPadding;
+	success = success && fwrite(GetIndices(), sizeof(uint32_t), header.NumIndices, pFile) == header.NumIndices;
+	success = success && fwrite(padding, 1, meshletPadding, pFile) == meshletPadding;
+	success = success && fwrite(GetMeshlets(), sizeof(Meshlet), header.NumMeshlets, pFile) == header.NumMeshlets;
+	success = success && fwrite(padding, 1, submeshPadding, pFile) == submeshPadding;
+	success = success && fwrite(GetSubmeshes(), sizeof(Submesh), header.NumSubmeshes, pFile) == header.NumSubmeshes;
+	success = success && fwrite(padding, 1, materialPadding, pFile) == materialPadding;
+	success = success && fwrite(GetMaterials(), sizeof(Material), header.NumMaterials, pFile) == header.NumMaterials;
+	success = success && fwrite(materialLibs.data(), 1, materialLibs.size(), pFile) == materialLibs.size();
+	success = fclose(pFile) == 0 && success;
+
+#ifdef _WIN32
+	success = success && MoveFileExA(tmpFileName.c_str(), pszFilename, MOVEFILE_REPLACE_EXISTING);
+#else
+	success = success && rename(tmpFileName.c_str(), pszFilename) == 0;
+#endif
+	if (!success) remove(tmpFileName.c_str());
+
+	return success;
+}
+
+bool ObjLoader::importCompressed(const char* pData, size_t size, uint32_t& numNorm)
+{
+	const auto startTime = chrono::steady_clock::now();
+
+	CompressedMeshHeader header;
+	if (size < sizeof(header)) return false;
+	memcpy(&header, pData, sizeof(header));
+
+	// Every coded value takes a byte at least.
+	const auto hasNormal = header.Stride == GetQuantizedStride(sizeof(float3[2]));
+	const auto submeshSize = sizeof(Submesh) * static_cast<uint64_t>(header.NumSubmeshes);
+	const auto materialSize = sizeof(Material) * static_cast<uint64_t>(header.NumMaterials);
+	auto offset = sizeof(header);
+	if (header.Version != g_compressedVersion || (header.Stride != GetQuantizedStride(sizeof(float3)) && !hasNormal) ||
+		header.NumIndices % 3 || static_cast<uint64_t>(header.NumVertices) + header.NumIndices > size ||
+		submeshSize + materialSize > size - offset) return false;
+
+	// An empty vector may have no storage to copy to.
+	m_submeshes.resize(header.NumSubmeshes);
+	m_materials.resize(header.NumMaterials);
+	if (submeshSize) memcpy(m_submeshes.data(), pData + offset, static_cast<size_t>(submeshSize));
+	offset += static_cast<size_t>(submeshSize);
+	if (materialSize) memcpy(m_materials.data(), pData + offset, static_cast<size_t>(materialSize));
+	offset += static_cast<size_t>(materialSize);
+	for (const auto& submesh : m_submeshes)
+		if (submesh.FirstIndex > header.NumIndices || submesh.NumIndices > header.NumIndices - submesh.FirstIndex ||
+			(submesh.MaterialIndex >= header.NumMaterials && submesh.MaterialIndex != UINT32_MAX)) return false;
+
+	vector<uint8_t> quantized(static_cast<size_t>(header.Stride) * header.NumVertices);
+	const auto vertexDataSize = MeshCodec::DecodeVertices(quantized.data(), header.NumVertices,
+		header.Stride, reinterpret_cast<const uint8_t*>(pData) + offset, size - offset);
+	if (!vertexDataSize) return false;
+	offset += vertexDataSize;
+
+	m_indices.resize(header.NumIndices);
+	if (!MeshCodec::DecodeIndices(m_indices.data(), header.NumIndices, header.NumVertices,
+		reinterpret_cast<const uint8_t*>(pData) + offset, size - offset)) return false;
+
+	// Into the float layout of the import; the normals are zero if the file has none.
+	const auto srcStride = static_cast<uint32_t>(hasNormal ? sizeof(float3[2]) : sizeof(float3));
+	m_vertices.resize(static_cast<size_t>(m_stride) * header.NumVertices);
+	if (srcStride == m_stride) DequantizeVertices(m_vertices.data(), quantized.data(), header.NumVertices, m_stride, header.BoundingBox);
+	else
+	{
+		vector<uint8_t> vertices(static_cast<size_t>(srcStride) * header.NumVertices);
+		DequantizeVertices(vertices.data(), quantized.data(), header.NumVertices, srcStride, header.BoundingBox);
+		memset(m_vertices.data(), 0, m_vertices.size());
+		for (auto i = 0u; i < header.NumVertices; ++i) memcpy(getVertex(i), &vertices[srcStride * i], sizeof(float3));
+	}
+	numNorm = hasNormal && m_stride >= sizeof(float3[2]) ? header.NumVertices : 0;
+
+	m_codecStats.EncodedSize = size;
+	m_codecStats.DecodedSize = m_vertices.size() + sizeof(uint32_t) * m_indices.size();
+	m_codecStats.DecodeTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+	return true;
+}
+
+void ObjLoader::importGeometryChunked(const char* pData, size_t size, uint32_t numThreads,
+	uint32_t& numNorm, bool forDX, bool swapYZ, bool weld)
+{
+	// Split the file into newline-aligned chunks, several per thread for load balancing
+	const auto pEnd = pData + size;
+	const size_t minChunkSize = 1 << 20;
+	numThreads = numThreads ? numThreads : (max)(thread::hardware_concurrency(), 1u);
+	const auto numChunks = static_cast<uint32_t>((min)(static_cast<size_t>(numThreads) * 4,
+		(size + minChunkSize - 1) / minChunkSize));
+
+	vector<const char*> chunkStarts(numChunks + 1);
+	chunkStarts[0] = pData;
+	chunkStarts[numChunks] = pEnd;
+	for (auto i = 1u; i < numChunks; ++i)
+		chunkStarts[i] = (max)(skipLine(pData + size * i / numChunks, pEnd), chunkStarts[i - 1]);
+
+	// Parse the chunks in parallel
+	vector<GeometryChunk> chunks(numChunks);
+	parallelFor(numChunks, numThreads, [&](uint32_t i)
+	{
+		parseGeometryChunk(chunkStarts[i], chunkStarts[i + 1], chunks[i], forDX, swapYZ);
+	});
+
+	// Prefix sums of the per-chunk element counts
+	vector<uint32_t> vertexBases(numChunks + 1), normalBases(numChunks + 1), indexBases(numChunks + 1);
+	auto numTexc = 0u;
+	vertexBases[0] = normalBases[0] = indexBases[0] = 0;
+	for (auto i = 0u; i < numChunks; ++i)
+	{
+		vertexBases[i + 1] = vertexBases[i] + static_cast<uint32_t>(chunks[i].Positions.size());
+		normalBases[i + 1] = normalBases[i] + static_cast<uint32_t>(chunks[i].Normals.size());
+		indexBases[i + 1] = indexBases[i] + static_cast<uint32_t>(chunks[i].Indices.size());
+		numTexc += chunks[i].NumTexc;
+	}
+
+	// Submesh starts, with the material names numbered in the order of first use
+	m_submeshes.push_back({ 0, 0, UINT32_MAX });
+	for (const auto& chunk : chunks)
+	{
+		const auto chunkIdx = static_cast<uint32_t>(&chunk - chunks.data());
+		for (const auto& lib : chunk.MaterialLibs) findOrAddName(m_materialLibs, lib);
+		for (const auto& start : chunk.GroupStarts)
+		{
+			const auto materialIndex = start.MaterialName == UINT32_MAX ? m_submeshes.back().MaterialIndex :
+				findOrAddName(m_materialNames, chunk.MaterialNames[start.MaterialName]);
+			m_submeshes.push_back({ indexBases[chunkIdx] + start.FirstIndex, 0, materialIndex });
+		}
+	}
+
+	// Allocate memory for the OBJ model data.
+	const auto numVert = vertexBases[numChunks];
+	numNorm = normalBases[numChunks];
+	m_stride += m_stride <= sizeof(float3) && numNorm ? sizeof(float3) : 0;
+	m_stride += numTexc ? sizeof(float[2]) : 0;
+	m_vertices.reserve(m_stride * (max)((max)(numVert, numTexc), numNorm));
+	m_vertices.resize(m_stride * numVert);
+	if (numChunks > 1) m_indices.resize(indexBases[numChunks]);
+
+	vector<float3> normals(numChunks > 1 ? numNorm : 0);
+	vector<uint32_t> nIndices(numChunks > 1 && numNorm ? m_indices.size() : 0);
+
+	// Stitch the chunks together, rebasing the relative indices
+	if (numChunks == 1)
+	{
+		m_indices.swap(chunks[0].Indices);
+		normals.swap(chunks[0].Normals);
+		nIndices.swap(chunks[0].NIndices);
+		if (numNorm) nIndices.resize(m_indices.size());
+	}
+	parallelFor(numChunks, numThreads, [&](uint32_t i)
+	{
+		auto& chunk = chunks[i];
+		const auto numChunkVert = static_cast<uint32_t>(chunk.Positions.size());
+		for (auto j = 0u; j < numChunkVert; ++j) getPosition(vertexBases[i] + j) = chunk.Positions[j];
+		vector<float3>().swap(chunk.Positions);
+		if (numChunks == 1) return;
+
+		copy(chunk.Indices.cbegin(), chunk.Indices.cend(), m_indices.begin() + indexBases[i]);
+		for (const auto& j : chunk.RelIndices) m_indices[indexBases[i] + j] += vertexBases[i];
+		vector<uint32_t>().swap(chunk.Indices);
+
+		if (numNorm)
+		{
+			copy(chunk.Normals.cbegin(), chunk.Normals.cend(), normals.begin() + normalBases[i]);
+			copy(chunk.NIndices.cbegin(), chunk.NIndices.cend(), nIndices.begin() + indexBases[i]);
+			for (const auto& j : chunk.RelNIndices) nIndices[indexBases[i] + j] += normalBases[i];
+		}
+	});
+	chunks.clear();
+
+	computePerVertexNormals(normals, nIndices, weld);
+
+	const auto isReversed = (forDX && !swapYZ) || (!forDX && swapYZ);
+	if (isReversed) reverse(m_indices.begin(), m_indices.end());
+	finalizeSubmeshes(m_submeshes, static_cast<uint32_t>(m_indices.size()), isReversed);
+}
+
+void ObjLoader::importGeometryFirstPass(FILE* pFile, uint32_t& numTexc, uint32_t& numNorm)
+{
+	auto v = 0u;
+	auto vt = 0u;
+	auto vn = 0u;
+	char buffer[256] = { 0 };
+
+	auto numVert = 0u;
+	auto numTri = 0u;
+	numTexc = 0;
+	numNorm = 0;
+
+	while (fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer))) != EOF)
+	{
+		switch (buffer[0])
+		{
+		case 'f':   // v, v//vn, v/vt, v/vt/vn.
+			fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer)));
+
+			if (strstr(buffer, "//")) // v//vn
+			{
+				sscanf_s(buffer, "%u//%u", &v, &vn);
+				fscanf_s(pFile, "%u//%u", &v, &vn);
+				fscanf_s(pFile, "%u//%u", &v, &vn);
+				++numTri;
+
+				while (fscanf_s(pFile, "%u//%u", &v, &vn) > 0) ++numTri;
+			}
+			else if (sscanf_s(buffer, "%u/%u/%u", &v, &vt, &vn) == 3) // v/vt/vn
+			{
+				fscanf_s(pFile, "%u/%u/%u", &v, &vt, &vn);
+				fscanf_s(pFile, "%u/%u/%u", &v, &vt, &vn);
+				++numTri;
+
+				while (fscanf_s(pFile, "%u/%u/%u", &v, &vt, &vn) > 0) ++numTri;
+
+				//m_hasTexcoord = true;
+			}
+			else if (sscanf_s(buffer, "%u/%u", &v, &vt) == 2) // v/vt
+			{
+				fscanf_s(pFile, "%u/%u", &v, &vt);
+				fscanf_s(pFile, "%u/%u", &v, &vt);
+				++numTri;
+
+				while (fscanf_s(pFile, "%u/%u", &v, &vt) > 0) ++numTri;
+
+				//m_hasTexcoord = true;
+			}
+			else // v
+			{
+				fscanf_s(pFile, "%u", &v);
+				fscanf_s(pFile, "%u", &v);
+				++numTri;
+
+				while (fscanf_s(pFile, "%u", &v) > 0)
+					++numTri;
+			}
+			break;
+
+		case 'v':   // v, vt, or vn
+			switch (buffer[1])
+			{
+			case '\0':
+				fgets(buffer, sizeof(buffer), pFile);
+				++numVert;
+				break;
+			case 't':
+				fgets(buffer, sizeof(buffer), pFile);
+				++numTexc;
+				break;
+			case 'n':
+				fgets(buffer, sizeof(buffer), pFile);
+				++numNorm;
+				break;
+			default:
+				break;
+			}
+			break;
+
+		default:
+			fgets(buffer, sizeof(buffer), pFile);
+			break;
+		}
+	}
+
+	// Allocate memory for the OBJ model data.
+	const auto numIdx = numTri * 3;
+	m_stride += m_stride <= sizeof(float3) && numNorm ? sizeof(float3) : 0;
+	m_stride += numTexc ? sizeof(float[2]) : 0;
+	m_vertices.reserve(m_stride * (max)((max)(numVert, numTexc), numNorm));
+	m_vertices.resize(m_stride * numVert);
+	m_indices.resize(numIdx);
+}
+
+void ObjLoader::importGeometrySecondPass(FILE* pFile, uint32_t numTexc, uint32_t numNorm, bool forDX, bool swapYZ, bool weld)
+{
+	auto numVert = 0u;
+	auto numTri = 0u;
+	char buffer[256] = { 0 };
+
+	vector<float3> normals;
+	vector<uint32_t> tIndices, nIndices;
+	if (numTexc) tIndices.resize(m_indices.size());
+	if (numNorm) nIndices.resize(m_indices.size());
+	normals.reserve(numNorm);
+	m_submeshes.push_back({ 0, 0, UINT32_MAX });
+
+	while (fscanf_s(pFile, "%s", buffer, static_cast<uint32_t>(sizeof(buffer))) != EOF)
+	{
+		switch (buffer[0])
+		{
+		case 'f': // v, v//vn, v/vt, or v/vt/vn.
+			loadIndices(pFile, numTri, numTexc, numNorm, nIndices, tIndices);
+			break;
+		case 'o':
+		case 'g':
+		case 'u':
+		case 'm': // o, g, usemtl, or mtllib
+		{
+			const string keyword(buffer);
+			if (!fgets(buffer, sizeof(buffer), pFile)) buffer[0] = '\0';
+			const auto pEnd = buffer + strlen(buffer);
+			if (keyword == "o" || keyword == "g")
+				m_submeshes.push_back({ numTri * 3, 0, m_submeshes.back().MaterialIndex });
+			else if (keyword == "usemtl")
+				m_submeshes.push_back({ numTri * 3, 0, findOrAddName(m_materialNames, parseName(buffer, pEnd)) });
+			else if (keyword == "mtllib") parseNames(buffer, pEnd, m_materialLibs);
+			break;
+		}
+		case 'v': // v, vn, or vt.
+			switch (buffer[1])
+			{
+			case '\0': // v
+			{
+				auto& p = getPosition(numVert++);
+				fscanf_s(pFile, "%f %f %f", &p.x, &p.y, &p.z);
+				if (swapYZ)
+				{
+					const auto tmp = p.y;
+					p.y = p.z;
+					p.z = tmp;
+				}
+				p.z = forDX ? -p.z : p.z;
+				break;
+			}
+			case 'n':
+				normals.emplace_back();
+				fscanf_s(pFile, "%f %f %f",
+					&normals.back().x,
+					&normals.back().y,
+					&normals.back().z);
+				if (swapYZ)
+				{
+					const auto tmp = normals.back().y;
+					normals.back().y = normals.back().z;
+					normals.back().z = tmp;
+				}
+				normals.back().z = forDX ? -normals.back().z : normals.back().z;
+			default:
+				break;
+			}
+			break;
+
+		default:
+			fgets(buffer, sizeof(buffer), pFile);
+			break;
+		}
+	}
+
+	computePerVertexNormals(normals, nIndices, weld);
+
+	const auto isReversed = (forDX && !swapYZ) || (!forDX && swapYZ);
+	if (isReversed) reverse(m_indices.begin(), m_indices.end());
+	finalizeSubmeshes(m_submeshes, static_cast<uint32_t>(m_indices.size()), isReversed);
+}
+
+void ObjLoader::loadIndices(FILE* pFile, uint32_t& numTri, uint32_t numTexc,
+	uint32_t numNorm, vector<uint32_t>& nIndices, vector<uint32_t>& tIndices)
+{
+	long long vi;
+	uint32_t v[3] = { 0 };
+	uint32_t vt[3] = { 0 };
+	uint32_t vn[3] = { 0 };
+
+	const auto numVert = GetNumVertices();
+
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		fscanf_s(pFile, "%lld", &vi);
+		v[i] = static_cast<uint32_t>(vi < 0 ? vi + numVert : vi - 1);
+		m_indices[numTri * 3 + i] = v[i];
+
+		if (tIndices.size() > 0)
+		{
+			fscanf_s(pFile, "/%lld", &vi);
+			vt[i] = static_cast<uint32_t>(vi < 0 ? vi + numTexc : vi - 1);
+			tIndices[numTri * 3 + i] = vt[i];
+		}
+		else if (nIndices.size() > 0) fscanf_s(pFile, "/");
+
+		if (nIndices.size() > 0)
+		{
+			fscanf_s(pFile, "/%lld", &vi);
+			vn[i] = static_cast<uint32_t>(vi < 0 ? vi + numNorm : vi - 1);
+			nIndices[numTri * 3 + i] = vn[i];
+		}
+	}
+	++numTri;
+
+	v[1] = v[2];
+	vt[1] = vt[2];
+	vn[1] = vn[2];
 
 	while (fscanf_s(pFile, "%lld", &vi) > 0)
 	{
@@ -297,14 +1977,75 @@ void ObjLoader::loadIndices(FILE* pFile, uint32_t& numTri, uint32_t numTexc,
 	}
 }
 
-void ObjLoader::computePerVertexNormals(const vector<float3>& normals, const vector<uint32_t>& nIndices)
+void ObjLoader::loadMaterials(const char* pszFilename)
+{
+	m_materials.assign(m_materialNames.size(), { float3(1.0f, 1.0f, 1.0f), 1.0f });
+
+	// The first definition of a name wins, and Pr wins over Ns.
+	vector<bool> isDefined(m_materials.size(), false);
+	vector<bool> hasPr(m_materials.size(), false);
+	const auto directory = getDirectory(pszFilename);
+	for (const auto& lib : m_materialLibs)
+	{
+		MappedFile file;
+		if (!file.Open((directory + lib).c_str())) continue;
+
+		auto materialIndex = UINT32_MAX;
+		const auto pEnd = file.GetData() + file.GetSize();
+		for (auto p = file.GetData(); p < pEnd; p = skipLine(p, pEnd))
+		{
+			p = skipBlanks(p, pEnd);
+			const auto pKeyword = p;
+			while (p < pEnd && !isBlank(*p) && *p != '\n') ++p;
+			const auto keyword = string(pKeyword, p);
+
+			if (keyword == "newmtl")
+			{
+				const auto name = parseName(p, pEnd);
+				materialIndex = static_cast<uint32_t>(find(m_materialNames.cbegin(), m_materialNames.cend(), name) - m_materialNames.cbegin());
+				materialIndex = materialIndex < m_materials.size() && !isDefined[materialIndex] ? materialIndex : UINT32_MAX;
+				if (materialIndex != UINT32_MAX) isDefined[materialIndex] = true;
+			}
+			else if (materialIndex == UINT32_MAX) continue;
+			else if (keyword == "Kd")
+			{
+				auto& baseColor = m_materials[materialIndex].BaseColor;
+				p = parseFloat(skipBlanks(p, pEnd), pEnd, baseColor.x);
+				p = parseFloat(skipBlanks(p, pEnd), pEnd, baseColor.y);
+				p = parseFloat(skipBlanks(p, pEnd), pEnd, baseColor.z);
+			}
+			else if (keyword == "Pr")
+			{
+				parseFloat(skipBlanks(p, pEnd), pEnd, m_materials[materialIndex].Roughness);
+				hasPr[materialIndex] = true;
+			}
+			else if (keyword == "Ns" && !hasPr[materialIndex])
+			{
+				// Blinn-Phong exponent to GGX alpha = sqrt(2 / (Ns + 2)), and alpha = roughness^2
+				auto ns = 0.0f;
+				parseFloat(skipBlanks(p, pEnd), pEnd, ns);
+				m_materials[materialIndex].Roughness = powf(2.0f / ((max)(ns, 0.0f) + 2.0f), 0.25f);
+			}
+		}
+	}
+}
+
+void ObjLoader::computePerVertexNormals(const vector<float3>& normals, const vector<uint32_t>& nIndices, bool weld)
 {
 	if (normals.empty()) return;
 
 	const auto stride = GetVertexStride();
 	vector<uint32_t> vni(GetNumVertices(), UINT32_MAX);
 
+	// For welding, the split vertices are keyed on their (position, normal) index pairs
+	// in an open-addressing hash table with linear probing.
 	const auto numIdx = static_cast<uint32_t>(m_indices.size());
+	auto hashBits = 0u;
+	while (weld && (1ull << hashBits) < 2ull * numIdx) ++hashBits;
+	vector<uint64_t> weldKeys(weld ? 1ull << hashBits : 0, UINT64_MAX);
+	vector<uint32_t> weldVertices(weldKeys.size());
+	const auto hashMask = weldKeys.size() - 1;
+
 	for (auto i = 0u; i < numIdx; i++)
 	{
 		auto vi = m_indices[i];
@@ -312,6 +2053,23 @@ void ObjLoader::computePerVertexNormals(const vector<float3>& normals, const vec
 
 		if (vni[vi] < UINT32_MAX)
 		{
+			if (weld)
+			{
+				const auto key = (static_cast<uint64_t>(vi) << 32) | nIndices[i];
+				auto slot = static_cast<size_t>((key * 0x9e3779b97f4a7c15) >> (64 - hashBits));
+				while (weldKeys[slot] != UINT64_MAX && weldKeys[slot] != key) slot = (slot + 1) & hashMask;
+
+				if (weldKeys[slot] == key)
+				{
+					// Reuse the vertex split for the same pair before
+					m_indices[i] = weldVertices[slot];
+					continue;
+				}
+
+				weldKeys[slot] = key;
+				weldVertices[slot] = GetNumVertices();
+			}
+
 			// Split vertex
 			vi = GetNumVertices();
 			m_vertices.resize(m_vertices.size() + stride);
@@ -334,85 +2092,934 @@ void ObjLoader::computePerVertexNormals(const vector<float3>& normals, const vec
 	m_vertices.shrink_to_fit();
 }
 
-void ObjLoader::recomputeNormals()
+void ObjLoader::sanitize(uint32_t numThreads)
 {
-	float3 e1, e2, n;
+	enum TriangleState : uint8_t
+	{
+		KEEP,
+		DEGENERATE,
+		NON_FINITE,
+		DUPLICATE
+	};
 
 	const auto numTri = static_cast<uint32_t>(m_indices.size()) / 3;
-	for (auto i = 0u; i < numTri; i++)
-	{
-		const auto pv0 = &getPosition(m_indices[i * 3]);
-		const auto pv1 = &getPosition(m_indices[i * 3 + 1]);
-		const auto pv2 = &getPosition(m_indices[i * 3 + 2]);
-		e1.x = pv1->x - pv0->x;
-		e1.y = pv1->y - pv0->y;
-		e1.z = pv1->z - pv0->z;
-		e2.x = pv2->x - pv1->x;
-		e2.y = pv2->y - pv1->y;
-		e2.z = pv2->z - pv1->z;
-		n.x = e1.y * e2.z - e1.z * e2.y;
-		n.y = e1.z * e2.x - e1.x * e2.z;
-		n.z = e1.x * e2.y - e1.y * e2.x;
-		const auto l = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
-		n.x /= l;
-		n.y /= l;
-		n.z /= l;
+	const auto numVert = GetNumVertices();
+	vector<uint8_t> states(numTri);
+	vector<uint32_t> minIndices(numTri);	// UINT32_MAX if already removed
+
+	// Zero-area triangles are those whose face normal in recomputeNormals() has a length of 0
+	const auto classify = [&](uint32_t i)
+	{
+		const auto& p0 = getPosition(m_indices[i * 3]);
+		const auto& p1 = getPosition(m_indices[i * 3 + 1]);
+		const auto& p2 = getPosition(m_indices[i * 3 + 2]);
+
+		// x * 0 is NaN exactly if x is infinite or NaN
+		for (const auto& p : { p0, p1, p2 })
+			if (p.x * 0.0f != 0.0f || p.y * 0.0f != 0.0f || p.z * 0.0f != 0.0f) return NON_FINITE;
+
+		const float3 e1(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+		const float3 e2(p2.x - p1.x, p2.y - p1.y, p2.z - p1.z);
+		const float3 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+
+		return n.x * n.x + n.y * n.y + n.z * n.z > 0.0f ? KEEP : DEGENERATE;
+	};
+
+	numThreads = numThreads ? numThreads : (max)(thread::hardware_concurrency(), 1u);
+	const uint32_t trisPerTask = 1 << 14;
+	parallelFor((numTri + trisPerTask - 1) / trisPerTask, numThreads, [&](uint32_t task)
+	{
+		auto i = task * trisPerTask;
+		const auto end = (min)(i + trisPerTask, numTri);
+#ifdef XUSG_OBJ_LOADER_SSE2
+		// 4 triangles at a time with the same operations as the scalar code. The 16-byte loads read
+		// past the position of a vertex, so the last vertex is loaded by components.
+		const auto loadPosition = [&](uint32_t vi)
+		{
+			const auto& p = getPosition(vi);
+
+			return vi + 1 < numVert ? _mm_loadu_ps(&p.x) : _mm_setr_ps(p.x, p.y, p.z, 0.0f);
+		};
+
+		const auto zero = _mm_setzero_ps();
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 p[3][4];
+			auto nan = zero;
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				for (uint8_t k = 0; k < 4; ++k) p[j][k] = loadPosition(m_indices[(i + k) * 3 + j]);
+				_MM_TRANSPOSE4_PS(p[j][0], p[j][1], p[j][2], p[j][3]);
+
+				for (uint8_t k = 0; k < 3; ++k) nan = _mm_add_ps(nan, _mm_mul_ps(p[j][k], zero));
+			}
+
+			const auto e1x = _mm_sub_ps(p[1][0], p[0][0]), e1y = _mm_sub_ps(p[1][1], p[0][1]), e1z = _mm_sub_ps(p[1][2], p[0][2]);
+			const auto e2x = _mm_sub_ps(p[2][0], p[1][0]), e2y = _mm_sub_ps(p[2][1], p[1][1]), e2z = _mm_sub_ps(p[2][2], p[1][2]);
+			const auto nx = _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y));
+			const auto ny = _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z));
+			const auto nz = _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x));
+			const auto l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+
+			const auto nonFiniteMask = _mm_movemask_ps(_mm_cmpunord_ps(nan, nan));
+			const auto keepMask = _mm_movemask_ps(_mm_cmpgt_ps(l2, zero));
+			for (uint8_t k = 0; k < 4; ++k)
+				states[i + k] = (nonFiniteMask >> k) & 1 ? NON_FINITE : ((keepMask >> k) & 1 ? KEEP : DEGENERATE);
+		}
+#endif
+		for (; i < end; ++i) states[i] = classify(i);
+
+		for (i = task * trisPerTask; i < end; ++i)
+		{
+			const auto pTri = &m_indices[i * 3];
+			minIndices[i] = states[i] == KEEP ? (min)((min)(pTri[0], pTri[1]), pTri[2]) : UINT32_MAX;
+		}
+	});
+
+	// Duplicates of the triangles left, with the same three indices in the same winding within the same
+	// submesh; a back-to-back pair is 2 faces, e.g. of a thin wall. The triangles are bucketed by their
+	// smallest index with one counting sort, in which bucketEnds[v] ends up as the end of bucket v, and
+	// the tasks then tell the triangles of their buckets apart by the other 2 indices in winding order.
+	// The first of each is kept.
+	struct Entry
+	{
+		uint32_t Second;
+		uint32_t Third;
+		uint32_t Triangle;
+	};
+
+	vector<uint32_t> bucketEnds(numVert, 0);
+	for (const auto& minIdx : minIndices) if (minIdx != UINT32_MAX) ++bucketEnds[minIdx];
+	auto numEntries = 0u;
+	for (auto& bucketEnd : bucketEnds)
+	{
+		const auto bucketSize = bucketEnd;
+		bucketEnd = numEntries;
+		numEntries += bucketSize;
+	}
 
-		const auto pVn0 = &getNormal(m_indices[i * 3]);
-		const auto pVn1 = &getNormal(m_indices[i * 3 + 1]);
-		const auto pVn2 = &getNormal(m_indices[i * 3 + 2]);
-		pVn0->x += n.x;
-		pVn0->y += n.y;
-		pVn0->z += n.z;
-		pVn1->x += n.x;
-		pVn1->y += n.y;
-		pVn1->z += n.z;
-		pVn2->x += n.x;
-		pVn2->y += n.y;
-		pVn2->z += n.z;
+	vector<Entry> entries(numEntries);
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		if (minIndices[i] == UINT32_MAX) continue;
+		const auto pTri = &m_indices[i * 3];
+		const uint8_t first = pTri[0] == minIndices[i] ? 0 : (pTri[1] == minIndices[i] ? 1 : 2);
+		entries[bucketEnds[minIndices[i]]++] = { pTri[(first + 1) % 3], pTri[(first + 2) % 3], i };
 	}
 
-	const auto numVert = GetNumVertices();
+	const auto numSubmeshes = static_cast<uint32_t>(m_submeshes.size());
+	const auto isSameSubmesh = [&](uint32_t triA, uint32_t triB)
+	{
+		if (numSubmeshes <= 1) return true;
+		const auto findSubmesh = [&](uint32_t tri)
+		{
+			return upper_bound(m_submeshes.cbegin(), m_submeshes.cend(), tri * 3,
+				[](uint32_t index, const Submesh& submesh) { return index < submesh.FirstIndex; });
+		};
+
+		return findSubmesh(triA) == findSubmesh(triB);
+	};
+
+	const uint32_t minTrisPerTask = 1 << 16;
+	const auto numTasks = (max)((min)(numThreads, (numEntries + minTrisPerTask - 1) / minTrisPerTask), 1u);
+	parallelFor(numTasks, numThreads, [&](uint32_t task)
+	{
+		const auto first = static_cast<uint32_t>(static_cast<uint64_t>(numVert) * task / numTasks);
+		const auto last = static_cast<uint32_t>(static_cast<uint64_t>(numVert) * (task + 1) / numTasks);
+		for (auto i = first; i < last; ++i)
+		{
+			// The entries of a bucket are in triangle order, and most buckets are small enough to
+			// compare pairwise. The larger ones are sorted, so that equal keys are in runs.
+			const auto pFirst = entries.data() + (i ? bucketEnds[i - 1] : 0);
+			const auto pLast = entries.data() + bucketEnds[i];
+			const auto isSorted = pLast - pFirst > 8;
+			if (isSorted) sort(pFirst, pLast, [](const Entry& a, const Entry& b)
+			{
+				return a.Second < b.Second || (a.Second == b.Second && (a.Third < b.Third ||
+					(a.Third == b.Third && a.Triangle < b.Triangle)));
+			});
+
+			auto pRun = pFirst;
+			for (auto pEntry = pFirst + 1; pEntry < pLast; ++pEntry)
+			{
+				if (isSorted && (pEntry->Second != pRun->Second || pEntry->Third != pRun->Third)) pRun = pEntry;
+				for (auto pPrev = pRun; pPrev < pEntry; ++pPrev)
+					if (pPrev->Second == pEntry->Second && pPrev->Third == pEntry->Third &&
+						isSameSubmesh(pPrev->Triangle, pEntry->Triangle))
+					{
+						states[pEntry->Triangle] = DUPLICATE;
+						break;
+					}
+			}
+		}
+	});
+
+	// Remove the triangles in place, keeping the order of the rest, and shrink the submesh ranges to match
+	vector<uint32_t> numKeptBefore(numTri + 1);
+	auto numKept = 0u;
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		numKeptBefore[i] = numKept;
+		switch (states[i])
+		{
+		case KEEP:
+			if (numKept < i) memcpy(&m_indices[numKept * 3], &m_indices[i * 3], sizeof(uint32_t[3]));
+			++numKept;
+			break;
+		case DEGENERATE:
+			++m_sanitizeStats.NumDegenerateTriangles;
+			break;
+		case NON_FINITE:
+			++m_sanitizeStats.NumNonFiniteTriangles;
+			break;
+		default:
+			++m_sanitizeStats.NumDuplicateTriangles;
+		}
+	}
+	numKeptBefore[numTri] = numKept;
+
+	if (numKept < numTri)
+	{
+		m_indices.resize(numKept * 3);
+
+		auto numSubmeshes = 0u;
+		for (auto submesh : m_submeshes)
+		{
+			const auto first = numKeptBefore[submesh.FirstIndex / 3];
+			submesh.NumIndices = (numKeptBefore[(submesh.FirstIndex + submesh.NumIndices) / 3] - first) * 3;
+			submesh.FirstIndex = first * 3;
+			if (submesh.NumIndices) m_submeshes[numSubmeshes++] = submesh;
+		}
+		m_submeshes.resize(numSubmeshes);
+	}
+
+	// Remove the unreferenced vertices, keeping the order of the rest
+	vector<uint32_t> remap(numVert, UINT32_MAX);
+	for (const auto& vi : m_indices) remap[vi] = 0;
+
+	auto numReferenced = 0u;
 	for (auto i = 0u; i < numVert; ++i)
 	{
-		const auto pVn = &getNormal(i);
-		const auto l = sqrt(pVn->x * pVn->x + pVn->y * pVn->y + pVn->z * pVn->z);
-		pVn->x /= l;
-		pVn->y /= l;
-		pVn->z /= l;
+		if (remap[i] == UINT32_MAX) continue;
+		if (numReferenced < i) memcpy(getVertex(numReferenced), getVertex(i), m_stride);
+		remap[i] = numReferenced++;
+	}
+
+	if (numReferenced < numVert)
+	{
+		for (auto& vi : m_indices) vi = remap[vi];
+		m_vertices.resize(static_cast<size_t>(m_stride) * numReferenced);
+		m_sanitizeStats.NumUnreferencedVertices = numVert - numReferenced;
+	}
+}
+
+void ObjLoader::recomputeNormals(uint32_t numThreads)
+{
+	// Unit face normals in SoA blocks of 4 triangles
+	const auto numTri = static_cast<uint32_t>(m_indices.size()) / 3;
+	const auto numBlocks = (numTri + 3) / 4;
+	vector<float> faceNormals(static_cast<size_t>(numBlocks) * 12);
+	const auto computeFaceNormal = [&](uint32_t i)
+	{
+		const auto& p0 = getPosition(m_indices[i * 3]);
+		const auto& p1 = getPosition(m_indices[i * 3 + 1]);
+		const auto& p2 = getPosition(m_indices[i * 3 + 2]);
+		const float3 e1(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+		const float3 e2(p2.x - p1.x, p2.y - p1.y, p2.z - p1.z);
+		float3 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+		const auto l = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+		if (l > 0.0f)
+		{
+			n.x /= l;
+			n.y /= l;
+			n.z /= l;
+		}
+		else n = float3(0.0f, 0.0f, 0.0f);
+
+		const auto pBlock = &faceNormals[(i / 4) * 12 + i % 4];
+		pBlock[0] = n.x;
+		pBlock[4] = n.y;
+		pBlock[8] = n.z;
+	};
+
+	numThreads = numThreads ? numThreads : (max)(thread::hardware_concurrency(), 1u);
+	const uint32_t blocksPerTask = 4096;
+	parallelFor((numBlocks + blocksPerTask - 1) / blocksPerTask, numThreads, [&](uint32_t task)
+	{
+		auto i = task * blocksPerTask * 4;
+		const auto end = (min)(i + blocksPerTask * 4, numTri);
+#ifdef XUSG_OBJ_LOADER_AVX2
+		// 2 SoA blocks at a time, otherwise as the SSE2 path below
+		const auto zero8 = _mm256_setzero_ps();
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 p[3][3];
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				__m128 q[8];
+				for (uint8_t k = 0; k < 8; ++k)
+					q[k] = _mm_loadu_ps(&getPosition(m_indices[(i + k) * 3 + j]).x);
+				_MM_TRANSPOSE4_PS(q[0], q[1], q[2], q[3]);
+				_MM_TRANSPOSE4_PS(q[4], q[5], q[6], q[7]);
+				for (uint8_t k = 0; k < 3; ++k)
+					p[j][k] = _mm256_insertf128_ps(_mm256_castps128_ps256(q[k]), q[k + 4], 1);
+			}
+
+			const auto e1x = _mm256_sub_ps(p[1][0], p[0][0]), e1y = _mm256_sub_ps(p[1][1], p[0][1]), e1z = _mm256_sub_ps(p[1][2], p[0][2]);
+			const auto e2x = _mm256_sub_ps(p[2][0], p[1][0]), e2y = _mm256_sub_ps(p[2][1], p[1][1]), e2z = _mm256_sub_ps(p[2][2], p[1][2]);
+			const auto nx = _mm256_sub_ps(_mm256_mul_ps(e1y, e2z), _mm256_mul_ps(e1z, e2y));
+			const auto ny = _mm256_sub_ps(_mm256_mul_ps(e1z, e2x), _mm256_mul_ps(e1x, e2z));
+			const auto nz = _mm256_sub_ps(_mm256_mul_ps(e1x, e2y), _mm256_mul_ps(e1y, e2x));
+			const auto l = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx),
+				_mm256_mul_ps(ny, ny)), _mm256_mul_ps(nz, nz)));
+
+			const auto nonZero = _mm256_cmp_ps(l, zero8, _CMP_GT_OQ);
+			const __m256 n[] =
+			{
+				_mm256_and_ps(_mm256_div_ps(nx, l), nonZero),
+				_mm256_and_ps(_mm256_div_ps(ny, l), nonZero),
+				_mm256_and_ps(_mm256_div_ps(nz, l), nonZero)
+			};
+			const auto pBlock = &faceNormals[(i / 4) * 12];
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				_mm_storeu_ps(pBlock + 4 * k, _mm256_castps256_ps128(n[k]));
+				_mm_storeu_ps(pBlock + 4 * k + 12, _mm256_extractf128_ps(n[k], 1));
+			}
+		}
+#endif
+#ifdef XUSG_OBJ_LOADER_SSE2
+		// The same operations in the same order as the scalar code, so the results are identical.
+		// The 16-byte loads take the first normal component along, which the normal slot guarantees.
+		const auto zero = _mm_setzero_ps();
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 p[3][4];
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				for (uint8_t k = 0; k < 4; ++k)
+					p[j][k] = _mm_loadu_ps(&getPosition(m_indices[(i + k) * 3 + j]).x);
+				_MM_TRANSPOSE4_PS(p[j][0], p[j][1], p[j][2], p[j][3]);
+			}
+
+			const auto e1x = _mm_sub_ps(p[1][0], p[0][0]), e1y = _mm_sub_ps(p[1][1], p[0][1]), e1z = _mm_sub_ps(p[1][2], p[0][2]);
+			const auto e2x = _mm_sub_ps(p[2][0], p[1][0]), e2y = _mm_sub_ps(p[2][1], p[1][1]), e2z = _mm_sub_ps(p[2][2], p[1][2]);
+			const auto nx = _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y));
+			const auto ny = _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z));
+			const auto nz = _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x));
+			const auto l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+
+			// Zero-area triangles get zero normals rather than NaNs
+			const auto nonZero = _mm_cmpgt_ps(l, zero);
+			const auto pBlock = &faceNormals[(i / 4) * 12];
+			_mm_storeu_ps(pBlock, _mm_and_ps(_mm_div_ps(nx, l), nonZero));
+			_mm_storeu_ps(pBlock + 4, _mm_and_ps(_mm_div_ps(ny, l), nonZero));
+			_mm_storeu_ps(pBlock + 8, _mm_and_ps(_mm_div_ps(nz, l), nonZero));
+		}
+#endif
+		for (; i < end; ++i) computeFaceNormal(i);
+	});
+
+	// Accumulate without atomics by partitioning the vertices. With several tasks, the corners are
+	// bucketed by vertex once with a counting sort, in which cornerEnds[v] ends up as the end of bucket v;
+	// each bucket is in corner order, so the sums are added in the same order as by the serial loop.
+	const auto numVert = GetNumVertices();
+	const auto numCorners = numTri * 3;
+	const uint32_t minTrisPerTask = 1 << 16;
+	const auto numTasks = (max)((min)(numThreads, (numTri + minTrisPerTask - 1) / minTrisPerTask), 1u);
+	const auto addFaceNormal = [&](float3& vn, uint32_t corner)
+	{
+		const auto pBlock = &faceNormals[(corner / 12) * 12 + (corner / 3) % 4];
+		vn.x += pBlock[0];
+		vn.y += pBlock[4];
+		vn.z += pBlock[8];
+	};
+
+	vector<uint32_t> cornerEnds;
+	vector<uint32_t> corners;
+	if (numTasks > 1)
+	{
+		cornerEnds.resize(numVert, 0);
+		for (auto i = 0u; i < numCorners; ++i) ++cornerEnds[m_indices[i]];
+		auto numEntries = 0u;
+		for (auto& cornerEnd : cornerEnds)
+		{
+			const auto bucketSize = cornerEnd;
+			cornerEnd = numEntries;
+			numEntries += bucketSize;
+		}
+
+		corners.resize(numCorners);
+		for (auto i = 0u; i < numCorners; ++i) corners[cornerEnds[m_indices[i]]++] = i;
 	}
+	else for (auto i = 0u; i < numCorners; ++i) addFaceNormal(getNormal(m_indices[i]), i);
+
+	parallelFor(numTasks, numThreads, [&](uint32_t task)
+	{
+		const auto first = static_cast<uint32_t>(static_cast<uint64_t>(numVert) * task / numTasks);
+		const auto last = static_cast<uint32_t>(static_cast<uint64_t>(numVert) * (task + 1) / numTasks);
+		if (numTasks > 1)
+		{
+			for (auto i = first; i < last; ++i)
+			{
+				auto& vn = getNormal(i);
+				for (auto j = i ? cornerEnds[i - 1] : 0; j < cornerEnds[i]; ++j) addFaceNormal(vn, corners[j]);
+			}
+		}
+
+		auto i = first;
+#ifdef XUSG_OBJ_LOADER_AVX2
+		// 8 vertices at a time, otherwise as the SSE2 path below
+		for (; i + 8 <= last && i + 8 < numVert; i += 8)
+		{
+			__m128 q[8];
+			for (uint8_t k = 0; k < 8; ++k) q[k] = _mm_loadu_ps(&getNormal(i + k).x);
+			_MM_TRANSPOSE4_PS(q[0], q[1], q[2], q[3]);
+			_MM_TRANSPOSE4_PS(q[4], q[5], q[6], q[7]);
+			const auto x = _mm256_insertf128_ps(_mm256_castps128_ps256(q[0]), q[4], 1);
+			const auto y = _mm256_insertf128_ps(_mm256_castps128_ps256(q[1]), q[5], 1);
+			const auto z = _mm256_insertf128_ps(_mm256_castps128_ps256(q[2]), q[6], 1);
+
+			const auto l = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+			const auto nonZero = _mm256_cmp_ps(l, _mm256_setzero_ps(), _CMP_GT_OQ);
+			const __m256 n[] =
+			{
+				_mm256_and_ps(_mm256_div_ps(x, l), nonZero),
+				_mm256_and_ps(_mm256_div_ps(y, l), nonZero),
+				_mm256_and_ps(_mm256_div_ps(z, l), nonZero)
+			};
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				q[k] = _mm256_castps256_ps128(n[k]);
+				q[k + 4] = _mm256_extractf128_ps(n[k], 1);
+			}
+			_MM_TRANSPOSE4_PS(q[0], q[1], q[2], q[3]);
+			_MM_TRANSPOSE4_PS(q[4], q[5], q[6], q[7]);
+
+			for (uint8_t k = 0; k < 8; ++k)
+			{
+				auto& vn = getNormal(i + k);
+				_mm_storel_pi(reinterpret_cast<__m64*>(&vn.x), q[k]);
+				_mm_store_ss(&vn.z, _mm_movehl_ps(q[k], q[k]));
+			}
+		}
+#endif
+#ifdef XUSG_OBJ_LOADER_SSE2
+		// 4 vertices at a time in SoA form; the 16-byte loads read past the normal of a vertex,
+		// so the last vertex is always left to the scalar loop.
+		for (; i + 4 <= last && i + 4 < numVert; i += 4)
+		{
+			auto x = _mm_loadu_ps(&getNormal(i).x);
+			auto y = _mm_loadu_ps(&getNormal(i + 1).x);
+			auto z = _mm_loadu_ps(&getNormal(i + 2).x);
+			auto w = _mm_loadu_ps(&getNormal(i + 3).x);
+			_MM_TRANSPOSE4_PS(x, y, z, w);
+
+			const auto l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+			const auto nonZero = _mm_cmpgt_ps(l, _mm_setzero_ps());
+			x = _mm_and_ps(_mm_div_ps(x, l), nonZero);
+			y = _mm_and_ps(_mm_div_ps(y, l), nonZero);
+			z = _mm_and_ps(_mm_div_ps(z, l), nonZero);
+			_MM_TRANSPOSE4_PS(x, y, z, w);
+
+			// Write 12 bytes per vertex, leaving the float after each normal untouched
+			for (uint8_t k = 0; k < 4; ++k)
+			{
+				const auto& v = k == 0 ? x : k == 1 ? y : k == 2 ? z : w;
+				auto& vn = getNormal(i + k);
+				_mm_storel_pi(reinterpret_cast<__m64*>(&vn.x), v);
+				_mm_store_ss(&vn.z, _mm_movehl_ps(v, v));
+			}
+		}
+#endif
+		for (; i < last; ++i)
+		{
+			// Vertices with no triangles of nonzero area are left with zero normals
+			auto& vn = getNormal(i);
+			const auto l = sqrt(vn.x * vn.x + vn.y * vn.y + vn.z * vn.z);
+			if (l > 0.0f)
+			{
+				vn.x /= l;
+				vn.y /= l;
+				vn.z /= l;
+			}
+			else vn = float3(0.0f, 0.0f, 0.0f);
+		}
+	});
 }
 
 void ObjLoader::computeAABB()
 {
-	float xMax, xMin, yMax, yMin, zMax, zMin;
-	const auto& p = getPosition(0);
-	xMax = xMin = p.x;
-	yMax = yMin = p.y;
-	zMax = zMin = p.z;
+	const auto numVert = GetNumVertices();
+	auto i = 1u;
+	float3 minPt = getPosition(0), maxPt = minPt;
+
+#ifdef XUSG_OBJ_LOADER_SSE2
+	// The new value goes first, so that a NaN is skipped as by the scalar comparisons. The 16-byte
+	// loads read past the position of a vertex, so the last vertex is always left to the scalar loop.
+	auto vMin = _mm_setr_ps(minPt.x, minPt.y, minPt.z, 0.0f), vMax = vMin;
+#ifdef XUSG_OBJ_LOADER_AVX2
+	// 2 vertices at a time; merging the halves at the end can only change the sign of a zero bound.
+	auto vMin2 = _mm256_insertf128_ps(_mm256_castps128_ps256(vMin), vMin, 1), vMax2 = vMin2;
+	for (; i + 2 < numVert; i += 2)
+	{
+		const auto p = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&getPosition(i).x)),
+			_mm_loadu_ps(&getPosition(i + 1).x), 1);
+		vMin2 = _mm256_min_ps(p, vMin2);
+		vMax2 = _mm256_max_ps(p, vMax2);
+	}
+	vMin = _mm_min_ps(_mm256_extractf128_ps(vMin2, 1), _mm256_castps256_ps128(vMin2));
+	vMax = _mm_max_ps(_mm256_extractf128_ps(vMax2, 1), _mm256_castps256_ps128(vMax2));
+#endif
+	for (; i + 1 < numVert; ++i)
+	{
+		const auto p = _mm_loadu_ps(&getPosition(i).x);
+		vMin = _mm_min_ps(p, vMin);
+		vMax = _mm_max_ps(p, vMax);
+	}
+
+	float vals[4];
+	_mm_storeu_ps(vals, vMin);
+	minPt = float3(vals);
+	_mm_storeu_ps(vals, vMax);
+	maxPt = float3(vals);
+#endif
+
+	for (; i < numVert; ++i)
+	{
+		const auto& p = getPosition(i);
+		if (p.x < minPt.x) minPt.x = p.x;
+		else if (p.x > maxPt.x) maxPt.x = p.x;
+
+		if (p.y < minPt.y) minPt.y = p.y;
+		else if (p.y > maxPt.y) maxPt.y = p.y;
+
+		if (p.z < minPt.z) minPt.z = p.z;
+		else if (p.z > maxPt.z) maxPt.z = p.z;
+	}
+
+	m_aabb.Min = minPt;
+	m_aabb.Max = maxPt;
+}
+
+static float computeVertexCacheScore(int32_t cachePos, uint32_t numActiveTris, uint32_t cacheSize)
+{
+	// No triangles left to emit
+	if (numActiveTris == 0) return -1.0f;
+
+	auto score = 0.0f;
+	if (cachePos >= 0)
+	{
+		// The vertices of the last triangle get a fixed score, so that the next triangle
+		// does not simply favor the most recently used edge.
+		if (cachePos < 3) score = 0.75f;
+		else score = powf(1.0f - (cachePos - 3) / static_cast<float>(cacheSize - 3), 1.5f);
+	}
+
+	// Favor vertices with few remaining triangles to avoid leaving lone triangles behind
+	score += 2.0f / sqrtf(static_cast<float>(numActiveTris));
+
+	return score;
+}
+
+void ObjLoader::buildVertexTriangleAdjacency(vector<uint32_t>& adjOffsets,
+	vector<uint32_t>& adjTris, vector<uint32_t>& numAdjTris) const
+{
+	// Triangles using vertex i are adjTris[adjOffsets[i]], ..., adjTris[adjOffsets[i] + numAdjTris[i] - 1]
+	const auto numVert = GetNumVertices();
+	adjOffsets.assign(numVert + 1, 0);
+	for (const auto& vi : m_indices) ++adjOffsets[vi + 1];
+	for (auto i = 0u; i < numVert; ++i) adjOffsets[i + 1] += adjOffsets[i];
+
+	numAdjTris.assign(numVert, 0);
+	adjTris.resize(m_indices.size());
+	for (auto i = 0u; i < static_cast<uint32_t>(m_indices.size()); ++i)
+	{
+		const auto vi = m_indices[i];
+		adjTris[adjOffsets[vi] + numAdjTris[vi]++] = i / 3;
+	}
+}
+
+void ObjLoader::optimizeVertexCache()
+{
+	// Forsyth's linear-speed vertex cache optimization over a simulated LRU cache
+	const uint32_t cacheSize = 32;
+	const auto numVert = GetNumVertices();
+	const auto numTri = GetNumIndices() / 3;
+
+	vector<uint32_t> adjOffsets, adjTris, numActiveTris;
+	buildVertexTriangleAdjacency(adjOffsets, adjTris, numActiveTris);
+
+	// Initial scores
+	vector<int32_t> cachePositions(numVert, -1);
+	vector<float> vertexScores(numVert);
+	for (auto i = 0u; i < numVert; ++i) vertexScores[i] = computeVertexCacheScore(-1, numActiveTris[i], cacheSize);
+
+	vector<float> triScores(numTri);
+	vector<bool> isTriAdded(numTri, false);
+	for (auto i = 0u; i < numTri; ++i)
+		triScores[i] = vertexScores[m_indices[i * 3]] + vertexScores[m_indices[i * 3 + 1]] + vertexScores[m_indices[i * 3 + 2]];
+
+	// The submeshes are optimized in turn, each within its own triangle range.
+	uint32_t cache[cacheSize + 3];
+	auto numCached = 0u;
+	auto nextTri = 0u;
+	auto triEnd = 0u;
+	auto bestTri = UINT32_MAX;
+	auto submesh = 0u;
+	vector<uint32_t> indices;
+	indices.reserve(m_indices.size());
+	for (auto n = 0u; n < numTri; ++n)
+	{
+		if (n == triEnd)
+		{
+			triEnd = submesh < m_submeshes.size() ? (m_submeshes[submesh].FirstIndex + m_submeshes[submesh].NumIndices) / 3 : numTri;
+			++submesh;
+			nextTri = n;
+			bestTri = n;
+			for (auto i = n + 1; i < triEnd; ++i) if (triScores[i] > triScores[bestTri]) bestTri = i;
+		}
+
+		// Fall back to the next triangle in input order when no cached vertex has triangles left
+		if (bestTri == UINT32_MAX)
+		{
+			while (isTriAdded[nextTri]) ++nextTri;
+			bestTri = nextTri;
+		}
+
+		// Emit the triangle, and remove it from the adjacency of its vertices
+		const auto pTri = &m_indices[bestTri * 3];
+		indices.insert(indices.end(), pTri, pTri + 3);
+		isTriAdded[bestTri] = true;
+		for (uint8_t i = 0; i < 3; ++i)
+		{
+			const auto vi = pTri[i];
+			const auto pAdjTris = &adjTris[adjOffsets[vi]];
+			auto& numAdjTris = numActiveTris[vi];
+			const auto j = static_cast<uint32_t>(find(pAdjTris, pAdjTris + numAdjTris, bestTri) - pAdjTris);
+			if (j < numAdjTris) pAdjTris[j] = pAdjTris[--numAdjTris];
+		}
+
+		// Move the vertices of the triangle to the front of the LRU cache
+		uint32_t newCache[cacheSize + 3];
+		auto numNewCached = 0u;
+		for (uint8_t i = 0; i < 3; ++i)
+			if (find(newCache, newCache + numNewCached, pTri[i]) == newCache + numNewCached)
+				newCache[numNewCached++] = pTri[i];
+		for (auto i = 0u; i < numCached; ++i)
+			if (cache[i] != pTri[0] && cache[i] != pTri[1] && cache[i] != pTri[2])
+				newCache[numNewCached++] = cache[i];
+
+		// Update the scores of the touched vertices and their remaining triangles;
+		// the vertices beyond cacheSize have just been evicted.
+		for (auto i = 0u; i < numNewCached; ++i)
+		{
+			const auto vi = newCache[i];
+			cachePositions[vi] = i < cacheSize ? static_cast<int32_t>(i) : -1;
+			const auto score = computeVertexCacheScore(cachePositions[vi], numActiveTris[vi], cacheSize);
+			const auto delta = score - vertexScores[vi];
+			vertexScores[vi] = score;
+			for (auto j = 0u; j < numActiveTris[vi]; ++j) triScores[adjTris[adjOffsets[vi] + j]] += delta;
+		}
+
+		// Pick the best triangle among those using cached vertices
+		numCached = (min)(numNewCached, cacheSize);
+		bestTri = UINT32_MAX;
+		auto bestScore = -1.0f;
+		for (auto i = 0u; i < numCached; ++i)
+		{
+			const auto vi = newCache[i];
+			cache[i] = vi;
+			for (auto j = 0u; j < numActiveTris[vi]; ++j)
+			{
+				const auto ti = adjTris[adjOffsets[vi] + j];
+				if (ti < triEnd && triScores[ti] > bestScore)
+				{
+					bestScore = triScores[ti];
+					bestTri = ti;
+				}
+			}
+		}
+	}
+
+	m_indices.swap(indices);
+}
+
+void ObjLoader::reorderVerticesByFirstUse()
+{
+	const auto numVert = GetNumVertices();
+	const auto stride = GetVertexStride();
+
+	// Renumber the vertices in the order the index buffer fetches them; unreferenced ones go last.
+	vector<uint32_t> remap(numVert, UINT32_MAX);
+	auto numRemapped = 0u;
+	for (auto& vi : m_indices)
+	{
+		if (remap[vi] == UINT32_MAX) remap[vi] = numRemapped++;
+		vi = remap[vi];
+	}
+	for (auto& vi : remap) if (vi == UINT32_MAX) vi = numRemapped++;
+
+	vector<uint8_t> vertices(m_vertices.size());
+	for (auto i = 0u; i < numVert; ++i) memcpy(&vertices[stride * remap[i]], getVertex(i), stride);
+	m_vertices.swap(vertices);
+}
+
+static uint32_t expandBits10(uint32_t v)
+{
+	// Insert two zero bits after each of the 10 low bits
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
 
-	auto x = 0.0f, y = 0.0f, z = 0.0f;
+	return v;
+}
 
+void ObjLoader::sortTrianglesByMortonCode()
+{
 	const auto numVert = GetNumVertices();
+	const auto numTri = GetNumIndices() / 3;
+	if (numTri < 2) return;
+
+	// Bounds of the positions; m_aabb is only valid when requested.
+	auto minPt = getPosition(0);
+	auto maxPt = minPt;
 	for (auto i = 1u; i < numVert; ++i)
 	{
-		const auto& p = getPosition(i);
-		x = p.x;
-		y = p.y;
-		z = p.z;
+		const auto& pos = getPosition(i);
+		minPt = float3((min)(pos.x, minPt.x), (min)(pos.y, minPt.y), (min)(pos.z, minPt.z));
+		maxPt = float3((max)(pos.x, maxPt.x), (max)(pos.y, maxPt.y), (max)(pos.z, maxPt.z));
+	}
+
+	// Quantize the centroids (sums of the 3 corners) to a 1024^3 grid over the bounds
+	const auto toGrid = [](float minVal, float maxVal) { return maxVal > minVal ? 1023.0f / (3.0f * (maxVal - minVal)) : 0.0f; };
+	const float3 scale(toGrid(minPt.x, maxPt.x), toGrid(minPt.y, maxPt.y), toGrid(minPt.z, maxPt.z));
+	const auto quantize = [](float sum, float minVal, float scale)
+	{
+		return static_cast<uint32_t>((max)((min)((sum - 3.0f * minVal) * scale, 1023.0f), 0.0f));
+	};
+
+	// Key = Morton code in the high bits, triangle index in the low bits for a stable order
+	vector<uint64_t> keys(numTri);
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		const auto& v0 = getPosition(m_indices[i * 3]);
+		const auto& v1 = getPosition(m_indices[i * 3 + 1]);
+		const auto& v2 = getPosition(m_indices[i * 3 + 2]);
+		const auto x = quantize(v0.x + v1.x + v2.x, minPt.x, scale.x);
+		const auto y = quantize(v0.y + v1.y + v2.y, minPt.y, scale.y);
+		const auto z = quantize(v0.z + v1.z + v2.z, minPt.z, scale.z);
+		const auto code = (expandBits10(x) << 2) | (expandBits10(y) << 1) | expandBits10(z);
+		keys[i] = (static_cast<uint64_t>(code) << 32) | i;
+	}
+
+	// Sort within each submesh
+	if (m_submeshes.empty()) sort(keys.begin(), keys.end());
+	for (const auto& submesh : m_submeshes)
+		sort(keys.begin() + submesh.FirstIndex / 3, keys.begin() + (submesh.FirstIndex + submesh.NumIndices) / 3);
+
+	vector<uint32_t> indices(m_indices.size());
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		const auto j = static_cast<uint32_t>(keys[i]);
+		indices[i * 3] = m_indices[j * 3];
+		indices[i * 3 + 1] = m_indices[j * 3 + 1];
+		indices[i * 3 + 2] = m_indices[j * 3 + 2];
+	}
+	m_indices.swap(indices);
+}
+
+void ObjLoader::buildMeshlets()
+{
+	const uint32_t maxVerts = 64;
+	const uint32_t maxTris = 124;
+	const auto numVert = GetNumVertices();
+	const auto numTri = GetNumIndices() / 3;
+
+	vector<uint32_t> adjOffsets, adjTris, numAdjTris;
+	buildVertexTriangleAdjacency(adjOffsets, adjTris, numAdjTris);
+
+	// Unit triangle normals with the same winding as recomputeNormals(); zero if degenerate
+	vector<float3> triNormals(numTri);
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		const auto& v0 = getPosition(m_indices[i * 3]);
+		const auto& v1 = getPosition(m_indices[i * 3 + 1]);
+		const auto& v2 = getPosition(m_indices[i * 3 + 2]);
+		const float3 e1(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z);
+		const float3 e2(v2.x - v1.x, v2.y - v1.y, v2.z - v1.z);
+		const float3 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+		const auto l = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+		triNormals[i] = l > 0.0f ? float3(n.x / l, n.y / l, n.z / l) : float3(0.0f, 0.0f, 0.0f);
+	}
+
+	// Grow each meshlet from a seed over adjacent triangles, preferring the ones adding the fewest
+	// vertices, then the ones closest to the average normal so far for tighter normal cones.
+	// The triangles of each meshlet become contiguous in the index buffer.
+	vector<bool> isTriUsed(numTri, false);
+	vector<uint32_t> vertexMeshletIds(numVert, UINT32_MAX);
+	vector<uint32_t> candidateMeshletIds(numTri, UINT32_MAX);
+	vector<uint32_t> indices;
+	vector<uint32_t> candidates;
+	vector<uint32_t> vertices;
+	vector<uint32_t> triangles;
+	indices.reserve(m_indices.size());
+	auto nextSeed = 0u;
+	auto triBegin = 0u;
+	auto triEnd = 0u;
+	auto submesh = 0u;
+	while (indices.size() < m_indices.size())
+	{
+		const auto meshletId = static_cast<uint32_t>(m_meshlets.size());
+		Meshlet meshlet = {};
+		meshlet.FirstIndex = static_cast<uint32_t>(indices.size());
+		float3 axis(0.0f, 0.0f, 0.0f);
+		candidates.clear();
+		vertices.clear();
+		triangles.clear();
+
+		// Meshlets do not cross submeshes, so the triangles of the seed's submesh are the only candidates.
+		while (isTriUsed[nextSeed]) ++nextSeed;
+		while (nextSeed >= triEnd)
+		{
+			triBegin = triEnd;
+			triEnd = submesh < m_submeshes.size() ? (m_submeshes[submesh].FirstIndex + m_submeshes[submesh].NumIndices) / 3 : numTri;
+			++submesh;
+		}
+		for (auto ti = nextSeed; ti != UINT32_MAX;)
+		{
+			const auto pTri = &m_indices[ti * 3];
+			indices.insert(indices.end(), pTri, pTri + 3);
+			isTriUsed[ti] = true;
+			triangles.emplace_back(ti);
+			axis = float3(axis.x + triNormals[ti].x, axis.y + triNormals[ti].y, axis.z + triNormals[ti].z);
+			++meshlet.NumTriangles;
+			for (uint8_t i = 0; i < 3; ++i)
+			{
+				const auto vi = pTri[i];
+				if (vertexMeshletIds[vi] == meshletId) continue;
+				vertexMeshletIds[vi] = meshletId;
+				vertices.emplace_back(vi);
+				for (auto j = adjOffsets[vi]; j < adjOffsets[vi] + numAdjTris[vi]; ++j)
+				{
+					const auto ci = adjTris[j];
+					if (isTriUsed[ci] || candidateMeshletIds[ci] == meshletId || ci < triBegin || ci >= triEnd) continue;
+					candidateMeshletIds[ci] = meshletId;
+					candidates.emplace_back(ci);
+				}
+			}
+
+			// Pick the next triangle; the ones that are used or no longer fit are dropped.
+			ti = UINT32_MAX;
+			if (meshlet.NumTriangles >= maxTris) break;
+			auto bestNewVerts = 4u;
+			auto bestDot = 0.0f;
+			for (auto i = 0u; i < candidates.size();)
+			{
+				const auto ci = candidates[i];
+				auto newVerts = 0u;
+				for (uint8_t j = 0; j < 3; ++j) newVerts += vertexMeshletIds[m_indices[ci * 3 + j]] == meshletId ? 0 : 1;
+				if (isTriUsed[ci] || vertices.size() + newVerts > maxVerts)
+				{
+					candidates[i] = candidates.back();
+					candidates.pop_back();
+					continue;
+				}
+
+				const auto& n = triNormals[ci];
+				const auto dot = n.x * axis.x + n.y * axis.y + n.z * axis.z;
+				if (ti == UINT32_MAX || newVerts < bestNewVerts ||
+					(newVerts == bestNewVerts && (dot > bestDot || (dot == bestDot && ci < ti))))
+				{
+					bestNewVerts = newVerts;
+					bestDot = dot;
+					ti = ci;
+				}
+				++i;
+			}
+		}
+		meshlet.NumVertices = static_cast<uint32_t>(vertices.size());
+
+		// Bounding sphere centered at the bounding box of the vertices
+		auto minPt = getPosition(vertices[0]);
+		auto maxPt = minPt;
+		for (const auto& vi : vertices)
+		{
+			const auto& p = getPosition(vi);
+			minPt = float3((min)(p.x, minPt.x), (min)(p.y, minPt.y), (min)(p.z, minPt.z));
+			maxPt = float3((max)(p.x, maxPt.x), (max)(p.y, maxPt.y), (max)(p.z, maxPt.z));
+		}
+		const auto& c = meshlet.Center = float3((minPt.x + maxPt.x) * 0.5f, (minPt.y + maxPt.y) * 0.5f, (minPt.z + maxPt.z) * 0.5f);
+		for (const auto& vi : vertices)
+		{
+			const auto& p = getPosition(vi);
+			meshlet.Radius = (max)(sqrtf((p.x - c.x) * (p.x - c.x) + (p.y - c.y) * (p.y - c.y) + (p.z - c.z) * (p.z - c.z)), meshlet.Radius);
+		}
+
+		// Normal cone; degenerate triangles are never rasterized, so they do not widen it.
+		const auto axisLen = sqrtf(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+		axis = axisLen > 0.0f ? float3(axis.x / axisLen, axis.y / axisLen, axis.z / axisLen) : axis;
+		auto minDot = axisLen > 0.0f ? 1.0f : -1.0f;
+		for (const auto& ti : triangles)
+		{
+			const auto& n = triNormals[ti];
+			if (n.x != 0.0f || n.y != 0.0f || n.z != 0.0f) minDot = (min)(n.x * axis.x + n.y * axis.y + n.z * axis.z, minDot);
+		}
+
+		// Wide cones make the test unreliable, so disable them.
+		meshlet.ConeAxis = minDot > 0.1f ? axis : float3(0.0f, 0.0f, 0.0f);
+		meshlet.ConeCutoff = minDot > 0.1f ? sqrtf(1.0f - minDot * minDot) : 1.0f;
+
+		m_meshlets.emplace_back(meshlet);
+	}
+
+	m_indices.swap(indices);
+}
 
-		if (x < xMin) xMin = x;
-		else if (x > xMax) xMax = x;
+void ObjLoader::quantizeVertices()
+{
+	const auto numVert = GetNumVertices();
+	vector<uint8_t> vertices(GetQuantizedStride(m_stride) * numVert);
+	QuantizeVertices(vertices.data(), m_vertices.data(), numVert, m_stride, m_aabb);
 
-		if (y < yMin) yMin = y;
-		else if (y > yMax) yMax = y;
+	// Report the round-trip error against the float data
+	vector<uint8_t> decoded(m_vertices.size());
+	DequantizeVertices(decoded.data(), vertices.data(), numVert, m_stride, m_aabb);
+	const auto hasNormal = m_stride >= sizeof(float3[2]);
+	for (auto i = 0u; i < numVert; ++i)
+	{
+		const auto& p = getPosition(i);
+		const auto pDecoded = reinterpret_cast<const float3*>(&decoded[m_stride * i]);
+		const float3 dp(pDecoded[0].x - p.x, pDecoded[0].y - p.y, pDecoded[0].z - p.z);
+		m_quantError.MaxPositionError = (max)(sqrtf(dp.x * dp.x + dp.y * dp.y + dp.z * dp.z), m_quantError.MaxPositionError);
 
-		if (z < zMin) zMin = z;
-		else if (z > zMax) zMax = z;
+		if (hasNormal)
+		{
+			// atan2 of |cross| and dot stays accurate for tiny angles, unlike acos of the dot
+			const auto& n = getNormal(i);
+			const auto& m = pDecoded[1];
+			const float3 c(n.y * m.z - n.z * m.y, n.z * m.x - n.x * m.z, n.x * m.y - n.y * m.x);
+			const auto angle = atan2f(sqrtf(c.x * c.x + c.y * c.y + c.z * c.z), n.x * m.x + n.y * m.y + n.z * m.z);
+			if (n.x != 0.0f || n.y != 0.0f || n.z != 0.0f) m_quantError.MaxNormalError = (max)(angle, m_quantError.MaxNormalError);
+		}
 	}
+	m_quantError.MaxNormalError *= 180.0f / 3.14159265f;
+
+	m_vertices.swap(vertices);
+	m_stride = GetQuantizedStride(m_stride);
+}
 
-	m_aabb.Min = float3(xMin, yMin, zMin);
-	m_aabb.Max = float3(xMax, yMax, zMax);
+void ObjLoader::splitVertexStreams()
+{
+	vector<uint8_t> vertices(m_vertices.size());
+	splitStreams(vertices.data(), m_vertices.data(), GetNumVertices(), m_stride, getPositionSize());
+	m_vertices.swap(vertices);
+}
+
+uint32_t ObjLoader::getPositionSize() const
+{
+	return static_cast<uint32_t>(m_isQuantized ? sizeof(uint16_t[4]) : sizeof(float3));
 }
 
 void* ObjLoader::getVertex(uint32_t i)
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include "XUSGMappedFile.h"
+
 namespace XUSG
 {
 	class ObjLoader
@@ -18,8 +20,6 @@ namespace XUSG
 			float3() = default;
 			constexpr float3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
 			explicit float3(const float* pArray) : x(pArray[0]), y(pArray[1]), z(pArray[2]) {}
-
-			float3& operator= (const float3& Float3) { x = Float3.x; y = Float3.y; z = Float3.z; return *this; }
 		};
 
 		struct AABB
@@ -28,38 +28,261 @@ namespace XUSG
 			float3 Max;
 		};
 
+		enum PostProcessFlag : uint32_t
+		{
+			POST_PROCESS_NONE = 0,
+			WELD_VERTICES = (1 << 0),			// Share split vertices with the same (position, normal) indices
+			OPTIMIZE_VERTEX_CACHE = (1 << 1),	// Reorder triangles for post-transform cache hits, then vertices for fetch locality
+			SORT_TRIANGLES_SPATIALLY = (1 << 2),	// Sort triangles by the Morton codes of their centroids, then vertices by first use
+			QUANTIZE_VERTICES = (1 << 3),		// Store positions as 16-bit UNORM within the AABB and normals as 2x16-bit SNORM octahedral
+			BUILD_MESHLETS = (1 << 4),			// Group triangles into contiguous meshlets of <= 64 vertices and <= 124 triangles
+			SPLIT_VERTEX_STREAMS = (1 << 5),	// Store the positions as a tightly packed stream ahead of the other attributes
+			SANITIZE_MESH = (1 << 6)			// Drop zero-area, duplicate and non-finite triangles, then unreferenced vertices
+		};
+		// SANITIZE_MESH is for meshes that are not known to be clean. It costs 15-35% of an import without
+		// other post processes, e.g. 3-5 ms of 16 ms for dragon.obj (100K triangles), but only a few percent
+		// next to WELD_VERTICES, SORT_TRIANGLES_SPATIALLY, OPTIMIZE_VERTEX_CACHE and BUILD_MESHLETS.
+
+		struct Submesh
+		{
+			uint32_t FirstIndex;
+			uint32_t NumIndices;
+			uint32_t MaterialIndex;	// Into GetMaterials(); UINT32_MAX before any usemtl
+		};
+
+		struct Material
+		{
+			float3	BaseColor;	// Kd
+			float	Roughness;	// Pr, or converted from the Blinn-Phong exponent Ns
+		};
+
+		struct Meshlet
+		{
+			uint32_t FirstIndex;	// Triangles are [FirstIndex, FirstIndex + 3 * NumTriangles) in the index buffer
+			uint32_t NumTriangles;
+			uint32_t NumVertices;
+			float3	Center;			// Bounding sphere
+			float	Radius;
+			float3	ConeAxis;		// Normal cone; back-facing from eyePt if
+			float	ConeCutoff;		// dot(Center - eyePt, ConeAxis) >= ConeCutoff * |Center - eyePt| + Radius
+		};
+
+		struct SanitizeStats
+		{
+			uint32_t NumDegenerateTriangles;	// Zero-area, including those with a repeated index
+			uint32_t NumDuplicateTriangles;		// Same vertices and winding as an earlier triangle of the submesh
+			uint32_t NumNonFiniteTriangles;		// With an infinite or NaN position
+			uint32_t NumUnreferencedVertices;
+		};
+
+		struct QuantizationError
+		{
+			float MaxPositionError;	// Object-space distance
+			float MaxNormalError;	// Angle in degrees
+		};
+
+		struct StreamBatch
+		{
+			const uint8_t* pVertices;	// New vertices, numbered from FirstVertex on
+			const uint32_t* pIndices;	// Triangles, which may also refer to the vertices of earlier batches
+			uint32_t FirstVertex;
+			uint32_t NumVertices;
+			uint32_t NumIndices;
+			uint32_t Stride;
+		};
+
+		// Returns false to cancel the import
+		using StreamCallback = std::function<bool(const StreamBatch& batch)>;
+
+		struct VertexCacheStats
+		{
+			float ACMR;	// Average cache miss ratio: vertex transforms per triangle
+			float ATVR;	// Average transform to vertex ratio: vertex transforms per referenced vertex
+		};
+
+		struct FetchReuseStats
+		{
+			uint64_t NumFetches;		// Cache-line accesses
+			uint64_t NumColdFetches;	// First accesses to a line
+			uint64_t Histogram[33];		// Warm accesses by the bit width of the reuse distance
+			double SumLogDistances;		// Sum of log2(reuse distance + 1) over warm accesses
+
+			float GetHitRatio(uint32_t numLines) const;
+		};
+
+		struct CodecStats
+		{
+			uint64_t EncodedSize;	// Bytes of the compressed file
+			uint64_t DecodedSize;	// Bytes of the vertices in the float layout and the indices
+			double DecodeTime;		// Seconds, including the dequantization
+
+			float GetCompressionRatio() const;
+			double GetDecodeThroughput() const;	// Decoded bytes per second
+		};
+
+		struct ImportOptions
+		{
+			bool NeedNorm;				// true by default
+			bool NeedAABB;				// true by default
+			bool ForDX;					// Negates z; true by default
+			bool SwapYZ;
+			bool UseCache;				// Maps <pszFilename>.cache instead of parsing when it is still valid for
+										// the OBJ file and the import options, and (re)writes it otherwise
+			uint32_t NumThreads;		// 0 uses all hardware threads; the result does not depend on it
+			uint32_t PostProcesses;		// A combination of PostProcessFlag
+
+			ImportOptions();
+		};
+
 		ObjLoader();
 		virtual ~ObjLoader();
 
-		bool Import(const char* pszFilename, bool needNorm = true,
-			bool needAABB = true, bool forDX = true, bool swapYZ = false);
+		bool Import(const char* pszFilename, bool needNorm = true, bool needAABB = true,
+			bool forDX = true, bool swapYZ = false);
+		// A file written by ExportCompressed() is decoded instead of parsed, and is never cached;
+		// ForDX and SwapYZ do not apply to it, since it stores the mesh as it was exported.
+		bool Import(const char* pszFilename, const ImportOptions& options);
 
-		const uint32_t GetNumVertices() const;
-		const uint32_t GetNumIndices() const;
-		const uint32_t GetVertexStride() const;
+		// Runs Import() on another thread, e.g. while the device is being set up. The loader must be
+		// neither used nor destroyed until the future is ready.
+		std::future<bool> ImportAsync(const char* pszFilename, const ImportOptions& options = ImportOptions());
+
+		// Streams the triangles in file order, in batches of up to batchSize, together with the vertices
+		// they introduce. A vertex is made for each distinct (position, normal) index pair as with
+		// WELD_VERTICES, or for each position without needNorm, so its attributes are final when it is
+		// emitted; texcoords and groups are dropped. Where a face refers to no normal, the normal is
+		// computed as by Import() from the triangles of the batch that introduces the vertex, which are
+		// all of its triangles only if they are close together in the file; a face is not split across
+		// batches unless it is larger than one. Only the positions, normals and pair lookup of the file so
+		// far, the position index of each vertex with needNorm, and the fixed-size read and batch buffers
+		// are held, and the import fails instead of growing them beyond memoryCap bytes.
+		// Returns false on a read failure, an out-of-range index, the cap, or a cancelling onBatch.
+		static bool ImportStreamed(const char* pszFilename, const StreamCallback& onBatch,
+			uint32_t batchSize = 65536, size_t memoryCap = SIZE_MAX, bool needNorm = true,
+			bool forDX = true, bool swapYZ = false);
+
+		// With QUANTIZE_VERTICES, each vertex is uint16_t[4] (x, y, z, 0) followed by a uint32_t
+		// octahedral normal if normals are present; texcoords are dropped. GetAABB() decodes the positions.
+		uint32_t GetNumVertices() const;
+		uint32_t GetNumIndices() const;
+		uint32_t GetVertexStride() const;
 		const uint8_t* GetVertices() const;
 		const uint32_t* GetIndices() const;
+		bool IsQuantized() const;
 
 		const AABB& GetAABB() const;
 
+		// The positions and the other attributes as two streams, each at its own stride. With
+		// SPLIT_VERTEX_STREAMS, the positions are packed (12 bytes, or 8 if quantized) for acceleration
+		// structure builds and depth-only passes, GetVertices() is the position stream followed by the
+		// attribute stream, and GetVertexStride() is the sum of both strides. Otherwise both streams are
+		// GetVertices() at GetVertexStride(). GetAttributes() is nullptr if there are no normals.
+		uint32_t GetPositionStride() const;
+		uint32_t GetAttributeStride() const;
+		const uint8_t* GetPositions() const;
+		const uint8_t* GetAttributes() const;
+
+		// Wall time of the last Import() in seconds, including the post processes
+		double GetImportTime() const;
+
+		// Writes the mesh in the compressed format of MeshCodec, with the positions quantized to 16-bit
+		// UNORM within the AABB and the normals to 2x16-bit SNORM octahedral as with QUANTIZE_VERTICES;
+		// the submeshes and materials are kept, and the meshlets and texcoords are not. The indices
+		// compress best after OPTIMIZE_VERTEX_CACHE or SORT_TRIANGLES_SPATIALLY.
+		bool ExportCompressed(const char* pszFilename) const;
+		// Of the last Import() of a compressed file
+		const CodecStats& GetCodecStats() const;
+
+		// A submesh starts at each o, g and usemtl, and the empty ones are dropped. The reordering post
+		// processes keep the triangles of a submesh within its range, and meshlets do not cross ranges.
+		// The materials are the distinct usemtl names in the order of first use, looked up in the mtllib
+		// files next to the OBJ file; a name not found gets a white base color and a roughness of 1.
+		uint32_t GetNumSubmeshes() const;
+		const Submesh* GetSubmeshes() const;
+		uint32_t GetNumMaterials() const;
+		const Material* GetMaterials() const;
+
+		uint32_t GetNumMeshlets() const;
+		const Meshlet* GetMeshlets() const;
+
+		bool HasSplitStreams() const;
+		const QuantizationError& GetQuantizationError() const;
+
+		// Of SANITIZE_MESH, which runs before the normals are recomputed, so that no unreferenced vertex or
+		// vertex of only zero-area triangles is left with a zero normal. The submesh ranges shrink to the
+		// triangles kept.
+		const SanitizeStats& GetSanitizeStats() const;
+
+		// stride is the stride of the float layout; the quantized stride is GetQuantizedStride(stride).
+		static uint32_t GetQuantizedStride(uint32_t stride);
+		static void QuantizeVertices(uint8_t* pDst, const uint8_t* pSrc, uint32_t numVertices,
+			uint32_t stride, const AABB& aabb);
+		static void DequantizeVertices(uint8_t* pDst, const uint8_t* pSrc, uint32_t numVertices,
+			uint32_t stride, const AABB& aabb);
+
+		// Writes the indices of the meshlets that are neither outside the frustum nor back-facing, and
+		// returns their number. eyePt and planes (a * x + b * y + c * z + d >= 0 inside) are in object space.
+		static uint32_t CullMeshlets(uint32_t* pVisible, const Meshlet* pMeshlets, uint32_t numMeshlets,
+			const float3& eyePt, const float planes[6][4]);
+
+		static VertexCacheStats SimulateVertexCache(const uint32_t* pIndices,
+			uint32_t numIndices, uint32_t numVertices, uint32_t cacheSize = 32);
+		static FetchReuseStats ReplayHitFetches(const uint32_t* pIndices, uint32_t vertexStride,
+			const uint32_t* pPrimitiveIndices, uint32_t numHits, uint32_t cacheLineSize = 64);
+
 	protected:
+		struct CacheHeader;
+
+		bool loadCache(const char* pszFilename, const MappedFile& source, uint64_t sourceHash, uint32_t importFlags);
+		bool saveCache(const char* pszFilename, const MappedFile& source, uint64_t sourceHash, uint32_t importFlags) const;
+		bool importCompressed(const char* pData, size_t size, uint32_t& numNorm);
+		void importGeometryChunked(const char* pData, size_t size, uint32_t numThreads,
+			uint32_t& numNorm, bool forDX, bool swapYZ, bool weld);
 		void importGeometryFirstPass(FILE* pFile, uint32_t& numTexc, uint32_t& numNorm);
-		void importGeometrySecondPass(FILE* pFile, uint32_t numTexc, uint32_t numNorm, bool forDX, bool swapYZ);
+		void importGeometrySecondPass(FILE* pFile, uint32_t numTexc, uint32_t numNorm, bool forDX, bool swapYZ, bool weld);
 		void loadIndices(FILE* pFile, uint32_t& numTri, uint32_t numTexc, uint32_t numNorm,
 			std::vector<uint32_t>& nIndices, std::vector<uint32_t>& tIndices);
-		void computePerVertexNormals(const std::vector<float3>& normals, const std::vector<uint32_t>& nIndices);
-		void recomputeNormals();
+		void loadMaterials(const char* pszFilename);
+		void sanitize(uint32_t numThreads);
+		void computePerVertexNormals(const std::vector<float3>& normals, const std::vector<uint32_t>& nIndices, bool weld);
+		void recomputeNormals(uint32_t numThreads);
 		void computeAABB();
+		void buildVertexTriangleAdjacency(std::vector<uint32_t>& adjOffsets,
+			std::vector<uint32_t>& adjTris, std::vector<uint32_t>& numAdjTris) const;
+		void optimizeVertexCache();
+		void sortTrianglesByMortonCode();
+		void reorderVerticesByFirstUse();
+		void buildMeshlets();
+		void quantizeVertices();
+		void splitVertexStreams();
 
+		uint32_t getPositionSize() const;
 		void* getVertex(uint32_t i);
 		float3& getPosition(uint32_t i);
 		float3& getNormal(uint32_t i);
 
 		std::vector<uint8_t>	m_vertices;
 		std::vector<uint32_t>	m_indices;
+		std::vector<Meshlet>	m_meshlets;
+		std::vector<Submesh>	m_submeshes;
+		std::vector<Material>	m_materials;
+
+		std::vector<std::string> m_materialNames;
+		std::vector<std::string> m_materialLibs;
 
 		uint32_t	m_stride;
 
 		AABB		m_aabb;
+
+		bool		m_isQuantized;
+		bool		m_isSplit;
+		QuantizationError m_quantError;
+		SanitizeStats m_sanitizeStats;
+
+		double		m_importTime;
+		CodecStats	m_codecStats;
+
+		MappedFile	m_cache;
+		const CacheHeader* m_pCacheHeader;
 	};
 }
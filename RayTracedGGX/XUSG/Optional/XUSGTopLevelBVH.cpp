@@ -0,0 +1,148 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "XUSGTopLevelBVH.h"
+
+using namespace std;
+using namespace XUSG;
+
+// Inverse of an affine 3x4 matrix, from the adjugate of its 3x3 part
+static bool invertAffine(const float m[3][4], float inv[3][4])
+{
+	const auto det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+		m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+		m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	if (!(fabsf(det) > 0.0f) || !isfinite(det)) return false;
+
+	const auto invDet = 1.0f / det;
+	inv[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * invDet;
+	inv[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+	inv[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+	inv[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * invDet;
+	inv[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+	inv[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+	inv[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * invDet;
+	inv[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+	inv[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+	for (uint8_t i = 0; i < 3; ++i)
+		inv[i][3] = -(inv[i][0] * m[0][3] + inv[i][1] * m[1][3] + inv[i][2] * m[2][3]);
+
+	return true;
+}
+
+// World bounds of the transformed object bounds, taking the extreme of each term per row
+// [Arvo 1990, "Transforming Axis-Aligned Bounding Boxes"]
+static void transformBounds(const float m[3][4], const BVH::Node& root, float* pBounds)
+{
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		pBounds[i] = pBounds[i + 3] = m[i][3];
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			const auto a = m[i][j] * root.Min[j];
+			const auto b = m[i][j] * root.Max[j];
+			pBounds[i] += (min)(a, b);
+			pBounds[i + 3] += (max)(a, b);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Top-level BVH
+//--------------------------------------------------------------------------------------
+
+TopLevelBVH::TopLevelBVH()
+{
+}
+
+TopLevelBVH::~TopLevelBVH()
+{
+}
+
+bool TopLevelBVH::Build(uint32_t numInstances, const BottomLevel* const* ppBottomLevels,
+	const float* const* transforms, const BVH::BuildOptions& options)
+{
+	m_instances.clear();
+	if (numInstances == 0) return false;
+
+	m_instances.resize(numInstances);
+	vector<float> bounds(numInstances * 6);
+	for (auto i = 0u; i < numInstances; ++i)
+	{
+		auto& instance = m_instances[i];
+		instance.Geometry = *ppBottomLevels[i];
+		if (!instance.Geometry.pBVH || instance.Geometry.pBVH->GetNumNodes() == 0) return false;
+
+		memcpy(instance.ObjectToWorld, transforms[i], sizeof(instance.ObjectToWorld));
+		if (!invertAffine(instance.ObjectToWorld, instance.WorldToObject)) return false;
+		transformBounds(instance.ObjectToWorld, instance.Geometry.pBVH->GetNodes()[0], &bounds[i * 6]);
+	}
+
+	return m_bvh.Build(bounds.data(), numInstances, options);
+}
+
+bool TopLevelBVH::Refit(const float* const* transforms, uint32_t numThreads)
+{
+	const auto numInstances = GetNumInstances();
+	if (numInstances == 0 || m_bvh.GetNumNodes() == 0) return false;
+
+	auto instances = m_instances;
+	vector<float> bounds(numInstances * 6);
+	for (auto i = 0u; i < numInstances; ++i)
+	{
+		auto& instance = instances[i];
+		memcpy(instance.ObjectToWorld, transforms[i], sizeof(instance.ObjectToWorld));
+		if (!invertAffine(instance.ObjectToWorld, instance.WorldToObject)) return false;
+		transformBounds(instance.ObjectToWorld, instance.Geometry.pBVH->GetNodes()[0], &bounds[i * 6]);
+	}
+	m_instances.swap(instances);
+
+	return m_bvh.Refit(bounds.data(), numThreads);
+}
+
+bool TopLevelBVH::Intersect(const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit) const
+{
+	return m_bvh.Intersect(ray, [&](uint32_t instanceIdx, float& tMax)
+	{
+		const auto& instance = m_instances[instanceIdx];
+		const auto& m = instance.WorldToObject;
+		BVH::Ray localRay;
+		for (uint8_t i = 0; i < 3; ++i)
+		{
+			localRay.Origin[i] = m[i][0] * ray.Origin[0] + m[i][1] * ray.Origin[1] + m[i][2] * ray.Origin[2] + m[i][3];
+			localRay.Direction[i] = m[i][0] * ray.Direction[0] + m[i][1] * ray.Direction[1] + m[i][2] * ray.Direction[2];
+		}
+		localRay.TMin = ray.TMin;
+		localRay.TMax = tMax;
+
+		const auto& geometry = instance.Geometry;
+		if (!geometry.pBVH->Intersect(localRay, geometry.pPositions, geometry.PositionStride,
+			geometry.pIndices, hit, acceptFirstHit)) return false;
+
+		tMax = hit.T;
+		hit.InstanceIndex = instanceIdx;
+
+		return true;
+	}, acceptFirstHit);
+}
+
+uint32_t TopLevelBVH::GetNumInstances() const
+{
+	return static_cast<uint32_t>(m_instances.size());
+}
+
+const BVH& TopLevelBVH::GetBVH() const
+{
+	return m_bvh;
+}
+
+const float* TopLevelBVH::GetObjectToWorld(uint32_t instanceIndex) const
+{
+	return &m_instances[instanceIndex].ObjectToWorld[0][0];
+}
+
+const float* TopLevelBVH::GetWorldToObject(uint32_t instanceIndex) const
+{
+	return &m_instances[instanceIndex].WorldToObject[0][0];
+}
@@ -0,0 +1,63 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "XUSGBVH.h"
+
+namespace XUSG
+{
+	// Two-level hierarchy on the CPU, as TopLevelAS over BottomLevelAS: a BVH over the world bounds
+	// of instances of per-mesh BVHs, each with an object-to-world transform. The rays are transformed
+	// into the object space of each instance they reach, so that a mesh is built once however many
+	// times it is instanced, and moving an instance only needs the top level to be refitted or rebuilt.
+	class TopLevelBVH
+	{
+	public:
+		// A mesh BVH with the geometry it was built over, which must outlive the top level
+		struct BottomLevel
+		{
+			const BVH*		pBVH;
+			const uint8_t*	pPositions;
+			uint32_t		PositionStride;
+			const uint32_t*	pIndices;
+		};
+
+		TopLevelBVH();
+		virtual ~TopLevelBVH();
+
+		// As TopLevelAS::SetInstances() followed by a build: instance i is of *ppBottomLevels[i], and
+		// transforms[i] is its object-to-world matrix as 3 rows of 4 floats, e.g. the first 12 floats
+		// of a transposed XMFLOAT4X4. Fails if there are no instances, a bottom level has not been
+		// built, or a transform cannot be inverted.
+		bool Build(uint32_t numInstances, const BottomLevel* const* ppBottomLevels, const float* const* transforms,
+			const BVH::BuildOptions& options = BVH::BuildOptions());
+		// Recomputes the world bounds of the instances for new transforms, as in Build(), and of the
+		// bottom levels after their refits, and refits the top level to them, keeping the tree. The
+		// tree degrades as the instances move apart from where it was built; see BVH::NeedsRebuild().
+		// Fails if nothing has been built or a transform cannot be inverted, keeping the instances.
+		bool Refit(const float* const* transforms, uint32_t numThreads = 0);
+
+		// Finds the closest hit in [TMin, TMax] over all instances, or any hit if acceptFirstHit.
+		// The hit distance is in the units of the world-space ray direction, as the object-space
+		// direction is not renormalized.
+		bool Intersect(const BVH::Ray& ray, BVH::Hit& hit, bool acceptFirstHit = false) const;
+
+		uint32_t GetNumInstances() const;
+		const BVH& GetBVH() const;
+		const float* GetObjectToWorld(uint32_t instanceIndex) const;
+		const float* GetWorldToObject(uint32_t instanceIndex) const;
+
+	protected:
+		struct Instance
+		{
+			float		ObjectToWorld[3][4];
+			float		WorldToObject[3][4];
+			BottomLevel	Geometry;
+		};
+
+		std::vector<Instance>	m_instances;
+		BVH						m_bvh;
+	};
+}
@@ -43,6 +43,10 @@
 #include <unordered_map>
 #endif
 #include <functional>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <chrono>
 #include <wrl.h>
 #include <shellapi.h>
 